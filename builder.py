@@ -7576,7 +7576,9 @@ menuentry "GeminiOS Live (Verbose Boot)" {
     os.makedirs(ISO_OUTPUT_DIR, exist_ok=True)
     iso_path = os.path.join(ISO_OUTPUT_DIR, iso_name)
     print_info(f"[*] Building {iso_path}...")
-    iso_cmd = f"grub-mkrescue -o {shlex.quote(iso_path)} {shlex.quote(ISO_WORK_DIR)}"
+    # The installer looks for this volume ID to find the live media without
+    # mounting every block device.
+    iso_cmd = f"grub-mkrescue -o {shlex.quote(iso_path)} {shlex.quote(ISO_WORK_DIR)} -- -volid GEMINIOS"
     if run_command(iso_cmd) != 0:
         print_error(" [FAILED] (grub-mkrescue)")
         return False
@@ -45,10 +45,10 @@ rm -f "$ROOTFS/bin/apps/system/gpkg-v2" \
       "$ROOTFS/usr/bin/gpkg-v2-worker"
 
 echo "Compiling ping..."
-build_tool "$ROOTFS/bin/apps/system/ping" "$PKGS/ping/ping.cpp"
+build_tool "$ROOTFS/bin/apps/system/ping" "$PKGS/ping/ping.cpp" "$SRC/resolver.cpp"
 
 echo "Compiling greq..."
-build_tool "$ROOTFS/bin/apps/system/greq" "$PKGS/greq/greq.cpp"
+build_tool "$ROOTFS/bin/apps/system/greq" "$PKGS/greq/"*.cpp "$SRC/resolver.cpp"
 
 echo "Compiling User Tools..."
 build_tool "$ROOTFS/bin/apps/system/su" "$PKGS/su/su.cpp"
@@ -5,7 +5,7 @@ OPENSSL_VER="3.3.0"
 download_and_extract "https://www.openssl.org/source/openssl-$OPENSSL_VER.tar.gz" "openssl-$OPENSSL_VER.tar.gz" "openssl-$OPENSSL_VER"
 
 cd "$DEP_DIR/openssl-$OPENSSL_VER"
-./config --prefix=/usr --libdir=lib/x86_64-linux-gnu --openssldir=/etc/ssl shared zlib-dynamic no-tests no-docs
+./config --prefix=/usr --libdir=lib/x86_64-linux-gnu --openssldir=/etc/ssl shared zlib-dynamic enable-ktls no-tests no-docs
 make -j$JOBS
 make install DESTDIR="$ROOTFS"
 
@@ -1,7 +1,9 @@
+#include "greq_common.h"
 #include "network.h"
 #include "signals.h"
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <vector>
 #include <string>
 #include <csignal>
@@ -11,8 +13,22 @@
 
 void sig_handler(int) { g_stop_sig = 1; }
 
+// Options for greq's own client, used by the modes HttpRequest cannot serve.
+greq::RequestOptions client_options(const HttpOptions& opts, const std::string& dns_cache) {
+    greq::RequestOptions request;
+    request.headers = opts.headers;
+    request.auth = opts.auth;
+    request.user_agent = opts.user_agent;
+    request.insecure = opts.insecure;
+    request.verbose = opts.verbose;
+    request.follow_location = opts.follow_location;
+    request.dns_cache = dns_cache;
+    return request;
+}
+
 int main(int argc, char* argv[]) {
     signal(SIGINT, sig_handler);
+    signal(SIGPIPE, SIG_IGN);
     
     if (argc < 2) {
         std::cout << "Usage: greq <url> [-o file] [-v]" << std::endl;
@@ -20,15 +36,35 @@ int main(int argc, char* argv[]) {
     }
 
     std::string url;
+    std::vector<std::string> urls;
+    std::string batch_file;
+    unsigned int concurrency = 8;
     std::string output_file;
     bool remote_name = false;
+    unsigned int parallel = 0;
+    bool resume = false;
+    bool compressed = false;
+    greq::DigestCheck digests;
+    greq::CacheOptions cache;
+    bool zero_copy = true;
+    bool bench_zero_copy = false;
+    std::string write_out;
+    std::string trace_timing;
+    std::vector<std::string> form_fields;
+    std::string upload_file;
+    std::string data_file;
+    std::string dns_cache;
+    // `greq bench [options] <url>` load-tests the URL instead of fetching it.
+    const bool bench = std::string(argv[1]) == "bench";
+    greq::BenchOptions bench_options;
     HttpOptions opts;
 
-    for (int i = 1; i < argc; ++i) {
+    for (int i = bench ? 2 : 1; i < argc; ++i) {
         std::string arg = argv[i];
 
         if (arg == "--help") {
             std::cout << "Usage: greq [options] <url>\n"
+                      << "       greq bench [-c <n>] [-t <n>] [--duration <time>] [-n <n>] [--pipeline <n>] [options] <url>\n"
                       << "Options:\n"
                       << "  -o <file>    Write output to file\n"
                       << "  -O           Write output to local file named like remote file\n"
@@ -39,10 +75,34 @@ int main(int argc, char* argv[]) {
                       << "  -X <method>  Specify request method\n"
                       << "  -H <header>  Add custom header\n"
                       << "  -d <data>    HTTP POST data\n"
+                      << "  --data-binary <data|@file>  POST data as is, or streamed from file (\"@-\" for stdin)\n"
+                      << "  -F <name=value|name=@file>  Add a multipart/form-data field; files are streamed\n"
+                      << "  -T <file>    Upload file with PUT (\"-\" for stdin, sent chunked)\n"
                       << "  -u <u:p>     Server user and password\n"
                       << "  -A <agent>   User-Agent\n"
                       << "  -x <proxy>   [protocol://]host:port or user:pass@host:port\n"
-                      << "  -k           Insecure (Skip SSL verification)\n";
+                      << "  -k           Insecure (Skip SSL verification)\n"
+                      << "  --parallel <n>  Download to the output file over n range connections\n"
+                      << "  -C -, --continue  Keep partial downloads and continue them on the next run\n"
+                      << "  -K <file>    Download every URL listed in file (\"-\" for stdin)\n"
+                      << "  --concurrency <n>  Transfers in flight in batch mode (default 8)\n"
+                      << "  --compressed Request a compressed response (zstd, gzip, deflate) and decode it\n"
+                      << "  --expect-sha256 <hex>  Fail, removing the output file, unless the body has this SHA-256\n"
+                      << "  --expect-blake3 <hex>  Fail, removing the output file, unless the body has this BLAKE3 hash\n"
+                      << "  --print-digest  Print the SHA-256 and BLAKE3 of the body\n"
+                      << "  --cache-dir <dir>  Keep downloads in dir and revalidate them instead of fetching again\n"
+                      << "  --cache-max <size>  Cache size limit, e.g. 500M (default 1G)\n"
+                      << "  --no-zero-copy  Copy downloads through user space instead of splicing them into the file\n"
+                      << "  --bench-zero-copy  Download to the output file with and without zero-copy and compare\n"
+                      << "  -w, --write-out <format>  Print curl-style %{variables} after the transfer (@file reads it)\n"
+                      << "  --trace-timing <file>  Append the transfer's stage timings as a JSON line (\"-\" for stderr)\n"
+                      << "  --dns-cache <file>  Keep DNS answers in file for later runs (default $GEMINIOS_DNS_CACHE)\n"
+                      << "Bench options (-X, -H, -d, -u, -A and -k shape the requests):\n"
+                      << "  -c <n>       Connections to keep open (default 10)\n"
+                      << "  -t <n>       Threads, each with its own event loop (default 2)\n"
+                      << "  --duration <time>  How long to run, e.g. 30s or 2m (default 10s)\n"
+                      << "  -n <n>       Stop after n responses instead\n"
+                      << "  --pipeline <n>  Requests in flight on each connection (default 1)\n";
             return 0;
         }
         else if (arg == "--version") {
@@ -67,16 +127,180 @@ int main(int argc, char* argv[]) {
             if (p.find("://") != std::string::npos) p = p.substr(p.find("://") + 3);
             opts.proxy = p;
         }
-        else if (arg == "-F" && i + 1 < argc) {
-             // Very basic multipart simulation: just send as body (Not spec compliant but a start)
-             std::string val = argv[++i];
-             opts.data += val + "\n";
-             opts.method = "POST";
+        else if (arg == "--parallel" && i + 1 < argc) {
+            const int n = std::atoi(argv[++i]);
+            if (n < 1 || n > 64) {
+                std::cerr << "greq: --parallel expects a connection count between 1 and 64" << std::endl;
+                return 1;
+            }
+            parallel = static_cast<unsigned int>(n);
+        }
+        else if (arg == "--continue") resume = true;
+        else if (arg == "--compressed") compressed = true;
+        else if ((arg == "--expect-sha256" || arg == "--expect-blake3") && i + 1 < argc) {
+            const std::string hex = argv[++i];
+            if (hex.size() != 64 || hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+                std::cerr << "greq: " << arg << " expects 64 hexadecimal digits" << std::endl;
+                return 1;
+            }
+            (arg == "--expect-sha256" ? digests.sha256 : digests.blake3) = hex;
+        }
+        else if (arg == "--print-digest") digests.print = true;
+        else if ((arg == "-w" || arg == "--write-out") && i + 1 < argc) {
+            write_out = argv[++i];
+            if (!write_out.empty() && write_out[0] == '@') {
+                const std::string path = write_out.substr(1);
+                std::ifstream in(path == "-" ? "/dev/stdin" : path);
+                if (!in) {
+                    std::cerr << "greq: cannot read --write-out format from " << path << std::endl;
+                    return 1;
+                }
+                write_out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+        }
+        else if (arg == "--trace-timing" && i + 1 < argc) trace_timing = argv[++i];
+        else if (arg == "--dns-cache" && i + 1 < argc) dns_cache = argv[++i];
+        else if (arg == "--no-zero-copy") zero_copy = false;
+        else if (arg == "--bench-zero-copy") bench_zero_copy = true;
+        else if (arg == "--cache-dir" && i + 1 < argc) cache.directory = argv[++i];
+        else if (arg == "--cache-max" && i + 1 < argc) {
+            if (!greq::parse_size(argv[++i], cache.max_bytes)) {
+                std::cerr << "greq: --cache-max expects a size such as 200M or 4G" << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "-C" && i + 1 < argc) {
+            if (std::string(argv[++i]) != "-") {
+                std::cerr << "greq: only '-C -' is supported, the offset comes from the output file" << std::endl;
+                return 1;
+            }
+            resume = true;
+        }
+        else if (arg == "-F" && i + 1 < argc) form_fields.push_back(argv[++i]);
+        else if ((arg == "-T" || arg == "--upload-file") && i + 1 < argc) upload_file = argv[++i];
+        else if (arg == "--data-binary" && i + 1 < argc) {
+            const std::string value = argv[++i];
+            if (!value.empty() && value[0] == '@') data_file = value.substr(1);
+            else opts.data = value;
+            if (opts.method == "GET") opts.method = "POST";
+        }
+        else if (arg == "-K" && i + 1 < argc) batch_file = argv[++i];
+        else if (arg == "--concurrency" && i + 1 < argc) {
+            const int n = std::atoi(argv[++i]);
+            if (n < 1 || n > 1024) {
+                std::cerr << "greq: --concurrency expects a value between 1 and 1024" << std::endl;
+                return 1;
+            }
+            concurrency = static_cast<unsigned int>(n);
+        }
+        else if (bench && (arg == "-c" || arg == "-t" || arg == "--pipeline" || arg == "-n") && i + 1 < argc) {
+            char* end = nullptr;
+            const unsigned long long n = std::strtoull(argv[++i], &end, 10);
+            const unsigned long long limit = arg == "-n" ? ~0ull : arg == "-t" ? 256 : arg == "-c" ? 100000 : 1024;
+            if (*end != '\0' || n < 1 || n > limit) {
+                std::cerr << "greq: bench " << arg << " expects a value between 1 and " << limit << std::endl;
+                return 1;
+            }
+            if (arg == "-c") bench_options.connections = static_cast<unsigned int>(n);
+            else if (arg == "-t") bench_options.threads = static_cast<unsigned int>(n);
+            else if (arg == "--pipeline") bench_options.pipeline = static_cast<unsigned int>(n);
+            else bench_options.requests = n;
+        }
+        else if (bench && arg == "--duration" && i + 1 < argc) {
+            if (!greq::parse_duration(argv[++i], bench_options.duration_ms) || bench_options.duration_ms == 0) {
+                std::cerr << "greq: --duration expects a time such as 30s or 2m" << std::endl;
+                return 1;
+            }
         }
         else if (arg[0] != '-') {
-            url = arg;
+            urls.push_back(arg);
         }
     }
+    if (!urls.empty()) url = urls.front();
+
+    // Uploads stream their files from disk through greq's own client.
+    greq::UploadBody upload;
+    {
+        const int bodies = (!form_fields.empty()) + (!upload_file.empty()) + (!data_file.empty() || !opts.data.empty());
+        if (bodies > 1) {
+            std::cerr << "greq: -d/--data-binary, -F and -T cannot be combined" << std::endl;
+            return 1;
+        }
+        std::string error;
+        if (!form_fields.empty()) {
+            if (!greq::build_form_body(form_fields, upload, error)) {
+                std::cerr << "greq: " << error << std::endl;
+                return 1;
+            }
+            if (opts.method == "GET") opts.method = "POST";
+        } else if (!upload_file.empty()) {
+            upload.parts.push_back({"", upload_file});
+            if (opts.method == "GET") opts.method = "PUT";
+            // Like curl, a URL ending in a slash gets the file's name.
+            if (!url.empty() && url.back() == '/' && upload_file != "-") url += upload_file.substr(upload_file.find_last_of('/') + 1);
+        } else if (!data_file.empty()) {
+            upload.parts.push_back({"", data_file});
+            upload.content_type = "application/x-www-form-urlencoded";
+        }
+        if (upload.active() && !greq::prepare_upload(upload, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            return 1;
+        }
+    }
+
+    if (bench) {
+        if (urls.size() != 1 || !batch_file.empty()) {
+            std::cerr << "greq: bench expects exactly one URL" << std::endl;
+            return 1;
+        }
+        if (!output_file.empty() || remote_name || parallel > 0 || resume || bench_zero_copy || digests.active() ||
+            !cache.directory.empty() || !write_out.empty() || !trace_timing.empty() || !opts.proxy.empty() ||
+            opts.include_headers || opts.follow_location || upload.active()) {
+            std::cerr << "greq: bench only takes the request options -X, -H, -d, -u, -A, -k and --compressed" << std::endl;
+            return 1;
+        }
+        greq::Url target;
+        std::string error;
+        if (!greq::parse_url(url, target, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            return 1;
+        }
+        greq::RequestOptions request = client_options(opts, dns_cache);
+        request.method = opts.method;
+        request.data = opts.data;
+        request.compressed = compressed;
+        if (!greq::run_bench(target, request, bench_options, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Several URLs, or a list of them, are fetched together over pooled
+    // keep-alive connections and each saved under its remote name.
+    if (urls.size() > 1 || !batch_file.empty()) {
+        if (!output_file.empty() || parallel > 0 || resume || bench_zero_copy || digests.active() ||
+            !cache.directory.empty() || !write_out.empty() || !trace_timing.empty() || !opts.proxy.empty() ||
+            opts.include_headers || opts.method != "GET" || !opts.data.empty() || upload.active()) {
+            std::cerr << "greq: batch mode only supports plain GET downloads to remote file names" << std::endl;
+            return 1;
+        }
+        std::vector<greq::BatchItem> items;
+        std::string error;
+        for (const auto& entry : urls) items.push_back({entry, ""});
+        if (!batch_file.empty() && !greq::read_batch_list(batch_file, items, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            return 1;
+        }
+        greq::RequestOptions request = client_options(opts, dns_cache);
+        request.compressed = compressed;
+        unsigned int failed = 0;
+        if (!greq::run_batch(items, request, concurrency, failed, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            return 1;
+        }
+        return failed == 0 ? 0 : 1;
+    }
 
     if (url.empty()) {
         std::cerr << "greq: no URL specified!" << std::endl;
@@ -99,23 +323,169 @@ int main(int argc, char* argv[]) {
         if (opts.verbose) std::cout << "[GREQ] Saving to: " << output_file << std::endl;
     }
 
+    if (digests.active() && opts.include_headers) {
+        std::cerr << "greq: digests cover the body only and cannot be combined with -i or -I" << std::endl;
+        return 1;
+    }
+
+    // Stage timings come from greq's own client; the clock starts when the
+    // request options for the transfer are made.
+    const bool timed = !write_out.empty() || !trace_timing.empty();
+    if (timed && bench_zero_copy) {
+        std::cerr << "greq: --write-out and --trace-timing cannot be combined with --bench-zero-copy" << std::endl;
+        return 1;
+    }
+    greq::TransferTiming timing;
+    auto timed_options = [&]() {
+        greq::RequestOptions request = client_options(opts, dns_cache);
+        if (timed) {
+            request.timing = &timing;
+            timing.start = greq::monotonic_ns();
+        }
+        return request;
+    };
+    auto finish = [&](int code) {
+        if (!timed) return code;
+        timing.total = timing.elapsed();
+        if (!write_out.empty()) std::cout << greq::format_write_out(write_out, timing) << std::flush;
+        if (trace_timing == "-") {
+            std::cerr << greq::timing_json(timing) << std::endl;
+        } else if (!trace_timing.empty()) {
+            std::ofstream trace(trace_timing, std::ios::app);
+            trace << greq::timing_json(timing) << "\n";
+            if (!trace) std::cerr << "greq: cannot write timings to " << trace_timing << std::endl;
+        }
+        return code;
+    };
+
+    if (!cache.directory.empty()) {
+        if (parallel > 0 || resume || compressed) {
+            std::cerr << "greq: --cache-dir cannot be combined with --parallel, --continue or --compressed" << std::endl;
+            return 1;
+        }
+        if (!opts.proxy.empty() || opts.include_headers || opts.method != "GET" || !opts.data.empty() || upload.active()) {
+            std::cerr << "greq: --cache-dir only supports plain GET downloads without a proxy" << std::endl;
+            return 1;
+        }
+        greq::Url target;
+        std::string error;
+        if (!greq::parse_url(url, target, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            return 1;
+        }
+        if (!greq::cached_fetch(target, timed_options(), cache, digests, output_file, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            return finish(1);
+        }
+        return finish(0);
+    }
+
+    // Plain GET downloads to a file use greq's own client as well, which can
+    // splice the body into the file instead of copying it through buffers.
+    const bool plain_get = opts.proxy.empty() && !opts.include_headers && opts.method == "GET" && opts.data.empty() &&
+        !upload.active();
+    const bool file_modes = parallel > 0 || resume || bench_zero_copy;
+    if (file_modes || (!output_file.empty() && plain_get && !compressed)) {
+        if (compressed) {
+            std::cerr << "greq: --compressed cannot be combined with --parallel, --continue or --bench-zero-copy" << std::endl;
+            return 1;
+        }
+        if (output_file.empty()) {
+            std::cerr << "greq: --parallel, --continue and --bench-zero-copy need an output file (-o or -O)" << std::endl;
+            return 1;
+        }
+        if (!plain_get) {
+            std::cerr << "greq: --parallel, --continue and --bench-zero-copy only support plain GET downloads without a proxy"
+                      << std::endl;
+            return 1;
+        }
+        greq::Url target;
+        std::string error;
+        if (!greq::parse_url(url, target, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            return 1;
+        }
+        greq::RequestOptions request = timed_options();
+        request.zero_copy = zero_copy;
+        greq::DownloadOptions download;
+        download.connections = parallel > 0 ? parallel : 1;
+        download.resume = resume;
+        download.digests = digests;
+        const bool ok = bench_zero_copy ? greq::benchmark_zero_copy(target, request, download, output_file, error)
+                                        : greq::download_to_file(target, request, download, output_file, error);
+        if (!ok) {
+            std::cerr << "greq: " << error << std::endl;
+            return finish(1);
+        }
+        return finish(0);
+    }
+
+    // HttpRequest is left with proxied requests: it resolves through
+    // ResolveDNS to a single IPv4 address, while greq's own client races
+    // every address. --compressed, timings and uploads need the own client
+    // anyway, so they cannot go through a proxy.
+    const bool own_client = opts.proxy.empty();
+    if (!own_client && (compressed || timed || upload.active())) {
+        std::cerr << "greq: --compressed, --write-out, --trace-timing and uploads do not support proxies" << std::endl;
+        return 1;
+    }
+    greq::Url target;
+    std::string error;
+    if (own_client) {
+        if (!greq::parse_url(url, target, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            return 1;
+        }
+    }
+    greq::RequestOptions request = timed_options();
+    request.method = opts.method;
+    request.data = opts.data;
+    request.upload = upload;
+    request.compressed = compressed;
+    // With a digest check the body is hashed on its way into the output.
+    greq::StreamDigest digest;
+    digest.use_blake3 = digests.print || !digests.blake3.empty();
+    auto transfer = [&](std::ostream& sink) {
+        greq::DigestStreambuf hashing(sink.rdbuf(), digest);
+        std::ostream hashed(&hashing);
+        std::ostream& out = digests.active() ? hashed : sink;
+        if (!own_client) return HttpRequest(url, out, opts);
+        if (greq::fetch_to_stream(target, request, out, opts.include_headers, error)) return true;
+        std::cerr << "greq: " << error << std::endl;
+        return false;
+    };
+
     if (!output_file.empty()) {
         std::ofstream f(output_file, std::ios::binary);
         if (!f) { perror(("greq: " + output_file).c_str()); return 1; }
-        if (!HttpRequest(url, f, opts)) {
+        if (!transfer(f)) {
             std::cerr << "greq: operation failed" << std::endl;
             // Remove partial file
             f.close();
-            remove(output_file.c_str());
-            return 1;
+            greq::remove_output(output_file);
+            return finish(1);
+        }
+        if (digests.active() && !greq::check_digests(digest, digests, output_file, std::cout, error)) {
+            std::cerr << "greq: " << error << std::endl;
+            f.close();
+            greq::remove_output(output_file);
+            return finish(1);
         }
     } else {
-        if (!HttpRequest(url, std::cout, opts)) {
+        if (!transfer(std::cout)) {
             std::cerr << "greq: operation failed" << std::endl;
-            return 1;
+            return finish(1);
+        }
+        // The body already went to stdout, so the digests go to stderr.
+        if (digests.active()) {
+            std::cout << std::flush;
+            if (!greq::check_digests(digest, digests, "-", std::cerr, error)) {
+                std::cerr << "greq: " << error << std::endl;
+                return finish(1);
+            }
         }
         // Ensure newline at end of terminal output if body didn't have it
         if (!opts.head_only) std::cout << std::flush; 
     }
-    return 0;
+    return finish(0);
 }
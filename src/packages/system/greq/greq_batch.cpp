@@ -0,0 +1,613 @@
+#include "greq_common.h"
+#include "resolver.h"
+#include "signals.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+#include <set>
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace greq {
+
+namespace {
+
+const int kMaxEvents = 64;
+const size_t kBatchReadBytes = 64 * 1024;
+
+using dns::Address;
+
+struct BatchJob {
+    size_t index = 0;
+    std::string source;
+    Url url;
+    std::string output_path;
+    int redirects = 0;
+    int retries = 0;
+    uint64_t started_ms = 0;
+
+    int fd = -1;
+    bool created = false;
+    bool redirecting = false;
+    bool anonymous = false;
+    std::string location;
+    int status = 0;
+    uint64_t bytes = 0;
+    ContentDecoder decoder;
+    std::string failure;
+};
+
+enum class LinkState { Connecting, Handshaking, Sending, Receiving, Idle };
+
+// One pooled connection. A link carries at most one job at a time and goes
+// back to Idle, still registered with epoll, when the response leaves the
+// connection reusable.
+struct BatchLink {
+    int fd = -1;
+    SSL* ssl = nullptr;
+    Url origin;
+    std::string key;
+    std::vector<Address> addresses;
+    size_t next_address = 0;
+    std::string connect_error;
+    LinkState state = LinkState::Connecting;
+    uint32_t interest = 0;
+    bool dead = false;
+
+    BatchJob* job = nullptr;
+    std::string request;
+    size_t sent = 0;
+    ResponseParser parser;
+    ResponseHandler handler;
+    unsigned int requests = 0;
+    bool received = false;
+    uint64_t deadline_ms = 0;
+};
+
+struct BatchLoop {
+    RequestOptions options;
+    unsigned int concurrency = 1;
+    int epoll_fd = -1;
+    std::vector<char> buffer;
+
+    std::vector<std::unique_ptr<BatchJob>> jobs;
+    std::deque<BatchJob*> queue;
+    std::vector<std::unique_ptr<BatchLink>> links;
+    std::map<std::string, std::vector<Address>> resolved;
+    unsigned int active = 0;
+
+    unsigned int succeeded = 0;
+    unsigned int failed = 0;
+    unsigned int connects = 0;
+    unsigned int reuses = 0;
+    uint64_t bytes = 0;
+};
+
+std::string origin_key(const Url& url) {
+    return url.scheme + "://" + url.host + ":" + std::to_string(url.port);
+}
+
+// Every URL on the same origin shares one lookup.
+bool resolve_origin(BatchLoop& loop, const Url& url, std::vector<Address>& addresses, std::string& error) {
+    const std::string key = origin_key(url);
+    const auto cached = loop.resolved.find(key);
+    if (cached != loop.resolved.end()) {
+        addresses = cached->second;
+        return true;
+    }
+    dns::ResolverOptions resolver;
+    resolver.cache_file = loop.options.dns_cache;
+    if (!dns::resolve(url.host, url.port, resolver, addresses, error)) return false;
+    loop.resolved[key] = addresses;
+    return true;
+}
+
+void report_job(const BatchLoop& loop, const BatchJob& job, const std::string& error) {
+    const int width = static_cast<int>(std::to_string(loop.jobs.size()).size());
+    char position[48];
+    std::snprintf(position, sizeof(position), "[%*zu/%zu]", width, job.index + 1, loop.jobs.size());
+    if (!error.empty()) {
+        std::cout << position << " FAILED " << job.source << ": " << error << std::endl;
+        return;
+    }
+    std::cout << position << " " << job.status << " " << format_size(job.bytes) << " "
+              << (monotonic_ms() - job.started_ms) << " ms " << job.source << " -> " << job.output_path << std::endl;
+}
+
+void finish_job(BatchLoop& loop, BatchJob& job, std::string error) {
+    --loop.active;
+    if (job.fd >= 0) {
+        if (close(job.fd) != 0 && error.empty()) error = job.output_path + ": " + std::strerror(errno);
+        job.fd = -1;
+    }
+    if (error.empty()) error = job.failure;
+    if (error.empty() && job.created && job.decoder.encoded_bytes > 0) {
+        finish_decoding(job.decoder, loop.options, error);
+    }
+
+    if (error.empty() && job.redirecting) {
+        Url next;
+        if (job.redirects >= loop.options.max_redirects) {
+            error = "maximum redirects (" + std::to_string(loop.options.max_redirects) + ") followed";
+        } else if (resolve_location(job.url, job.location, next, error)) {
+            verbose_line(loop.options, "Redirect to " + url_to_string(next));
+            if (!same_origin(job.url, next)) job.anonymous = true;
+            job.url = next;
+            ++job.redirects;
+            loop.queue.push_front(&job);
+            return;
+        }
+    }
+    if (!error.empty()) {
+        if (job.created) remove_output(job.output_path);
+        ++loop.failed;
+    } else {
+        ++loop.succeeded;
+        loop.bytes += job.bytes;
+    }
+    report_job(loop, job, error);
+}
+
+void set_interest(BatchLoop& loop, BatchLink& link, uint32_t events) {
+    if (link.interest == events) return;
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.ptr = &link;
+    epoll_ctl(loop.epoll_fd, link.interest == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, link.fd, &event);
+    link.interest = events;
+}
+
+void close_socket(BatchLink& link) {
+    if (link.ssl) {
+        SSL_free(link.ssl);
+        link.ssl = nullptr;
+    }
+    if (link.fd >= 0) close(link.fd);
+    link.fd = -1;
+    link.interest = 0;
+}
+
+void close_link(BatchLink& link) {
+    close_socket(link);
+    link.dead = true;
+}
+
+// A request that dies on a reused connection before any reply arrived most
+// likely raced the server closing it, and is queued again once.
+void fail_link(BatchLoop& loop, BatchLink& link, const std::string& error) {
+    BatchJob* job = link.job;
+    link.job = nullptr;
+    close_link(link);
+    if (!job) return;
+    if (link.requests > 1 && !link.received && !job->created && job->retries == 0) {
+        ++job->retries;
+        --loop.active;
+        loop.queue.push_front(job);
+        return;
+    }
+    finish_job(loop, *job, error);
+}
+
+bool start_connect(BatchLoop& loop, BatchLink& link, std::string& error) {
+    for (; link.next_address < link.addresses.size(); ++link.next_address) {
+        const Address& address = link.addresses[link.next_address];
+        link.fd = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (link.fd < 0) {
+            link.connect_error = std::strerror(errno);
+            continue;
+        }
+        if (connect(link.fd, reinterpret_cast<const struct sockaddr*>(&address.storage), address.length) == 0 ||
+            errno == EINPROGRESS) {
+            link.state = LinkState::Connecting;
+            link.deadline_ms = monotonic_ms() + static_cast<uint64_t>(loop.options.connect_timeout_ms);
+            set_interest(loop, link, EPOLLOUT);
+            return true;
+        }
+        link.connect_error = std::strerror(errno);
+        close_socket(link);
+    }
+    error = "cannot connect to " + link.origin.host + ":" + std::to_string(link.origin.port) +
+        (link.connect_error.empty() ? "" : ": " + link.connect_error);
+    return false;
+}
+
+void assign_job(BatchLoop& loop, BatchLink& link, BatchJob& job) {
+    link.job = &job;
+    if (job.anonymous) {
+        RequestOptions options = loop.options;
+        drop_credentials(options);
+        link.request = build_request(job.url, options, {});
+    } else {
+        link.request = build_request(job.url, loop.options, {});
+    }
+    link.sent = 0;
+    link.parser.reset(false);
+    link.received = false;
+    if (link.requests > 0) ++loop.reuses;
+    ++link.requests;
+    if (job.started_ms == 0) job.started_ms = monotonic_ms();
+    job.redirecting = false;
+    job.failure.clear();
+
+    BatchJob* target = &job;
+    const bool follow = loop.options.follow_location;
+    const bool compressed = loop.options.compressed;
+    link.handler.on_head = [target, follow, compressed](const HttpResponse& head) {
+        target->status = head.status;
+        target->redirecting = follow && is_redirect(head.status) && !head.header("Location").empty();
+        if (target->redirecting) {
+            target->location = head.header("Location");
+            return true;
+        }
+        // Error bodies are read and dropped so the connection stays usable.
+        if (head.status >= 400) {
+            target->failure = "server returned HTTP " + std::to_string(head.status);
+            return true;
+        }
+        target->fd = open(target->output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (target->fd < 0) {
+            target->failure = target->output_path + ": " + std::strerror(errno);
+            return false;
+        }
+        target->created = true;
+        target->bytes = 0;
+        const BodySink sink = [target](const char* data, size_t size) {
+            if (!write_all_fd(target->fd, data, size)) {
+                target->failure = target->output_path + ": " + std::strerror(errno);
+                return false;
+            }
+            target->bytes += size;
+            return true;
+        };
+        return begin_decoding(target->decoder, compressed ? head.header("Content-Encoding") : "", sink, target->failure);
+    };
+    link.handler.on_body = [target](const char* data, size_t size) {
+        if (target->fd < 0) return true;
+        if (decode_chunk(target->decoder, data, size)) return true;
+        if (target->failure.empty()) target->failure = target->decoder.error;
+        return false;
+    };
+}
+
+void complete_response(BatchLoop& loop, BatchLink& link, bool reusable) {
+    BatchJob* job = link.job;
+    link.job = nullptr;
+    const HttpResponse& response = link.parser.response;
+    reusable = reusable && response.complete && response.keep_alive && !link.parser.stopped;
+    if (reusable) {
+        link.state = LinkState::Idle;
+        set_interest(loop, link, EPOLLIN | EPOLLRDHUP);
+    } else {
+        close_link(link);
+    }
+    finish_job(loop, *job, "");
+}
+
+// Runs one connection's state machine until it has to wait for the socket.
+void drive(BatchLoop& loop, BatchLink& link) {
+    while (!link.dead) {
+        switch (link.state) {
+        case LinkState::Connecting: {
+            int socket_error = 0;
+            socklen_t length = sizeof(socket_error);
+            getsockopt(link.fd, SOL_SOCKET, SO_ERROR, &socket_error, &length);
+            if (socket_error == EINPROGRESS || socket_error == EALREADY) return;
+            if (socket_error != 0) {
+                link.connect_error = std::strerror(socket_error);
+                close_socket(link);
+                ++link.next_address;
+                std::string error;
+                if (!start_connect(loop, link, error)) fail_link(loop, link, error);
+                return;
+            }
+            const int one = 1;
+            setsockopt(link.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            ++loop.connects;
+            verbose_line(loop.options, "Connected to " + link.origin.host + " port " + std::to_string(link.origin.port));
+            if (link.origin.tls()) {
+                std::string error;
+                link.ssl = create_tls_session(link.origin, loop.options, link.fd, error);
+                if (!link.ssl) {
+                    fail_link(loop, link, error);
+                    return;
+                }
+                link.state = LinkState::Handshaking;
+            } else {
+                link.state = LinkState::Sending;
+            }
+            break;
+        }
+        case LinkState::Handshaking: {
+            const int result = SSL_connect(link.ssl);
+            if (result == 1) {
+                link.state = LinkState::Sending;
+                break;
+            }
+            const int reason = SSL_get_error(link.ssl, result);
+            if (reason == SSL_ERROR_WANT_READ) return set_interest(loop, link, EPOLLIN);
+            if (reason == SSL_ERROR_WANT_WRITE) return set_interest(loop, link, EPOLLOUT);
+            fail_link(loop, link, tls_handshake_error(link.ssl, link.origin));
+            return;
+        }
+        case LinkState::Sending: {
+            link.deadline_ms = monotonic_ms() + static_cast<uint64_t>(loop.options.io_timeout_ms);
+            while (link.sent < link.request.size()) {
+                const char* data = link.request.data() + link.sent;
+                const size_t size = link.request.size() - link.sent;
+                if (link.ssl) {
+                    const int written = SSL_write(link.ssl, data, static_cast<int>(size));
+                    if (written > 0) {
+                        link.sent += static_cast<size_t>(written);
+                        continue;
+                    }
+                    const int reason = SSL_get_error(link.ssl, written);
+                    if (reason == SSL_ERROR_WANT_WRITE) return set_interest(loop, link, EPOLLOUT);
+                    if (reason == SSL_ERROR_WANT_READ) return set_interest(loop, link, EPOLLIN);
+                } else {
+                    const ssize_t written = send(link.fd, data, size, MSG_NOSIGNAL);
+                    if (written >= 0) {
+                        link.sent += static_cast<size_t>(written);
+                        continue;
+                    }
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) return set_interest(loop, link, EPOLLOUT);
+                }
+                fail_link(loop, link, "failed to send request to " + link.origin.host);
+                return;
+            }
+            link.state = LinkState::Receiving;
+            set_interest(loop, link, EPOLLIN);
+            break;
+        }
+        case LinkState::Receiving:
+        case LinkState::Idle: {
+            ssize_t got = 0;
+            if (link.ssl) {
+                const int result = SSL_read(link.ssl, loop.buffer.data(), static_cast<int>(loop.buffer.size()));
+                if (result > 0) {
+                    got = result;
+                } else {
+                    const int reason = SSL_get_error(link.ssl, result);
+                    if (reason == SSL_ERROR_WANT_READ) {
+                        if (link.state == LinkState::Receiving) set_interest(loop, link, EPOLLIN);
+                        return;
+                    }
+                    if (reason == SSL_ERROR_WANT_WRITE) return set_interest(loop, link, EPOLLOUT);
+                    got = reason == SSL_ERROR_ZERO_RETURN || (reason == SSL_ERROR_SYSCALL && result == 0) ? 0 : -1;
+                }
+            } else {
+                got = recv(link.fd, loop.buffer.data(), loop.buffer.size(), 0);
+                if (got < 0 && errno == EINTR) continue;
+                if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            }
+            // An idle connection only wakes up when the server closes it.
+            if (link.state == LinkState::Idle) {
+                close_link(link);
+                return;
+            }
+            if (got < 0) {
+                fail_link(loop, link, "failed to read from " + link.origin.host);
+                return;
+            }
+            if (got == 0) {
+                std::string error;
+                if (!link.received && link.requests > 1) {
+                    fail_link(loop, link, "connection closed by the server");
+                } else if (link.parser.finish_at_eof(error)) {
+                    complete_response(loop, link, false);
+                } else {
+                    fail_link(loop, link, error);
+                }
+                return;
+            }
+            link.received = true;
+            link.deadline_ms = monotonic_ms() + static_cast<uint64_t>(loop.options.io_timeout_ms);
+            std::string error;
+            const size_t used = link.parser.feed(loop.buffer.data(), static_cast<size_t>(got), link.handler, error);
+            if (!error.empty()) {
+                fail_link(loop, link, error);
+                return;
+            }
+            if (link.parser.done()) {
+                // Bytes past the end of a response we did not ask for mean
+                // the connection is out of step; do not reuse it.
+                complete_response(loop, link, used == static_cast<size_t>(got));
+                return;
+            }
+            break;
+        }
+        }
+    }
+}
+
+// Hands queued jobs to idle pooled connections for their origin, opening
+// new ones while under the concurrency limit and, at the limit, recycling
+// an idle connection to some other origin.
+void schedule(BatchLoop& loop) {
+    while (loop.active < loop.concurrency && !loop.queue.empty()) {
+        BatchJob* job = loop.queue.front();
+        const std::string key = origin_key(job->url);
+        BatchLink* link = nullptr;
+        BatchLink* spare = nullptr;
+        size_t open_links = 0;
+        for (const auto& candidate : loop.links) {
+            if (candidate->dead) continue;
+            ++open_links;
+            if (candidate->state != LinkState::Idle) continue;
+            if (candidate->key == key) {
+                link = candidate.get();
+                break;
+            }
+            spare = candidate.get();
+        }
+
+        if (link) {
+            loop.queue.pop_front();
+            ++loop.active;
+            assign_job(loop, *link, *job);
+            link->state = LinkState::Sending;
+            drive(loop, *link);
+            continue;
+        }
+        if (open_links >= loop.concurrency) {
+            if (!spare) break;
+            close_link(*spare);
+        }
+
+        loop.queue.pop_front();
+        ++loop.active;
+        std::vector<Address> addresses;
+        std::string error;
+        if (!resolve_origin(loop, job->url, addresses, error)) {
+            if (job->started_ms == 0) job->started_ms = monotonic_ms();
+            finish_job(loop, *job, error);
+            continue;
+        }
+        loop.links.emplace_back(new BatchLink());
+        link = loop.links.back().get();
+        link->origin = job->url;
+        link->key = key;
+        link->addresses = addresses;
+        assign_job(loop, *link, *job);
+        if (!start_connect(loop, *link, error)) fail_link(loop, *link, error);
+    }
+}
+
+}  // namespace
+
+bool read_batch_list(const std::string& path, std::vector<BatchItem>& items, std::string& error) {
+    std::ifstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+    }
+    std::istream& in = path == "-" ? std::cin : file;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        BatchItem item;
+        fields >> item.url >> item.output_path;
+        items.push_back(item);
+    }
+    return true;
+}
+
+bool run_batch(
+    const std::vector<BatchItem>& items,
+    const RequestOptions& options,
+    unsigned int concurrency,
+    unsigned int& failed,
+    std::string& error
+) {
+    BatchLoop loop;
+    loop.options = options;
+    loop.concurrency = std::max(1u, concurrency);
+    loop.buffer.resize(kBatchReadBytes);
+
+    std::set<std::string> outputs;
+    for (size_t i = 0; i < items.size(); ++i) {
+        loop.jobs.emplace_back(new BatchJob());
+        BatchJob& job = *loop.jobs.back();
+        job.index = i;
+        job.source = items[i].url;
+        std::string parse_error;
+        const bool parsed = parse_url(items[i].url, job.url, parse_error);
+        job.output_path = !items[i].output_path.empty() ? items[i].output_path
+                        : parsed                        ? remote_file_name(job.url)
+                                                        : "";
+        if (!parsed) {
+            job.failure = parse_error;
+            continue;
+        }
+        if (!outputs.insert(job.output_path).second) {
+            error = "more than one URL would be saved as " + job.output_path + "; name them in the list file";
+            return false;
+        }
+        loop.queue.push_back(&job);
+    }
+
+    loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop.epoll_fd < 0) {
+        error = std::string("epoll: ") + std::strerror(errno);
+        return false;
+    }
+    for (const auto& job : loop.jobs) {
+        if (!job->failure.empty()) {
+            ++loop.active;
+            finish_job(loop, *job, job->failure);
+        }
+    }
+
+    const uint64_t started = monotonic_ms();
+    std::vector<struct epoll_event> events(kMaxEvents);
+    while (!g_stop_sig) {
+        loop.links.erase(
+            std::remove_if(loop.links.begin(), loop.links.end(), [](const std::unique_ptr<BatchLink>& link) { return link->dead; }),
+            loop.links.end()
+        );
+        schedule(loop);
+        if (loop.active == 0 && loop.queue.empty()) break;
+
+        uint64_t now = monotonic_ms();
+        uint64_t wake = now + 1000;
+        for (const auto& link : loop.links) {
+            if (!link->dead && link->job) wake = std::min(wake, link->deadline_ms);
+        }
+        const int ready = epoll_wait(loop.epoll_fd, events.data(), kMaxEvents, static_cast<int>(wake > now ? wake - now : 0));
+        if (ready < 0 && errno != EINTR) {
+            error = std::string("epoll: ") + std::strerror(errno);
+            break;
+        }
+        for (int i = 0; i < ready; ++i) {
+            BatchLink& link = *static_cast<BatchLink*>(events[i].data.ptr);
+            if (!link.dead) drive(loop, link);
+        }
+        now = monotonic_ms();
+        for (const auto& link : loop.links) {
+            if (!link->dead && link->job && now >= link->deadline_ms) {
+                fail_link(loop, *link, link->state == LinkState::Connecting || link->state == LinkState::Handshaking
+                                           ? "connection to " + link->origin.host + " timed out"
+                                           : "timed out waiting for " + link->origin.host);
+            }
+        }
+    }
+
+    for (const auto& link : loop.links) {
+        if (!link->dead) fail_link(loop, *link, g_stop_sig ? "interrupted" : error);
+    }
+    while (!loop.queue.empty()) {
+        BatchJob* job = loop.queue.front();
+        loop.queue.pop_front();
+        ++loop.active;
+        finish_job(loop, *job, g_stop_sig ? "interrupted" : error);
+    }
+    close(loop.epoll_fd);
+
+    const uint64_t elapsed = std::max<uint64_t>(monotonic_ms() - started, 1);
+    verbose_line(options, std::to_string(loop.succeeded) + " downloaded, " + std::to_string(loop.failed) + " failed, " +
+                              format_size(loop.bytes) + " in " + std::to_string(elapsed) + " ms over " +
+                              std::to_string(loop.connects) + " connections (" + std::to_string(loop.reuses) +
+                              " requests on reused connections)");
+    failed = loop.failed;
+    return error.empty();
+}
+
+}  // namespace greq
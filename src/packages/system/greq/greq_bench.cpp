@@ -0,0 +1,587 @@
+#include "greq_common.h"
+#include "resolver.h"
+#include "signals.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace greq {
+
+namespace {
+
+const int kBenchMaxEvents = 256;
+const size_t kBenchReadBytes = 64 * 1024;
+const uint64_t kBenchTickNs = 100ull * 1000 * 1000;
+
+// Latency histogram after HdrHistogram: values below kSubBuckets ns are
+// counted exactly and every doubling above that is split into
+// kSubBuckets / 2 steps, so a count stands for its values within 0.1%.
+// Latencies up to 2^42 ns (73 minutes) fit in 33792 counters.
+const int kSubBucketBits = 11;
+const uint64_t kSubBuckets = 1ull << kSubBucketBits;
+const uint64_t kMaxLatencyNs = (1ull << 42) - 1;
+
+size_t histogram_index(uint64_t value) {
+    const int magnitude = 64 - __builtin_clzll(value | (kSubBuckets - 1)) - kSubBucketBits;
+    return static_cast<size_t>(magnitude) * (kSubBuckets / 2) + static_cast<size_t>(value >> magnitude);
+}
+
+// The largest value counted at `index`.
+uint64_t histogram_value(size_t index) {
+    if (index < kSubBuckets) return index;
+    const size_t magnitude = index / (kSubBuckets / 2) - 1;
+    const uint64_t sub_bucket = index - magnitude * (kSubBuckets / 2);
+    return ((sub_bucket + 1) << magnitude) - 1;
+}
+
+struct LatencyHistogram {
+    std::vector<uint64_t> counts = std::vector<uint64_t>(histogram_index(kMaxLatencyNs) + 1);
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+};
+
+void record_latency(LatencyHistogram& histogram, uint64_t ns) {
+    ns = std::min(ns, kMaxLatencyNs);
+    ++histogram.counts[histogram_index(ns)];
+    ++histogram.total;
+    histogram.sum += ns;
+    histogram.max = std::max(histogram.max, ns);
+}
+
+void merge_histogram(LatencyHistogram& into, const LatencyHistogram& from) {
+    for (size_t i = 0; i < into.counts.size(); ++i) into.counts[i] += from.counts[i];
+    into.total += from.total;
+    into.sum += from.sum;
+    into.max = std::max(into.max, from.max);
+}
+
+uint64_t latency_percentile(const LatencyHistogram& histogram, double percentile) {
+    if (histogram.total == 0) return 0;
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percentile / 100.0 * static_cast<double>(histogram.total))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < histogram.counts.size(); ++i) {
+        seen += histogram.counts[i];
+        if (seen >= rank) return std::min(histogram_value(i), histogram.max);
+    }
+    return histogram.max;
+}
+
+double latency_stdev(const LatencyHistogram& histogram) {
+    if (histogram.total < 2) return 0;
+    const double mean = static_cast<double>(histogram.sum) / static_cast<double>(histogram.total);
+    double squares = 0;
+    for (size_t i = 0; i < histogram.counts.size(); ++i) {
+        if (histogram.counts[i] == 0) continue;
+        const double delta = static_cast<double>(std::min(histogram_value(i), histogram.max)) - mean;
+        squares += delta * delta * static_cast<double>(histogram.counts[i]);
+    }
+    return std::sqrt(squares / static_cast<double>(histogram.total));
+}
+
+std::string format_latency(double ns) {
+    char buffer[32];
+    if (ns < 1000.0) std::snprintf(buffer, sizeof(buffer), "%.0fns", ns);
+    else if (ns < 1000000.0) std::snprintf(buffer, sizeof(buffer), "%.2fus", ns / 1000.0);
+    else if (ns < 1000000000.0) std::snprintf(buffer, sizeof(buffer), "%.2fms", ns / 1000000.0);
+    else std::snprintf(buffer, sizeof(buffer), "%.2fs", ns / 1000000000.0);
+    return buffer;
+}
+
+using dns::Address;
+
+enum class BenchState { Connecting, Handshaking, Open };
+
+struct BenchConnection {
+    int fd = -1;
+    SSL* ssl = nullptr;
+    BenchState state = BenchState::Connecting;
+    size_t next_address = 0;
+    std::string connect_error;
+    uint32_t interest = 0;
+    // Requests are only queued once the previous batch is fully written, so
+    // a TLS write is always retried with the same buffer.
+    std::string out;
+    size_t sent = 0;
+    // When each request still waiting for its response was queued.
+    std::deque<uint64_t> in_flight;
+    ResponseParser parser;
+    bool answered = false;
+    uint64_t deadline_ns = 0;
+};
+
+struct BenchCounters {
+    uint64_t responses = 0;
+    uint64_t bytes = 0;
+    uint64_t non_success = 0;
+    uint64_t connects = 0;
+    uint64_t connect_errors = 0;
+    uint64_t read_errors = 0;
+    uint64_t write_errors = 0;
+    uint64_t timeouts = 0;
+};
+
+// What the worker threads share. In count mode `claimed` is the number of
+// requests handed out so far; every one ends as a response or an error.
+struct BenchRun {
+    Url url;
+    RequestOptions options;
+    BenchOptions bench;
+    std::vector<Address> addresses;
+    std::string request;
+    bool head = false;
+    uint64_t deadline_ns = 0;
+    std::atomic<uint64_t> claimed{0};
+    std::atomic<bool> answered{false};
+    std::atomic<bool> stop{false};
+    std::mutex mutex;
+    std::string error;
+};
+
+struct BenchWorker {
+    BenchRun* run = nullptr;
+    unsigned int connection_count = 0;
+    int epoll_fd = -1;
+    std::vector<char> buffer;
+    std::vector<std::unique_ptr<BenchConnection>> connections;
+    ResponseHandler handler;
+    LatencyHistogram latency;
+    BenchCounters counters;
+};
+
+void abort_run(BenchRun& run, const std::string& error) {
+    std::lock_guard<std::mutex> lock(run.mutex);
+    if (run.error.empty()) run.error = error;
+    run.stop = true;
+}
+
+bool accepting(const BenchRun& run, uint64_t now) {
+    return !run.stop.load(std::memory_order_relaxed) && !g_stop_sig && (run.deadline_ns == 0 || now < run.deadline_ns);
+}
+
+bool claim_request(BenchRun& run) {
+    if (run.bench.requests == 0) return true;
+    uint64_t claimed = run.claimed.load(std::memory_order_relaxed);
+    while (claimed < run.bench.requests) {
+        if (run.claimed.compare_exchange_weak(claimed, claimed + 1, std::memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+void set_interest(BenchWorker& worker, BenchConnection& conn, uint32_t events) {
+    if (conn.interest == events) return;
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.ptr = &conn;
+    epoll_ctl(worker.epoll_fd, conn.interest == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, conn.fd, &event);
+    conn.interest = events;
+}
+
+void close_socket(BenchConnection& conn) {
+    if (conn.ssl) {
+        SSL_free(conn.ssl);
+        conn.ssl = nullptr;
+    }
+    if (conn.fd >= 0) close(conn.fd);
+    conn.fd = -1;
+    conn.interest = 0;
+}
+
+bool start_connect(BenchWorker& worker, BenchConnection& conn, std::string& error) {
+    const BenchRun& run = *worker.run;
+    for (; conn.next_address < run.addresses.size(); ++conn.next_address) {
+        const Address& address = run.addresses[conn.next_address];
+        conn.fd = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (conn.fd < 0) {
+            conn.connect_error = std::strerror(errno);
+            continue;
+        }
+        if (connect(conn.fd, reinterpret_cast<const struct sockaddr*>(&address.storage), address.length) == 0 ||
+            errno == EINPROGRESS) {
+            conn.state = BenchState::Connecting;
+            conn.deadline_ns = monotonic_ns() + static_cast<uint64_t>(run.options.connect_timeout_ms) * 1000000;
+            set_interest(worker, conn, EPOLLOUT);
+            return true;
+        }
+        conn.connect_error = std::strerror(errno);
+        close_socket(conn);
+    }
+    error = "cannot connect to " + run.url.host + ":" + std::to_string(run.url.port) +
+        (conn.connect_error.empty() ? "" : ": " + conn.connect_error);
+    return false;
+}
+
+// A connection that cannot be opened before any response arrived means the
+// server is not there, and ends the run. Later it is a counted error that,
+// in count mode, uses up one request so the run still ends if the server
+// goes away. The connection is tried again on the next loop pass.
+void connect_failed(BenchWorker& worker, BenchConnection& conn, const std::string& error) {
+    BenchRun& run = *worker.run;
+    close_socket(conn);
+    ++worker.counters.connect_errors;
+    if (!run.answered.load(std::memory_order_relaxed)) {
+        abort_run(run, error);
+        return;
+    }
+    claim_request(run);
+}
+
+void reopen(BenchWorker& worker, BenchConnection& conn) {
+    conn.out.clear();
+    conn.sent = 0;
+    conn.parser.reset(worker.run->head);
+    conn.answered = false;
+    conn.next_address = 0;
+    conn.connect_error.clear();
+    if (!accepting(*worker.run, monotonic_ns())) return;
+    std::string error;
+    if (!start_connect(worker, conn, error)) connect_failed(worker, conn, error);
+}
+
+// Drops the connection and opens a new one. Unanswered requests go back to
+// the budget when the server closed the connection between responses, and
+// are lost otherwise.
+void restart(BenchWorker& worker, BenchConnection& conn, bool give_back) {
+    BenchRun& run = *worker.run;
+    if (give_back && run.bench.requests > 0) run.claimed.fetch_sub(conn.in_flight.size(), std::memory_order_relaxed);
+    conn.in_flight.clear();
+    close_socket(conn);
+    reopen(worker, conn);
+}
+
+// Records the response at the head of the pipeline; false when it ended
+// the connection, which is then reopened.
+bool finish_response(BenchWorker& worker, BenchConnection& conn) {
+    BenchRun& run = *worker.run;
+    record_latency(worker.latency, monotonic_ns() - conn.in_flight.front());
+    conn.in_flight.pop_front();
+    ++worker.counters.responses;
+    const HttpResponse& response = conn.parser.response;
+    if (response.status < 200 || response.status >= 400) ++worker.counters.non_success;
+    if (!conn.answered) {
+        conn.answered = true;
+        if (!run.answered.load(std::memory_order_relaxed)) run.answered = true;
+    }
+    if (!response.keep_alive) {
+        restart(worker, conn, true);
+        return false;
+    }
+    conn.parser.reset(run.head);
+    return true;
+}
+
+bool parse_responses(BenchWorker& worker, BenchConnection& conn, size_t size) {
+    const char* data = worker.buffer.data();
+    size_t used = 0;
+    while (used < size) {
+        std::string error;
+        used += conn.parser.feed(data + used, size - used, worker.handler, error);
+        if (!error.empty() || (conn.parser.done() && conn.in_flight.empty())) {
+            ++worker.counters.read_errors;
+            restart(worker, conn, false);
+            return false;
+        }
+        if (!conn.parser.done()) break;
+        if (!finish_response(worker, conn)) return false;
+    }
+    return true;
+}
+
+// Reads and parses everything the socket holds; false when the connection
+// was restarted.
+bool receive(BenchWorker& worker, BenchConnection& conn) {
+    while (true) {
+        ssize_t got = 0;
+        if (conn.ssl) {
+            const int result = SSL_read(conn.ssl, worker.buffer.data(), static_cast<int>(worker.buffer.size()));
+            if (result > 0) {
+                got = result;
+            } else {
+                const int reason = SSL_get_error(conn.ssl, result);
+                if (reason == SSL_ERROR_WANT_READ || reason == SSL_ERROR_WANT_WRITE) return true;
+                got = reason == SSL_ERROR_ZERO_RETURN || (reason == SSL_ERROR_SYSCALL && result == 0) ? 0 : -1;
+            }
+        } else {
+            got = recv(conn.fd, worker.buffer.data(), worker.buffer.size(), 0);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        }
+        if (got == 0) {
+            std::string error;
+            const bool between = conn.parser.state == ResponseParser::State::Head && conn.parser.line.empty();
+            if (!between && conn.parser.finish_at_eof(error) && !conn.in_flight.empty()) {
+                // A close-delimited body ends here.
+                if (finish_response(worker, conn)) restart(worker, conn, true);
+                return false;
+            }
+            // A server ending a keep-alive connection between responses is
+            // not an error, unless it never answered anything on it.
+            const bool clean = between && (conn.answered || conn.in_flight.empty());
+            if (!clean) ++worker.counters.read_errors;
+            restart(worker, conn, clean);
+            return false;
+        }
+        if (got < 0) {
+            ++worker.counters.read_errors;
+            restart(worker, conn, false);
+            return false;
+        }
+        worker.counters.bytes += static_cast<uint64_t>(got);
+        conn.deadline_ns = monotonic_ns() + static_cast<uint64_t>(worker.run->options.io_timeout_ms) * 1000000;
+        if (!parse_responses(worker, conn, static_cast<size_t>(got))) return false;
+    }
+}
+
+// Tops the pipeline up once everything queued has been written and writes
+// what the socket takes; false when the connection was restarted.
+bool send_requests(BenchWorker& worker, BenchConnection& conn) {
+    BenchRun& run = *worker.run;
+    if (conn.sent == conn.out.size()) {
+        conn.out.clear();
+        conn.sent = 0;
+        const uint64_t now = monotonic_ns();
+        if (conn.in_flight.empty()) conn.deadline_ns = now + static_cast<uint64_t>(run.options.io_timeout_ms) * 1000000;
+        while (conn.in_flight.size() < run.bench.pipeline && accepting(run, now) && claim_request(run)) {
+            conn.out += run.request;
+            conn.in_flight.push_back(now);
+        }
+    }
+    while (conn.sent < conn.out.size()) {
+        const char* data = conn.out.data() + conn.sent;
+        const size_t size = conn.out.size() - conn.sent;
+        if (conn.ssl) {
+            const int written = SSL_write(conn.ssl, data, static_cast<int>(size));
+            if (written > 0) {
+                conn.sent += static_cast<size_t>(written);
+                continue;
+            }
+            const int reason = SSL_get_error(conn.ssl, written);
+            if (reason == SSL_ERROR_WANT_WRITE || reason == SSL_ERROR_WANT_READ) return true;
+        } else {
+            const ssize_t written = send(conn.fd, data, size, MSG_NOSIGNAL);
+            if (written >= 0) {
+                conn.sent += static_cast<size_t>(written);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+        }
+        ++worker.counters.write_errors;
+        restart(worker, conn, false);
+        return false;
+    }
+    return true;
+}
+
+void drive(BenchWorker& worker, BenchConnection& conn, uint32_t events) {
+    BenchRun& run = *worker.run;
+    if (conn.state == BenchState::Connecting) {
+        int socket_error = 0;
+        socklen_t length = sizeof(socket_error);
+        getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &socket_error, &length);
+        if (socket_error == EINPROGRESS || socket_error == EALREADY) return;
+        if (socket_error != 0) {
+            conn.connect_error = std::strerror(socket_error);
+            close_socket(conn);
+            ++conn.next_address;
+            std::string error;
+            if (!start_connect(worker, conn, error)) connect_failed(worker, conn, error);
+            return;
+        }
+        const int one = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        ++worker.counters.connects;
+        events = 0;
+        if (run.url.tls()) {
+            std::string error;
+            conn.ssl = create_tls_session(run.url, run.options, conn.fd, error);
+            if (!conn.ssl) {
+                close_socket(conn);
+                abort_run(run, error);
+                return;
+            }
+            conn.state = BenchState::Handshaking;
+        } else {
+            conn.state = BenchState::Open;
+        }
+    }
+    if (conn.state == BenchState::Handshaking) {
+        const int result = SSL_connect(conn.ssl);
+        if (result != 1) {
+            const int reason = SSL_get_error(conn.ssl, result);
+            if (reason == SSL_ERROR_WANT_READ) return set_interest(worker, conn, EPOLLIN);
+            if (reason == SSL_ERROR_WANT_WRITE) return set_interest(worker, conn, EPOLLOUT);
+            connect_failed(worker, conn, tls_handshake_error(conn.ssl, run.url));
+            return;
+        }
+        conn.state = BenchState::Open;
+        events = 0;
+    }
+    if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && !receive(worker, conn)) return;
+    if (!send_requests(worker, conn)) return;
+    uint32_t interest = EPOLLIN;
+    if (conn.sent < conn.out.size()) interest |= EPOLLOUT;
+    set_interest(worker, conn, interest);
+}
+
+bool worker_idle(const BenchWorker& worker) {
+    for (const auto& conn : worker.connections) {
+        if (!conn->in_flight.empty()) return false;
+    }
+    return true;
+}
+
+void run_worker(BenchWorker& worker) {
+    BenchRun& run = *worker.run;
+    worker.buffer.resize(kBenchReadBytes);
+    worker.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker.epoll_fd < 0) {
+        abort_run(run, std::string("epoll: ") + std::strerror(errno));
+        return;
+    }
+    for (unsigned int i = 0; i < worker.connection_count; ++i) {
+        worker.connections.emplace_back(new BenchConnection());
+        reopen(worker, *worker.connections.back());
+    }
+
+    std::vector<struct epoll_event> events(kBenchMaxEvents);
+    while (true) {
+        uint64_t now = monotonic_ns();
+        if (!accepting(run, now)) break;
+        if (run.bench.requests > 0 && run.claimed.load(std::memory_order_relaxed) >= run.bench.requests && worker_idle(worker)) break;
+        uint64_t wait = kBenchTickNs;
+        if (run.deadline_ns > 0) wait = std::min(wait, run.deadline_ns - now);
+        const int ready = epoll_wait(worker.epoll_fd, events.data(), kBenchMaxEvents, static_cast<int>((wait + 999999) / 1000000));
+        if (ready < 0 && errno != EINTR) {
+            abort_run(run, std::string("epoll: ") + std::strerror(errno));
+            break;
+        }
+        for (int i = 0; i < ready; ++i) {
+            BenchConnection& conn = *static_cast<BenchConnection*>(events[i].data.ptr);
+            if (conn.fd >= 0) drive(worker, conn, events[i].events);
+        }
+        now = monotonic_ns();
+        for (const auto& conn : worker.connections) {
+            if (conn->fd < 0) {
+                reopen(worker, *conn);
+            } else if ((conn->state != BenchState::Open || !conn->in_flight.empty()) && now >= conn->deadline_ns) {
+                ++worker.counters.timeouts;
+                if (conn->state == BenchState::Open) {
+                    restart(worker, *conn, false);
+                } else {
+                    connect_failed(worker, *conn, "connection to " + run.url.host + " timed out");
+                }
+            }
+        }
+    }
+    for (const auto& conn : worker.connections) close_socket(*conn);
+    close(worker.epoll_fd);
+}
+
+}  // namespace
+
+bool run_bench(const Url& url, const RequestOptions& options, const BenchOptions& bench, std::string& error) {
+    BenchRun run;
+    run.url = url;
+    run.options = options;
+    run.bench = bench;
+    run.bench.connections = std::max(1u, bench.connections);
+    run.bench.threads = std::max(1u, std::min(bench.threads, run.bench.connections));
+    run.bench.pipeline = std::max(1u, bench.pipeline);
+    if (run.bench.duration_ms == 0 && run.bench.requests == 0) run.bench.duration_ms = 10000;
+    run.head = options.method == "HEAD";
+    run.request = build_request(url, options, {});
+    dns::ResolverOptions resolver;
+    resolver.cache_file = options.dns_cache;
+    if (!dns::resolve(url.host, url.port, resolver, run.addresses, error)) return false;
+
+    if (run.bench.requests > 0) {
+        std::printf("Running %llu requests", static_cast<unsigned long long>(run.bench.requests));
+        if (run.bench.duration_ms > 0) std::printf(" (at most %.1fs)", static_cast<double>(run.bench.duration_ms) / 1000.0);
+    } else {
+        std::printf("Running %.1fs test", static_cast<double>(run.bench.duration_ms) / 1000.0);
+    }
+    std::printf(" @ %s\n  %u threads and %u connections, %u request%s in flight per connection\n",
+                url_to_string(url).c_str(), run.bench.threads, run.bench.connections, run.bench.pipeline,
+                run.bench.pipeline == 1 ? "" : "s");
+    std::fflush(stdout);
+
+    const uint64_t started = monotonic_ns();
+    if (run.bench.duration_ms > 0) run.deadline_ns = started + run.bench.duration_ms * 1000000;
+    std::vector<std::unique_ptr<BenchWorker>> workers;
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < run.bench.threads; ++i) {
+        workers.emplace_back(new BenchWorker());
+        BenchWorker& worker = *workers.back();
+        worker.run = &run;
+        worker.connection_count = run.bench.connections / run.bench.threads + (i < run.bench.connections % run.bench.threads ? 1 : 0);
+    }
+    for (const auto& worker : workers) {
+        BenchWorker* target = worker.get();
+        threads.emplace_back([target]() { run_worker(*target); });
+    }
+    for (auto& thread : threads) thread.join();
+    const uint64_t elapsed = std::max<uint64_t>(monotonic_ns() - started, 1);
+
+    if (!run.error.empty()) {
+        error = run.error;
+        return false;
+    }
+    LatencyHistogram latency;
+    BenchCounters totals;
+    for (const auto& worker : workers) {
+        merge_histogram(latency, worker->latency);
+        totals.responses += worker->counters.responses;
+        totals.bytes += worker->counters.bytes;
+        totals.non_success += worker->counters.non_success;
+        totals.connects += worker->counters.connects;
+        totals.connect_errors += worker->counters.connect_errors;
+        totals.read_errors += worker->counters.read_errors;
+        totals.write_errors += worker->counters.write_errors;
+        totals.timeouts += worker->counters.timeouts;
+    }
+
+    const double seconds = static_cast<double>(elapsed) / 1e9;
+    const double mean = latency.total ? static_cast<double>(latency.sum) / static_cast<double>(latency.total) : 0;
+    std::printf("  Latency    avg %s, stdev %s, max %s\n", format_latency(mean).c_str(),
+                format_latency(latency_stdev(latency)).c_str(), format_latency(static_cast<double>(latency.max)).c_str());
+    std::printf("  Latency distribution\n");
+    const double percentiles[] = {50, 75, 90, 99, 99.9, 99.99};
+    for (const double percentile : percentiles) {
+        std::printf("    %7.3f%%  %s\n", percentile, format_latency(static_cast<double>(latency_percentile(latency, percentile))).c_str());
+    }
+    std::printf("  %llu requests in %.2fs, %s read over %llu connections\n", static_cast<unsigned long long>(totals.responses),
+                seconds, format_size(totals.bytes).c_str(), static_cast<unsigned long long>(totals.connects));
+    if (totals.connect_errors || totals.read_errors || totals.write_errors || totals.timeouts) {
+        std::printf("  Socket errors: connect %llu, read %llu, write %llu, timeout %llu\n",
+                    static_cast<unsigned long long>(totals.connect_errors), static_cast<unsigned long long>(totals.read_errors),
+                    static_cast<unsigned long long>(totals.write_errors), static_cast<unsigned long long>(totals.timeouts));
+    }
+    if (totals.non_success) {
+        std::printf("  Non-2xx or 3xx responses: %llu\n", static_cast<unsigned long long>(totals.non_success));
+    }
+    std::printf("Requests/sec: %.2f\n", static_cast<double>(totals.responses) / seconds);
+    std::printf("Transfer/sec: %s\n", format_size(static_cast<uint64_t>(static_cast<double>(totals.bytes) / seconds)).c_str());
+    std::fflush(stdout);
+    if (g_stop_sig) {
+        error = "interrupted";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace greq
@@ -0,0 +1,436 @@
+#include "greq_common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <linux/fs.h>
+#include <map>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace greq {
+
+namespace {
+
+const int kCacheVersion = 1;
+// Temporary bodies this old belong to a greq that died mid-download.
+const time_t kStaleTempSeconds = 3600;
+
+// One cached URL. Entries live in index/<sha256 of the URL> and point at a
+// body in objects/, named after the body's own SHA-256 so identical
+// downloads from different URLs share one copy. The entry's mtime is its
+// last use, which is what eviction orders by.
+struct CacheEntry {
+    std::string key;
+    std::string url;
+    std::string etag;
+    std::string last_modified;
+    std::string object;
+    uint64_t size = 0;
+    struct timespec used = {};
+};
+
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t served = 0;
+};
+
+// Exclusive lock over the index, the objects and the stats of one cache
+// directory. Transfers themselves run unlocked.
+struct CacheLock {
+    int fd = -1;
+
+    explicit CacheLock(const std::string& directory) {
+        fd = open((directory + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        while (fd >= 0 && flock(fd, LOCK_EX) != 0 && errno == EINTR) {}
+    }
+    ~CacheLock() {
+        if (fd >= 0) close(fd);
+    }
+    CacheLock(const CacheLock&) = delete;
+    CacheLock& operator=(const CacheLock&) = delete;
+};
+
+std::string sha256_of(const std::string& text) {
+    StreamDigest digest;
+    update_digest(digest, text.data(), text.size());
+    return sha256_hex(digest);
+}
+
+std::string index_path(const CacheOptions& cache, const std::string& key) {
+    return cache.directory + "/index/" + key;
+}
+
+std::string object_path(const CacheOptions& cache, const std::string& object) {
+    return cache.directory + "/objects/" + object.substr(0, 2) + "/" + object;
+}
+
+bool make_directory(const std::string& path, std::string& error) {
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        const std::string prefix = path.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+            error = prefix + ": " + std::strerror(errno);
+            return false;
+        }
+        if (slash == std::string::npos) return true;
+    }
+}
+
+bool read_entry(const std::string& path, CacheEntry& entry) {
+    std::ifstream in(path);
+    std::string line;
+    int version = 0;
+    while (std::getline(in, line)) {
+        const size_t equals = line.find('=');
+        if (equals == std::string::npos) continue;
+        const std::string key = line.substr(0, equals);
+        const std::string value = line.substr(equals + 1);
+        if (key == "VERSION") version = std::atoi(value.c_str());
+        else if (key == "URL") entry.url = value;
+        else if (key == "ETAG") entry.etag = value;
+        else if (key == "LAST_MODIFIED") entry.last_modified = value;
+        else if (key == "OBJECT") entry.object = value;
+        else if (key == "SIZE") entry.size = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    struct stat info = {};
+    if (stat(path.c_str(), &info) == 0) entry.used = info.st_mtim;
+    return version == kCacheVersion && entry.object.size() == 64;
+}
+
+bool write_entry(const CacheOptions& cache, const CacheEntry& entry, std::string& error) {
+    std::string contents = "VERSION=" + std::to_string(kCacheVersion) + "\n";
+    contents += "URL=" + entry.url + "\n";
+    contents += "ETAG=" + entry.etag + "\n";
+    contents += "LAST_MODIFIED=" + entry.last_modified + "\n";
+    contents += "OBJECT=" + entry.object + "\n";
+    contents += "SIZE=" + std::to_string(entry.size) + "\n";
+
+    const std::string path = index_path(cache, entry.key);
+    const std::string temp_path = path + ".tmp";
+    const int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && write_all_fd(fd, contents.data(), contents.size());
+    if (fd >= 0 && close(fd) != 0) ok = false;
+    if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+        error = path + ": " + std::strerror(errno);
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+CacheStats read_stats(const CacheOptions& cache) {
+    CacheStats stats;
+    std::ifstream in(cache.directory + "/stats");
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t equals = line.find('=');
+        if (equals == std::string::npos) continue;
+        const uint64_t value = std::strtoull(line.c_str() + equals + 1, nullptr, 10);
+        const std::string key = line.substr(0, equals);
+        if (key == "HITS") stats.hits = value;
+        else if (key == "MISSES") stats.misses = value;
+        else if (key == "SERVED") stats.served = value;
+    }
+    return stats;
+}
+
+void write_stats(const CacheOptions& cache, const CacheStats& stats) {
+    std::ofstream out(cache.directory + "/stats", std::ios::trunc);
+    out << "HITS=" << stats.hits << "\nMISSES=" << stats.misses << "\nSERVED=" << stats.served << "\n";
+}
+
+bool older(const CacheEntry& a, const CacheEntry& b) {
+    return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+}
+
+// Drops least recently used entries until the distinct bodies fit in the
+// limit, along with any body no remaining entry points at. Must run under
+// the cache lock; returns the entry count and bytes left.
+void evict(const CacheOptions& cache, const RequestOptions& options, size_t& entries, uint64_t& used) {
+    std::vector<CacheEntry> index;
+    DIR* dir = opendir((cache.directory + "/index").c_str());
+    while (dir) {
+        const struct dirent* item = readdir(dir);
+        if (!item) break;
+        const std::string name = item->d_name;
+        if (name.size() != 64) continue;
+        CacheEntry entry;
+        entry.key = name;
+        if (!read_entry(index_path(cache, name), entry)) {
+            unlink(index_path(cache, name).c_str());
+            continue;
+        }
+        index.push_back(entry);
+    }
+    if (dir) closedir(dir);
+
+    std::map<std::string, unsigned int> references;
+    used = 0;
+    for (auto it = index.begin(); it != index.end();) {
+        struct stat info = {};
+        if (stat(object_path(cache, it->object).c_str(), &info) != 0) {
+            unlink(index_path(cache, it->key).c_str());
+            it = index.erase(it);
+            continue;
+        }
+        if (references[it->object]++ == 0) used += static_cast<uint64_t>(info.st_size);
+        ++it;
+    }
+
+    std::sort(index.begin(), index.end(), older);
+    size_t evicted = 0;
+    uint64_t freed = 0;
+    for (const auto& entry : index) {
+        if (used <= cache.max_bytes) break;
+        unlink(index_path(cache, entry.key).c_str());
+        ++evicted;
+        if (--references[entry.object] == 0) {
+            unlink(object_path(cache, entry.object).c_str());
+            used -= std::min(used, entry.size);
+            freed += entry.size;
+        }
+    }
+    entries = index.size() - evicted;
+    if (evicted > 0) {
+        verbose_line(options, "Cache: evicted " + std::to_string(evicted) + " least recently used entries (" + format_size(freed) + ")");
+    }
+
+    dir = opendir((cache.directory + "/tmp").c_str());
+    const time_t now = time(nullptr);
+    while (dir) {
+        const struct dirent* item = readdir(dir);
+        if (!item) break;
+        const std::string path = cache.directory + "/tmp/" + item->d_name;
+        struct stat info = {};
+        if (item->d_name[0] != '.' && stat(path.c_str(), &info) == 0 && now - info.st_mtime > kStaleTempSeconds) unlink(path.c_str());
+    }
+    if (dir) closedir(dir);
+}
+
+// Copies a whole cached body into the output: a reflink where the
+// filesystem shares extents, else copy_file_range, else sendfile (which
+// also handles a pipe on stdout), else plain reads and writes.
+bool copy_body(int in, int out, uint64_t size, std::string& method, std::string& error) {
+    struct stat info = {};
+    if (fstat(out, &info) == 0 && S_ISREG(info.st_mode) && ioctl(out, FICLONE, in) == 0) {
+        method = "reflink";
+        return true;
+    }
+    off_t offset = 0;
+    method = "copy_file_range";
+    while (static_cast<uint64_t>(offset) < size) {
+        const ssize_t copied = copy_file_range(in, &offset, out, nullptr, size - static_cast<uint64_t>(offset), 0);
+        if (copied > 0) continue;
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied == 0 || offset > 0 || (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)) {
+            error = copied == 0 ? "cached body is shorter than its entry" : std::strerror(errno);
+            return false;
+        }
+        break;
+    }
+    if (static_cast<uint64_t>(offset) == size) return true;
+
+    method = "sendfile";
+    while (static_cast<uint64_t>(offset) < size) {
+        const ssize_t copied = sendfile(out, in, &offset, static_cast<size_t>(size - static_cast<uint64_t>(offset)));
+        if (copied > 0) continue;
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied == 0 || offset > 0 || errno != EINVAL) {
+            error = copied == 0 ? "cached body is shorter than its entry" : std::strerror(errno);
+            return false;
+        }
+        break;
+    }
+    if (static_cast<uint64_t>(offset) == size) return true;
+
+    method = "read/write";
+    std::vector<char> buffer(256 * 1024);
+    while (static_cast<uint64_t>(offset) < size) {
+        const ssize_t got = pread(in, buffer.data(), buffer.size(), offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0 || !write_all_fd(out, buffer.data(), static_cast<size_t>(got))) {
+            error = got == 0 ? "cached body is shorter than its entry" : std::strerror(errno);
+            return false;
+        }
+        offset += got;
+    }
+    return true;
+}
+
+bool hash_file(int fd, StreamDigest& digest, std::string& error) {
+    std::vector<char> buffer(1024 * 1024);
+    off_t offset = 0;
+    while (true) {
+        const ssize_t got = pread(fd, buffer.data(), buffer.size(), offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            error = std::strerror(errno);
+            return false;
+        }
+        if (got == 0) return true;
+        update_digest(digest, buffer.data(), static_cast<size_t>(got));
+        offset += got;
+    }
+}
+
+}  // namespace
+
+bool cached_fetch(
+    const Url& url,
+    const RequestOptions& options,
+    const CacheOptions& cache,
+    const DigestCheck& digests,
+    const std::string& output_path,
+    std::string& error
+) {
+    if (!make_directory(cache.directory + "/index", error) || !make_directory(cache.directory + "/objects", error) ||
+        !make_directory(cache.directory + "/tmp", error)) {
+        return false;
+    }
+    const std::string url_text = url_to_string(url);
+    CacheEntry cached;
+    cached.key = sha256_of(url_text);
+    // Open the body before asking the server, so a concurrent eviction
+    // cannot take it away between a 304 and the copy.
+    int cached_fd = -1;
+    if (read_entry(index_path(cache, cached.key), cached) && cached.url == url_text) {
+        cached_fd = open(object_path(cache, cached.object).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    std::vector<std::string> headers;
+    if (cached_fd >= 0) {
+        if (!cached.etag.empty()) headers.push_back("If-None-Match: " + cached.etag);
+        if (!cached.last_modified.empty()) headers.push_back("If-Modified-Since: " + cached.last_modified);
+    }
+
+    const std::string temp_path = cache.directory + "/tmp/" + std::to_string(getpid()) + "-" + cached.key;
+    StreamDigest digest;
+    digest.use_blake3 = digests.print || !digests.blake3.empty();
+    CacheEntry fresh;
+    fresh.key = cached.key;
+    fresh.url = url_text;
+    int temp_fd = -1;
+    bool not_modified = false;
+    std::string uncacheable;
+    std::string failure;
+    ResponseHandler handler;
+    handler.on_head = [&](const HttpResponse& head) {
+        if (head.status == 304 && cached_fd >= 0) {
+            not_modified = true;
+            return true;
+        }
+        if (head.status >= 300) {
+            failure = "server returned HTTP " + std::to_string(head.status);
+            return false;
+        }
+        temp_fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (temp_fd < 0) {
+            failure = temp_path + ": " + std::strerror(errno);
+            return false;
+        }
+        fresh.etag = head.header("ETag");
+        fresh.last_modified = head.header("Last-Modified");
+        if (head.status != 200) uncacheable = "HTTP " + std::to_string(head.status);
+        else if (to_lower(head.header("Cache-Control")).find("no-store") != std::string::npos) uncacheable = "no-store";
+        else if (fresh.etag.empty() && fresh.last_modified.empty()) uncacheable = "no validator";
+        return true;
+    };
+    handler.on_body = [&](const char* data, size_t size) {
+        if (!write_all_fd(temp_fd, data, size)) {
+            failure = std::string("write failed: ") + std::strerror(errno);
+            return false;
+        }
+        update_digest(digest, data, size);
+        fresh.size += size;
+        return true;
+    };
+
+    Url current = url;
+    HttpConnection conn;
+    HttpResponse response;
+    bool ok = fetch_url(conn, current, options, headers, response, handler, error);
+    close_connection(conn);
+    if (ok && !failure.empty()) {
+        error = failure;
+        ok = false;
+    }
+
+    const int body_fd = not_modified ? cached_fd : temp_fd;
+    const uint64_t body_size = not_modified ? cached.size : fresh.size;
+    std::string hash_error;
+    if (ok && not_modified && digests.active() && !hash_file(cached_fd, digest, hash_error)) {
+        error = "cannot read cached body: " + hash_error;
+        ok = false;
+    }
+    // A body that fails its expected digest never reaches the output.
+    const std::string name = output_path.empty() ? "-" : output_path;
+    if (ok && digests.active() && !check_digests(digest, digests, name, output_path.empty() ? std::cerr : std::cout, error)) {
+        ok = false;
+    }
+
+    std::string method;
+    if (ok) {
+        const int out = output_path.empty() ? STDOUT_FILENO
+                                            : open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            error = output_path + ": " + std::strerror(errno);
+            ok = false;
+        } else {
+            std::string copy_error;
+            if (!copy_body(body_fd, out, body_size, method, copy_error)) {
+                error = name + ": " + copy_error;
+                ok = false;
+            }
+            if (out != STDOUT_FILENO && close(out) != 0 && ok) {
+                error = output_path + ": " + std::strerror(errno);
+                ok = false;
+            }
+            if (!ok && out != STDOUT_FILENO) remove_output(output_path);
+        }
+    }
+    if (cached_fd >= 0) close(cached_fd);
+    if (temp_fd >= 0) close(temp_fd);
+
+    CacheLock lock(cache.directory);
+    CacheStats stats = read_stats(cache);
+    if (ok && not_modified) {
+        ++stats.hits;
+        stats.served += body_size;
+        utimensat(AT_FDCWD, index_path(cache, cached.key).c_str(), nullptr, 0);
+        verbose_line(options, "Cache hit: " + url_text + " not modified, served " + format_size(body_size) + " via " + method);
+    } else if (ok) {
+        ++stats.misses;
+        if (uncacheable.empty() && fresh.size > cache.max_bytes) uncacheable = "larger than the cache";
+        fresh.object = sha256_hex(digest);
+        const std::string object = object_path(cache, fresh.object);
+        std::string store_error;
+        if (uncacheable.empty() && (!make_directory(object.substr(0, object.rfind('/')), store_error) ||
+                                    rename(temp_path.c_str(), object.c_str()) != 0 || !write_entry(cache, fresh, store_error))) {
+            uncacheable = store_error.empty() ? std::strerror(errno) : store_error;
+        }
+        verbose_line(options, "Cache miss: " + url_text + ", " +
+                                  (uncacheable.empty() ? "stored " + format_size(fresh.size) + " as " + fresh.object.substr(0, 12)
+                                                       : "not stored (" + uncacheable + ")"));
+    }
+    unlink(temp_path.c_str());
+    if (ok) write_stats(cache, stats);
+
+    size_t entries = 0;
+    uint64_t used = 0;
+    evict(cache, options, entries, used);
+    verbose_line(options, "Cache: " + std::to_string(stats.hits) + " hits, " + std::to_string(stats.misses) + " misses, " +
+                              format_size(stats.served) + " served from cache; " + std::to_string(entries) + " entries in " +
+                              format_size(used) + " of " + format_size(cache.max_bytes));
+    return ok;
+}
+
+}  // namespace greq
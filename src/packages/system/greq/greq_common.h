@@ -0,0 +1,402 @@
+#ifndef GEMINIOS_GREQ_COMMON_H
+#define GEMINIOS_GREQ_COMMON_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <functional>
+#include <iosfwd>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef struct ssl_st SSL;
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+
+namespace greq {
+
+struct Url {
+    std::string scheme;
+    std::string host;
+    int port = 0;
+    std::string target;
+
+    bool tls() const { return scheme == "https"; }
+};
+
+// CLOCK_MONOTONIC stage marks of one transfer, in nanoseconds after
+// `start`. After redirects they describe the last request; `redirect` is
+// when it began.
+struct TransferTiming {
+    uint64_t start = 0;
+    uint64_t namelookup = 0;
+    uint64_t connect = 0;
+    uint64_t appconnect = 0;
+    uint64_t pretransfer = 0;
+    uint64_t starttransfer = 0;
+    uint64_t redirect = 0;
+    uint64_t total = 0;
+    int http_code = 0;
+    unsigned int redirects = 0;
+    uint64_t size_download = 0;
+    std::string url_effective;
+
+    uint64_t elapsed() const;
+};
+
+// One piece of a streamed request body: literal bytes, or a file read from
+// disk while the request goes out ("-" is stdin). `size` is the file's
+// length once prepare_upload has looked, or -1 for pipes and the like.
+struct UploadPart {
+    std::string data;
+    std::string path;
+    int64_t size = -1;
+};
+
+// A request body sent from its parts instead of RequestOptions::data, so
+// files never sit in memory. `length` is -1 when some part has no known
+// size, and the body then goes out with chunked transfer encoding.
+struct UploadBody {
+    std::vector<UploadPart> parts;
+    std::string content_type;
+    int64_t length = -1;
+
+    bool active() const { return !parts.empty(); }
+};
+
+// greq's own HTTP/1.1 client options. Invocations that need none of the
+// features built on this client still go through libgemcore's HttpRequest.
+struct RequestOptions {
+    std::string method = "GET";
+    std::vector<std::string> headers;
+    std::string data;
+    UploadBody upload;
+    std::string auth;
+    std::string user_agent;
+    bool insecure = false;
+    bool verbose = false;
+    bool follow_location = false;
+    // Ask for zstd, gzip or deflate and decode the body as it arrives.
+    bool compressed = false;
+    // Let handlers splice bodies into files, and offer kTLS on HTTPS
+    // connections so that works past the handshake too.
+    bool zero_copy = false;
+    // Stage marks are recorded here when set; only for one transfer at a time.
+    TransferTiming* timing = nullptr;
+    // Resolver cache file kept between runs; see resolver.h.
+    std::string dns_cache;
+    int max_redirects = 20;
+    int connect_timeout_ms = 30000;
+    int io_timeout_ms = 60000;
+};
+
+struct HttpConnection {
+    int fd = -1;
+    SSL* ssl = nullptr;
+    std::string scheme;
+    std::string host;
+    int port = 0;
+    // Bytes read past the end of the last response.
+    std::string leftover;
+    bool reusable = false;
+    unsigned int requests = 0;
+    // The kernel decrypts this TLS connection, so its socket reads and
+    // splices yield plaintext.
+    bool ktls_recv = false;
+};
+
+struct HttpResponse {
+    std::string version;
+    int status = 0;
+    std::string reason;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string raw_head;
+    int64_t content_length = -1;
+    bool chunked = false;
+    bool keep_alive = false;
+    // False when the body handler stopped reading before the end.
+    bool complete = false;
+    uint64_t body_bytes = 0;
+
+    std::string header(const std::string& name) const;
+};
+
+typedef std::function<bool(const char* data, size_t size)> BodySink;
+
+// on_head sees every final (non-1xx) response head before its body; either
+// callback returning false stops the transfer and closes the connection.
+//
+// A body of known length on a plain or kTLS socket may skip user space:
+// when splice_target names a file and offset, the rest of the body is
+// spliced there through a pipe and on_spliced sees each piece's length.
+// Bytes already read, and everything after a splice error, still go
+// through on_body.
+struct ResponseHandler {
+    std::function<bool(const HttpResponse& response)> on_head;
+    BodySink on_body;
+    std::function<bool(int& fd, uint64_t& offset)> splice_target;
+    std::function<bool(uint64_t size)> on_spliced;
+};
+
+// Streaming Content-Encoding decoder: compressed body chunks go in, and the
+// sink sees the decoded bytes through one fixed-size buffer.
+struct ContentDecoder {
+    std::string encoding;
+    BodySink sink;
+    struct z_stream_s* zlib = nullptr;
+    struct ZSTD_DCtx_s* zstd = nullptr;
+    std::vector<char> buffer;
+    bool finished = false;
+    bool raw_deflate = false;
+    bool stopped = false;
+    uint64_t encoded_bytes = 0;
+    uint64_t decoded_bytes = 0;
+    uint64_t decode_ns = 0;
+    std::string error;
+
+    ContentDecoder() = default;
+    ~ContentDecoder();
+    ContentDecoder(const ContentDecoder&) = delete;
+    ContentDecoder& operator=(const ContentDecoder&) = delete;
+};
+
+// Incremental BLAKE3 state: the chunk being absorbed and a stack of the
+// chaining values of completed subtrees.
+struct Blake3Hasher {
+    uint32_t chunk_cv[8];
+    uint64_t chunk_counter = 0;
+    uint8_t block[64];
+    uint32_t block_length = 0;
+    uint32_t blocks_compressed = 0;
+    uint32_t cv_stack[54][8];
+    size_t stack_length = 0;
+};
+
+// SHA-256 of a byte stream, plus BLAKE3 when use_blake3 is set. Both are
+// fed as the data is written, so checking a download never reads it back.
+struct StreamDigest {
+    EVP_MD_CTX* sha256 = nullptr;
+    bool use_blake3 = false;
+    Blake3Hasher blake3;
+
+    StreamDigest();
+    ~StreamDigest();
+    StreamDigest(const StreamDigest&) = delete;
+    StreamDigest& operator=(const StreamDigest&) = delete;
+};
+
+// Expected digests (lowercase or uppercase hex, empty when not checked) and
+// whether to print the computed ones.
+struct DigestCheck {
+    std::string sha256;
+    std::string blake3;
+    bool print = false;
+
+    bool active() const { return print || !sha256.empty() || !blake3.empty(); }
+};
+
+// Forwards everything written to it to another stream buffer and hashes
+// whatever that buffer accepted.
+class DigestStreambuf : public std::streambuf {
+public:
+    DigestStreambuf(std::streambuf* target, StreamDigest& digest);
+
+protected:
+    std::streamsize xsputn(const char* data, std::streamsize size) override;
+    int_type overflow(int_type c) override;
+    int sync() override;
+
+private:
+    std::streambuf* target_;
+    StreamDigest& digest_;
+};
+
+// Incremental HTTP/1.1 response parser. feed() consumes at most one
+// response and returns how many bytes it used, so pipelined responses can
+// be parsed back to back from the same buffer.
+struct ResponseParser {
+    enum class State { Head, Body, ChunkSize, ChunkData, ChunkEnd, Trailers, Done };
+
+    State state = State::Head;
+    bool no_body = false;
+    HttpResponse response;
+    uint64_t remaining = 0;
+    std::string line;
+    bool stopped = false;
+
+    void reset(bool head_request);
+    size_t feed(const char* data, size_t size, const ResponseHandler& handler, std::string& error);
+    bool finish_at_eof(std::string& error);
+    bool done() const { return state == State::Done; }
+};
+
+std::string to_lower(std::string value);
+std::string trim(const std::string& value);
+bool parse_url(const std::string& text, Url& url, std::string& error);
+bool resolve_location(const Url& base, const std::string& location, Url& url, std::string& error);
+std::string url_to_string(const Url& url);
+std::string remote_file_name(const Url& url);
+std::string base64_encode(const std::string& value);
+void verbose_line(const RequestOptions& options, const std::string& message);
+std::string format_size(uint64_t bytes);
+bool parse_size(const std::string& text, uint64_t& bytes);
+// "500ms", "30s" (also a bare number), "5m" or "1h".
+bool parse_duration(const std::string& text, uint64_t& ms);
+uint64_t monotonic_ms();
+uint64_t monotonic_ns();
+
+bool is_redirect(int status);
+bool same_origin(const Url& a, const Url& b);
+// Clears the user's auth and Authorization/Cookie headers, which are not
+// sent on once a redirect leaves the origin they were given for.
+void drop_credentials(RequestOptions& options);
+SSL* create_tls_session(const Url& url, const RequestOptions& options, int fd, std::string& error);
+std::string tls_handshake_error(SSL* ssl, const Url& url);
+bool open_connection(const Url& url, const RequestOptions& options, HttpConnection& conn, std::string& error);
+void close_connection(HttpConnection& conn);
+ssize_t connection_read(HttpConnection& conn, char* buffer, size_t size);
+bool connection_write(HttpConnection& conn, const char* data, size_t size);
+std::string build_request(const Url& url, const RequestOptions& options, const std::vector<std::string>& extra_headers);
+bool perform_request(
+    HttpConnection& conn,
+    const Url& url,
+    const RequestOptions& options,
+    const std::vector<std::string>& extra_headers,
+    HttpResponse& response,
+    const ResponseHandler& handler,
+    std::string& error
+);
+// -F fields in curl syntax (name=value, name=@file and name=<file, with
+// ;type= and ;filename= after a file) as a multipart/form-data body.
+bool build_form_body(const std::vector<std::string>& fields, UploadBody& body, std::string& error);
+bool prepare_upload(UploadBody& body, std::string& error);
+// False when part of the body comes from stdin or a pipe and so can only
+// be sent once.
+bool upload_replayable(const UploadBody& body);
+bool send_upload(HttpConnection& conn, const UploadBody& body, const RequestOptions& options, std::string& error);
+bool fetch_url(
+    HttpConnection& conn,
+    Url& url,
+    const RequestOptions& options,
+    const std::vector<std::string>& extra_headers,
+    HttpResponse& response,
+    const ResponseHandler& handler,
+    std::string& error
+);
+
+struct DownloadOptions {
+    unsigned int connections = 1;
+    // Keep the partial file and a resume record when the transfer fails,
+    // and continue after the verified prefix an earlier run left behind.
+    bool resume = false;
+    // Checked against the finished file, which is removed on a mismatch.
+    DigestCheck digests;
+};
+
+// What a kept partial download is known to hold: the first `verified`
+// bytes, whose digest is accumulated in `digest` as data arrives, and the
+// validator and length of the remote file they came from.
+struct ResumeState {
+    std::string path;
+    std::string validator;
+    uint64_t total = 0;
+    uint64_t verified = 0;
+    // Set when there was no record and `verified` is just the file size.
+    bool unrecorded = false;
+    StreamDigest digest;
+};
+
+std::string format_write_out(const std::string& format, const TransferTiming& timing);
+std::string timing_json(const TransferTiming& timing);
+
+bool begin_decoding(ContentDecoder& decoder, const std::string& encoding, const BodySink& sink, std::string& error);
+bool decode_chunk(ContentDecoder& decoder, const char* data, size_t size);
+bool finish_decoding(ContentDecoder& decoder, const RequestOptions& options, std::string& error);
+
+void blake3_init(Blake3Hasher& hasher);
+void blake3_update(Blake3Hasher& hasher, const char* data, size_t size);
+std::string blake3_hex(const Blake3Hasher& hasher);
+void reset_digest(StreamDigest& digest);
+void update_digest(StreamDigest& digest, const char* data, size_t size);
+std::string sha256_hex(const StreamDigest& digest);
+bool check_digests(
+    const StreamDigest& digest,
+    const DigestCheck& check,
+    const std::string& name,
+    std::ostream& out,
+    std::string& error
+);
+
+void remove_output(const std::string& path);
+bool write_all_fd(int fd, const char* data, size_t size);
+bool pwrite_all_fd(int fd, const char* data, size_t size, uint64_t offset);
+bool load_resume_state(const std::string& output_path, const RequestOptions& options, ResumeState& state, std::string& error);
+bool save_resume_state(const ResumeState& state, const std::string& url, std::string& error);
+void reset_resume_state(ResumeState& state);
+bool extend_resume_digest(ResumeState& state, int fd, uint64_t end, std::string& error);
+void discard_resume_state(const ResumeState& state);
+// One line of a batch list: a URL and, optionally, where to save it.
+struct BatchItem {
+    std::string url;
+    std::string output_path;
+};
+
+bool read_batch_list(const std::string& path, std::vector<BatchItem>& items, std::string& error);
+bool run_batch(
+    const std::vector<BatchItem>& items,
+    const RequestOptions& options,
+    unsigned int concurrency,
+    unsigned int& failed,
+    std::string& error
+);
+// `greq bench`: keep `connections` keep-alive connections busy with
+// `pipeline` requests in flight on each, spread over `threads` epoll loops,
+// until `duration_ms` passes or `requests` responses arrive (0 = no limit).
+struct BenchOptions {
+    unsigned int connections = 10;
+    unsigned int threads = 2;
+    unsigned int pipeline = 1;
+    uint64_t duration_ms = 0;
+    uint64_t requests = 0;
+};
+
+bool run_bench(const Url& url, const RequestOptions& options, const BenchOptions& bench, std::string& error);
+// Opt-in cache of plain GET downloads, revalidated with the stored ETag
+// and Last-Modified on every use.
+struct CacheOptions {
+    std::string directory;
+    uint64_t max_bytes = 1024ull * 1024 * 1024;
+};
+
+bool cached_fetch(
+    const Url& url,
+    const RequestOptions& options,
+    const CacheOptions& cache,
+    const DigestCheck& digests,
+    const std::string& output_path,
+    std::string& error
+);
+bool fetch_to_stream(const Url& url, const RequestOptions& options, std::ostream& out, bool include_headers, std::string& error);
+bool download_to_file(
+    const Url& url,
+    const RequestOptions& options,
+    const DownloadOptions& download,
+    const std::string& output_path,
+    std::string& error
+);
+// Downloads the URL to output_path a few times with and without the
+// zero-copy path and prints the throughput and CPU time of each.
+bool benchmark_zero_copy(
+    const Url& url,
+    const RequestOptions& options,
+    const DownloadOptions& download,
+    const std::string& output_path,
+    std::string& error
+);
+
+}  // namespace greq
+
+#endif
@@ -0,0 +1,165 @@
+#include "greq_common.h"
+
+#include <chrono>
+#include <cstdio>
+#include <zlib.h>
+#include <zstd.h>
+
+namespace greq {
+
+namespace {
+
+const size_t kDecodeBufferBytes = 64 * 1024;
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count()
+    );
+}
+
+void release_decoder(ContentDecoder& decoder) {
+    if (decoder.zlib) {
+        inflateEnd(decoder.zlib);
+        delete decoder.zlib;
+        decoder.zlib = nullptr;
+    }
+    if (decoder.zstd) {
+        ZSTD_freeDStream(decoder.zstd);
+        decoder.zstd = nullptr;
+    }
+}
+
+bool init_zlib(ContentDecoder& decoder, int window_bits) {
+    if (decoder.zlib) {
+        inflateEnd(decoder.zlib);
+        delete decoder.zlib;
+    }
+    decoder.zlib = new z_stream();
+    return inflateInit2(decoder.zlib, window_bits) == Z_OK;
+}
+
+bool deliver(ContentDecoder& decoder, size_t size) {
+    decoder.decoded_bytes += size;
+    if (size == 0 || decoder.sink(decoder.buffer.data(), size)) return true;
+    decoder.stopped = true;
+    return false;
+}
+
+bool inflate_chunk(ContentDecoder& decoder, const char* data, size_t size) {
+    z_stream& stream = *decoder.zlib;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    while (true) {
+        stream.next_out = reinterpret_cast<Bytef*>(decoder.buffer.data());
+        stream.avail_out = static_cast<uInt>(decoder.buffer.size());
+        const auto started = std::chrono::steady_clock::now();
+        const int result = inflate(&stream, Z_NO_FLUSH);
+        decoder.decode_ns += elapsed_ns(started);
+
+        // Some servers label raw DEFLATE data as zlib-wrapped "deflate".
+        if (result == Z_DATA_ERROR && decoder.encoding == "deflate" && !decoder.raw_deflate && decoder.encoded_bytes == size) {
+            decoder.raw_deflate = true;
+            if (!init_zlib(decoder, -MAX_WBITS)) break;
+            return inflate_chunk(decoder, data, size);
+        }
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+            decoder.error = "corrupt " + decoder.encoding + " body" + (stream.msg ? std::string(": ") + stream.msg : "");
+            return false;
+        }
+        if (!deliver(decoder, decoder.buffer.size() - stream.avail_out)) return false;
+        if (result == Z_STREAM_END) {
+            decoder.finished = true;
+            // Concatenated gzip members decode as one body.
+            if (stream.avail_in == 0) return true;
+            inflateReset(&stream);
+            decoder.finished = false;
+            continue;
+        }
+        if (stream.avail_in == 0 && stream.avail_out != 0) return true;
+        if (result == Z_BUF_ERROR && stream.avail_out != 0) return true;
+    }
+    decoder.error = "cannot initialise " + decoder.encoding + " decoder";
+    return false;
+}
+
+bool zstd_chunk(ContentDecoder& decoder, const char* data, size_t size) {
+    ZSTD_inBuffer input = {data, size, 0};
+    while (true) {
+        ZSTD_outBuffer output = {decoder.buffer.data(), decoder.buffer.size(), 0};
+        const auto started = std::chrono::steady_clock::now();
+        const size_t result = ZSTD_decompressStream(decoder.zstd, &output, &input);
+        decoder.decode_ns += elapsed_ns(started);
+        if (ZSTD_isError(result)) {
+            decoder.error = std::string("corrupt zstd body: ") + ZSTD_getErrorName(result);
+            return false;
+        }
+        decoder.finished = result == 0;
+        if (!deliver(decoder, output.pos)) return false;
+        if (input.pos == input.size && output.pos < output.size) return true;
+    }
+}
+
+}  // namespace
+
+ContentDecoder::~ContentDecoder() {
+    release_decoder(*this);
+}
+
+bool begin_decoding(ContentDecoder& decoder, const std::string& encoding, const BodySink& sink, std::string& error) {
+    release_decoder(decoder);
+    decoder.encoding = to_lower(trim(encoding));
+    decoder.sink = sink;
+    decoder.finished = false;
+    decoder.raw_deflate = false;
+    decoder.stopped = false;
+    decoder.encoded_bytes = 0;
+    decoder.decoded_bytes = 0;
+    decoder.decode_ns = 0;
+    decoder.error.clear();
+    if (decoder.encoding == "x-gzip") decoder.encoding = "gzip";
+
+    if (decoder.encoding.empty() || decoder.encoding == "identity") {
+        decoder.encoding.clear();
+        return true;
+    }
+    decoder.buffer.resize(kDecodeBufferBytes);
+    if (decoder.encoding == "gzip" || decoder.encoding == "deflate") {
+        if (init_zlib(decoder, decoder.encoding == "gzip" ? MAX_WBITS + 16 : MAX_WBITS)) return true;
+    } else if (decoder.encoding == "zstd") {
+        decoder.zstd = ZSTD_createDStream();
+        if (decoder.zstd && !ZSTD_isError(ZSTD_initDStream(decoder.zstd))) return true;
+    } else {
+        error = "unsupported Content-Encoding '" + encoding + "'";
+        return false;
+    }
+    error = "cannot initialise " + decoder.encoding + " decoder";
+    return false;
+}
+
+bool decode_chunk(ContentDecoder& decoder, const char* data, size_t size) {
+    decoder.encoded_bytes += size;
+    if (decoder.encoding.empty()) {
+        decoder.decoded_bytes += size;
+        if (decoder.sink(data, size)) return true;
+        decoder.stopped = true;
+        return false;
+    }
+    return decoder.zstd ? zstd_chunk(decoder, data, size) : inflate_chunk(decoder, data, size);
+}
+
+bool finish_decoding(ContentDecoder& decoder, const RequestOptions& options, std::string& error) {
+    if (decoder.encoding.empty()) return true;
+    if (!decoder.finished) {
+        error = "truncated " + decoder.encoding + " body";
+        return false;
+    }
+    char ratio[32];
+    std::snprintf(ratio, sizeof(ratio), "%.1fx", decoder.encoded_bytes == 0 ? 0.0
+                  : static_cast<double>(decoder.decoded_bytes) / static_cast<double>(decoder.encoded_bytes));
+    verbose_line(options, "Content-Encoding " + decoder.encoding + ": " + format_size(decoder.encoded_bytes) + " -> " +
+                              format_size(decoder.decoded_bytes) + " (" + ratio + "), decoded in " +
+                              std::to_string(decoder.decode_ns / 1000) + " us");
+    return true;
+}
+
+}  // namespace greq
@@ -0,0 +1,263 @@
+#include "greq_common.h"
+
+#include <algorithm>
+#include <cstring>
+#include <openssl/evp.h>
+#include <ostream>
+
+namespace greq {
+
+namespace {
+
+// BLAKE3 (hash mode, 32-byte output), after the reference implementation.
+// OpenSSL has no BLAKE3, so this is the portable one-block-at-a-time form.
+const uint32_t kBlake3Iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+const unsigned int kMessagePermutation[16] = {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+const uint32_t kChunkStart = 1;
+const uint32_t kChunkEnd = 2;
+const uint32_t kParent = 4;
+const uint32_t kRoot = 8;
+
+inline uint32_t rotate_right(uint32_t value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+inline void mix(uint32_t* state, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    state[a] = state[a] + state[b] + x;
+    state[d] = rotate_right(state[d] ^ state[a], 16);
+    state[c] = state[c] + state[d];
+    state[b] = rotate_right(state[b] ^ state[c], 12);
+    state[a] = state[a] + state[b] + y;
+    state[d] = rotate_right(state[d] ^ state[a], 8);
+    state[c] = state[c] + state[d];
+    state[b] = rotate_right(state[b] ^ state[c], 7);
+}
+
+void blake3_compress(
+    const uint32_t chaining_value[8],
+    const uint32_t block_words[16],
+    uint64_t counter,
+    uint32_t block_length,
+    uint32_t flags,
+    uint32_t out[16]
+) {
+    uint32_t state[16] = {
+        chaining_value[0], chaining_value[1], chaining_value[2], chaining_value[3],
+        chaining_value[4], chaining_value[5], chaining_value[6], chaining_value[7],
+        kBlake3Iv[0], kBlake3Iv[1], kBlake3Iv[2], kBlake3Iv[3],
+        static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), block_length, flags,
+    };
+    uint32_t message[16];
+    std::memcpy(message, block_words, sizeof(message));
+    for (int round = 0; round < 7; ++round) {
+        mix(state, 0, 4, 8, 12, message[0], message[1]);
+        mix(state, 1, 5, 9, 13, message[2], message[3]);
+        mix(state, 2, 6, 10, 14, message[4], message[5]);
+        mix(state, 3, 7, 11, 15, message[6], message[7]);
+        mix(state, 0, 5, 10, 15, message[8], message[9]);
+        mix(state, 1, 6, 11, 12, message[10], message[11]);
+        mix(state, 2, 7, 8, 13, message[12], message[13]);
+        mix(state, 3, 4, 9, 14, message[14], message[15]);
+        uint32_t permuted[16];
+        for (int i = 0; i < 16; ++i) permuted[i] = message[kMessagePermutation[i]];
+        std::memcpy(message, permuted, sizeof(message));
+    }
+    for (int i = 0; i < 8; ++i) {
+        out[i] = state[i] ^ state[i + 8];
+        out[i + 8] = state[i + 8] ^ chaining_value[i];
+    }
+}
+
+void load_words(const uint8_t* bytes, uint32_t words[16]) {
+    for (int i = 0; i < 16; ++i) {
+        words[i] = static_cast<uint32_t>(bytes[4 * i]) | static_cast<uint32_t>(bytes[4 * i + 1]) << 8 |
+            static_cast<uint32_t>(bytes[4 * i + 2]) << 16 | static_cast<uint32_t>(bytes[4 * i + 3]) << 24;
+    }
+}
+
+void chunk_reset(Blake3Hasher& hasher, uint64_t chunk_counter) {
+    std::memcpy(hasher.chunk_cv, kBlake3Iv, sizeof(hasher.chunk_cv));
+    hasher.chunk_counter = chunk_counter;
+    std::memset(hasher.block, 0, sizeof(hasher.block));
+    hasher.block_length = 0;
+    hasher.blocks_compressed = 0;
+}
+
+uint32_t chunk_start_flag(const Blake3Hasher& hasher) {
+    return hasher.blocks_compressed == 0 ? kChunkStart : 0;
+}
+
+void parent_chaining_value(const uint32_t left[8], const uint32_t right[8], uint32_t flags, uint32_t out[8]) {
+    uint32_t block[16];
+    std::memcpy(block, left, 8 * sizeof(uint32_t));
+    std::memcpy(block + 8, right, 8 * sizeof(uint32_t));
+    uint32_t full[16];
+    blake3_compress(kBlake3Iv, block, 0, 64, kParent | flags, full);
+    std::memcpy(out, full, 8 * sizeof(uint32_t));
+}
+
+void push_chunk_chaining_value(Blake3Hasher& hasher, uint32_t cv[8], uint64_t total_chunks) {
+    // Merge completed subtrees: one merge per trailing zero bit of the count.
+    while ((total_chunks & 1) == 0) {
+        --hasher.stack_length;
+        parent_chaining_value(hasher.cv_stack[hasher.stack_length], cv, 0, cv);
+        total_chunks >>= 1;
+    }
+    std::memcpy(hasher.cv_stack[hasher.stack_length], cv, 8 * sizeof(uint32_t));
+    ++hasher.stack_length;
+}
+
+}  // namespace
+
+void blake3_init(Blake3Hasher& hasher) {
+    chunk_reset(hasher, 0);
+    hasher.stack_length = 0;
+}
+
+void blake3_update(Blake3Hasher& hasher, const char* data, size_t size) {
+    const uint8_t* input = reinterpret_cast<const uint8_t*>(data);
+    while (size > 0) {
+        const size_t chunk_length = 64 * hasher.blocks_compressed + hasher.block_length;
+        if (chunk_length == 1024) {
+            uint32_t words[16];
+            uint32_t out[16];
+            load_words(hasher.block, words);
+            blake3_compress(hasher.chunk_cv, words, hasher.chunk_counter, 64, chunk_start_flag(hasher) | kChunkEnd, out);
+            const uint64_t total_chunks = hasher.chunk_counter + 1;
+            push_chunk_chaining_value(hasher, out, total_chunks);
+            chunk_reset(hasher, total_chunks);
+            continue;
+        }
+        // A full block is only compressed once more input shows it is not
+        // the chunk's last one.
+        if (hasher.block_length == 64) {
+            uint32_t words[16];
+            uint32_t out[16];
+            load_words(hasher.block, words);
+            blake3_compress(hasher.chunk_cv, words, hasher.chunk_counter, 64, chunk_start_flag(hasher), out);
+            std::memcpy(hasher.chunk_cv, out, sizeof(hasher.chunk_cv));
+            ++hasher.blocks_compressed;
+            std::memset(hasher.block, 0, sizeof(hasher.block));
+            hasher.block_length = 0;
+        }
+        const size_t take = std::min<size_t>(64 - hasher.block_length, size);
+        std::memcpy(hasher.block + hasher.block_length, input, take);
+        hasher.block_length += static_cast<uint32_t>(take);
+        input += take;
+        size -= take;
+    }
+}
+
+std::string blake3_hex(const Blake3Hasher& hasher) {
+    uint32_t input_cv[8];
+    uint32_t block[16];
+    std::memcpy(input_cv, hasher.chunk_cv, sizeof(input_cv));
+    load_words(hasher.block, block);
+    uint32_t block_length = hasher.block_length;
+    uint32_t flags = chunk_start_flag(hasher) | kChunkEnd;
+    uint64_t counter = hasher.chunk_counter;
+
+    for (size_t remaining = hasher.stack_length; remaining > 0; --remaining) {
+        uint32_t out[16];
+        blake3_compress(input_cv, block, counter, block_length, flags, out);
+        std::memcpy(block, hasher.cv_stack[remaining - 1], 8 * sizeof(uint32_t));
+        std::memcpy(block + 8, out, 8 * sizeof(uint32_t));
+        std::memcpy(input_cv, kBlake3Iv, sizeof(input_cv));
+        counter = 0;
+        block_length = 64;
+        flags = kParent;
+    }
+    uint32_t out[16];
+    blake3_compress(input_cv, block, counter, block_length, flags | kRoot, out);
+
+    static const char hex[] = "0123456789abcdef";
+    std::string text;
+    for (int i = 0; i < 8; ++i) {
+        for (int byte = 0; byte < 4; ++byte) {
+            const uint8_t value = static_cast<uint8_t>(out[i] >> (8 * byte));
+            text += hex[value >> 4];
+            text += hex[value & 0x0f];
+        }
+    }
+    return text;
+}
+
+StreamDigest::StreamDigest() : sha256(EVP_MD_CTX_new()) {
+    reset_digest(*this);
+}
+
+StreamDigest::~StreamDigest() {
+    EVP_MD_CTX_free(sha256);
+}
+
+void reset_digest(StreamDigest& digest) {
+    EVP_DigestInit_ex(digest.sha256, EVP_sha256(), nullptr);
+    blake3_init(digest.blake3);
+}
+
+void update_digest(StreamDigest& digest, const char* data, size_t size) {
+    EVP_DigestUpdate(digest.sha256, data, size);
+    if (digest.use_blake3) blake3_update(digest.blake3, data, size);
+}
+
+std::string sha256_hex(const StreamDigest& digest) {
+    EVP_MD_CTX* copy = EVP_MD_CTX_new();
+    unsigned char value[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (!copy || EVP_MD_CTX_copy_ex(copy, digest.sha256) != 1 || EVP_DigestFinal_ex(copy, value, &length) != 1) length = 0;
+    EVP_MD_CTX_free(copy);
+    static const char hex[] = "0123456789abcdef";
+    std::string text;
+    for (unsigned int i = 0; i < length; ++i) {
+        text += hex[value[i] >> 4];
+        text += hex[value[i] & 0x0f];
+    }
+    return text;
+}
+
+bool check_digests(
+    const StreamDigest& digest,
+    const DigestCheck& check,
+    const std::string& name,
+    std::ostream& out,
+    std::string& error
+) {
+    const std::string sha256 = sha256_hex(digest);
+    const std::string blake3 = digest.use_blake3 ? blake3_hex(digest.blake3) : "";
+    if (check.print) {
+        out << "SHA256 (" << name << ") = " << sha256 << "\n";
+        if (digest.use_blake3) out << "BLAKE3 (" << name << ") = " << blake3 << "\n";
+        out.flush();
+    }
+    if (!check.sha256.empty() && to_lower(check.sha256) != sha256) {
+        error = "SHA-256 mismatch for " + name + ": expected " + to_lower(check.sha256) + ", got " + sha256;
+        return false;
+    }
+    if (!check.blake3.empty() && to_lower(check.blake3) != blake3) {
+        error = "BLAKE3 mismatch for " + name + ": expected " + to_lower(check.blake3) + ", got " + blake3;
+        return false;
+    }
+    return true;
+}
+
+DigestStreambuf::DigestStreambuf(std::streambuf* target, StreamDigest& digest) : target_(target), digest_(digest) {}
+
+std::streamsize DigestStreambuf::xsputn(const char* data, std::streamsize size) {
+    const std::streamsize written = target_->sputn(data, size);
+    if (written > 0) update_digest(digest_, data, static_cast<size_t>(written));
+    return written;
+}
+
+DigestStreambuf::int_type DigestStreambuf::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+    const char byte = traits_type::to_char_type(c);
+    return xsputn(&byte, 1) == 1 ? c : traits_type::eof();
+}
+
+int DigestStreambuf::sync() {
+    return target_->pubsync();
+}
+
+}  // namespace greq
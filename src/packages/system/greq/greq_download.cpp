@@ -0,0 +1,631 @@
+#include "greq_common.h"
+#include "signals.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <ostream>
+#include <memory>
+#include <mutex>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace greq {
+
+namespace {
+
+// Below this size a second connection costs more than it saves.
+const uint64_t kMinParallelBytes = 4ull * 1024 * 1024;
+// An idle connection only steals half of a segment when both halves keep
+// at least this much, and splits on this alignment.
+const uint64_t kMinStealBytes = 1024ull * 1024;
+const uint64_t kSegmentAlignment = 64 * 1024;
+const int kSegmentAttempts = 3;
+const uint64_t kCheckpointBytes = 16ull * 1024 * 1024;
+
+struct Segment {
+    std::atomic<uint64_t> next{0};
+    std::atomic<uint64_t> end{0};
+};
+
+struct WorkerStats {
+    uint64_t bytes = 0;
+    unsigned int segments = 0;
+    unsigned int steals = 0;
+    unsigned int connects = 0;
+};
+
+struct ParallelDownload {
+    Url url;
+    RequestOptions options;
+    std::string validator;
+    uint64_t total = 0;
+    int fd = -1;
+
+    std::mutex lock;
+    std::deque<std::unique_ptr<Segment>> segments;
+    std::deque<Segment*> pending;
+    std::atomic<bool> failed{false};
+    std::atomic<unsigned int> running{0};
+    std::string error;
+};
+
+void fail_download(ParallelDownload& download, const std::string& error) {
+    std::lock_guard<std::mutex> guard(download.lock);
+    if (!download.failed.exchange(true)) download.error = error;
+}
+
+Segment* add_segment(ParallelDownload& download, uint64_t start, uint64_t end) {
+    download.segments.emplace_back(new Segment());
+    Segment* segment = download.segments.back().get();
+    segment->next = start;
+    segment->end = end;
+    return segment;
+}
+
+// Hands out the next unclaimed segment, or splits the segment with the
+// most bytes left so a connection that finished early takes over the back
+// half of a slow one. The owner notices the lowered end on its next write;
+// anything it already wrote past the split point is rewritten with the
+// same bytes by the thief.
+Segment* claim_segment(ParallelDownload& download, WorkerStats& stats) {
+    std::lock_guard<std::mutex> guard(download.lock);
+    if (!download.pending.empty()) {
+        Segment* segment = download.pending.front();
+        download.pending.pop_front();
+        return segment;
+    }
+    Segment* victim = nullptr;
+    uint64_t most = 0;
+    for (const auto& segment : download.segments) {
+        const uint64_t next = segment->next.load();
+        const uint64_t end = segment->end.load();
+        if (end > next && end - next > most) {
+            most = end - next;
+            victim = segment.get();
+        }
+    }
+    if (!victim || most < 2 * kMinStealBytes) return nullptr;
+    const uint64_t end = victim->end.load();
+    const uint64_t split = (end - most / 2) & ~(kSegmentAlignment - 1);
+    victim->end = split;
+    ++stats.steals;
+    return add_segment(download, split, end);
+}
+
+// Everything below the first segment that still has bytes to fetch is on
+// disk for good.
+uint64_t contiguous_prefix(ParallelDownload& download) {
+    std::lock_guard<std::mutex> guard(download.lock);
+    uint64_t prefix = download.total;
+    for (const auto& segment : download.segments) {
+        if (segment->next.load() < segment->end.load()) prefix = std::min(prefix, segment->next.load());
+    }
+    return prefix;
+}
+
+bool parse_content_range(const std::string& value, uint64_t& start, uint64_t& total) {
+    unsigned long long first = 0;
+    unsigned long long last = 0;
+    unsigned long long length = 0;
+    if (std::sscanf(value.c_str(), "bytes %llu-%llu/%llu", &first, &last, &length) != 3) return false;
+    start = first;
+    total = length;
+    return true;
+}
+
+// Fetches what is left of one segment on the worker's connection. Returns
+// false on a transport error; a response that cannot be used at all fails
+// the whole download.
+bool fetch_segment(ParallelDownload& download, HttpConnection& conn, Segment& segment, WorkerStats& stats, std::string& error) {
+    const uint64_t start = segment.next.load();
+    const uint64_t end = segment.end.load();
+    std::vector<std::string> headers = {"Range: bytes=" + std::to_string(start) + "-" + std::to_string(end - 1)};
+    if (!download.validator.empty()) headers.push_back("If-Range: " + download.validator);
+
+    ResponseHandler handler;
+    handler.on_head = [&](const HttpResponse& head) {
+        uint64_t range_start = 0;
+        uint64_t range_total = 0;
+        if (head.status == 200) {
+            fail_download(download, "the remote file changed during the download");
+            return false;
+        }
+        if (head.status != 206 || !parse_content_range(head.header("Content-Range"), range_start, range_total) ||
+            range_start != start || range_total != download.total) {
+            fail_download(download, "unexpected reply to a range request (HTTP " + std::to_string(head.status) + ")");
+            return false;
+        }
+        return true;
+    };
+    handler.on_body = [&](const char* data, size_t size) {
+        if (download.failed) return false;
+        const uint64_t position = segment.next.load();
+        const uint64_t limit = segment.end.load();
+        if (position >= limit) return false;
+        const size_t take = static_cast<size_t>(std::min<uint64_t>(size, limit - position));
+        if (!pwrite_all_fd(download.fd, data, take, position)) {
+            fail_download(download, std::string("write failed: ") + std::strerror(errno));
+            return false;
+        }
+        segment.next = position + take;
+        stats.bytes += take;
+        return take == size;
+    };
+    // A spliced piece may run past a lowered end; the thief rewrites those
+    // bytes with the same data, as with an overlong write above.
+    handler.splice_target = [&](int& fd, uint64_t& offset) {
+        fd = download.fd;
+        offset = segment.next.load();
+        return download.options.zero_copy && !download.failed && offset < segment.end.load();
+    };
+    handler.on_spliced = [&](uint64_t size) {
+        segment.next += size;
+        stats.bytes += size;
+        return !download.failed && segment.next.load() < segment.end.load();
+    };
+
+    HttpResponse response;
+    const bool reused = conn.fd >= 0;
+    if (!perform_request(conn, download.url, download.options, headers, response, handler, error)) return false;
+    if (!reused || conn.requests == 1) ++stats.connects;
+    return true;
+}
+
+void run_worker(ParallelDownload& download, WorkerStats& stats) {
+    HttpConnection conn;
+    while (!download.failed && !g_stop_sig) {
+        Segment* segment = claim_segment(download, stats);
+        if (!segment) break;
+        ++stats.segments;
+
+        int failures = 0;
+        while (segment->next.load() < segment->end.load() && !download.failed && !g_stop_sig) {
+            const uint64_t before = segment->next.load();
+            std::string error;
+            if (fetch_segment(download, conn, *segment, stats, error) && segment->next.load() > before) {
+                failures = 0;
+                continue;
+            }
+            close_connection(conn);
+            if (segment->next.load() > before) {
+                failures = 0;
+                continue;
+            }
+            if (++failures >= kSegmentAttempts) {
+                fail_download(download, error.empty() ? "server sent no data for a range request" : error);
+                break;
+            }
+            verbose_line(download.options, "Retrying range at " + std::to_string(before) + ": " + error);
+        }
+    }
+    close_connection(conn);
+    --download.running;
+}
+
+std::string strong_validator(const HttpResponse& head) {
+    const std::string etag = head.header("ETag");
+    return !etag.empty() && etag.compare(0, 2, "W/") != 0 ? etag : head.header("Last-Modified");
+}
+
+// A failed transfer either disappears, as it always has, or with --continue
+// stays on disk next to a record of how much of it is known good.
+void abandon_download(
+    const std::string& output_path,
+    const Url& url,
+    const DownloadOptions& download,
+    const ResumeState& state
+) {
+    if (!download.resume || state.verified == 0) {
+        remove_output(output_path);
+        discard_resume_state(state);
+        return;
+    }
+    std::string error;
+    if (!save_resume_state(state, url_to_string(url), error)) {
+        std::cerr << "greq: cannot record partial download: " << error << std::endl;
+        return;
+    }
+    std::cerr << "greq: kept " << format_size(state.verified) << " of " << output_path
+              << ", run again with -C - to continue" << std::endl;
+}
+
+bool single_stream_download(
+    HttpConnection& conn,
+    Url& url,
+    const RequestOptions& options,
+    const DownloadOptions& download,
+    const std::string& output_path,
+    ResumeState& state,
+    std::string& error
+) {
+    const uint64_t offset = state.verified;
+    const int fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (offset == 0 ? O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        error = output_path + ": " + std::strerror(errno);
+        return false;
+    }
+    // -o /dev/stdout, a FIFO or a terminal cannot take positioned writes.
+    struct stat info = {};
+    const bool regular = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+    std::vector<std::string> headers;
+    if (offset > 0) {
+        headers.push_back("Range: bytes=" + std::to_string(offset) + "-");
+        if (!state.validator.empty()) headers.push_back("If-Range: " + state.validator);
+    }
+
+    std::string failure;
+    bool already_complete = false;
+    uint64_t checkpoint = offset;
+    ResponseHandler handler;
+    handler.on_head = [&](const HttpResponse& head) {
+        uint64_t start = 0;
+        uint64_t total = 0;
+        unsigned long long length = 0;
+        if (head.status == 416 && offset > 0) {
+            if (std::sscanf(head.header("Content-Range").c_str(), "bytes */%llu", &length) == 1 && length == offset &&
+                (state.total == 0 || state.total == length)) {
+                verbose_line(options, output_path + " is already complete");
+                already_complete = true;
+                return true;
+            }
+            failure = "server cannot continue at byte " + std::to_string(offset) + ", the next run starts over";
+            reset_resume_state(state);
+            return false;
+        }
+        if (head.status >= 400) {
+            failure = "server returned HTTP " + std::to_string(head.status);
+            return false;
+        }
+        if (head.status == 206) {
+            if (!parse_content_range(head.header("Content-Range"), start, total) || start != offset ||
+                (state.total != 0 && total != state.total)) {
+                failure = "unexpected Content-Range in resumed download, the next run starts over";
+                reset_resume_state(state);
+                return false;
+            }
+            verbose_line(options, "Continuing at byte " + std::to_string(offset) + " of " + std::to_string(total));
+            state.total = total;
+        } else {
+            if (offset > 0) {
+                verbose_line(options, "Server sent the whole file, starting over");
+                if (ftruncate(fd, 0) != 0) {
+                    failure = output_path + ": " + std::strerror(errno);
+                    return false;
+                }
+                reset_resume_state(state);
+            }
+            state.total = head.content_length > 0 ? static_cast<uint64_t>(head.content_length) : 0;
+        }
+        state.validator = strong_validator(head);
+        return true;
+    };
+    handler.on_body = [&](const char* data, size_t size) {
+        if (already_complete) return true;
+        if (!(regular ? pwrite_all_fd(fd, data, size, state.verified) : write_all_fd(fd, data, size))) {
+            failure = std::string("write failed: ") + std::strerror(errno);
+            return false;
+        }
+        update_digest(state.digest, data, size);
+        state.verified += size;
+        // Checkpoint now and then so even a killed greq loses little.
+        if (download.resume && state.verified - checkpoint >= kCheckpointBytes) {
+            std::string ignored;
+            save_resume_state(state, url_to_string(url), ignored);
+            checkpoint = state.verified;
+        }
+        return true;
+    };
+    // The resume record and digest checks hash the body on its way through
+    // user space, so only a plain download into a file can skip it.
+    if (options.zero_copy && regular && !download.resume && !download.digests.active()) {
+        handler.splice_target = [&](int& target, uint64_t& position) {
+            target = fd;
+            position = state.verified;
+            return true;
+        };
+        handler.on_spliced = [&](uint64_t size) {
+            state.verified += size;
+            return true;
+        };
+    }
+
+    HttpResponse response;
+    bool ok = fetch_url(conn, url, options, headers, response, handler, error);
+    if (ok && !failure.empty()) {
+        error = failure;
+        ok = false;
+    }
+    // Drop anything a previous run wrote past its verified prefix.
+    if (ok && regular && ftruncate(fd, static_cast<off_t>(state.verified)) != 0) {
+        error = output_path + ": " + std::strerror(errno);
+        ok = false;
+    }
+    if (close(fd) != 0 && ok) {
+        error = output_path + ": " + std::strerror(errno);
+        ok = false;
+    }
+    if (!ok) {
+        abandon_download(output_path, url, download, state);
+        return false;
+    }
+    discard_resume_state(state);
+    return true;
+}
+
+bool parallel_download(
+    const Url& url,
+    const RequestOptions& options,
+    const DownloadOptions& settings,
+    const HttpResponse& head,
+    const std::string& output_path,
+    ResumeState& state,
+    std::string& error
+) {
+    ParallelDownload download;
+    download.url = url;
+    download.options = options;
+    download.options.follow_location = false;
+    download.options.timing = nullptr;
+    download.total = static_cast<uint64_t>(head.content_length);
+    // If-Range needs a strong validator; a weak ETag or a date both let the
+    // server answer 200 with the new body, which fails the download.
+    download.validator = strong_validator(head);
+
+    if (state.verified > 0 &&
+        ((!state.validator.empty() && state.validator != download.validator) ||
+         (state.total != 0 && state.total != download.total) || state.verified > download.total)) {
+        verbose_line(options, "Remote file changed since the partial download, starting over");
+        reset_resume_state(state);
+    }
+    // A parallel run reserves the whole file before any range arrives, so a
+    // full-size file without a record says nothing about what it holds.
+    if (state.unrecorded && state.verified >= download.total) {
+        verbose_line(options, "No resume record for a full-size " + output_path + ", starting over");
+        reset_resume_state(state);
+    }
+    state.validator = download.validator;
+    state.total = download.total;
+    const uint64_t offset = state.verified;
+
+    download.fd = open(output_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | (offset == 0 ? O_TRUNC : 0), 0644);
+    if (download.fd < 0) {
+        error = output_path + ": " + std::strerror(errno);
+        return false;
+    }
+    // The record goes down before the file grows to full size, so a run
+    // killed at any point leaves a record of the verified prefix behind.
+    if (settings.resume && !save_resume_state(state, url_to_string(url), error)) {
+        error = "cannot record partial download: " + error;
+        close(download.fd);
+        if (offset == 0) remove_output(output_path);
+        return false;
+    }
+    // Reserve the whole file up front so out-of-order range writes neither
+    // fragment it nor run out of space halfway through.
+    struct stat info = {};
+    if (fstat(download.fd, &info) == 0 && S_ISREG(info.st_mode) &&
+        fallocate(download.fd, 0, 0, static_cast<off_t>(download.total)) != 0) {
+        if (errno == ENOSPC || ftruncate(download.fd, static_cast<off_t>(download.total)) != 0) {
+            error = output_path + ": " + std::strerror(errno);
+            close(download.fd);
+            abandon_download(output_path, url, settings, state);
+            return false;
+        }
+    }
+
+    const uint64_t remaining = download.total - offset;
+    const unsigned int workers = remaining == 0 ? 0
+        : static_cast<unsigned int>(std::max<uint64_t>(1, std::min<uint64_t>(settings.connections, remaining / kMinStealBytes)));
+    const uint64_t share = workers == 0 ? 0 : (remaining / workers) & ~(kSegmentAlignment - 1);
+    for (unsigned int i = 0; i < workers; ++i) {
+        const uint64_t start = offset + share * i;
+        download.pending.push_back(add_segment(download, start, i + 1 == workers ? download.total : start + share));
+    }
+    verbose_line(options, "Downloading " + format_size(remaining) + " over " + std::to_string(workers) + " connections" +
+                              (download.validator.empty() ? " (no validator)" : " (If-Range " + download.validator + ")"));
+
+    const uint64_t started = monotonic_ms();
+    std::vector<WorkerStats> stats(workers);
+    std::vector<std::thread> threads;
+    download.running = workers;
+    for (unsigned int i = 0; i < workers; ++i) threads.emplace_back(run_worker, std::ref(download), std::ref(stats[i]));
+    // Ranges finish out of order, so a digest check or the resume record
+    // follows the contiguous prefix while it grows and hashes it from the
+    // page cache. The record is checkpointed as the prefix advances.
+    std::string digest_error;
+    bool hashing = settings.digests.active() || settings.resume;
+    uint64_t checkpoint = offset;
+    while (hashing && download.running > 0 && !download.failed) {
+        const uint64_t before = state.verified;
+        if (!extend_resume_digest(state, download.fd, contiguous_prefix(download), digest_error)) {
+            hashing = false;
+        } else if (settings.resume && state.verified - checkpoint >= kCheckpointBytes) {
+            std::string ignored;
+            save_resume_state(state, url_to_string(url), ignored);
+            checkpoint = state.verified;
+        } else if (state.verified == before) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+    for (auto& thread : threads) thread.join();
+    const uint64_t elapsed = std::max<uint64_t>(monotonic_ms() - started, 1);
+
+    // Only the prefix below the first gap can be recorded as done.
+    const uint64_t prefix = contiguous_prefix(download);
+    const bool ok = !download.failed && !g_stop_sig && prefix == download.total;
+    if (!ok) {
+        error = download.failed ? download.error : g_stop_sig ? "interrupted" : "download incomplete";
+        if (settings.resume && !extend_resume_digest(state, download.fd, prefix, digest_error)) reset_resume_state(state);
+        close(download.fd);
+        abandon_download(output_path, url, settings, state);
+        return false;
+    }
+    if (settings.digests.active() && !extend_resume_digest(state, download.fd, download.total, digest_error)) {
+        error = output_path + ": cannot hash download: " + digest_error;
+        close(download.fd);
+        abandon_download(output_path, url, settings, state);
+        return false;
+    }
+    if (close(download.fd) != 0) {
+        error = output_path + ": " + std::strerror(errno);
+        abandon_download(output_path, url, settings, state);
+        return false;
+    }
+    discard_resume_state(state);
+
+    for (unsigned int i = 0; i < workers; ++i) {
+        verbose_line(options, "Connection " + std::to_string(i + 1) + ": " + format_size(stats[i].bytes) + " in " +
+                                  std::to_string(stats[i].segments) + " segments (" + std::to_string(stats[i].steals) +
+                                  " stolen), " + std::to_string(stats[i].connects) + " connects");
+    }
+    if (options.timing) options.timing->size_download = remaining;
+    verbose_line(options, "Downloaded " + format_size(remaining) + " in " + std::to_string(elapsed) + " ms (" +
+                              format_size(remaining * 1000 / elapsed) + "/s)");
+    return true;
+}
+
+// A file that fails its expected digest is not left behind to be trusted.
+bool verify_download(const DownloadOptions& download, const std::string& output_path, const ResumeState& state, std::string& error) {
+    if (!download.digests.active() || check_digests(state.digest, download.digests, output_path, std::cout, error)) return true;
+    remove_output(output_path);
+    return false;
+}
+
+}  // namespace
+
+bool fetch_to_stream(const Url& url, const RequestOptions& options, std::ostream& out, bool include_headers, std::string& error) {
+    Url current = url;
+    HttpConnection conn;
+    ContentDecoder decoder;
+    std::string failure;
+    const BodySink sink = [&out](const char* data, size_t size) {
+        out.write(data, static_cast<std::streamsize>(size));
+        return static_cast<bool>(out);
+    };
+    ResponseHandler handler;
+    handler.on_head = [&](const HttpResponse& head) {
+        if (include_headers) out << head.raw_head;
+        return begin_decoding(decoder, options.compressed ? head.header("Content-Encoding") : "", sink, failure);
+    };
+    handler.on_body = [&](const char* data, size_t size) {
+        if (decode_chunk(decoder, data, size)) return true;
+        failure = decoder.stopped ? "write failed" : decoder.error;
+        return false;
+    };
+
+    HttpResponse response;
+    bool ok = fetch_url(conn, current, options, {}, response, handler, error);
+    close_connection(conn);
+    if (ok && !failure.empty()) {
+        error = failure;
+        ok = false;
+    }
+    if (ok && response.body_bytes > 0 && !finish_decoding(decoder, options, error)) ok = false;
+    out.flush();
+    return ok;
+}
+
+bool download_to_file(
+    const Url& url,
+    const RequestOptions& options,
+    const DownloadOptions& download,
+    const std::string& output_path,
+    std::string& error
+) {
+    ResumeState state;
+    state.digest.use_blake3 = download.digests.print || !download.digests.blake3.empty();
+    if (download.resume && !load_resume_state(output_path, options, state, error)) return false;
+
+    Url effective = url;
+    HttpConnection conn;
+    if (download.connections < 2) {
+        const bool ok = single_stream_download(conn, effective, options, download, output_path, state, error);
+        close_connection(conn);
+        return ok && verify_download(download, output_path, state, error);
+    }
+
+    // Probe with HEAD first: only a 200 with a known length and byte-range
+    // support is worth splitting, everything else is fetched as one stream.
+    RequestOptions probe_options = options;
+    probe_options.method = "HEAD";
+    HttpResponse head;
+    if (!fetch_url(conn, effective, probe_options, {}, head, {}, error)) return false;
+    // The transfer goes straight to where the probe was redirected, so it
+    // must not carry credentials the probe already dropped on the way.
+    RequestOptions followed = options;
+    if (!same_origin(url, effective)) drop_credentials(followed);
+
+    const bool ranges = to_lower(head.header("Accept-Ranges")).find("bytes") != std::string::npos;
+    const uint64_t total = head.content_length > 0 ? static_cast<uint64_t>(head.content_length) : 0;
+    if (head.status != 200 || !ranges || total < kMinParallelBytes) {
+        verbose_line(options, head.status != 200 ? "HEAD returned " + std::to_string(head.status) + ", using a single connection"
+                              : !ranges         ? "Server does not accept byte ranges, using a single connection"
+                                                : "Using a single connection for " + format_size(total));
+        const bool ok = single_stream_download(conn, effective, followed, download, output_path, state, error);
+        close_connection(conn);
+        return ok && verify_download(download, output_path, state, error);
+    }
+    close_connection(conn);
+    return parallel_download(effective, followed, download, head, output_path, state, error) &&
+        verify_download(download, output_path, state, error);
+}
+
+bool benchmark_zero_copy(
+    const Url& url,
+    const RequestOptions& options,
+    const DownloadOptions& download,
+    const std::string& output_path,
+    std::string& error
+) {
+    const int kRounds = 3;
+    struct Result {
+        const char* name;
+        uint64_t best_ms = 0;
+        uint64_t cpu_ms = 0;
+        uint64_t bytes = 0;
+    };
+    Result results[2] = {{"buffered"}, {"zero-copy"}};
+    auto cpu_ms = []() {
+        struct rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 +
+            static_cast<uint64_t>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+    };
+
+    // Alternate the modes so neither always runs against a warmer server.
+    for (int round = 0; round < kRounds; ++round) {
+        for (int mode = 0; mode < 2; ++mode) {
+            RequestOptions run = options;
+            run.zero_copy = mode == 1;
+            const uint64_t cpu_before = cpu_ms();
+            const uint64_t started = monotonic_ms();
+            if (!download_to_file(url, run, download, output_path, error)) return false;
+            const uint64_t elapsed = std::max<uint64_t>(monotonic_ms() - started, 1);
+            Result& result = results[mode];
+            if (result.best_ms == 0 || elapsed < result.best_ms) result.best_ms = elapsed;
+            result.cpu_ms += cpu_ms() - cpu_before;
+            struct stat info = {};
+            if (stat(output_path.c_str(), &info) == 0) result.bytes = static_cast<uint64_t>(info.st_size);
+        }
+    }
+
+    std::printf("%-10s %12s %10s %14s %12s\n", "mode", "size", "best", "throughput", "cpu/run");
+    for (const Result& result : results) {
+        std::printf("%-10s %12s %7llu ms %12s/s %9llu ms\n", result.name, format_size(result.bytes).c_str(),
+                    static_cast<unsigned long long>(result.best_ms),
+                    format_size(result.bytes * 1000 / result.best_ms).c_str(),
+                    static_cast<unsigned long long>(result.cpu_ms / kRounds));
+    }
+    return true;
+}
+
+}  // namespace greq
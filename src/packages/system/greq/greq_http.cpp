@@ -0,0 +1,684 @@
+#include "greq_common.h"
+#include "resolver.h"
+#include "signals.h"
+#include "sys_info.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace greq {
+
+namespace {
+
+const size_t kMaxHeadBytes = 64 * 1024;
+const size_t kReadBufferBytes = 64 * 1024;
+// Pipe capacity asked for when splicing a body; the kernel may grant less.
+const int kSplicePipeBytes = 1024 * 1024;
+
+SSL_CTX* shared_tls_context(std::string& error) {
+    static std::once_flag once;
+    static SSL_CTX* context = nullptr;
+    std::call_once(once, []() {
+        context = SSL_CTX_new(TLS_client_method());
+        if (!context) return;
+        SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+        SSL_CTX_set_default_verify_paths(context);
+        SSL_CTX_load_verify_locations(context, "/etc/ssl/certs/ca-certificates.crt", nullptr);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+        // Close-delimited bodies end with a bare TCP close on many servers.
+        SSL_CTX_set_options(context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+        static const unsigned char alpn[] = {8, 'h', 't', 't', 'p', '/', '1', '.', '1'};
+        SSL_CTX_set_alpn_protos(context, alpn, sizeof(alpn));
+        ERR_clear_error();
+    });
+    if (!context) error = "cannot initialise TLS";
+    return context;
+}
+
+std::string tls_error_string() {
+    const unsigned long code = ERR_get_error();
+    if (code == 0) return "unknown TLS error";
+    char buffer[256];
+    ERR_error_string_n(code, buffer, sizeof(buffer));
+    return buffer;
+}
+
+bool header_present(const std::vector<std::string>& headers, const std::string& name) {
+    const std::string prefix = to_lower(name) + ":";
+    for (const auto& header : headers) {
+        if (to_lower(header.substr(0, prefix.size())) == prefix) return true;
+    }
+    return false;
+}
+
+// Moves the rest of a Content-Length body from the socket into the
+// handler's file through a pipe, so the payload is never copied to user
+// space. Sets `fallback` instead of failing when the kernel refuses the
+// splice (no splice support for this socket, or a kTLS control record),
+// leaving the caller to read the remainder the ordinary way.
+bool splice_body(
+    HttpConnection& conn,
+    ResponseParser& parser,
+    const ResponseHandler& handler,
+    int fd,
+    uint64_t offset,
+    const RequestOptions& options,
+    bool& fallback,
+    std::string& error
+) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        fallback = true;
+        return false;
+    }
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, kSplicePipeBytes);
+    const int granted = fcntl(pipe_fds[1], F_GETPIPE_SZ);
+    const size_t capacity = granted > 0 ? static_cast<size_t>(granted) : 64 * 1024;
+    verbose_line(options, "Splicing " + format_size(parser.remaining) + " into the output" +
+                              (conn.ssl ? " from a kTLS socket" : ""));
+
+    loff_t position = static_cast<loff_t>(offset);
+    bool ok = true;
+    while (parser.remaining > 0) {
+        if (g_stop_sig) {
+            error = "interrupted";
+            ok = false;
+            break;
+        }
+        const size_t want = static_cast<size_t>(std::min<uint64_t>(parser.remaining, capacity));
+        const ssize_t got = splice(conn.fd, nullptr, pipe_fds[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            verbose_line(options, std::string("splice stopped (") + std::strerror(errno) + "), reading the rest");
+            fallback = true;
+            ok = false;
+            break;
+        }
+        if (got <= 0) {
+            error = got == 0 ? "connection closed before the response ended" : "timed out waiting for " + conn.host;
+            ok = false;
+            break;
+        }
+        for (ssize_t moved = 0; moved < got;) {
+            const ssize_t put = splice(pipe_fds[0], nullptr, fd, &position, static_cast<size_t>(got - moved), SPLICE_F_MOVE);
+            if (put < 0 && errno == EINTR) continue;
+            if (put <= 0) {
+                error = std::string("write failed: ") + (put < 0 ? std::strerror(errno) : "no progress");
+                ok = false;
+                break;
+            }
+            moved += put;
+        }
+        if (!ok) break;
+
+        parser.remaining -= static_cast<uint64_t>(got);
+        parser.response.body_bytes += static_cast<uint64_t>(got);
+        const bool keep_going = !handler.on_spliced || handler.on_spliced(static_cast<uint64_t>(got));
+        if (parser.remaining == 0) {
+            parser.response.complete = true;
+            parser.state = ResponseParser::State::Done;
+        } else if (!keep_going) {
+            parser.stopped = true;
+            parser.state = ResponseParser::State::Done;
+        }
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return ok;
+}
+
+bool parse_status_line(const std::string& line, HttpResponse& response) {
+    const size_t first = line.find(' ');
+    if (first == std::string::npos || line.compare(0, 5, "HTTP/") != 0) return false;
+    response.version = line.substr(0, first);
+    const size_t second = line.find(' ', first + 1);
+    const std::string code = line.substr(first + 1, second == std::string::npos ? std::string::npos : second - first - 1);
+    if (code.size() != 3 || code.find_first_not_of("0123456789") != std::string::npos) return false;
+    response.status = std::stoi(code);
+    response.reason = second == std::string::npos ? "" : line.substr(second + 1);
+    return true;
+}
+
+}  // namespace
+
+bool is_redirect(int status) {
+    return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+}
+
+SSL* create_tls_session(const Url& url, const RequestOptions& options, int fd, std::string& error) {
+    SSL_CTX* context = shared_tls_context(error);
+    if (!context) return nullptr;
+    SSL* ssl = SSL_new(context);
+    if (!ssl) {
+        error = tls_error_string();
+        return nullptr;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, url.host.c_str());
+    if (options.insecure) {
+        SSL_set_verify(ssl, SSL_VERIFY_NONE, nullptr);
+    } else {
+        SSL_set_verify(ssl, SSL_VERIFY_PEER, nullptr);
+        SSL_set1_host(ssl, url.host.c_str());
+    }
+#ifndef OPENSSL_NO_KTLS
+    // OpenSSL hands the session keys to the kernel after the handshake when
+    // the tls module and the negotiated cipher allow it.
+    if (options.zero_copy) SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#endif
+    return ssl;
+}
+
+std::string tls_handshake_error(SSL* ssl, const Url& url) {
+    const long verify = SSL_get_verify_result(ssl);
+    return "TLS handshake with " + url.host + " failed: " +
+        (verify != X509_V_OK ? X509_verify_cert_error_string(verify) : tls_error_string());
+}
+
+std::string HttpResponse::header(const std::string& name) const {
+    const std::string wanted = to_lower(name);
+    for (const auto& entry : headers) {
+        if (to_lower(entry.first) == wanted) return entry.second;
+    }
+    return "";
+}
+
+void ResponseParser::reset(bool head_request) {
+    state = State::Head;
+    no_body = head_request;
+    response = HttpResponse();
+    remaining = 0;
+    line.clear();
+    stopped = false;
+}
+
+size_t ResponseParser::feed(const char* data, size_t size, const ResponseHandler& handler, std::string& error) {
+    size_t used = 0;
+    while (used < size && state != State::Done) {
+        if (state == State::Head) {
+            const size_t before = line.size();
+            line.append(data + used, size - used);
+            const size_t end = line.find("\r\n\r\n", before >= 3 ? before - 3 : 0);
+            if (end == std::string::npos) {
+                if (line.size() > kMaxHeadBytes) {
+                    error = "response header too large";
+                    return used;
+                }
+                used = size;
+                break;
+            }
+            used += end + 4 - before;
+            const std::string head = line.substr(0, end + 4);
+            line.clear();
+
+            HttpResponse parsed;
+            parsed.raw_head = head;
+            size_t position = head.find("\r\n");
+            if (!parse_status_line(head.substr(0, position), parsed)) {
+                error = "malformed HTTP status line";
+                return used;
+            }
+            position += 2;
+            while (position < end) {
+                const size_t next = head.find("\r\n", position);
+                const std::string header_line = head.substr(position, next - position);
+                position = next + 2;
+                const size_t colon = header_line.find(':');
+                if (colon == std::string::npos) continue;
+                parsed.headers.emplace_back(trim(header_line.substr(0, colon)), trim(header_line.substr(colon + 1)));
+            }
+            // Interim responses carry no body; the real head follows.
+            if (parsed.status >= 100 && parsed.status < 200 && parsed.status != 101) continue;
+
+            const std::string connection = to_lower(parsed.header("Connection"));
+            parsed.keep_alive = parsed.version == "HTTP/1.0"
+                ? connection.find("keep-alive") != std::string::npos
+                : connection.find("close") == std::string::npos;
+            parsed.chunked = to_lower(parsed.header("Transfer-Encoding")).find("chunked") != std::string::npos;
+            const std::string length = parsed.header("Content-Length");
+            if (!parsed.chunked && !length.empty()) {
+                parsed.content_length = static_cast<int64_t>(std::strtoull(length.c_str(), nullptr, 10));
+            }
+            const bool bodyless = no_body || parsed.status == 204 || parsed.status == 304;
+            if (!bodyless && !parsed.chunked && parsed.content_length < 0) parsed.keep_alive = false;
+            response = parsed;
+
+            if (handler.on_head && !handler.on_head(response)) {
+                stopped = true;
+                state = State::Done;
+                break;
+            }
+            if (bodyless || response.content_length == 0) {
+                response.complete = true;
+                state = State::Done;
+            } else if (response.chunked) {
+                state = State::ChunkSize;
+            } else {
+                remaining = static_cast<uint64_t>(response.content_length);
+                state = State::Body;
+            }
+            continue;
+        }
+
+        if (state == State::Body || state == State::ChunkData) {
+            const bool delimited = state == State::ChunkData || response.content_length >= 0;
+            size_t take = size - used;
+            if (delimited && take > remaining) take = static_cast<size_t>(remaining);
+            response.body_bytes += take;
+            if (delimited) remaining -= take;
+            const bool keep_going = !handler.on_body || handler.on_body(data + used, take);
+            used += take;
+            if (!keep_going) {
+                stopped = true;
+                state = State::Done;
+                break;
+            }
+            if (delimited && remaining == 0) {
+                if (state == State::ChunkData) {
+                    state = State::ChunkEnd;
+                } else {
+                    response.complete = true;
+                    state = State::Done;
+                }
+            }
+            continue;
+        }
+
+        // Chunk framing and trailers are line based.
+        const char* newline = static_cast<const char*>(std::memchr(data + used, '\n', size - used));
+        if (!newline) {
+            line.append(data + used, size - used);
+            used = size;
+            if (line.size() > kMaxHeadBytes) error = "chunk header too large";
+            break;
+        }
+        line.append(data + used, static_cast<size_t>(newline - (data + used)));
+        used = static_cast<size_t>(newline - data) + 1;
+        const std::string text = trim(line);
+        line.clear();
+
+        if (state == State::ChunkEnd) {
+            state = State::ChunkSize;
+        } else if (state == State::ChunkSize) {
+            if (text.empty() || !std::isxdigit(static_cast<unsigned char>(text[0]))) {
+                error = "malformed chunk size";
+                return used;
+            }
+            remaining = std::strtoull(text.c_str(), nullptr, 16);
+            state = remaining == 0 ? State::Trailers : State::ChunkData;
+        } else if (state == State::Trailers && text.empty()) {
+            response.complete = true;
+            state = State::Done;
+        }
+    }
+    return used;
+}
+
+bool ResponseParser::finish_at_eof(std::string& error) {
+    if (state == State::Body && response.content_length < 0) {
+        response.complete = true;
+        state = State::Done;
+    }
+    if (state == State::Done) return true;
+    error = state == State::Head && line.empty() ? "empty reply from server" : "connection closed before the response ended";
+    return false;
+}
+
+bool open_connection(const Url& url, const RequestOptions& options, HttpConnection& conn, std::string& error) {
+    close_connection(conn);
+
+    dns::ResolverOptions resolver;
+    resolver.cache_file = options.dns_cache;
+    dns::ConnectResult connected;
+    if (!dns::connect_host(url.host, url.port, resolver, options.connect_timeout_ms, connected, error)) return false;
+    const int fd = connected.fd;
+    if (options.timing) {
+        // The lookup overlaps the connection attempts; namelookup marks the
+        // first address.
+        options.timing->namelookup = connected.resolved_ns > options.timing->start
+            ? connected.resolved_ns - options.timing->start : 0;
+    }
+    if (options.timing) options.timing->connect = options.timing->elapsed();
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval timeout = {options.io_timeout_ms / 1000, (options.io_timeout_ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    conn.fd = fd;
+    conn.scheme = url.scheme;
+    conn.host = url.host;
+    conn.port = url.port;
+    conn.requests = 0;
+    conn.reusable = true;
+
+    if (url.tls()) {
+        conn.ssl = create_tls_session(url, options, fd, error);
+        if (!conn.ssl) {
+            close_connection(conn);
+            return false;
+        }
+        if (SSL_connect(conn.ssl) != 1) {
+            error = tls_handshake_error(conn.ssl, url);
+            close_connection(conn);
+            return false;
+        }
+        if (options.timing) options.timing->appconnect = options.timing->elapsed();
+        verbose_line(options, std::string("TLS ") + SSL_get_version(conn.ssl) + " " + SSL_get_cipher_name(conn.ssl));
+#ifndef OPENSSL_NO_KTLS
+        conn.ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(conn.ssl));
+#endif
+        if (options.zero_copy) verbose_line(options, conn.ktls_recv ? "kTLS receive offload enabled" : "kTLS not available");
+    }
+    verbose_line(
+        options,
+        "Connected to " + url.host + " (" + dns::address_to_string(connected.address) + ") port " + std::to_string(url.port)
+    );
+    return true;
+}
+
+void close_connection(HttpConnection& conn) {
+    if (conn.ssl) {
+        SSL_free(conn.ssl);
+        conn.ssl = nullptr;
+    }
+    if (conn.fd >= 0) close(conn.fd);
+    conn.fd = -1;
+    conn.leftover.clear();
+    conn.reusable = false;
+    conn.ktls_recv = false;
+}
+
+ssize_t connection_read(HttpConnection& conn, char* buffer, size_t size) {
+    if (!conn.leftover.empty()) {
+        const size_t take = std::min(size, conn.leftover.size());
+        std::memcpy(buffer, conn.leftover.data(), take);
+        conn.leftover.erase(0, take);
+        return static_cast<ssize_t>(take);
+    }
+    while (true) {
+        if (conn.ssl) {
+            const int got = SSL_read(conn.ssl, buffer, static_cast<int>(std::min<size_t>(size, 1 << 30)));
+            if (got > 0) return got;
+            const int reason = SSL_get_error(conn.ssl, got);
+            if (reason == SSL_ERROR_ZERO_RETURN) return 0;
+            if (reason == SSL_ERROR_SYSCALL && errno == EINTR && !g_stop_sig) continue;
+            return reason == SSL_ERROR_SYSCALL && got == 0 ? 0 : -1;
+        }
+        const ssize_t got = recv(conn.fd, buffer, size, 0);
+        if (got < 0 && errno == EINTR && !g_stop_sig) continue;
+        return got;
+    }
+}
+
+bool connection_write(HttpConnection& conn, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = 0;
+        if (conn.ssl) {
+            const int sent = SSL_write(conn.ssl, data, static_cast<int>(std::min<size_t>(size, 1 << 30)));
+            if (sent <= 0) return false;
+            written = sent;
+        } else {
+            written = send(conn.fd, data, size, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR && !g_stop_sig) continue;
+                return false;
+            }
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+std::string build_request(const Url& url, const RequestOptions& options, const std::vector<std::string>& extra_headers) {
+    const bool default_port = url.port == (url.tls() ? 443 : 80);
+    const bool ipv6 = url.host.find(':') != std::string::npos;
+    std::string host = ipv6 ? "[" + url.host + "]" : url.host;
+    if (!default_port) host += ":" + std::to_string(url.port);
+
+    std::string request = options.method + " " + url.target + " HTTP/1.1\r\n";
+    if (!header_present(options.headers, "Host")) request += "Host: " + host + "\r\n";
+    if (!header_present(options.headers, "User-Agent")) {
+        request += "User-Agent: " + (options.user_agent.empty() ? std::string("greq/") + OS_VERSION_ID : options.user_agent) + "\r\n";
+    }
+    if (!header_present(options.headers, "Accept")) request += "Accept: */*\r\n";
+    if (options.compressed && !header_present(options.headers, "Accept-Encoding")) {
+        request += "Accept-Encoding: zstd, gzip, deflate\r\n";
+    }
+    if (!options.auth.empty() && !header_present(options.headers, "Authorization")) {
+        request += "Authorization: Basic " + base64_encode(options.auth) + "\r\n";
+    }
+    for (const auto& header : options.headers) request += header + "\r\n";
+    for (const auto& header : extra_headers) request += header + "\r\n";
+    if (options.upload.active()) {
+        if (!header_present(options.headers, "Content-Type") && !options.upload.content_type.empty()) {
+            request += "Content-Type: " + options.upload.content_type + "\r\n";
+        }
+        request += options.upload.length >= 0 ? "Content-Length: " + std::to_string(options.upload.length) + "\r\n"
+                                              : std::string("Transfer-Encoding: chunked\r\n");
+    } else if (!options.data.empty() || options.method == "POST" || options.method == "PUT") {
+        if (!header_present(options.headers, "Content-Type") && !options.data.empty()) {
+            request += "Content-Type: application/x-www-form-urlencoded\r\n";
+        }
+        request += "Content-Length: " + std::to_string(options.data.size()) + "\r\n";
+    }
+    request += "\r\n";
+    request += options.data;
+    return request;
+}
+
+bool perform_request(
+    HttpConnection& conn,
+    const Url& url,
+    const RequestOptions& options,
+    const std::vector<std::string>& extra_headers,
+    HttpResponse& response,
+    const ResponseHandler& handler,
+    std::string& error
+) {
+    // A body read from a pipe can only be sent once, so it never goes out
+    // on a kept-alive connection that may turn out to be closed.
+    const bool replayable = !options.upload.active() || upload_replayable(options.upload);
+    if (conn.fd >= 0 && (!conn.reusable || conn.scheme != url.scheme || conn.host != url.host || conn.port != url.port ||
+                         !replayable)) {
+        close_connection(conn);
+    }
+    const std::string request = build_request(url, options, extra_headers);
+    std::vector<char> buffer(kReadBufferBytes);
+
+    // A kept-alive connection may have been closed by the server while
+    // idle; that shows up as a failed write or an empty read and is worth
+    // exactly one retry on a fresh connection.
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        const bool reused = conn.fd >= 0;
+        if (!reused && !open_connection(url, options, conn, error)) return false;
+        if (reused) verbose_line(options, "Re-using connection to " + url.host);
+        TransferTiming* timing = options.timing;
+        if (timing) {
+            // A kept-alive connection needed no lookup, connect or handshake.
+            if (reused) {
+                timing->namelookup = timing->connect = timing->elapsed();
+                if (conn.ssl) timing->appconnect = timing->connect;
+            }
+            timing->pretransfer = timing->elapsed();
+        }
+        if (!connection_write(conn, request.data(), request.size())) {
+            close_connection(conn);
+            if (reused) continue;
+            error = "failed to send request to " + url.host;
+            return false;
+        }
+        if (options.upload.active() && !send_upload(conn, options.upload, options, error)) {
+            close_connection(conn);
+            if (reused && error != "interrupted") {
+                error.clear();
+                continue;
+            }
+            return false;
+        }
+        ++conn.requests;
+
+        ResponseParser parser;
+        parser.reset(options.method == "HEAD");
+        bool received = false;
+        bool retry = false;
+        bool splice_tried = false;
+        while (!parser.done()) {
+            if (g_stop_sig) {
+                close_connection(conn);
+                error = "interrupted";
+                return false;
+            }
+            const ssize_t got = connection_read(conn, buffer.data(), buffer.size());
+            if (got <= 0) {
+                if (reused && !received) {
+                    retry = true;
+                    break;
+                }
+                close_connection(conn);
+                if (got < 0) {
+                    if (g_stop_sig) error = "interrupted";
+                    else if (errno == EAGAIN || errno == EWOULDBLOCK) error = "timed out waiting for " + url.host;
+                    else error = "failed to read from " + url.host;
+                    return false;
+                }
+                if (!parser.finish_at_eof(error)) return false;
+                break;
+            }
+            if (!received && timing) timing->starttransfer = timing->elapsed();
+            received = true;
+            const size_t used = parser.feed(buffer.data(), static_cast<size_t>(got), handler, error);
+            if (!error.empty()) {
+                close_connection(conn);
+                return false;
+            }
+            if (parser.done() && used < static_cast<size_t>(got)) {
+                conn.leftover.assign(buffer.data() + used, static_cast<size_t>(got) - used);
+            }
+            // Everything buffered so far went through on_body; the rest of a
+            // fixed-length body can go straight from the socket to the file.
+            int splice_fd = -1;
+            uint64_t splice_offset = 0;
+            if (!splice_tried && parser.state == ResponseParser::State::Body && parser.response.content_length >= 0 &&
+                handler.splice_target && (!conn.ssl || (conn.ktls_recv && SSL_pending(conn.ssl) == 0))) {
+                splice_tried = true;
+                bool fallback = false;
+                if (handler.splice_target(splice_fd, splice_offset) &&
+                    !splice_body(conn, parser, handler, splice_fd, splice_offset, options, fallback, error) && !fallback) {
+                    close_connection(conn);
+                    return false;
+                }
+            }
+        }
+        if (retry) {
+            close_connection(conn);
+            continue;
+        }
+
+        response = parser.response;
+        if (timing) {
+            timing->http_code = response.status;
+            timing->size_download = response.body_bytes;
+        }
+        if (conn.fd >= 0 && (parser.stopped || !response.complete || !response.keep_alive)) close_connection(conn);
+        conn.reusable = conn.fd >= 0;
+        return true;
+    }
+    error = "connection to " + url.host + " was closed by the server";
+    return false;
+}
+
+bool same_origin(const Url& a, const Url& b) {
+    return a.scheme == b.scheme && a.host == b.host && a.port == b.port;
+}
+
+void drop_credentials(RequestOptions& options) {
+    options.auth.clear();
+    auto& headers = options.headers;
+    headers.erase(
+        std::remove_if(headers.begin(), headers.end(), [](const std::string& header) {
+            return header_present({header}, "Authorization") || header_present({header}, "Cookie");
+        }),
+        headers.end()
+    );
+}
+
+bool fetch_url(
+    HttpConnection& conn,
+    Url& url,
+    const RequestOptions& options,
+    const std::vector<std::string>& extra_headers,
+    HttpResponse& response,
+    const ResponseHandler& handler,
+    std::string& error
+) {
+    RequestOptions current = options;
+    for (int hop = 0;; ++hop) {
+        bool redirecting = false;
+        ResponseHandler wrapper;
+        wrapper.on_head = [&](const HttpResponse& head) {
+            redirecting = current.follow_location && is_redirect(head.status) && !head.header("Location").empty();
+            if (redirecting) return true;
+            return !handler.on_head || handler.on_head(head);
+        };
+        wrapper.on_body = [&](const char* data, size_t size) {
+            return redirecting || !handler.on_body || handler.on_body(data, size);
+        };
+        if (handler.splice_target) {
+            wrapper.splice_target = [&](int& fd, uint64_t& offset) {
+                return !redirecting && handler.splice_target(fd, offset);
+            };
+            wrapper.on_spliced = handler.on_spliced;
+        }
+        verbose_line(current, current.method + " " + url_to_string(url));
+        if (current.timing) {
+            TransferTiming& timing = *current.timing;
+            timing.url_effective = url_to_string(url);
+            timing.namelookup = timing.connect = timing.appconnect = timing.pretransfer = timing.starttransfer = 0;
+        }
+        if (!perform_request(conn, url, current, extra_headers, response, wrapper, error)) return false;
+        if (!redirecting) return true;
+
+        if (hop >= current.max_redirects) {
+            error = "maximum redirects (" + std::to_string(current.max_redirects) + ") followed";
+            return false;
+        }
+        Url next;
+        if (!resolve_location(url, response.header("Location"), next, error)) return false;
+        verbose_line(current, "Redirect " + std::to_string(response.status) + " to " + url_to_string(next));
+        if (response.status == 303 || ((response.status == 301 || response.status == 302) && current.method == "POST")) {
+            if (current.method != "HEAD") current.method = "GET";
+            current.data.clear();
+            current.upload = UploadBody();
+        } else if (current.upload.active() && !upload_replayable(current.upload)) {
+            error = "cannot send a piped request body again to follow the redirect to " + url_to_string(next);
+            return false;
+        }
+        if (!same_origin(url, next)) {
+            verbose_line(current, "Not sending credentials to " + next.host + ":" + std::to_string(next.port));
+            drop_credentials(current);
+        }
+        url = next;
+        if (current.timing) {
+            ++current.timing->redirects;
+            current.timing->redirect = current.timing->elapsed();
+        }
+    }
+}
+
+}  // namespace greq
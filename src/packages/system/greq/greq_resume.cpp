@@ -0,0 +1,125 @@
+#include "greq_common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace greq {
+
+namespace {
+
+const int kResumeVersion = 1;
+const char* const kResumeSuffix = ".greq-partial";
+
+}  // namespace
+
+void reset_resume_state(ResumeState& state) {
+    state.validator.clear();
+    state.total = 0;
+    state.verified = 0;
+    state.unrecorded = false;
+    reset_digest(state.digest);
+}
+
+bool extend_resume_digest(ResumeState& state, int fd, uint64_t end, std::string& error) {
+    std::vector<char> buffer(1024 * 1024);
+    while (state.verified < end) {
+        const size_t want = static_cast<size_t>(std::min<uint64_t>(buffer.size(), end - state.verified));
+        const ssize_t got = pread(fd, buffer.data(), want, static_cast<off_t>(state.verified));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            error = got < 0 ? std::strerror(errno) : "file is shorter than its resume record";
+            return false;
+        }
+        update_digest(state.digest, buffer.data(), static_cast<size_t>(got));
+        state.verified += static_cast<uint64_t>(got);
+    }
+    return true;
+}
+
+bool load_resume_state(const std::string& output_path, const RequestOptions& options, ResumeState& state, std::string& error) {
+    state.path = output_path + kResumeSuffix;
+    reset_resume_state(state);
+
+    struct stat info = {};
+    if (stat(output_path.c_str(), &info) != 0 && errno != ENOENT) {
+        error = output_path + ": " + std::strerror(errno);
+        return false;
+    }
+    if (info.st_size == 0) {
+        unlink(state.path.c_str());
+        return true;
+    }
+
+    uint64_t recorded = static_cast<uint64_t>(info.st_size);
+    std::string recorded_digest;
+    std::ifstream in(state.path);
+    std::string line;
+    int version = 0;
+    while (std::getline(in, line)) {
+        const size_t equals = line.find('=');
+        if (line.empty() || line[0] == '#' || equals == std::string::npos) continue;
+        const std::string key = line.substr(0, equals);
+        const std::string value = line.substr(equals + 1);
+        if (key == "VERSION") version = std::atoi(value.c_str());
+        else if (key == "VALIDATOR") state.validator = value;
+        else if (key == "TOTAL") state.total = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "VERIFIED") recorded = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "SHA256") recorded_digest = value;
+    }
+    const bool have_record = version == kResumeVersion && !recorded_digest.empty();
+    if (!have_record) {
+        // Without a record this is curl's -C -: trust whatever is on disk.
+        state.validator.clear();
+        state.total = 0;
+        recorded = static_cast<uint64_t>(info.st_size);
+        state.unrecorded = true;
+        verbose_line(options, "No resume record for " + output_path + ", continuing after its " + format_size(recorded) + " unverified");
+    }
+
+    const int fd = open(output_path.c_str(), O_RDONLY | O_CLOEXEC);
+    std::string read_error;
+    if (fd < 0 || static_cast<uint64_t>(info.st_size) < recorded || !extend_resume_digest(state, fd, recorded, read_error) ||
+        (have_record && sha256_hex(state.digest) != recorded_digest)) {
+        verbose_line(options, "Partial file " + output_path + " does not match its resume record, starting over");
+        reset_resume_state(state);
+    } else if (have_record) {
+        verbose_line(options, "Verified " + format_size(state.verified) + " already downloaded to " + output_path);
+    }
+    if (fd >= 0) close(fd);
+    return true;
+}
+
+bool save_resume_state(const ResumeState& state, const std::string& url, std::string& error) {
+    std::string contents = "# greq partial download, continue with: greq -C - -o <file> <url>\n";
+    contents += "VERSION=" + std::to_string(kResumeVersion) + "\n";
+    contents += "URL=" + url + "\n";
+    contents += "VALIDATOR=" + state.validator + "\n";
+    contents += "TOTAL=" + std::to_string(state.total) + "\n";
+    contents += "VERIFIED=" + std::to_string(state.verified) + "\n";
+    contents += "SHA256=" + sha256_hex(state.digest) + "\n";
+
+    const std::string temp_path = state.path + ".tmp";
+    const int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && write_all_fd(fd, contents.data(), contents.size());
+    if (fd >= 0 && close(fd) != 0) ok = false;
+    if (!ok || rename(temp_path.c_str(), state.path.c_str()) != 0) {
+        error = state.path + ": " + std::strerror(errno);
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void discard_resume_state(const ResumeState& state) {
+    if (!state.path.empty()) unlink(state.path.c_str());
+}
+
+}  // namespace greq
@@ -0,0 +1,109 @@
+#include "greq_common.h"
+
+#include <cstdio>
+#include <iostream>
+
+namespace greq {
+
+namespace {
+
+std::string seconds(uint64_t ns) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6f", static_cast<double>(ns) / 1e9);
+    return buffer;
+}
+
+uint64_t speed(const TransferTiming& timing) {
+    return timing.total == 0 ? 0 : static_cast<uint64_t>(static_cast<double>(timing.size_download) * 1e9 / timing.total);
+}
+
+std::string http_code(int status) {
+    char buffer[8];
+    std::snprintf(buffer, sizeof(buffer), "%03d", status);
+    return buffer;
+}
+
+std::string json_string(const std::string& value) {
+    std::string out = "\"";
+    for (const char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned int>(c));
+            out += escape;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// The curl --write-out variables greq knows; false for any other name.
+bool write_out_variable(const std::string& name, const TransferTiming& timing, std::string& value) {
+    if (name == "time_namelookup") value = seconds(timing.namelookup);
+    else if (name == "time_connect") value = seconds(timing.connect);
+    else if (name == "time_appconnect") value = seconds(timing.appconnect);
+    else if (name == "time_pretransfer") value = seconds(timing.pretransfer);
+    else if (name == "time_starttransfer") value = seconds(timing.starttransfer);
+    else if (name == "time_redirect") value = seconds(timing.redirect);
+    else if (name == "time_total") value = seconds(timing.total);
+    else if (name == "size_download") value = std::to_string(timing.size_download);
+    else if (name == "speed_download") value = std::to_string(speed(timing));
+    else if (name == "http_code" || name == "response_code") value = http_code(timing.http_code);
+    else if (name == "num_redirects") value = std::to_string(timing.redirects);
+    else if (name == "url_effective") value = timing.url_effective;
+    else if (name == "json") value = timing_json(timing);
+    else return false;
+    return true;
+}
+
+}  // namespace
+
+uint64_t TransferTiming::elapsed() const {
+    return monotonic_ns() - start;
+}
+
+// Expands %{variable}, %% and the backslash escapes curl accepts in -w.
+std::string format_write_out(const std::string& format, const TransferTiming& timing) {
+    std::string out;
+    for (size_t i = 0; i < format.size(); ++i) {
+        const char c = format[i];
+        if (c == '%' && i + 1 < format.size() && format[i + 1] == '%') {
+            out += '%';
+            ++i;
+        } else if (c == '%' && i + 1 < format.size() && format[i + 1] == '{' && format.find('}', i) != std::string::npos) {
+            const size_t end = format.find('}', i);
+            const std::string name = format.substr(i + 2, end - i - 2);
+            std::string value;
+            if (write_out_variable(name, timing, value)) out += value;
+            else std::cerr << "greq: unknown --write-out variable: '" << name << "'" << std::endl;
+            i = end;
+        } else if (c == '\\' && i + 1 < format.size() &&
+                   (format[i + 1] == 'n' || format[i + 1] == 'r' || format[i + 1] == 't' || format[i + 1] == '\\')) {
+            const char next = format[++i];
+            out += next == 'n' ? '\n' : next == 'r' ? '\r' : next == 't' ? '\t' : '\\';
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+std::string timing_json(const TransferTiming& timing) {
+    return "{\"url_effective\":" + json_string(timing.url_effective) +
+        ",\"http_code\":" + std::to_string(timing.http_code) +
+        ",\"num_redirects\":" + std::to_string(timing.redirects) +
+        ",\"size_download\":" + std::to_string(timing.size_download) +
+        ",\"speed_download\":" + std::to_string(speed(timing)) +
+        ",\"time_namelookup\":" + seconds(timing.namelookup) +
+        ",\"time_connect\":" + seconds(timing.connect) +
+        ",\"time_appconnect\":" + seconds(timing.appconnect) +
+        ",\"time_pretransfer\":" + seconds(timing.pretransfer) +
+        ",\"time_starttransfer\":" + seconds(timing.starttransfer) +
+        ",\"time_redirect\":" + seconds(timing.redirect) +
+        ",\"time_total\":" + seconds(timing.total) + "}";
+}
+
+}  // namespace greq
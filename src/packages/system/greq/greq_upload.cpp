@@ -0,0 +1,303 @@
+#include "greq_common.h"
+#include "signals.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/rand.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace greq {
+
+namespace {
+
+const size_t kUploadBufferBytes = 64 * 1024;
+// Room in front of the buffer for a chunk-size line.
+const size_t kChunkPrefixBytes = 18;
+
+std::string boundary_string() {
+    unsigned char random[12] = {};
+    if (RAND_bytes(random, sizeof(random)) != 1) {
+        const uint64_t now = monotonic_ns();
+        std::memcpy(random, &now, sizeof(now));
+    }
+    static const char hex[] = "0123456789abcdef";
+    std::string boundary(24, '-');
+    for (const unsigned char byte : random) {
+        boundary += hex[byte >> 4];
+        boundary += hex[byte & 0x0f];
+    }
+    return boundary;
+}
+
+// Names and file names go in quoted strings; quotes and line breaks are
+// percent-encoded the way browsers do it.
+std::string quote_field(const std::string& value) {
+    std::string quoted = "\"";
+    for (const char c : value) {
+        if (c == '"') quoted += "%22";
+        else if (c == '\r') quoted += "%0D";
+        else if (c == '\n') quoted += "%0A";
+        else quoted += c;
+    }
+    return quoted + "\"";
+}
+
+std::string guess_content_type(const std::string& path) {
+    static const std::pair<const char*, const char*> types[] = {
+        {".txt", "text/plain"}, {".html", "text/html"}, {".htm", "text/html"}, {".css", "text/css"},
+        {".csv", "text/csv"}, {".json", "application/json"}, {".xml", "application/xml"}, {".pdf", "application/pdf"},
+        {".gz", "application/gzip"}, {".zip", "application/zip"}, {".zst", "application/zstd"},
+        {".png", "image/png"}, {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"}, {".gif", "image/gif"},
+        {".svg", "image/svg+xml"}, {".webp", "image/webp"},
+    };
+    const size_t dot = path.rfind('.');
+    if (dot != std::string::npos && path.find('/', dot) == std::string::npos) {
+        const std::string extension = to_lower(path.substr(dot));
+        for (const auto& type : types) {
+            if (extension == type.first) return type.second;
+        }
+    }
+    return "application/octet-stream";
+}
+
+void append_literal(UploadBody& body, const std::string& data) {
+    if (body.parts.empty() || !body.parts.back().path.empty()) body.parts.push_back(UploadPart());
+    body.parts.back().data += data;
+}
+
+bool write_chunk_frame(HttpConnection& conn, char* data, size_t size) {
+    // data has kChunkPrefixBytes free in front of it and two bytes after.
+    char prefix[kChunkPrefixBytes + 1];
+    const int length = std::snprintf(prefix, sizeof(prefix), "%zx\r\n", size);
+    std::memcpy(data - length, prefix, static_cast<size_t>(length));
+    data[size] = '\r';
+    data[size + 1] = '\n';
+    return connection_write(conn, data - length, static_cast<size_t>(length) + size + 2);
+}
+
+bool send_literal(HttpConnection& conn, const std::string& data, bool chunked) {
+    if (data.empty()) return true;
+    if (!chunked) return connection_write(conn, data.data(), data.size());
+    char size[kChunkPrefixBytes + 1];
+    const int length = std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+    const std::string frame = std::string(size, static_cast<size_t>(length)) + data + "\r\n";
+    return connection_write(conn, frame.data(), frame.size());
+}
+
+// Streams one file part: sendfile on plain connections when the length is
+// known, otherwise read through one fixed buffer. sendfile moves the file
+// position, so the buffered loop picks up where it stopped if the kernel
+// refuses partway.
+bool send_file(
+    HttpConnection& conn,
+    const UploadPart& part,
+    bool chunked,
+    std::vector<char>& buffer,
+    uint64_t& sent,
+    std::string& error
+) {
+    const bool from_stdin = part.path == "-";
+    const int fd = from_stdin ? STDIN_FILENO : open(part.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = part.path + ": " + std::strerror(errno);
+        return false;
+    }
+    const bool known = part.size >= 0;
+    uint64_t left = known ? static_cast<uint64_t>(part.size) : 0;
+    bool ok = true;
+
+    if (known && !chunked && !conn.ssl) {
+        while (left > 0 && !g_stop_sig) {
+            const ssize_t moved = sendfile(conn.fd, fd, nullptr, static_cast<size_t>(std::min<uint64_t>(left, 1u << 30)));
+            if (moved < 0 && errno == EINTR) continue;
+            if (moved <= 0) {
+                if (moved < 0 && (errno == EINVAL || errno == ENOSYS)) break;
+                ok = false;
+                error = moved == 0 ? part.path + " shrank while it was being uploaded"
+                      : errno == EAGAIN ? "timed out sending to " + conn.host
+                                        : "failed to send request body to " + conn.host;
+                break;
+            }
+            left -= static_cast<uint64_t>(moved);
+            sent += static_cast<uint64_t>(moved);
+        }
+    }
+    while (ok && (!known || left > 0) && !g_stop_sig) {
+        char* data = buffer.data() + kChunkPrefixBytes;
+        const size_t want = known ? static_cast<size_t>(std::min<uint64_t>(left, kUploadBufferBytes)) : kUploadBufferBytes;
+        const ssize_t got = read(fd, data, want);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            error = part.path + ": " + std::strerror(errno);
+            ok = false;
+            break;
+        }
+        if (got == 0) {
+            if (known) {
+                error = part.path + " shrank while it was being uploaded";
+                ok = false;
+            }
+            break;
+        }
+        const size_t size = static_cast<size_t>(got);
+        if (!(chunked ? write_chunk_frame(conn, data, size) : connection_write(conn, data, size))) {
+            error = "failed to send request body to " + conn.host;
+            ok = false;
+            break;
+        }
+        if (known) left -= size;
+        sent += size;
+    }
+    if (ok && g_stop_sig) {
+        error = "interrupted";
+        ok = false;
+    }
+    if (!from_stdin) close(fd);
+    return ok;
+}
+
+}  // namespace
+
+bool build_form_body(const std::vector<std::string>& fields, UploadBody& body, std::string& error) {
+    const std::string boundary = boundary_string();
+    body = UploadBody();
+    body.content_type = "multipart/form-data; boundary=" + boundary;
+    for (const auto& field : fields) {
+        const size_t equals = field.find('=');
+        if (equals == std::string::npos || equals == 0) {
+            error = "-F expects name=value, name=@file or name=<file, not '" + field + "'";
+            return false;
+        }
+        const std::string name = field.substr(0, equals);
+        std::string value = field.substr(equals + 1);
+        std::string header = "--" + boundary + "\r\nContent-Disposition: form-data; name=" + quote_field(name);
+
+        const bool attach = !value.empty() && value[0] == '@';
+        const bool inline_file = !value.empty() && value[0] == '<';
+        if (!attach && !inline_file) {
+            append_literal(body, header + "\r\n\r\n" + value + "\r\n");
+            continue;
+        }
+        // A file reference may carry ;type= and ;filename= after the path;
+        // other semicolons belong to the path.
+        std::string path = value.substr(1);
+        size_t cut = path.find(';');
+        while (cut != std::string::npos && path.compare(cut + 1, 5, "type=") != 0 &&
+               path.compare(cut + 1, 9, "filename=") != 0) {
+            cut = path.find(';', cut + 1);
+        }
+        std::string type;
+        std::string file_name;
+        if (cut != std::string::npos) {
+            std::string settings = path.substr(cut + 1);
+            path.erase(cut);
+            while (!settings.empty()) {
+                const size_t next = settings.find(';');
+                const std::string setting = settings.substr(0, next);
+                settings = next == std::string::npos ? "" : settings.substr(next + 1);
+                if (setting.compare(0, 5, "type=") == 0) {
+                    type = setting.substr(5);
+                } else if (setting.compare(0, 9, "filename=") == 0) {
+                    file_name = setting.substr(9);
+                } else {
+                    error = "-F " + name + ": unknown setting '" + setting + "'";
+                    return false;
+                }
+            }
+        }
+        if (path.empty()) {
+            error = "-F " + name + " names no file";
+            return false;
+        }
+        if (attach) {
+            if (file_name.empty()) file_name = path == "-" ? "-" : path.substr(path.find_last_of('/') + 1);
+            header += "; filename=" + quote_field(file_name) + "\r\nContent-Type: " +
+                (type.empty() ? guess_content_type(path) : type);
+        } else if (!type.empty()) {
+            header += "\r\nContent-Type: " + type;
+        }
+        append_literal(body, header + "\r\n\r\n");
+        UploadPart file;
+        file.path = path;
+        body.parts.push_back(file);
+        append_literal(body, "\r\n");
+    }
+    append_literal(body, "--" + boundary + "--\r\n");
+    return true;
+}
+
+bool prepare_upload(UploadBody& body, std::string& error) {
+    int64_t length = 0;
+    for (auto& part : body.parts) {
+        if (part.path.empty()) {
+            part.size = static_cast<int64_t>(part.data.size());
+        } else {
+            struct stat info = {};
+            const int status = part.path == "-" ? fstat(STDIN_FILENO, &info) : stat(part.path.c_str(), &info);
+            if (status != 0 || (part.path != "-" && access(part.path.c_str(), R_OK) != 0)) {
+                error = part.path + ": " + std::strerror(errno);
+                return false;
+            }
+            if (S_ISDIR(info.st_mode)) {
+                error = part.path + ": is a directory";
+                return false;
+            }
+            part.size = -1;
+            if (S_ISREG(info.st_mode)) {
+                // Redirected stdin may already be partly read.
+                const off_t position = part.path == "-" ? lseek(STDIN_FILENO, 0, SEEK_CUR) : 0;
+                part.size = static_cast<int64_t>(info.st_size) - std::max<off_t>(position, 0);
+            }
+        }
+        if (part.size < 0) length = -1;
+        if (length >= 0) length += part.size;
+    }
+    body.length = length;
+    return true;
+}
+
+bool upload_replayable(const UploadBody& body) {
+    for (const auto& part : body.parts) {
+        if (part.path == "-" || (!part.path.empty() && part.size < 0)) return false;
+    }
+    return true;
+}
+
+bool send_upload(HttpConnection& conn, const UploadBody& body, const RequestOptions& options, std::string& error) {
+    const bool chunked = body.length < 0;
+    std::vector<char> buffer(kChunkPrefixBytes + kUploadBufferBytes + 2);
+    // Corked, the part headers and the first file bytes share segments
+    // despite TCP_NODELAY.
+    int on = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    uint64_t sent = 0;
+    bool ok = true;
+    for (const auto& part : body.parts) {
+        if (part.path.empty()) {
+            ok = send_literal(conn, part.data, chunked);
+            if (!ok) error = "failed to send request body to " + conn.host;
+            sent += part.data.size();
+        } else {
+            ok = send_file(conn, part, chunked, buffer, sent, error);
+        }
+        if (!ok) break;
+    }
+    if (ok && chunked && !connection_write(conn, "0\r\n\r\n", 5)) {
+        error = "failed to send request body to " + conn.host;
+        ok = false;
+    }
+    on = 0;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    if (ok) verbose_line(options, "Uploaded " + format_size(sent) + (chunked ? " (chunked)" : ""));
+    return ok;
+}
+
+}  // namespace greq
@@ -0,0 +1,223 @@
+#include "greq_common.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <openssl/evp.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace greq {
+
+std::string to_lower(std::string value) {
+    for (char& c : value) {
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+    }
+    return value;
+}
+
+std::string trim(const std::string& value) {
+    const size_t start = value.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) return "";
+    const size_t end = value.find_last_not_of(" \t\r\n");
+    return value.substr(start, end - start + 1);
+}
+
+bool parse_url(const std::string& text, Url& url, std::string& error) {
+    std::string rest = text;
+    url = Url();
+    const size_t scheme_end = rest.find("://");
+    if (scheme_end == std::string::npos) {
+        url.scheme = "http";
+    } else {
+        url.scheme = to_lower(rest.substr(0, scheme_end));
+        rest = rest.substr(scheme_end + 3);
+    }
+    if (url.scheme != "http" && url.scheme != "https") {
+        error = "unsupported protocol '" + url.scheme + "'";
+        return false;
+    }
+
+    const size_t path_start = rest.find_first_of("/?#");
+    std::string authority = rest.substr(0, path_start);
+    url.target = path_start == std::string::npos ? "/" : rest.substr(path_start);
+    const size_t fragment = url.target.find('#');
+    if (fragment != std::string::npos) url.target.erase(fragment);
+    if (url.target.empty() || url.target[0] != '/') url.target = "/" + url.target;
+
+    const size_t at = authority.rfind('@');
+    if (at != std::string::npos) authority = authority.substr(at + 1);
+
+    url.port = url.tls() ? 443 : 80;
+    std::string port_text;
+    if (!authority.empty() && authority[0] == '[') {
+        const size_t close = authority.find(']');
+        if (close == std::string::npos) {
+            error = "malformed IPv6 address in '" + text + "'";
+            return false;
+        }
+        url.host = authority.substr(1, close - 1);
+        if (close + 1 < authority.size() && authority[close + 1] == ':') port_text = authority.substr(close + 2);
+    } else {
+        const size_t colon = authority.rfind(':');
+        url.host = authority.substr(0, colon);
+        if (colon != std::string::npos) port_text = authority.substr(colon + 1);
+    }
+    if (!port_text.empty()) {
+        char* end = nullptr;
+        const long port = std::strtol(port_text.c_str(), &end, 10);
+        if (*end != '\0' || port <= 0 || port > 65535) {
+            error = "invalid port in '" + text + "'";
+            return false;
+        }
+        url.port = static_cast<int>(port);
+    }
+    if (url.host.empty()) {
+        error = "no host in '" + text + "'";
+        return false;
+    }
+    return true;
+}
+
+bool resolve_location(const Url& base, const std::string& location, Url& url, std::string& error) {
+    if (location.find("://") != std::string::npos) return parse_url(location, url, error);
+    url = base;
+    if (location.compare(0, 2, "//") == 0) return parse_url(base.scheme + ":" + location, url, error);
+    if (!location.empty() && location[0] == '/') {
+        url.target = location;
+        return true;
+    }
+    std::string directory = base.target.substr(0, base.target.find('?'));
+    directory = directory.substr(0, directory.rfind('/') + 1);
+    url.target = directory + location;
+    return true;
+}
+
+std::string url_to_string(const Url& url) {
+    const bool default_port = url.port == (url.tls() ? 443 : 80);
+    const bool ipv6 = url.host.find(':') != std::string::npos;
+    std::string text = url.scheme + "://" + (ipv6 ? "[" + url.host + "]" : url.host);
+    if (!default_port) text += ":" + std::to_string(url.port);
+    return text + url.target;
+}
+
+std::string remote_file_name(const Url& url) {
+    std::string path = url.target.substr(0, url.target.find('?'));
+    const size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos) path = path.substr(slash + 1);
+    return path.empty() ? "index.html" : path;
+}
+
+std::string base64_encode(const std::string& value) {
+    std::string encoded(4 * ((value.size() + 2) / 3) + 1, '\0');
+    const int length = EVP_EncodeBlock(
+        reinterpret_cast<unsigned char*>(&encoded[0]),
+        reinterpret_cast<const unsigned char*>(value.data()),
+        static_cast<int>(value.size())
+    );
+    encoded.resize(length < 0 ? 0 : static_cast<size_t>(length));
+    return encoded;
+}
+
+void verbose_line(const RequestOptions& options, const std::string& message) {
+    if (options.verbose) std::cerr << "[GREQ] " << message << std::endl;
+}
+
+std::string format_size(uint64_t bytes) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024.0;
+        ++unit;
+    }
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return buffer;
+}
+
+// Accepts a byte count with an optional K, M, G or T (binary) suffix.
+bool parse_size(const std::string& text, uint64_t& bytes) {
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str() || errno != 0) return false;
+    const std::string suffix = to_lower(end);
+    int shift = 0;
+    if (suffix.empty() || suffix == "b") shift = 0;
+    else if (suffix == "k" || suffix == "kib") shift = 10;
+    else if (suffix == "m" || suffix == "mib") shift = 20;
+    else if (suffix == "g" || suffix == "gib") shift = 30;
+    else if (suffix == "t" || suffix == "tib") shift = 40;
+    else return false;
+    if (shift > 0 && value > (~0ull >> shift)) return false;
+    bytes = static_cast<uint64_t>(value) << shift;
+    return true;
+}
+
+bool parse_duration(const std::string& text, uint64_t& ms) {
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str() || errno != 0) return false;
+    const std::string suffix = to_lower(end);
+    uint64_t scale = 0;
+    if (suffix == "ms") scale = 1;
+    else if (suffix.empty() || suffix == "s") scale = 1000;
+    else if (suffix == "m") scale = 60 * 1000;
+    else if (suffix == "h") scale = 60 * 60 * 1000;
+    else return false;
+    if (value > ~0ull / scale) return false;
+    ms = static_cast<uint64_t>(value) * scale;
+    return true;
+}
+
+uint64_t monotonic_ms() {
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + static_cast<uint64_t>(now.tv_nsec) / 1000000;
+}
+
+uint64_t monotonic_ns() {
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + static_cast<uint64_t>(now.tv_nsec);
+}
+
+// Removes what a failed download left behind, but never a device or other
+// non-regular file such as -o /dev/null.
+void remove_output(const std::string& path) {
+    struct stat info = {};
+    if (lstat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) unlink(path.c_str());
+}
+
+bool write_all_fd(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool pwrite_all_fd(int fd, const char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        const ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+        offset += static_cast<uint64_t>(written);
+    }
+    return true;
+}
+
+}  // namespace greq
@@ -8,12 +8,27 @@
 #include <unistd.h>
 
 int main(int argc, char* argv[]) {
+    std::string image_path;
+    bool resume = false;
+    std::string progress_json;
     for (int i = 1; i < argc; ++i) {
         const std::string arg = argv[i];
         if (arg == "-v" || arg == "--verbose") installer::g_verbose = true;
+        if (arg == "--image" && i + 1 < argc) image_path = argv[++i];
+        if (arg == "--resume") resume = true;
+        if (arg == "--progress-json" && i + 1 < argc) progress_json = argv[++i];
     }
 
-    installer::write_text_file(installer::kLogPath, "");
+    // A resumed install keeps appending to the log of the interrupted run.
+    installer::start_logging(!resume);
+
+    // One JSON record per second and per finished stage, for unattended runs
+    // that have nobody watching the progress line. Set up before any other
+    // output, so none of it lands among the JSON lines.
+    if (!progress_json.empty() && !installer::set_progress_json_output(progress_json)) {
+        installer::print_notice("Error:", installer::C_RED, "Cannot write progress to " + progress_json + ".");
+        return 1;
+    }
 
     installer::print_header("Welcome");
     std::cout << "Welcome to the " << OS_NAME << " installer.\n";
@@ -33,10 +48,32 @@ int main(int argc, char* argv[]) {
     std::string unused;
     std::getline(std::cin, unused);
 
-    installer::InstallerConfig config;
-    if (!installer::configure_installer(config, tools)) {
-        installer::print_notice("!", installer::C_YELLOW, "Installation cancelled by user.");
-        return 0;
+    installer::InstallJournal journal;
+    if (resume) {
+        std::string journal_error;
+        if (!installer::load_install_journal(journal, journal_error)) {
+            installer::print_notice("Error:", installer::C_RED, journal_error);
+            return 1;
+        }
+        if (!installer::confirm_resume(journal)) {
+            installer::print_notice("!", installer::C_YELLOW, "Installation cancelled by user.");
+            return 0;
+        }
+    } else {
+        installer::InstallerConfig& config = journal.config;
+        if (!image_path.empty()) {
+            std::string image_error;
+            uint64_t image_bytes = 0;
+            if (!installer::inspect_filesystem_image(image_path, config.filesystem, image_bytes, image_error)) {
+                installer::print_notice("Error:", installer::C_RED, image_error);
+                return 1;
+            }
+            config.image_path = image_path;
+        }
+        if (!installer::configure_installer(config, tools)) {
+            installer::print_notice("!", installer::C_YELLOW, "Installation cancelled by user.");
+            return 0;
+        }
     }
 
     installer::print_header("Installing");
@@ -44,18 +81,22 @@ int main(int argc, char* argv[]) {
     std::cout << "Detailed command output is being written to " << installer::kLogPath << ".\n\n";
 
     std::string error;
-    if (!installer::perform_install(tools, config, error)) {
+    if (!installer::perform_install(tools, journal, error)) {
+        installer::flush_log();
         installer::print_notice("Error:", installer::C_RED, error.empty() ? "Installation failed." : error);
         std::cout << "\nReview " << installer::kLogPath << " for the failing command.\n";
+        std::cout << "After fixing the cause, run the installer with --resume to finish the remaining steps.\n";
         return 1;
     }
 
     installer::print_header("Complete");
+    installer::flush_log();
     installer::print_notice("Success:", installer::C_GREEN, "Installation completed successfully.");
     std::cout << "Target root: " << installer::kTargetRoot << "\n";
     std::cout << "Log file:    " << installer::kLogPath << "\n\n";
 
     if (installer::prompt_yes_no("Reboot now?", true)) {
+        installer::stop_logging();
         ::sync();
         reboot(RB_AUTOBOOT);
         installer::print_notice("Warning:", installer::C_YELLOW, "Reboot request failed.");
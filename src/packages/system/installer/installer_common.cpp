@@ -10,8 +10,14 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <linux/fs.h>
+#include <linux/netlink.h>
+#include <poll.h>
 #include <sstream>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <termios.h>
 #include <sys/wait.h>
@@ -31,6 +37,7 @@ const char* C_BG_BLUE = "\033[44m";
 
 const std::string kTargetRoot = "/mnt/target";
 const std::string kLogPath = "/tmp/geminios-installer.log";
+const int kMkfsTimeoutMs = 30 * 60 * 1000;
 
 bool g_verbose = false;
 
@@ -85,12 +92,6 @@ std::string join_strings(const std::vector<std::string>& items, const std::strin
     return out.str();
 }
 
-void append_log_line(const std::string& line) {
-    std::ofstream log(kLogPath, std::ios::app);
-    if (!log) return;
-    log << line << "\n";
-}
-
 std::string timestamp_string() {
     std::time_t now = std::time(nullptr);
     std::tm tm_now;
@@ -100,14 +101,6 @@ std::string timestamp_string() {
     return buffer;
 }
 
-void log_message(const std::string& level, const std::string& message) {
-    const std::string line = "[" + timestamp_string() + "] [" + level + "] " + message;
-    append_log_line(line);
-    if (g_verbose) {
-        std::cerr << line << std::endl;
-    }
-}
-
 void clear_screen() {
     std::cout << "\033[2J\033[1;1H";
 }
@@ -267,155 +260,6 @@ std::string format_command(const std::string& path, const std::vector<std::strin
     return command;
 }
 
-CommandResult run_command(const std::string& path, const std::vector<std::string>& args, const std::string& stdin_data) {
-    if (path.empty()) {
-        return {false, -1, "missing executable path"};
-    }
-
-    log_message("INFO", "EXEC " + format_command(path, args));
-
-    int stdin_pipe[2] = {-1, -1};
-    if (!stdin_data.empty() && pipe(stdin_pipe) != 0) {
-        return {false, -1, "failed to create stdin pipe"};
-    }
-
-    pid_t pid = fork();
-    if (pid < 0) {
-        if (stdin_pipe[0] >= 0) {
-            close(stdin_pipe[0]);
-            close(stdin_pipe[1]);
-        }
-        return {false, -1, "fork failed"};
-    }
-
-    if (pid == 0) {
-        if (!stdin_data.empty()) {
-            close(stdin_pipe[1]);
-            dup2(stdin_pipe[0], STDIN_FILENO);
-            close(stdin_pipe[0]);
-        }
-
-        int log_fd = open(kLogPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
-        if (log_fd >= 0) {
-            dup2(log_fd, STDOUT_FILENO);
-            dup2(log_fd, STDERR_FILENO);
-            close(log_fd);
-        }
-
-        std::vector<char*> exec_args;
-        exec_args.push_back(const_cast<char*>(path.c_str()));
-        for (const auto& arg : args) {
-            exec_args.push_back(const_cast<char*>(arg.c_str()));
-        }
-        exec_args.push_back(nullptr);
-
-        execv(path.c_str(), exec_args.data());
-        std::cerr << "execv failed for " << path << ": " << std::strerror(errno) << std::endl;
-        _exit(127);
-    }
-
-    if (!stdin_data.empty()) {
-        close(stdin_pipe[0]);
-        ssize_t remaining = static_cast<ssize_t>(stdin_data.size());
-        const char* cursor = stdin_data.data();
-        while (remaining > 0) {
-            ssize_t written = write(stdin_pipe[1], cursor, static_cast<size_t>(remaining));
-            if (written < 0) break;
-            remaining -= written;
-            cursor += written;
-        }
-        close(stdin_pipe[1]);
-    }
-
-    int status = 0;
-    if (waitpid(pid, &status, 0) < 0) {
-        return {false, -1, "waitpid failed"};
-    }
-
-    if (WIFEXITED(status)) {
-        const int exit_code = WEXITSTATUS(status);
-        const bool ok = exit_code == 0;
-        if (!ok) {
-            log_message("ERROR", "Command failed with exit code " + std::to_string(exit_code) + ". See " + kLogPath);
-        }
-        return {ok, exit_code, ok ? "" : "exit code " + std::to_string(exit_code)};
-    }
-
-    if (WIFSIGNALED(status)) {
-        const int sig = WTERMSIG(status);
-        log_message("ERROR", "Command terminated by signal " + std::to_string(sig) + ". See " + kLogPath);
-        return {false, 128 + sig, "signal " + std::to_string(sig)};
-    }
-
-    return {false, -1, "command did not exit cleanly"};
-}
-
-CommandResult run_command_capture(const std::string& path, const std::vector<std::string>& args, std::string& output) {
-    output.clear();
-    if (path.empty()) return {false, -1, "missing executable path"};
-
-    log_message("INFO", "EXEC " + format_command(path, args));
-
-    int out_pipe[2];
-    if (pipe(out_pipe) != 0) {
-        return {false, -1, "failed to create capture pipe"};
-    }
-
-    pid_t pid = fork();
-    if (pid < 0) {
-        close(out_pipe[0]);
-        close(out_pipe[1]);
-        return {false, -1, "fork failed"};
-    }
-
-    if (pid == 0) {
-        close(out_pipe[0]);
-        dup2(out_pipe[1], STDOUT_FILENO);
-        close(out_pipe[1]);
-
-        int log_fd = open(kLogPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
-        if (log_fd >= 0) {
-            dup2(log_fd, STDERR_FILENO);
-            close(log_fd);
-        }
-
-        std::vector<char*> exec_args;
-        exec_args.push_back(const_cast<char*>(path.c_str()));
-        for (const auto& arg : args) {
-            exec_args.push_back(const_cast<char*>(arg.c_str()));
-        }
-        exec_args.push_back(nullptr);
-
-        execv(path.c_str(), exec_args.data());
-        std::cerr << "execv failed for " << path << ": " << std::strerror(errno) << std::endl;
-        _exit(127);
-    }
-
-    close(out_pipe[1]);
-    char buffer[4096];
-    ssize_t read_count = 0;
-    while ((read_count = read(out_pipe[0], buffer, sizeof(buffer))) > 0) {
-        output.append(buffer, static_cast<size_t>(read_count));
-    }
-    close(out_pipe[0]);
-
-    int status = 0;
-    if (waitpid(pid, &status, 0) < 0) {
-        return {false, -1, "waitpid failed"};
-    }
-
-    if (WIFEXITED(status)) {
-        const int exit_code = WEXITSTATUS(status);
-        return {exit_code == 0, exit_code, exit_code == 0 ? "" : "exit code " + std::to_string(exit_code)};
-    }
-
-    if (WIFSIGNALED(status)) {
-        return {false, 128 + WTERMSIG(status), "signal " + std::to_string(WTERMSIG(status))};
-    }
-
-    return {false, -1, "command did not exit cleanly"};
-}
-
 bool prompt_yes_no(const std::string& question, bool default_value) {
     while (true) {
         std::cout << question << (default_value ? " [Y/n]: " : " [y/N]: ");
@@ -706,12 +550,128 @@ std::string partition_path(const std::string& disk, int partition_number) {
     return disk + std::to_string(partition_number);
 }
 
-bool wait_for_path(const std::string& path, int retries, int delay_ms) {
-    for (int i = 0; i < retries; ++i) {
-        if (file_exists(path)) return true;
-        usleep(delay_ms * 1000);
+uint64_t monotonic_ms() {
+    struct timespec now {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000ULL + static_cast<uint64_t>(now.tv_nsec) / 1000000ULL;
+}
+
+namespace {
+
+int open_uevent_socket() {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) return -1;
+
+    struct sockaddr_nl addr {};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
     }
-    return false;
+    return fd;
+}
+
+int open_directory_watch(const std::vector<std::string>& dirs) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return -1;
+
+    bool watching = false;
+    for (const auto& dir : dirs) {
+        if (inotify_add_watch(fd, dir.c_str(), IN_CREATE | IN_MOVED_TO | IN_ATTRIB) >= 0) {
+            watching = true;
+        }
+    }
+    if (!watching) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void drain_fd(int fd) {
+    char buffer[8192];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+}  // namespace
+
+bool wait_for_device_event(
+    const std::function<bool()>& ready,
+    int timeout_ms,
+    const std::vector<std::string>& watch_dirs
+) {
+    if (ready()) return true;
+
+    // Subscribe before re-checking so a node created between the first check
+    // and the subscription still wakes us up. The kernel uevent and the
+    // devtmpfs inotify event are both emitted as soon as the node exists, so
+    // the common case returns without ever sleeping.
+    const int uevent_fd = open_uevent_socket();
+    const int inotify_fd = open_directory_watch(watch_dirs);
+    if (uevent_fd < 0 && inotify_fd < 0) {
+        log_message("WARN", "Device event sources unavailable; falling back to polling.");
+    }
+
+    struct pollfd fds[2];
+    nfds_t fd_count = 0;
+    if (uevent_fd >= 0) fds[fd_count++] = {uevent_fd, POLLIN, 0};
+    if (inotify_fd >= 0) fds[fd_count++] = {inotify_fd, POLLIN, 0};
+
+    const uint64_t deadline = monotonic_ms() + static_cast<uint64_t>(std::max(timeout_ms, 0));
+    bool satisfied = ready();
+    while (!satisfied) {
+        const uint64_t now = monotonic_ms();
+        if (now >= deadline) break;
+        int wait_ms = static_cast<int>(deadline - now);
+
+        if (fd_count == 0) {
+            usleep(static_cast<useconds_t>(std::min(wait_ms, 50)) * 1000);
+        } else if (poll(fds, fd_count, wait_ms) > 0) {
+            for (nfds_t i = 0; i < fd_count; ++i) {
+                if (fds[i].revents & POLLIN) drain_fd(fds[i].fd);
+            }
+        }
+        satisfied = ready();
+    }
+
+    if (uevent_fd >= 0) close(uevent_fd);
+    if (inotify_fd >= 0) close(inotify_fd);
+    return satisfied;
+}
+
+bool wait_for_paths(const std::vector<std::string>& paths, int timeout_ms) {
+    std::vector<std::string> watch_dirs;
+    for (const auto& path : paths) {
+        const std::string::size_type slash = path.find_last_of('/');
+        const std::string dir = slash == std::string::npos || slash == 0 ? "/" : path.substr(0, slash);
+        if (std::find(watch_dirs.begin(), watch_dirs.end(), dir) == watch_dirs.end()) {
+            watch_dirs.push_back(dir);
+        }
+    }
+
+    const uint64_t started = monotonic_ms();
+    const bool ok = wait_for_device_event(
+        [&paths]() {
+            for (const auto& path : paths) {
+                if (!file_exists(path)) return false;
+            }
+            return true;
+        },
+        timeout_ms,
+        watch_dirs
+    );
+    log_message(
+        ok ? "INFO" : "WARN",
+        (ok ? "Device nodes ready after " : "Timed out after ") + std::to_string(monotonic_ms() - started) +
+            " ms waiting for " + join_strings(paths)
+    );
+    return ok;
+}
+
+bool wait_for_path(const std::string& path, int timeout_ms) {
+    return wait_for_paths({path}, timeout_ms);
 }
 
 bool ensure_file_removed(const std::string& path) {
@@ -756,7 +716,7 @@ void cleanup_install_state(InstallState& state) {
     state.mounted_paths.clear();
 }
 
-bool copy_tree(const ToolRegistry& tools, const std::string& source, const std::string& destination_path) {
+bool copy_tree(const ToolRegistry& tools, const std::string& source, const std::string& destination_path, bool keep_existing) {
     if (!file_exists(source)) {
         log_message("WARN", "Skipping missing source path " + source);
         return true;
@@ -771,33 +731,99 @@ bool copy_tree(const ToolRegistry& tools, const std::string& source, const std::
         }
     }
 
-    CommandResult result = run_command(tools.cp, {"-a", source, destination_path});
+    // -T merges into a destination directory that already exists (the
+    // install journal lives under /var/lib) instead of nesting inside it.
+    // keep_existing additionally leaves files already there (the boot
+    // readahead pack) untouched.
+    const std::vector<std::string> args = keep_existing
+        ? std::vector<std::string>{"-a", "-T", "--update=none", source, destination_path}
+        : std::vector<std::string>{"-a", "-T", source, destination_path};
+    CommandResult result = run_command(tools.cp, args);
     return result.success;
 }
 
-std::string capture_blkid_value(const ToolRegistry& tools, const std::string& device, const std::string& key) {
-    if (tools.blkid.empty() || device.empty()) return "";
+bool copy_listed_paths(
+    const ToolRegistry& tools,
+    const std::string& source_root,
+    const std::vector<std::string>& paths,
+    std::string& error
+) {
+    // cp --parents recreates each path's directories under the target. The
+    // batches run one after another so files land in the order given.
+    const size_t kBatchSize = 256;
+    std::vector<CommandJob> jobs;
+    for (size_t start = 0; start < paths.size(); start += kBatchSize) {
+        CommandJob job;
+        job.path = tools.cp;
+        job.working_directory = source_root;
+        job.args = {"-a", "--parents", "--remove-destination", "-t", kTargetRoot};
+        const size_t end = std::min(paths.size(), start + kBatchSize);
+        for (size_t i = start; i < end; ++i) job.args.push_back(paths[i].substr(1));
+        jobs.push_back(job);
+    }
+
+    for (const auto& result : run_commands(jobs, 1)) {
+        if (!result.result.success) {
+            error = "Failed to copy files from " + source_root + ". See " + kLogPath;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool uses_btrfs_subvolumes(const InstallerConfig& config) {
+    return config.filesystem == FilesystemType::Btrfs && config.btrfs_subvolumes;
+}
+
+const std::vector<BtrfsSubvolume>& btrfs_subvolume_layout() {
+    // @swap keeps the NOCOW swapfile out of @, so snapshots of the root
+    // subvolume never trip over an active swapfile.
+    static const std::vector<BtrfsSubvolume> layout = {
+        {"@", "/"},
+        {"@home", "/home"},
+        {"@var_log", "/var/log"},
+        {"@snapshots", "/.snapshots"},
+        {"@swap", "/swap"},
+    };
+    return layout;
+}
 
-    std::string output;
-    CommandResult result = run_command_capture(tools.blkid, {"-s", key, "-o", "value", device}, output);
-    if (!result.success) return "";
-    return trim(output);
+std::string swapfile_path(const InstallerConfig& config) {
+    return uses_btrfs_subvolumes(config) ? "/swap/swapfile" : "/swapfile";
 }
 
 bool create_swapfile(const ToolRegistry& tools, const InstallerConfig& config) {
     if (config.swap_mode != SwapMode::Swapfile || config.swap_size_mb <= 0) return true;
-    if (config.filesystem == FilesystemType::Btrfs || config.filesystem == FilesystemType::F2fs) {
+    if (config.filesystem == FilesystemType::F2fs) {
         log_message("ERROR", "Swapfiles on " + filesystem_label(config.filesystem) + " are not supported by this installer yet. Use a swap partition instead.");
         return false;
     }
 
-    const std::string swapfile = kTargetRoot + "/swapfile";
+    const std::string swapfile = kTargetRoot + swapfile_path(config);
     int fd = open(swapfile.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0600);
     if (fd < 0) {
         log_message("ERROR", "Failed to create swapfile: " + std::string(std::strerror(errno)));
         return false;
     }
 
+    if (config.filesystem == FilesystemType::Btrfs) {
+        // btrfs only accepts swapfiles without copy-on-write (and therefore
+        // without compression). The flag must be set while the file is
+        // still empty.
+        int flags = 0;
+        bool nocow = ioctl(fd, FS_IOC_GETFLAGS, &flags) == 0;
+        if (nocow) {
+            flags |= FS_NOCOW_FL;
+            nocow = ioctl(fd, FS_IOC_SETFLAGS, &flags) == 0;
+        }
+        if (!nocow) {
+            log_message("ERROR", "Failed to mark swapfile NOCOW: " + std::string(std::strerror(errno)));
+            close(fd);
+            ensure_file_removed(swapfile);
+            return false;
+        }
+    }
+
     const off_t size = static_cast<off_t>(config.swap_size_mb) * 1024 * 1024;
     const int fallocate_result = posix_fallocate(fd, 0, size);
     if (fallocate_result != 0) {
@@ -838,8 +864,14 @@ ToolRegistry detect_tools() {
     tools.mkfs_ext4 = find_executable("mkfs.ext4");
     tools.mkfs_xfs = find_executable("mkfs.xfs");
     tools.mkfs_btrfs = find_executable("mkfs.btrfs");
+    tools.btrfs = find_executable("btrfs");
     tools.mkfs_f2fs = find_executable("mkfs.f2fs");
     tools.mkfs_vfat = find_executable("mkfs.vfat");
+    tools.e2fsck = find_executable("e2fsck");
+    tools.tune2fs = find_executable("tune2fs");
+    tools.resize2fs = find_executable("resize2fs");
+    tools.xfs_admin = find_executable("xfs_admin");
+    tools.xfs_growfs = find_executable("xfs_growfs");
     tools.mkswap = find_executable("mkswap");
     tools.blkid = find_executable("blkid");
     tools.grub_install = find_executable("grub-install");
@@ -23,6 +23,7 @@ extern const char* C_BG_BLUE;
 
 extern const std::string kTargetRoot;
 extern const std::string kLogPath;
+extern const int kMkfsTimeoutMs;
 
 extern bool g_verbose;
 
@@ -47,7 +48,8 @@ enum class FilesystemType {
 enum class SwapMode {
     None,
     Swapfile,
-    Partition
+    Partition,
+    Zram
 };
 
 enum class BootloaderChoice {
@@ -61,6 +63,13 @@ enum class InstallProfile {
     Developer
 };
 
+enum class StorageMedia {
+    Rotational,
+    Ssd,
+    Nvme,
+    Emmc
+};
+
 struct DiskInfo {
     std::string name;
     std::string path;
@@ -82,6 +91,10 @@ struct InstallerConfig {
     PartitionMode partition_mode = PartitionMode::AutoWipe;
     BootMode boot_mode = BootMode::Auto;
     FilesystemType filesystem = FilesystemType::Ext4;
+    bool btrfs_subvolumes = true;
+    // When set, the root partition is written from this prebuilt ext4/xfs
+    // image instead of being formatted and filled file by file.
+    std::string image_path;
     SwapMode swap_mode = SwapMode::Swapfile;
     BootloaderChoice bootloader = BootloaderChoice::Grub;
     InstallProfile profile = InstallProfile::Desktop;
@@ -93,6 +106,10 @@ struct InstallerConfig {
     bool format_efi = true;
     std::string swap_partition;
     int swap_size_mb = 2048;
+    bool zswap = false;
+    std::string swap_compressor = "zstd";
+    int zram_percent = 50;
+    bool zram_per_cpu = false;
 
     std::string hostname = "geminios-pc";
     std::string timezone = "UTC";
@@ -110,8 +127,14 @@ struct ToolRegistry {
     std::string mkfs_ext4;
     std::string mkfs_xfs;
     std::string mkfs_btrfs;
+    std::string btrfs;
     std::string mkfs_f2fs;
     std::string mkfs_vfat;
+    std::string e2fsck;
+    std::string tune2fs;
+    std::string resize2fs;
+    std::string xfs_admin;
+    std::string xfs_growfs;
     std::string mkswap;
     std::string blkid;
     std::string grub_install;
@@ -126,6 +149,48 @@ struct CommandResult {
     std::string message;
 };
 
+// One command for run_commands(). Output is logged line by line unless
+// capture_output is set, in which case stdout is returned and only stderr
+// is logged. A timeout of 0 means no limit.
+struct CommandJob {
+    std::string path;
+    std::vector<std::string> args;
+    std::string stdin_data;
+    std::string working_directory;
+    bool capture_output = false;
+    bool log_failure = true;
+    int timeout_ms = 0;
+};
+
+struct CommandJobResult {
+    CommandResult result;
+    std::string output;
+    bool timed_out = false;
+    uint64_t elapsed_ms = 0;
+    uint64_t user_ms = 0;
+    uint64_t system_ms = 0;
+    long max_rss_kb = 0;
+};
+
+// Identifiers read straight from a block device's superblock and its
+// disk's partition table. Empty fields mean "not present".
+struct BlockProbe {
+    std::string device;
+    std::string disk;
+    int partition_number = 0;
+    uint64_t bytes = 0;
+    std::string fs_type;
+    std::string uuid;
+    std::string label;
+    std::string partuuid;
+    std::string part_type;
+};
+
+struct IsoVolume {
+    std::string device;
+    std::string volume_id;
+};
+
 struct InstallArtifacts {
     std::string root_partition;
     std::string efi_partition;
@@ -133,21 +198,97 @@ struct InstallArtifacts {
     std::string root_uuid;
     std::string root_partuuid;
     std::string efi_uuid;
+    std::string efi_partuuid;
     std::string swap_uuid;
+    std::string swap_partuuid;
+    std::string disk_id;
+};
+
+struct StorageProfile {
+    std::string disk;
+    StorageMedia media = StorageMedia::Rotational;
+    bool rotational = true;
+    bool supports_discard = false;
+    bool periodic_trim = false;
+    uint64_t discard_granularity = 0;
+    uint64_t minimum_io_size = 0;
+    uint64_t optimal_io_size = 0;
+    uint64_t physical_block_size = 0;
+    std::vector<std::string> mkfs_args;
+    bool noatime = false;
+    std::vector<std::string> mount_options;
+    int btrfs_compress_level = 0;
+    std::string io_scheduler;
+};
+
+struct BtrfsSubvolume {
+    const char* name;
+    const char* mountpoint;
+};
+
+struct ManifestEntry {
+    std::string path;
+    mode_t mode = 0;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+struct CopyManifest {
+    std::string source_root;
+    std::vector<ManifestEntry> entries;
+    uint64_t file_count = 0;
+    uint64_t total_bytes = 0;
+};
+
+struct VerifyReport {
+    size_t checked_entries = 0;
+    uint64_t verified_bytes = 0;
+    uint64_t elapsed_ms = 0;
+    std::vector<std::string> mismatches;
 };
 
 struct InstallState {
     std::vector<std::string> mounted_paths;
 };
 
+// Progress of one install, kept in /run and on the target so that an
+// interrupted install can be picked up again with --resume.
+struct InstallJournal {
+    InstallerConfig config;
+    InstallArtifacts artifacts;
+    std::vector<std::string> completed_phases;
+    std::vector<std::string> copied_paths;
+    bool resumed = false;
+    bool target_mounted = false;
+};
+
 std::string trim(const std::string& value);
 std::string to_lower(std::string value);
 std::string to_upper(std::string value);
 std::string format_bytes(uint64_t bytes);
 std::string join_strings(const std::vector<std::string>& items, const std::string& separator = ", ");
-void append_log_line(const std::string& line);
 std::string timestamp_string();
+uint64_t monotonic_ms();
+void start_logging(bool truncate);
+void flush_log();
+void stop_logging();
+void set_log_phase(const char* phase);
+void append_log_line(const std::string& line);
 void log_message(const std::string& level, const std::string& message);
+void log_command(const std::string& path, const std::vector<std::string>& args);
+void log_command_output(const std::string& tag, const std::string& line);
+bool set_progress_json_output(const std::string& path);
+// Shows a live progress line (and JSON records, when enabled) for one long
+// stage. Work reports through add_progress(), or a sampler polled by the
+// renderer returns absolute counts. Totals of 0 mean "unknown".
+void begin_progress(
+    const std::string& stage,
+    uint64_t total_bytes,
+    uint64_t total_files,
+    const std::function<void(uint64_t& bytes, uint64_t& files)>& sampler = {}
+);
+void add_progress(uint64_t bytes, uint64_t files);
+void end_progress();
 void clear_screen();
 void print_header(const std::string& title);
 void print_notice(const std::string& prefix, const char* color, const std::string& message);
@@ -165,6 +306,7 @@ std::string quote_arg(const std::string& arg);
 std::string format_command(const std::string& path, const std::vector<std::string>& args);
 CommandResult run_command(const std::string& path, const std::vector<std::string>& args = {}, const std::string& stdin_data = "");
 CommandResult run_command_capture(const std::string& path, const std::vector<std::string>& args, std::string& output);
+std::vector<CommandJobResult> run_commands(const std::vector<CommandJob>& jobs, unsigned int max_parallel = 0);
 bool prompt_yes_no(const std::string& question, bool default_value);
 std::string prompt_text(const std::string& question, const std::string& default_value = "", bool allow_empty = false);
 std::string prompt_secret(const std::string& question, const std::string& default_value = "", bool allow_empty = false);
@@ -191,20 +333,94 @@ bool valid_hostname(const std::string& hostname);
 bool valid_timezone(const std::string& timezone);
 std::string filesystem_mkfs_tool(const ToolRegistry& tools, FilesystemType type);
 std::string partition_path(const std::string& disk, int partition_number);
-bool wait_for_path(const std::string& path, int retries = 30, int delay_ms = 250);
+bool wait_for_device_event(
+    const std::function<bool()>& ready,
+    int timeout_ms,
+    const std::vector<std::string>& watch_dirs = {"/dev"}
+);
+bool wait_for_paths(const std::vector<std::string>& paths, int timeout_ms = 7500);
+bool wait_for_path(const std::string& path, int timeout_ms = 7500);
 bool ensure_file_removed(const std::string& path);
+bool remove_path_recursive(const std::string& path);
 bool ensure_symlink(const std::string& target, const std::string& link_path);
 bool mount_device(const std::string& source, const std::string& target, const std::string& fstype, unsigned long flags = 0, const std::string& data = "");
 bool unmount_path(const std::string& target);
 void cleanup_install_state(InstallState& state);
-bool copy_tree(const ToolRegistry& tools, const std::string& source, const std::string& destination_path);
-std::string capture_blkid_value(const ToolRegistry& tools, const std::string& device, const std::string& key);
+bool copy_tree(const ToolRegistry& tools, const std::string& source, const std::string& destination_path, bool keep_existing = false);
+bool copy_listed_paths(
+    const ToolRegistry& tools,
+    const std::string& source_root,
+    const std::vector<std::string>& paths,
+    std::string& error
+);
+std::vector<BlockProbe> probe_block_devices(const std::vector<std::string>& devices);
+std::vector<BlockProbe> probe_disk_partitions(const std::vector<DiskInfo>& disks);
+std::vector<IsoVolume> probe_iso9660_devices(const std::vector<std::string>& devices);
+bool uses_btrfs_subvolumes(const InstallerConfig& config);
+const std::vector<BtrfsSubvolume>& btrfs_subvolume_layout();
+std::string swapfile_path(const InstallerConfig& config);
 bool create_swapfile(const ToolRegistry& tools, const InstallerConfig& config);
+std::string storage_media_label(StorageMedia media);
+std::string sysfs_disk_name(const std::string& device_path);
+std::string disk_stable_id(const std::string& disk);
+StorageProfile detect_storage_profile(const std::string& device_path, FilesystemType filesystem, bool formatting);
+unsigned long storage_mount_flags(const StorageProfile& profile);
+std::string storage_mount_data(const StorageProfile& profile);
+std::string storage_fstab_options(const StorageProfile& profile);
+void log_storage_profile(const StorageProfile& profile);
+bool apply_io_scheduler(const StorageProfile& profile);
+bool write_io_scheduler_rule(const StorageProfile& profile, std::string& error);
+bool write_trim_service(const StorageProfile& profile, std::string& error);
+std::string manifest_source_path(const std::string& root, const std::string& path);
+unsigned int installer_worker_count();
+bool scan_copy_manifest(
+    const std::string& source_root,
+    const std::vector<std::string>& paths,
+    CopyManifest& manifest,
+    std::string& error
+);
+bool verify_copied_tree(const CopyManifest& manifest, const std::string& target_root, VerifyReport& report);
+std::vector<std::string> build_boot_file_list(const CopyManifest& manifest);
+bool precopy_boot_files(
+    const ToolRegistry& tools,
+    const CopyManifest& manifest,
+    const std::vector<std::string>& files,
+    std::string& error
+);
+bool write_readahead_pack(const std::vector<std::string>& files, std::string& error);
+uint64_t auto_partition_root_bytes(const InstallerConfig& config);
+bool inspect_filesystem_image(const std::string& path, FilesystemType& type, uint64_t& bytes, std::string& error);
+bool write_root_image(
+    const ToolRegistry& tools,
+    const InstallerConfig& config,
+    const InstallArtifacts& artifacts,
+    std::string& error
+);
+bool grow_mounted_root_image(const ToolRegistry& tools, const InstallerConfig& config, std::string& error);
+bool load_install_journal(InstallJournal& journal, std::string& error);
+bool save_install_journal(const InstallJournal& journal);
+bool journal_phase_done(const InstallJournal& journal, const std::string& phase);
+bool complete_journal_phase(InstallJournal& journal, const std::string& phase);
+void clear_install_journal(const InstallJournal& journal);
+bool save_journal_manifest(const InstallJournal& journal, const CopyManifest& manifest);
+bool load_journal_manifest(CopyManifest& manifest);
+std::vector<std::string> unfinished_manifest_entries(
+    const CopyManifest& manifest,
+    const std::string& prefix,
+    const std::string& target_root
+);
+std::function<void(uint64_t&, uint64_t&)> copy_progress_sampler(
+    const CopyManifest& manifest,
+    const std::string& target_root,
+    uint64_t& copied_bytes,
+    uint64_t& copied_files
+);
 ToolRegistry detect_tools();
 void print_environment_summary(const ToolRegistry& tools);
 
 bool configure_installer(InstallerConfig& config, const ToolRegistry& tools);
-bool perform_install(const ToolRegistry& tools, const InstallerConfig& config, std::string& error);
+bool confirm_resume(InstallJournal& journal);
+bool perform_install(const ToolRegistry& tools, InstallJournal& journal, std::string& error);
 
 }  // namespace installer
 
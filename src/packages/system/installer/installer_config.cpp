@@ -14,9 +14,14 @@ std::string swap_mode_label(const InstallerConfig& config) {
         case SwapMode::None:
             return "Disabled";
         case SwapMode::Swapfile:
-            return "Swapfile (" + std::to_string(config.swap_size_mb) + " MiB)";
+            return "Swapfile (" + std::to_string(config.swap_size_mb) + " MiB" +
+                   (config.zswap ? ", zswap " + config.swap_compressor : "") + ")";
         case SwapMode::Partition:
-            return config.swap_partition.empty() ? "Existing swap partition (not set)" : "Partition (" + config.swap_partition + ")";
+            if (config.swap_partition.empty()) return "Existing swap partition (not set)";
+            return "Partition (" + config.swap_partition + (config.zswap ? ", zswap " + config.swap_compressor : "") + ")";
+        case SwapMode::Zram:
+            return "zram (" + config.swap_compressor + ", " + std::to_string(config.zram_percent) + "% of RAM" +
+                   (config.zram_per_cpu ? ", one device per CPU" : "") + ")";
     }
     return "Unknown";
 }
@@ -25,6 +30,130 @@ bool validate_partition_path(const std::string& path) {
     return path.rfind("/dev/", 0) == 0 && file_exists(path);
 }
 
+const char* kEspTypeGuid = "c12a7328-f81f-11d2-ba4b-00a0c93ec93b";
+const char* kSwapTypeGuid = "0657fd6d-a4ab-43c4-84e5-0933c84b4f4f";
+
+bool is_efi_candidate(const BlockProbe& probe) {
+    return probe.part_type == kEspTypeGuid || probe.part_type == "0xef";
+}
+
+bool is_swap_candidate(const BlockProbe& probe) {
+    return probe.fs_type == "swap" || probe.part_type == kSwapTypeGuid || probe.part_type == "0x82";
+}
+
+bool is_root_candidate(const BlockProbe& probe) {
+    return !is_efi_candidate(probe) && !is_swap_candidate(probe) && probe.fs_type != "vfat";
+}
+
+std::string describe_probe(const BlockProbe& probe) {
+    std::string line = probe.fs_type.empty() ? "no filesystem" : probe.fs_type;
+    if (!probe.label.empty()) line += " \"" + probe.label + "\"";
+    if (is_efi_candidate(probe)) line += "  [EFI system]";
+    return line;
+}
+
+const BlockProbe* find_probe(const std::vector<BlockProbe>& probes, const std::string& device) {
+    for (const auto& probe : probes) {
+        if (probe.device == device) return &probe;
+    }
+    return nullptr;
+}
+
+std::string suggest_partition(
+    const std::vector<BlockProbe>& probes,
+    const std::string& current,
+    bool (*candidate)(const BlockProbe&),
+    const std::string& fallback
+) {
+    if (!current.empty()) return current;
+    for (const auto& probe : probes) {
+        if (candidate(probe)) return probe.device;
+    }
+    return fallback;
+}
+
+void print_detected_partitions(const std::vector<BlockProbe>& probes) {
+    if (probes.empty()) {
+        std::cout << "No existing partitions were detected.\n\n";
+        return;
+    }
+    std::cout << "Detected partitions:\n";
+    for (const auto& probe : probes) {
+        std::cout << "  " << probe.device << "  " << format_bytes(probe.bytes) << "  " << describe_probe(probe) << "\n";
+    }
+    std::cout << "\n";
+}
+
+// Checks what is actually on the partitions the user named, so a typo does
+// not end with the installer mounting or swapping on the wrong data.
+void validate_existing_partitions(
+    const InstallerConfig& config,
+    BootMode boot_mode,
+    std::vector<std::string>& errors,
+    std::vector<std::string>& warnings
+) {
+    std::vector<std::string> devices = {config.root_partition};
+    if (boot_mode == BootMode::Uefi) devices.push_back(config.efi_partition);
+    if (config.swap_mode == SwapMode::Partition) devices.push_back(config.swap_partition);
+    const std::vector<BlockProbe> probes = probe_block_devices(devices);
+
+    const BlockProbe& root = probes[0];
+    if (!config.format_root && root.fs_type != filesystem_label(config.filesystem)) {
+        errors.push_back(
+            "Root partition " + config.root_partition + " contains " + (root.fs_type.empty() ? "no filesystem" : root.fs_type) +
+            ", not " + filesystem_label(config.filesystem) + ". Enable formatting or pick the matching filesystem."
+        );
+    }
+    if (boot_mode == BootMode::Uefi && !config.format_efi && probes[1].fs_type != "vfat") {
+        errors.push_back("EFI partition " + config.efi_partition + " does not contain a FAT filesystem. Enable formatting for it.");
+    }
+    const BlockProbe& swap = probes.back();
+    if (config.swap_mode == SwapMode::Partition && !swap.fs_type.empty() && swap.fs_type != "swap") {
+        warnings.push_back("Swap partition " + config.swap_partition + " holds a " + swap.fs_type + " filesystem that mkswap will erase.");
+    }
+}
+
+void validate_root_image(const InstallerConfig& config, const ToolRegistry& tools, std::vector<std::string>& errors) {
+    FilesystemType type = config.filesystem;
+    uint64_t image_bytes = 0;
+    std::string image_error;
+    if (!inspect_filesystem_image(config.image_path, type, image_bytes, image_error)) {
+        errors.push_back(image_error);
+        return;
+    }
+    if (type != config.filesystem) {
+        errors.push_back("Image " + config.image_path + " no longer holds a " + filesystem_label(config.filesystem) + " filesystem.");
+    }
+    if (config.partition_mode == PartitionMode::Existing) {
+        if (!config.format_root) {
+            errors.push_back("Image installs overwrite the root partition. Enable formatting for it.");
+        }
+        const BlockProbe root = probe_block_devices({config.root_partition}).front();
+        if (root.bytes != 0 && image_bytes > root.bytes) {
+            errors.push_back(
+                "Image " + config.image_path + " (" + format_bytes(image_bytes) + ") is larger than " +
+                config.root_partition + " (" + format_bytes(root.bytes) + ")."
+            );
+        }
+    } else if (config.partition_mode == PartitionMode::AutoWipe && !config.disk.empty()) {
+        // Checked against the planned layout, before anything is wiped.
+        const uint64_t root_bytes = auto_partition_root_bytes(config);
+        if (root_bytes != 0 && image_bytes > root_bytes) {
+            errors.push_back(
+                "Image " + config.image_path + " (" + format_bytes(image_bytes) + ") does not fit the " +
+                format_bytes(root_bytes) + " root partition planned on " + config.disk + "."
+            );
+        }
+    }
+    const bool ext4 = config.filesystem == FilesystemType::Ext4;
+    if (ext4 && (tools.e2fsck.empty() || tools.tune2fs.empty() || tools.resize2fs.empty())) {
+        errors.push_back("ext4 image installs require e2fsck, tune2fs and resize2fs.");
+    }
+    if (!ext4 && (tools.xfs_admin.empty() || tools.xfs_growfs.empty())) {
+        errors.push_back("XFS image installs require xfs_admin and xfs_growfs.");
+    }
+}
+
 std::vector<std::string> validate_configuration(const InstallerConfig& config, const ToolRegistry& tools, std::vector<std::string>& warnings) {
     warnings.clear();
     std::vector<std::string> errors;
@@ -50,6 +179,7 @@ std::vector<std::string> validate_configuration(const InstallerConfig& config, c
         if (config.swap_mode == SwapMode::Partition && (config.swap_partition.empty() || !validate_partition_path(config.swap_partition))) {
             errors.push_back("Swap partition mode requires a valid swap partition path.");
         }
+        if (errors.empty()) validate_existing_partitions(config, boot_mode, errors, warnings);
     }
 
     if (!valid_hostname(config.hostname)) {
@@ -78,24 +208,35 @@ std::vector<std::string> validate_configuration(const InstallerConfig& config, c
     if (config.swap_mode == SwapMode::Swapfile && config.swap_size_mb < 256) {
         errors.push_back("Swapfile size must be at least 256 MiB.");
     }
-    if (config.swap_mode == SwapMode::Swapfile &&
-        (config.filesystem == FilesystemType::Btrfs || config.filesystem == FilesystemType::F2fs)) {
+    if (config.swap_mode == SwapMode::Swapfile && config.filesystem == FilesystemType::F2fs) {
         errors.push_back(filesystem_label(config.filesystem) + " installs cannot use a swapfile yet. Select a swap partition or disable swap.");
     }
+    if (config.swap_mode == SwapMode::Zram && (config.zram_percent < 10 || config.zram_percent > 150)) {
+        errors.push_back("zram size must be between 10% and 150% of RAM.");
+    }
+    if ((config.swap_mode == SwapMode::Zram || config.zswap) &&
+        config.swap_compressor != "zstd" && config.swap_compressor != "lz4") {
+        errors.push_back("Compressed swap supports the zstd and lz4 algorithms.");
+    }
     if (config.partition_mode == PartitionMode::AutoWipe && config.swap_mode == SwapMode::Partition) {
         errors.push_back("Automatic partitioning cannot use an existing swap partition.");
     }
 
-    if (filesystem_mkfs_tool(tools, config.filesystem).empty()) {
+    if (!config.image_path.empty()) {
+        validate_root_image(config, tools, errors);
+    } else if (filesystem_mkfs_tool(tools, config.filesystem).empty()) {
         errors.push_back("No mkfs tool is available for the selected filesystem.");
     }
+    if (uses_btrfs_subvolumes(config) && tools.btrfs.empty()) {
+        errors.push_back("The btrfs subvolume layout requires the btrfs tool.");
+    }
     if (config.partition_mode == PartitionMode::AutoWipe && tools.sfdisk.empty()) {
         errors.push_back("Automatic partitioning requires sfdisk.");
     }
     if (boot_mode == BootMode::Uefi && (config.partition_mode == PartitionMode::AutoWipe || config.format_efi) && tools.mkfs_vfat.empty()) {
         errors.push_back("UEFI installs require mkfs.vfat.");
     }
-    if (config.swap_mode != SwapMode::None && tools.mkswap.empty()) {
+    if ((config.swap_mode == SwapMode::Swapfile || config.swap_mode == SwapMode::Partition) && tools.mkswap.empty()) {
         errors.push_back("Swap configuration requires mkswap.");
     }
     if (tools.cp.empty()) {
@@ -163,11 +304,26 @@ void configure_partitioning(InstallerConfig& config) {
         return;
     }
 
-    config.root_partition = prompt_text("Existing root partition", config.root_partition.empty() ? "/dev/sda1" : config.root_partition);
-    config.format_root = prompt_yes_no("Format the root partition?", config.format_root);
+    const std::vector<BlockProbe> probes = probe_disk_partitions(list_disks());
+    print_detected_partitions(probes);
+
+    config.root_partition = prompt_text(
+        "Existing root partition",
+        suggest_partition(probes, config.root_partition, is_root_candidate, "/dev/sda1")
+    );
+    const BlockProbe* root = find_probe(probes, config.root_partition);
+    if (root) std::cout << "  " << config.root_partition << " currently holds " << describe_probe(*root) << ".\n";
+    config.format_root = prompt_yes_no("Format the root partition?", root && root->fs_type.empty() ? true : config.format_root);
     if (effective_boot_mode(config) == BootMode::Uefi) {
-        config.efi_partition = prompt_text("EFI system partition", config.efi_partition.empty() ? "/dev/sda2" : config.efi_partition);
-        config.format_efi = prompt_yes_no("Format the EFI partition?", config.format_efi);
+        config.efi_partition = prompt_text(
+            "EFI system partition",
+            suggest_partition(probes, config.efi_partition, is_efi_candidate, "/dev/sda2")
+        );
+        const BlockProbe* efi = find_probe(probes, config.efi_partition);
+        // Reformatting an ESP that already holds other boot loaders would
+        // remove them, so only default to it when there is nothing to keep.
+        const bool efi_formatted = efi && efi->fs_type == "vfat";
+        config.format_efi = prompt_yes_no("Format the EFI partition?", efi ? !efi_formatted : config.format_efi);
     } else {
         config.efi_partition.clear();
         config.format_efi = false;
@@ -196,6 +352,24 @@ void configure_boot_mode_menu(InstallerConfig& config) {
     }
 }
 
+void configure_root_image(InstallerConfig& config) {
+    const std::string path = prompt_text("Path to the root filesystem image", config.image_path);
+    FilesystemType type = FilesystemType::Ext4;
+    uint64_t bytes = 0;
+    std::string error;
+    if (!inspect_filesystem_image(path, type, bytes, error)) {
+        print_notice("!", C_RED, error);
+        std::cout << "Press ENTER to continue.";
+        std::string unused;
+        std::getline(std::cin, unused);
+        return;
+    }
+    config.image_path = path;
+    config.filesystem = type;
+    std::cout << "  " << path << " holds a " << format_bytes(bytes) << " " << filesystem_label(type)
+              << " filesystem; it will be grown to fill the root partition.\n";
+}
+
 void configure_filesystem_menu(InstallerConfig& config, const ToolRegistry& tools) {
     print_header("Filesystem");
 
@@ -213,6 +387,8 @@ void configure_filesystem_menu(InstallerConfig& config, const ToolRegistry& tool
         options.push_back(filesystem_label(type));
     }
 
+    options.push_back("Prebuilt filesystem image (ext4 / xfs)");
+
     if (available.empty()) {
         print_notice("!", C_RED, "No supported filesystem tools are available.");
         std::cout << "Press ENTER to continue.";
@@ -221,15 +397,39 @@ void configure_filesystem_menu(InstallerConfig& config, const ToolRegistry& tool
         return;
     }
 
-    int default_index = 0;
-    for (size_t i = 0; i < available.size(); ++i) {
+    int default_index = config.image_path.empty() ? 0 : static_cast<int>(available.size());
+    for (size_t i = 0; config.image_path.empty() && i < available.size(); ++i) {
         if (available[i] == config.filesystem) {
             default_index = static_cast<int>(i);
             break;
         }
     }
 
-    config.filesystem = available[prompt_choice("Select the root filesystem:", options, default_index)];
+    const int choice = prompt_choice("Select the root filesystem:", options, default_index);
+    if (choice == static_cast<int>(available.size())) {
+        configure_root_image(config);
+        return;
+    }
+    config.image_path.clear();
+    config.filesystem = available[choice];
+    if (config.filesystem == FilesystemType::Btrfs) {
+        config.btrfs_subvolumes = prompt_yes_no(
+            "Use subvolumes (@, @home, @var_log, @snapshots) with zstd compression?",
+            config.btrfs_subvolumes
+        );
+    }
+}
+
+std::string prompt_swap_compressor(const std::string& current) {
+    const int choice = prompt_choice(
+        "Select the compression algorithm:",
+        {
+            "zstd - better ratio, more CPU",
+            "lz4 - fastest, lower ratio"
+        },
+        current == "lz4" ? 1 : 0
+    );
+    return choice == 1 ? "lz4" : "zstd";
 }
 
 void configure_swap_menu(InstallerConfig& config) {
@@ -237,7 +437,8 @@ void configure_swap_menu(InstallerConfig& config) {
 
     std::vector<std::string> options = {
         "No swap",
-        "Create a swapfile on the target root filesystem"
+        "Create a swapfile on the target root filesystem",
+        "Compressed swap in RAM (zram)"
     };
     if (config.partition_mode == PartitionMode::Existing) {
         options.push_back("Use an existing swap partition");
@@ -245,12 +446,14 @@ void configure_swap_menu(InstallerConfig& config) {
 
     int default_index = 0;
     if (config.swap_mode == SwapMode::Swapfile) default_index = 1;
-    if (config.swap_mode == SwapMode::Partition && config.partition_mode == PartitionMode::Existing) default_index = 2;
+    if (config.swap_mode == SwapMode::Zram) default_index = 2;
+    if (config.swap_mode == SwapMode::Partition && config.partition_mode == PartitionMode::Existing) default_index = 3;
 
     const int choice = prompt_choice("Select swap configuration:", options, default_index);
     if (choice == 0) {
         config.swap_mode = SwapMode::None;
         config.swap_partition.clear();
+        config.zswap = false;
         return;
     }
 
@@ -260,11 +463,31 @@ void configure_swap_menu(InstallerConfig& config) {
         int parsed = config.swap_size_mb;
         if (parse_int(swap_size, parsed) && parsed > 0) config.swap_size_mb = parsed;
         config.swap_partition.clear();
+        config.zswap = prompt_yes_no("Enable a zswap compressed cache in front of the swapfile?", config.zswap);
+        if (config.zswap) config.swap_compressor = prompt_swap_compressor(config.swap_compressor);
+        return;
+    }
+
+    if (choice == 2) {
+        config.swap_mode = SwapMode::Zram;
+        config.swap_partition.clear();
+        config.zswap = false;
+        config.swap_compressor = prompt_swap_compressor(config.swap_compressor);
+        std::string percent = prompt_text("zram size as a percentage of RAM", std::to_string(config.zram_percent));
+        int parsed = config.zram_percent;
+        if (parse_int(percent, parsed) && parsed > 0) config.zram_percent = parsed;
+        config.zram_per_cpu = prompt_yes_no("Create one zram device per CPU?", config.zram_per_cpu);
         return;
     }
 
     config.swap_mode = SwapMode::Partition;
-    config.swap_partition = prompt_text("Existing swap partition", config.swap_partition.empty() ? "/dev/sda3" : config.swap_partition);
+    const std::vector<BlockProbe> probes = probe_disk_partitions(list_disks());
+    config.swap_partition = prompt_text(
+        "Existing swap partition",
+        suggest_partition(probes, config.swap_partition, is_swap_candidate, "/dev/sda3")
+    );
+    config.zswap = prompt_yes_no("Enable a zswap compressed cache in front of the swap partition?", config.zswap);
+    if (config.zswap) config.swap_compressor = prompt_swap_compressor(config.swap_compressor);
 }
 
 void configure_identity_menu(InstallerConfig& config) {
@@ -344,7 +567,9 @@ void print_configuration_summary(const InstallerConfig& config) {
         std::cout << "  3. EFI Partition:  (not used)\n";
     }
     std::cout << "  4. Boot Mode:      " << boot_mode_label(config.boot_mode) << " -> " << boot_mode_label(effective_boot_mode(config)) << "\n";
-    std::cout << "  5. Filesystem:     " << filesystem_label(config.filesystem) << "\n";
+    std::cout << "  5. Filesystem:     " << filesystem_label(config.filesystem)
+              << (uses_btrfs_subvolumes(config) ? " (subvolumes, zstd)" : "")
+              << (config.image_path.empty() ? "" : " (image " + config.image_path + ")") << "\n";
     std::cout << "  6. Swap:           " << swap_mode_label(config) << "\n";
     std::cout << "  7. Hostname:       " << config.hostname << "\n";
     std::cout << "  8. Timezone:       " << config.timezone << "\n";
@@ -448,4 +673,28 @@ bool configure_installer(InstallerConfig& config, const ToolRegistry& tools) {
     }
 }
 
+bool confirm_resume(InstallJournal& journal) {
+    InstallerConfig& config = journal.config;
+    print_header("Resume");
+    print_configuration_summary(config);
+    std::cout << "\nCompleted phases: "
+              << (journal.completed_phases.empty() ? "none" : join_strings(journal.completed_phases)) << "\n\n";
+
+    // The journal never holds passwords, so they are asked for again if the
+    // accounts phase still has to run.
+    if (!journal_phase_done(journal, "accounts")) {
+        auto prompt_password = [](const std::string& label) {
+            while (true) {
+                const std::string password = prompt_password_with_confirmation(label);
+                if (password.size() >= 4) return password;
+                print_notice("!", C_YELLOW, "Passwords must be at least 4 characters.");
+            }
+        };
+        config.root_password = prompt_password("Root password");
+        if (config.user.create) config.user.password = prompt_password("User password");
+    }
+
+    return prompt_yes_no("Resume the interrupted installation?", true);
+}
+
 }  // namespace installer
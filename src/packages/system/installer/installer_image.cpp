@@ -0,0 +1,431 @@
+#include "installer_common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <mutex>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+// Large aligned writes keep the device streaming; a few buffers in flight
+// let the image be read while the previous chunk is being written.
+const size_t kImageChunkBytes = 8 * 1024 * 1024;
+const size_t kImageBufferCount = 4;
+const size_t kImageAlignment = 4096;
+// Always written in full, holes included, so signatures left behind by an
+// earlier filesystem cannot outlive the image's own superblock.
+const uint64_t kImageHeadBytes = 1024 * 1024;
+
+struct ImageSegment {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+};
+
+struct ImageChunk {
+    uint64_t offset = 0;
+    size_t length = 0;
+    unsigned char* buffer = nullptr;
+};
+
+uint64_t align_down(uint64_t value) {
+    return value & ~static_cast<uint64_t>(kImageAlignment - 1);
+}
+
+uint64_t align_up(uint64_t value) {
+    return align_down(value + kImageAlignment - 1);
+}
+
+// Data ranges of the image, widened to the write alignment and merged.
+bool image_data_segments(int fd, uint64_t image_bytes, std::vector<ImageSegment>& segments, std::string& error) {
+    const uint64_t end_of_image = align_up(image_bytes);
+    auto add = [&segments, end_of_image](uint64_t start, uint64_t end) {
+        start = align_down(start);
+        end = std::min(align_up(end), end_of_image);
+        if (end <= start) return;
+        if (!segments.empty() && start <= segments.back().offset + segments.back().length) {
+            const uint64_t merged_end = std::max(end, segments.back().offset + segments.back().length);
+            segments.back().length = merged_end - segments.back().offset;
+            return;
+        }
+        segments.push_back({start, end - start});
+    };
+
+    add(0, std::min(kImageHeadBytes, image_bytes));
+    off_t position = 0;
+    while (static_cast<uint64_t>(position) < image_bytes) {
+        const off_t data = lseek(fd, position, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) break;
+            error = std::string("Failed to map the image: ") + std::strerror(errno);
+            return false;
+        }
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) hole = static_cast<off_t>(image_bytes);
+        add(static_cast<uint64_t>(data), static_cast<uint64_t>(hole));
+        position = hole;
+    }
+    return true;
+}
+
+// The gaps between the data ranges, up to the aligned end of the image.
+std::vector<ImageSegment> image_hole_segments(const std::vector<ImageSegment>& data, uint64_t image_bytes) {
+    std::vector<ImageSegment> holes;
+    uint64_t position = 0;
+    for (const auto& segment : data) {
+        if (segment.offset > position) holes.push_back({position, segment.offset - position});
+        position = segment.offset + segment.length;
+    }
+    const uint64_t end_of_image = align_up(image_bytes);
+    if (end_of_image > position) holes.push_back({position, end_of_image - position});
+    return holes;
+}
+
+bool write_zeros(int device_fd, const ImageSegment& hole, std::string& error) {
+    void* zeros = nullptr;
+    if (posix_memalign(&zeros, kImageAlignment, kImageChunkBytes) != 0) {
+        error = "Failed to allocate a zero buffer.";
+        return false;
+    }
+    std::memset(zeros, 0, kImageChunkBytes);
+    uint64_t offset = hole.offset;
+    const uint64_t end = hole.offset + hole.length;
+    bool ok = true;
+    while (offset < end) {
+        const size_t length = static_cast<size_t>(std::min<uint64_t>(kImageChunkBytes, end - offset));
+        const ssize_t n = pwrite(device_fd, zeros, length, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            error = "Failed to zero the root partition: " + std::string(n < 0 ? std::strerror(errno) : "short write");
+            ok = false;
+            break;
+        }
+        offset += static_cast<uint64_t>(n);
+    }
+    std::free(zeros);
+    return ok;
+}
+
+// Holes in the image must read back as zeros from the device too: mke2fs
+// "zeroes" the inode tables and journal of a file image by punching holes
+// and then marks them zeroed, so stale partition contents there would be
+// taken for metadata. BLKZEROOUT lets the device do it without a transfer
+// where it can; otherwise the zeros are written out.
+bool zero_image_holes(int device_fd, const std::vector<ImageSegment>& holes, bool& offloaded, std::string& error) {
+    offloaded = true;
+    for (const auto& hole : holes) {
+        if (offloaded) {
+            uint64_t range[2] = {hole.offset, hole.length};
+            if (ioctl(device_fd, BLKZEROOUT, range) == 0) {
+                add_progress(hole.length, 0);
+                continue;
+            }
+            if (errno != EOPNOTSUPP && errno != ENOTTY && errno != EINVAL) {
+                error = "Failed to zero the root partition: " + std::string(std::strerror(errno));
+                return false;
+            }
+            offloaded = false;
+        }
+        if (!write_zeros(device_fd, hole, error)) return false;
+        add_progress(hole.length, 0);
+    }
+    return true;
+}
+
+uint64_t block_device_bytes(int fd) {
+    uint64_t bytes = 0;
+    if (ioctl(fd, BLKGETSIZE64, &bytes) == 0) return bytes;
+    struct stat st;
+    return fstat(fd, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+}
+
+// Reads run on the calling thread and writes on a second one, handing
+// buffers back and forth through two queues.
+bool stream_image_segments(
+    int image_fd,
+    int device_fd,
+    const std::vector<ImageSegment>& segments,
+    std::string& error
+) {
+    void* arena = nullptr;
+    if (posix_memalign(&arena, kImageAlignment, kImageChunkBytes * kImageBufferCount) != 0) {
+        error = "Failed to allocate image copy buffers.";
+        return false;
+    }
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<unsigned char*> free_buffers;
+    std::deque<ImageChunk> ready;
+    bool reading_done = false;
+    bool failed = false;
+    std::string failure;
+    for (size_t i = 0; i < kImageBufferCount; ++i) {
+        free_buffers.push_back(static_cast<unsigned char*>(arena) + i * kImageChunkBytes);
+    }
+
+    std::thread writer([&]() {
+        while (true) {
+            ImageChunk chunk;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]() { return !ready.empty() || reading_done || failed; });
+                if (failed || ready.empty()) return;
+                chunk = ready.front();
+                ready.pop_front();
+            }
+
+            size_t written = 0;
+            while (written < chunk.length) {
+                const ssize_t n = pwrite(
+                    device_fd,
+                    chunk.buffer + written,
+                    chunk.length - written,
+                    static_cast<off_t>(chunk.offset + written)
+                );
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    failed = true;
+                    failure = "Failed to write the image to the root partition: " +
+                              std::string(n < 0 ? std::strerror(errno) : "short write");
+                    changed.notify_all();
+                    return;
+                }
+                written += static_cast<size_t>(n);
+            }
+
+            add_progress(chunk.length, 0);
+            std::lock_guard<std::mutex> guard(lock);
+            free_buffers.push_back(chunk.buffer);
+            changed.notify_all();
+        }
+    });
+
+    for (const auto& segment : segments) {
+        uint64_t offset = segment.offset;
+        const uint64_t end = segment.offset + segment.length;
+        while (offset < end) {
+            unsigned char* buffer = nullptr;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]() { return !free_buffers.empty() || failed; });
+                if (failed) break;
+                buffer = free_buffers.front();
+                free_buffers.pop_front();
+            }
+
+            const size_t length = static_cast<size_t>(std::min<uint64_t>(kImageChunkBytes, end - offset));
+            size_t got = 0;
+            while (got < length) {
+                const ssize_t n = pread(image_fd, buffer + got, length - got, static_cast<off_t>(offset + got));
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    failed = true;
+                    failure = std::string("Failed to read the image: ") + std::strerror(errno);
+                    changed.notify_all();
+                    break;
+                }
+                if (n == 0) {
+                    // The last chunk is padded out to the write alignment.
+                    std::memset(buffer + got, 0, length - got);
+                    got = length;
+                    break;
+                }
+                got += static_cast<size_t>(n);
+            }
+            if (got < length) break;
+
+            std::lock_guard<std::mutex> guard(lock);
+            ready.push_back({offset, length, buffer});
+            changed.notify_all();
+            offset += length;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (failed) break;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        reading_done = true;
+        changed.notify_all();
+    }
+    writer.join();
+    std::free(arena);
+
+    if (failed) {
+        error = failure;
+        return false;
+    }
+    return true;
+}
+
+bool copy_image_to_device(const std::string& image, const std::string& device, std::string& error) {
+    const int image_fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (image_fd < 0) {
+        error = "Failed to open image " + image + ": " + std::strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(image_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(image_fd);
+        error = "Image " + image + " is not a regular file.";
+        return false;
+    }
+    const uint64_t image_bytes = static_cast<uint64_t>(st.st_size);
+    posix_fadvise(image_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // Not every device driver takes O_DIRECT; buffered writes still work,
+    // they just go through the page cache first.
+    bool direct = true;
+    int device_fd = open(device.c_str(), O_WRONLY | O_DIRECT | O_EXCL | O_CLOEXEC);
+    if (device_fd < 0 && errno == EINVAL) {
+        direct = false;
+        device_fd = open(device.c_str(), O_WRONLY | O_EXCL | O_CLOEXEC);
+    }
+    if (device_fd < 0) {
+        error = "Failed to open " + device + " for writing: " + std::strerror(errno);
+        close(image_fd);
+        return false;
+    }
+
+    const uint64_t device_bytes = block_device_bytes(device_fd);
+    if (align_up(image_bytes) > device_bytes) {
+        error = "Image " + image + " (" + format_bytes(image_bytes) + ") does not fit on " + device +
+                " (" + format_bytes(device_bytes) + ").";
+        close(device_fd);
+        close(image_fd);
+        return false;
+    }
+
+    std::vector<ImageSegment> segments;
+    if (!image_data_segments(image_fd, image_bytes, segments, error)) {
+        close(device_fd);
+        close(image_fd);
+        return false;
+    }
+    uint64_t data_bytes = 0;
+    for (const auto& segment : segments) data_bytes += segment.length;
+    const std::vector<ImageSegment> holes = image_hole_segments(segments, image_bytes);
+    const uint64_t hole_bytes = align_up(image_bytes) - data_bytes;
+    log_message(
+        "INFO",
+        "Image " + image + ": " + format_bytes(image_bytes) + ", " + format_bytes(data_bytes) + " of data in " +
+            std::to_string(segments.size()) + " extents" + (direct ? "" : " (buffered writes)")
+    );
+
+    const uint64_t started = monotonic_ms();
+    begin_progress("image", data_bytes + hole_bytes, 0);
+    bool ok = stream_image_segments(image_fd, device_fd, segments, error);
+    bool offloaded = true;
+    if (ok) ok = zero_image_holes(device_fd, holes, offloaded, error);
+    end_progress();
+    if (ok && !holes.empty()) {
+        log_message(
+            "INFO",
+            "Zeroed " + format_bytes(hole_bytes) + " of image holes on " + device +
+                (offloaded ? " with BLKZEROOUT" : " by writing zeros")
+        );
+    }
+    if (ok && fsync(device_fd) != 0) {
+        error = "Failed to flush " + device + ": " + std::strerror(errno);
+        ok = false;
+    }
+    close(device_fd);
+    close(image_fd);
+    if (!ok) return false;
+
+    const uint64_t elapsed_ms = std::max<uint64_t>(monotonic_ms() - started, 1);
+    log_message(
+        "INFO",
+        "Wrote " + format_bytes(data_bytes) + " to " + device + " in " + std::to_string(elapsed_ms) + " ms (" +
+            format_bytes(data_bytes * 1000 / elapsed_ms) + "/s)"
+    );
+    return true;
+}
+
+}  // namespace
+
+bool inspect_filesystem_image(const std::string& path, FilesystemType& type, uint64_t& bytes, std::string& error) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        error = "Image " + path + " was not found or is not a regular file.";
+        return false;
+    }
+
+    const BlockProbe probe = probe_block_devices({path}).front();
+    if (probe.fs_type == "ext4") {
+        type = FilesystemType::Ext4;
+    } else if (probe.fs_type == "xfs") {
+        type = FilesystemType::Xfs;
+    } else {
+        error = "Image " + path + " holds " + (probe.fs_type.empty() ? "no recognised filesystem" : probe.fs_type) +
+                "; only ext4 and xfs images are supported.";
+        return false;
+    }
+    bytes = static_cast<uint64_t>(st.st_size);
+    return true;
+}
+
+bool write_root_image(
+    const ToolRegistry& tools,
+    const InstallerConfig& config,
+    const InstallArtifacts& artifacts,
+    std::string& error
+) {
+    if (!copy_image_to_device(config.image_path, artifacts.root_partition, error)) return false;
+
+    // Every machine written from the same image would otherwise share one
+    // filesystem UUID, which breaks UUID= mounts as soon as two of them meet.
+    std::vector<CommandJob> jobs;
+    auto add_job = [&jobs](const std::string& path, const std::vector<std::string>& args) {
+        CommandJob job;
+        job.path = path;
+        job.args = args;
+        job.timeout_ms = kMkfsTimeoutMs;
+        jobs.push_back(job);
+    };
+    if (config.filesystem == FilesystemType::Ext4) {
+        // tune2fs and resize2fs both insist on a freshly checked filesystem.
+        add_job(tools.e2fsck, {"-f", "-p", artifacts.root_partition});
+        add_job(tools.tune2fs, {"-U", "random", "-L", "GeminiRoot", artifacts.root_partition});
+        add_job(tools.resize2fs, {artifacts.root_partition});
+    } else {
+        // XFS only grows while mounted; see grow_mounted_root_image().
+        add_job(tools.xfs_admin, {"-U", "generate", "-L", "GeminiRoot", artifacts.root_partition});
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const CommandJobResult result = run_commands({jobs[i]}).front();
+        // e2fsck exits with 1 when it corrected something, which is fine here.
+        const bool fsck_fixed = jobs[i].path == tools.e2fsck && result.result.exit_code == 1;
+        if (!result.result.success && !fsck_fixed) {
+            error = "Preparing the written root image failed. See " + kLogPath;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool grow_mounted_root_image(const ToolRegistry& tools, const InstallerConfig& config, std::string& error) {
+    if (config.filesystem != FilesystemType::Xfs) return true;
+    if (!run_command(tools.xfs_growfs, {kTargetRoot}).success) {
+        error = "Failed to grow the XFS root filesystem. See " + kLogPath;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace installer
@@ -2,9 +2,11 @@
 
 #include "user_mgmt.h"
 
+#include <algorithm>
 #include <cctype>
 #include <cerrno>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <dirent.h>
@@ -35,41 +37,6 @@ std::string kernel_root_argument(const InstallArtifacts& artifacts) {
     return {};
 }
 
-bool remove_path_recursive(const std::string& path) {
-    struct stat st;
-    if (lstat(path.c_str(), &st) != 0) {
-        return errno == ENOENT;
-    }
-
-    if (S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode)) {
-        DIR* dir = opendir(path.c_str());
-        if (!dir) {
-            log_message("WARN", "Failed to open " + path + " for cleanup: " + std::strerror(errno));
-            return false;
-        }
-
-        bool ok = true;
-        while (dirent* entry = readdir(dir)) {
-            const std::string name = entry->d_name;
-            if (name == "." || name == "..") continue;
-            if (!remove_path_recursive(path + "/" + name)) ok = false;
-        }
-        closedir(dir);
-
-        if (rmdir(path.c_str()) != 0) {
-            log_message("WARN", "Failed to remove directory " + path + ": " + std::strerror(errno));
-            return false;
-        }
-        return ok;
-    }
-
-    if (unlink(path.c_str()) != 0) {
-        log_message("WARN", "Failed to remove " + path + ": " + std::strerror(errno));
-        return false;
-    }
-    return true;
-}
-
 bool looks_like_live_root(const std::string& candidate) {
     return directory_exists(candidate) &&
            directory_exists(candidate + "/usr") &&
@@ -105,6 +72,88 @@ bool try_mount_iso_device_read_only(const std::string& device, const std::string
     return mount(device.c_str(), mountpoint.c_str(), "iso9660", MS_RDONLY, nullptr) == 0;
 }
 
+const int kLiveMediaGraceMs = 3000;
+const char* kLiveVolumePrefix = "GEMINIOS";
+
+bool is_live_media_name(const std::string& name) {
+    return name.rfind("sr", 0) == 0 ||
+        name.rfind("sd", 0) == 0 ||
+        name.rfind("vd", 0) == 0 ||
+        name.rfind("hd", 0) == 0 ||
+        name.rfind("nvme", 0) == 0 ||
+        name.rfind("mmcblk", 0) == 0;
+}
+
+std::vector<std::string> list_directory(const std::string& path, bool& scanned) {
+    std::vector<std::string> names;
+    DIR* dir = opendir(path.c_str());
+    scanned = dir != nullptr;
+    if (!dir) return names;
+
+    while (dirent* entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name != "." && name != "..") names.push_back(name);
+    }
+    closedir(dir);
+    return names;
+}
+
+std::vector<std::string> list_directory(const std::string& path) {
+    bool scanned = false;
+    return list_directory(path, scanned);
+}
+
+std::vector<std::string> list_live_media_candidates(bool& scanned) {
+    std::vector<std::string> names;
+    for (const auto& name : list_directory("/dev", scanned)) {
+        if (is_live_media_name(name)) names.push_back(name);
+    }
+    return names;
+}
+
+// True once a SCSI host's scan produced a block device. Symlinks are not
+// followed, so the walk stays inside the host's own device tree.
+bool sysfs_tree_has_block(const std::string& path, int depth) {
+    for (const auto& name : list_directory(path)) {
+        const std::string child = path + "/" + name;
+        if (name == "block" && !list_directory(child).empty()) return true;
+        struct stat st;
+        if (depth > 0 && lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && sysfs_tree_has_block(child, depth - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A live medium can only still appear while the kernel is adding one: a
+// USB storage interface whose SCSI scan has not produced a disk yet
+// (usb-storage waits delay_use seconds before scanning), or a disk the
+// kernel has announced whose /dev node is not there yet.
+bool live_media_add_pending() {
+    static const char* const kUsbStorageDrivers[] = {
+        "/sys/bus/usb/drivers/usb-storage",
+        "/sys/bus/usb/drivers/uas",
+    };
+    for (const char* driver : kUsbStorageDrivers) {
+        for (const auto& name : list_directory(driver)) {
+            // Bound interfaces are named bus-port:config.interface.
+            if (name.find(':') == std::string::npos) continue;
+            const std::string interface_path = std::string(driver) + "/" + name;
+            bool has_host = false;
+            for (const auto& child : list_directory(interface_path)) {
+                if (child.rfind("host", 0) != 0) continue;
+                has_host = true;
+                if (!sysfs_tree_has_block(interface_path + "/" + child, 3)) return true;
+            }
+            if (!has_host) return true;
+        }
+    }
+    for (const auto& name : list_directory("/sys/class/block")) {
+        if (is_live_media_name(name) && !file_exists("/dev/" + name)) return true;
+    }
+    return false;
+}
+
 bool find_pristine_live_source_root(
     const ToolRegistry& tools,
     LiveBaseMount& mount_state,
@@ -146,55 +195,79 @@ bool find_pristine_live_source_root(
         return false;
     }
 
-    DIR* dir = opendir("/dev");
-    if (!dir) {
-        error = "Unable to scan /dev for the live boot media.";
+    std::set<std::string> tried;
+    bool scanned = false;
+    auto has_untried_candidate = [&tried, &scanned]() {
+        for (const auto& name : list_live_media_candidates(scanned)) {
+            if (tried.count(name) == 0) return true;
+        }
         return false;
-    }
+    };
 
-    while (dirent* entry = readdir(dir)) {
-        const std::string name = entry->d_name;
-        if (name == "." || name == "..") continue;
-
-        const bool match =
-            name.rfind("sr", 0) == 0 ||
-            name.rfind("sd", 0) == 0 ||
-            name.rfind("vd", 0) == 0 ||
-            name.rfind("hd", 0) == 0 ||
-            name.rfind("nvme", 0) == 0 ||
-            name.rfind("mmcblk", 0) == 0;
-        if (!match) continue;
-
-        const std::string device = "/dev/" + name;
-        if (!try_mount_iso_device_read_only(device, mount_state.media_mount)) {
-            continue;
+    // Slow USB and optical media can still be enumerating when the installer
+    // starts, so give late devices one event-driven grace period before
+    // giving up on the pristine image. The wait only happens, and only lasts,
+    // while the kernel is still adding a device that could be the medium.
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass > 0) {
+            if (!live_media_add_pending()) {
+                log_message("INFO", "No storage device is still being added; not waiting for live media.");
+                break;
+            }
+            wait_for_device_event(
+                [&has_untried_candidate]() { return has_untried_candidate() || !live_media_add_pending(); },
+                kLiveMediaGraceMs
+            );
+            if (!has_untried_candidate()) break;
         }
-        mount_state.media_mounted = true;
 
-        const std::string root_sfs = mount_state.media_mount + "/root.sfs";
-        if (file_exists(root_sfs)) {
-            CommandResult result = run_command(
-                tools.mount,
-                {"-t", "squashfs", "-o", "loop,ro", root_sfs, mount_state.root_mount}
-            );
-            if (result.success && looks_like_live_root(mount_state.root_mount)) {
-                closedir(dir);
-                mount_state.root_mounted = true;
-                source_root = mount_state.root_mount;
-                return true;
+        const std::vector<std::string> candidates = list_live_media_candidates(scanned);
+        if (!scanned) {
+            error = "Unable to scan /dev for the live boot media.";
+            return false;
+        }
+
+        std::vector<std::string> devices;
+        for (const auto& name : candidates) {
+            if (tried.insert(name).second) devices.push_back("/dev/" + name);
+        }
+
+        // Only devices with an ISO9660 descriptor are worth a mount attempt,
+        // and media labelled by our image builder go first.
+        std::vector<IsoVolume> volumes = probe_iso9660_devices(devices);
+        std::stable_sort(volumes.begin(), volumes.end(), [](const IsoVolume& left, const IsoVolume& right) {
+            return left.volume_id.rfind(kLiveVolumePrefix, 0) == 0 && right.volume_id.rfind(kLiveVolumePrefix, 0) != 0;
+        });
+
+        for (const auto& volume : volumes) {
+            if (!try_mount_iso_device_read_only(volume.device, mount_state.media_mount)) {
+                continue;
             }
-            if (!result.success) {
-                log_message(
-                    "WARN",
-                    "Failed to mount " + root_sfs + " as squashfs; the installer will fall back to the running live root if needed."
+            mount_state.media_mounted = true;
+
+            const std::string root_sfs = mount_state.media_mount + "/root.sfs";
+            if (file_exists(root_sfs)) {
+                CommandResult result = run_command(
+                    tools.mount,
+                    {"-t", "squashfs", "-o", "loop,ro", root_sfs, mount_state.root_mount}
                 );
+                if (result.success && looks_like_live_root(mount_state.root_mount)) {
+                    mount_state.root_mounted = true;
+                    source_root = mount_state.root_mount;
+                    return true;
+                }
+                if (!result.success) {
+                    log_message(
+                        "WARN",
+                        "Failed to mount " + root_sfs + " as squashfs; the installer will fall back to the running live root if needed."
+                    );
+                }
             }
-        }
 
-        unmount_path(mount_state.media_mount);
-        mount_state.media_mounted = false;
+            unmount_path(mount_state.media_mount);
+            mount_state.media_mounted = false;
+        }
     }
-    closedir(dir);
 
     error = "Unable to locate and mount the pristine live base image (root.sfs).";
     return false;
@@ -388,6 +461,25 @@ bool configure_machine_identity(std::string& error) {
     return true;
 }
 
+const uint64_t kMiB = 1024ull * 1024ull;
+// Automatic layout: partitions start at 1 MiB, and UEFI installs put a
+// 512 MiB EFI partition before the root.
+const uint64_t kAutoPartitionStartBytes = kMiB;
+const uint64_t kAutoEfiPartitionBytes = 512 * kMiB;
+
+// PARTUUIDs are known as soon as the table is written and, unlike kernel
+// names, stay put across reboots, so --resume finds the partitions by them.
+void record_partition_ids(InstallArtifacts& artifacts) {
+    const std::vector<BlockProbe> probes = probe_block_devices({
+        artifacts.root_partition,
+        artifacts.efi_partition,
+        artifacts.swap_partition
+    });
+    artifacts.root_partuuid = probes[0].partuuid;
+    artifacts.efi_partuuid = probes[1].partuuid;
+    artifacts.swap_partuuid = probes[2].partuuid;
+}
+
 bool auto_partition_disk(const ToolRegistry& tools, const InstallerConfig& config, InstallArtifacts& artifacts, std::string& error) {
     if (tools.sfdisk.empty()) {
         error = "sfdisk is required for automatic partitioning.";
@@ -401,7 +493,7 @@ bool auto_partition_disk(const ToolRegistry& tools, const InstallerConfig& confi
         layout =
             "label: gpt\n"
             "first-lba: 2048\n\n"
-            "size=512MiB, type=U, name=\"EFI System\"\n"
+            "size=" + std::to_string(kAutoEfiPartitionBytes / kMiB) + "MiB, type=U, name=\"EFI System\"\n"
             "type=L, name=\"GeminiOS Root\"\n";
     } else {
         layout =
@@ -419,28 +511,40 @@ bool auto_partition_disk(const ToolRegistry& tools, const InstallerConfig& confi
     if (!tools.blockdev.empty()) {
         run_command(tools.blockdev, {"--rereadpt", config.disk});
     }
-    if (!tools.udevadm.empty()) {
-        run_command(tools.udevadm, {"settle"});
-    }
-    ::sync();
 
     artifacts.root_partition = partition_path(config.disk, boot_mode == BootMode::Uefi ? 2 : 1);
     artifacts.efi_partition = boot_mode == BootMode::Uefi ? partition_path(config.disk, 1) : "";
 
-    if (!wait_for_path(artifacts.root_partition)) {
-        error = "Root partition device did not appear after partitioning.";
-        return false;
-    }
-    if (!artifacts.efi_partition.empty() && !wait_for_path(artifacts.efi_partition)) {
-        error = "EFI partition device did not appear after partitioning.";
-        return false;
+    std::vector<std::string> partitions = {artifacts.root_partition};
+    if (!artifacts.efi_partition.empty()) partitions.push_back(artifacts.efi_partition);
+
+    // The partition nodes show up with the kernel uevent, but udev may still
+    // be running its rules for them (blkid probing, by-uuid links, holders),
+    // which would race with mkfs and later lookups. Settle once, bounded, so
+    // the wait covers the udev-processed events and not just the nodes.
+    const bool nodes_ready = wait_for_paths(partitions);
+    if (!tools.udevadm.empty()) {
+        CommandJob settle;
+        settle.path = tools.udevadm;
+        settle.args = {"settle", "--timeout=10"};
+        settle.timeout_ms = 15000;
+        const CommandJobResult settled = run_commands({settle}).front();
+        if (!settled.result.success) log_message("WARN", "udevadm settle did not finish after partitioning; continuing.");
+    }
+    if (nodes_ready || wait_for_paths(partitions, 2000)) {
+        record_partition_ids(artifacts);
+        return true;
     }
 
-    return true;
+    error = file_exists(artifacts.root_partition)
+        ? "EFI partition device did not appear after partitioning."
+        : "Root partition device did not appear after partitioning.";
+    return false;
 }
 
 bool resolve_install_artifacts(const InstallerConfig& config, InstallArtifacts& artifacts, std::string& error) {
     artifacts = {};
+    if (!config.disk.empty()) artifacts.disk_id = disk_stable_id(sysfs_disk_name(config.disk));
 
     if (config.partition_mode == PartitionMode::AutoWipe) return true;
 
@@ -461,28 +565,48 @@ bool resolve_install_artifacts(const InstallerConfig& config, InstallArtifacts&
         return false;
     }
 
+    record_partition_ids(artifacts);
     return true;
 }
 
-bool format_partitions(const ToolRegistry& tools, const InstallerConfig& config, InstallArtifacts& artifacts, std::string& error) {
+bool format_partitions(
+    const ToolRegistry& tools,
+    const InstallerConfig& config,
+    const StorageProfile& storage,
+    InstallArtifacts& artifacts,
+    std::string& error
+) {
     const BootMode boot_mode = effective_boot_mode(config);
     const std::string mkfs_tool = filesystem_mkfs_tool(tools, config.filesystem);
 
-    if (config.partition_mode == PartitionMode::AutoWipe || config.format_root) {
+    // Root, EFI and swap live on different partitions, so their mkfs runs
+    // are independent and can go to the disk together.
+    std::vector<CommandJob> jobs;
+    std::vector<std::string> failures;
+    auto add_job = [&jobs, &failures](const std::string& path, const std::vector<std::string>& args, const std::string& failure) {
+        CommandJob job;
+        job.path = path;
+        job.args = args;
+        job.timeout_ms = kMkfsTimeoutMs;
+        jobs.push_back(job);
+        failures.push_back(failure);
+    };
+
+    const bool write_image = !config.image_path.empty();
+    if ((config.partition_mode == PartitionMode::AutoWipe || config.format_root) && !write_image) {
         std::vector<std::string> args;
         if (config.filesystem == FilesystemType::Ext4) {
-            args = {"-F", "-L", "GeminiRoot", artifacts.root_partition};
+            args = {"-F", "-L", "GeminiRoot"};
         } else if (config.filesystem == FilesystemType::Xfs) {
-            args = {"-f", "-L", "GeminiRoot", artifacts.root_partition};
+            args = {"-f", "-L", "GeminiRoot"};
         } else if (config.filesystem == FilesystemType::F2fs) {
-            args = {"-f", "-l", "GeminiRoot", artifacts.root_partition};
+            args = {"-f", "-l", "GeminiRoot"};
         } else {
-            args = {"-f", "-L", "GeminiRoot", artifacts.root_partition};
-        }
-        if (!run_command(mkfs_tool, args).success) {
-            error = "Formatting root partition failed. See " + kLogPath;
-            return false;
+            args = {"-f", "-L", "GeminiRoot"};
         }
+        args.insert(args.end(), storage.mkfs_args.begin(), storage.mkfs_args.end());
+        args.push_back(artifacts.root_partition);
+        add_job(mkfs_tool, args, "Formatting root partition failed.");
     }
 
     if (boot_mode == BootMode::Uefi && !artifacts.efi_partition.empty() && (config.partition_mode == PartitionMode::AutoWipe || config.format_efi)) {
@@ -490,37 +614,127 @@ bool format_partitions(const ToolRegistry& tools, const InstallerConfig& config,
             error = "mkfs.vfat is required for EFI partition formatting.";
             return false;
         }
-        if (!run_command(tools.mkfs_vfat, {"-F", "32", "-n", "EFI", artifacts.efi_partition}).success) {
-            error = "Formatting EFI partition failed. See " + kLogPath;
-            return false;
-        }
+        add_job(tools.mkfs_vfat, {"-F", "32", "-n", "EFI", artifacts.efi_partition}, "Formatting EFI partition failed.");
     }
 
     if (config.swap_mode == SwapMode::Partition && !artifacts.swap_partition.empty()) {
-        if (!run_command(tools.mkswap, {"-L", "GeminiSwap", artifacts.swap_partition}).success) {
-            error = "Formatting swap partition failed. See " + kLogPath;
+        add_job(tools.mkswap, {"-L", "GeminiSwap", artifacts.swap_partition}, "Formatting swap partition failed.");
+    }
+
+    // mkfs reports nothing we could measure, so this only shows elapsed time.
+    begin_progress("format", 0, 0);
+    const std::vector<CommandJobResult> results = run_commands(jobs);
+    end_progress();
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].result.success) {
+            error = failures[i] + " See " + kLogPath;
             return false;
         }
     }
 
-    artifacts.root_uuid = capture_blkid_value(tools, artifacts.root_partition, "UUID");
-    artifacts.root_partuuid = capture_blkid_value(tools, artifacts.root_partition, "PARTUUID");
-    artifacts.efi_uuid = capture_blkid_value(tools, artifacts.efi_partition, "UUID");
-    artifacts.swap_uuid = capture_blkid_value(tools, artifacts.swap_partition, "UUID");
+    const std::vector<BlockProbe> probes = probe_block_devices({
+        artifacts.root_partition,
+        artifacts.efi_partition,
+        artifacts.swap_partition
+    });
+    artifacts.root_uuid = probes[0].uuid;
+    artifacts.root_partuuid = probes[0].partuuid;
+    artifacts.efi_uuid = probes[1].uuid;
+    artifacts.swap_uuid = probes[2].uuid;
     return true;
 }
 
-bool prepare_target_mounts(const InstallerConfig& config, InstallArtifacts& artifacts, InstallState& state, std::string& error) {
+std::string btrfs_subvolume_options(const std::string& base_options, const std::string& subvolume) {
+    return base_options.empty() ? "subvol=" + subvolume : base_options + ",subvol=" + subvolume;
+}
+
+bool create_btrfs_subvolumes(const ToolRegistry& tools, const InstallArtifacts& artifacts, std::string& error) {
+    if (tools.btrfs.empty()) {
+        error = "The btrfs subvolume layout requires the btrfs tool.";
+        return false;
+    }
+
+    // Subvolumes are created from the top-level volume (subvolid=5), which
+    // is only mounted for as long as this takes.
+    if (!mount_device(artifacts.root_partition, kTargetRoot, "btrfs", 0, "subvolid=5")) {
+        error = "Failed to mount the btrfs top-level volume.";
+        return false;
+    }
+
+    bool ok = true;
+    for (const auto& subvolume : btrfs_subvolume_layout()) {
+        const std::string path = kTargetRoot + "/" + subvolume.name;
+        if (directory_exists(path)) continue;
+        if (!run_command(tools.btrfs, {"subvolume", "create", path}).success) {
+            error = std::string("Failed to create btrfs subvolume ") + subvolume.name + ". See " + kLogPath;
+            ok = false;
+            break;
+        }
+    }
+
+    if (!unmount_path(kTargetRoot) && ok) {
+        error = "Failed to unmount the btrfs top-level volume.";
+        ok = false;
+    }
+    return ok;
+}
+
+bool mount_btrfs_subvolumes(
+    const ToolRegistry& tools,
+    const StorageProfile& storage,
+    const InstallArtifacts& artifacts,
+    InstallState& state,
+    std::string& error
+) {
+    if (!create_btrfs_subvolumes(tools, artifacts, error)) return false;
+
+    // The layout table lists @ first, so every later mountpoint is created
+    // inside the freshly mounted root subvolume.
+    for (const auto& subvolume : btrfs_subvolume_layout()) {
+        const std::string mountpoint = std::string(subvolume.mountpoint) == "/"
+            ? kTargetRoot
+            : kTargetRoot + subvolume.mountpoint;
+        if (!mount_device(
+                artifacts.root_partition,
+                mountpoint,
+                "btrfs",
+                storage_mount_flags(storage),
+                btrfs_subvolume_options(storage_mount_data(storage), subvolume.name))) {
+            error = std::string("Failed to mount btrfs subvolume ") + subvolume.name + ".";
+            return false;
+        }
+        state.mounted_paths.push_back(mountpoint);
+    }
+    return true;
+}
+
+bool prepare_target_mounts(
+    const ToolRegistry& tools,
+    const InstallerConfig& config,
+    const StorageProfile& storage,
+    InstallArtifacts& artifacts,
+    InstallState& state,
+    std::string& error
+) {
     if (!mkdir_p(kTargetRoot)) {
         error = "Failed to create target mount root.";
         return false;
     }
 
-    if (!mount_device(artifacts.root_partition, kTargetRoot, filesystem_label(config.filesystem))) {
-        error = "Failed to mount root filesystem.";
-        return false;
+    if (uses_btrfs_subvolumes(config)) {
+        if (!mount_btrfs_subvolumes(tools, storage, artifacts, state, error)) return false;
+    } else {
+        if (!mount_device(
+                artifacts.root_partition,
+                kTargetRoot,
+                filesystem_label(config.filesystem),
+                storage_mount_flags(storage),
+                storage_mount_data(storage))) {
+            error = "Failed to mount root filesystem.";
+            return false;
+        }
+        state.mounted_paths.push_back(kTargetRoot);
     }
-    state.mounted_paths.push_back(kTargetRoot);
 
     if (effective_boot_mode(config) == BootMode::Uefi && !artifacts.efi_partition.empty()) {
         const std::string efi_mount = kTargetRoot + "/boot/efi";
@@ -538,7 +752,13 @@ bool prepare_target_mounts(const InstallerConfig& config, InstallArtifacts& arti
     return true;
 }
 
-bool bootstrap_target_filesystem(const ToolRegistry& tools, std::string& error) {
+bool bootstrap_target_filesystem(
+    const ToolRegistry& tools,
+    const StorageProfile& storage,
+    bool fresh_target,
+    InstallJournal& journal,
+    std::string& error
+) {
     const bool is_live = file_exists("/etc/geminios-live");
     std::string base_source_root = "/";
     bool using_live_root_fallback = false;
@@ -572,14 +792,84 @@ bool bootstrap_target_filesystem(const ToolRegistry& tools, std::string& error)
         "/var/cache"
     };
 
+    // A resumed copy keeps the manifest of the first attempt, so files are
+    // judged against the same list the journal was started with.
+    CopyManifest manifest;
+    if (journal.resumed && load_journal_manifest(manifest)) {
+        manifest.source_root = base_source_root;
+        log_message("INFO", "Resuming copy against the journaled manifest of " + std::to_string(manifest.entries.size()) + " entries");
+    } else {
+        if (!scan_copy_manifest(base_source_root, essential_paths, manifest, error)) {
+            error = "Failed to scan the base system: " + error;
+            return false;
+        }
+        journal.copied_paths.clear();
+        if (!save_journal_manifest(journal, manifest)) {
+            log_message("WARN", "Failed to record the copy manifest in the install journal.");
+        }
+    }
+
+    // cp reports nothing back, so copy progress is measured by checking
+    // manifest entries off on the target. A resumed copy starts from what is
+    // already there.
+    uint64_t copied_bytes = 0;
+    uint64_t copied_files = 0;
+    auto copy_sampler = copy_progress_sampler(manifest, kTargetRoot, copied_bytes, copied_files);
+    if (journal.resumed) {
+        log_message(
+            "INFO",
+            "Already copied: " + format_bytes(copied_bytes) + " in " + std::to_string(copied_files) + " entries"
+        );
+    }
+    begin_progress("copy", manifest.total_bytes, manifest.entries.size(), copy_sampler);
+
+    // Seek-bound media gain the most from having boot files packed together;
+    // the layout only holds on a filesystem we just created.
+    std::vector<std::string> boot_files;
+    const bool slow_media = storage.media == StorageMedia::Rotational || storage.media == StorageMedia::Emmc;
+    if (fresh_target && slow_media) {
+        boot_files = build_boot_file_list(manifest);
+        if (!precopy_boot_files(tools, manifest, boot_files, error)) return false;
+    }
+
     for (const auto& path : essential_paths) {
-        const std::string source_path = base_source_root + path;
-        if (!copy_tree(tools, source_path, kTargetRoot + path)) {
+        if (std::find(journal.copied_paths.begin(), journal.copied_paths.end(), path) != journal.copied_paths.end()) {
+            log_message("INFO", "Skipping " + path + ", copied before the interruption");
+            continue;
+        }
+
+        const std::string source_path = manifest_source_path(base_source_root, path);
+        if (journal.resumed && path_exists_no_follow(kTargetRoot + path)) {
+            // Only what the interrupted run left missing or half-written.
+            const std::vector<std::string> unfinished = unfinished_manifest_entries(manifest, path, kTargetRoot);
+            log_message("INFO", "Resuming " + path + ": " + std::to_string(unfinished.size()) + " entries left to copy");
+            if (!copy_listed_paths(tools, base_source_root, unfinished, error)) return false;
+        } else if (!copy_tree(tools, source_path, kTargetRoot + path, !boot_files.empty())) {
             error = "Failed to copy " + source_path + ". See " + kLogPath;
             return false;
         }
+
+        journal.copied_paths.push_back(path);
+        save_install_journal(journal);
+    }
+
+    end_progress();
+    print_notice("->", C_CYAN, "Verifying copied base system");
+    VerifyReport report;
+    if (!verify_copied_tree(manifest, kTargetRoot, report)) {
+        // The running live root keeps changing underneath the copy (logs,
+        // caches), so only a pristine read-only source is held to an exact match.
+        if (using_live_root_fallback) {
+            log_message("WARN", std::to_string(report.mismatches.size()) + " entries changed while copying the running live root.");
+        } else {
+            error = "The copied base system does not match the source (" + std::to_string(report.mismatches.size()) +
+                    " mismatches, first: " + report.mismatches.front() + "). See " + kLogPath;
+            return false;
+        }
     }
 
+    if (!write_readahead_pack(boot_files, error)) return false;
+
     const std::vector<std::string> required_dirs = {
         kTargetRoot + "/dev",
         kTargetRoot + "/proc",
@@ -1042,6 +1332,7 @@ bool configure_identity(const InstallerConfig& config, const InstallArtifacts& a
     marker << "PROFILE=" << profile_label(config.profile) << "\n";
     marker << "BOOT_MODE=" << boot_mode_label(effective_boot_mode(config)) << "\n";
     marker << "FILESYSTEM=" << filesystem_label(config.filesystem) << "\n";
+    if (uses_btrfs_subvolumes(config)) marker << "BTRFS_LAYOUT=subvolumes\n";
     marker << "ROOT_PARTITION=" << artifacts.root_partition << "\n";
     if (!artifacts.root_partuuid.empty()) marker << "ROOT_PARTUUID=" << artifacts.root_partuuid << "\n";
     marker << "EFI_PARTITION=" << artifacts.efi_partition << "\n";
@@ -1055,10 +1346,113 @@ bool configure_identity(const InstallerConfig& config, const InstallArtifacts& a
     return true;
 }
 
-bool write_fstab(const InstallerConfig& config, const InstallArtifacts& artifacts, std::string& error) {
+const char* const kZramServiceName = "zram-swap";
+
+// zram is sized and attached at boot rather than at install time, so nothing
+// is allocated or flushed on the target disk for it; the installer only
+// drops the settings, a setup script and an enabled ginit oneshot service.
+bool configure_zram_swap(const InstallerConfig& config, std::string& error) {
+    const std::string service_file = std::string("/usr/lib/ginit/services/") + kZramServiceName + ".gservice";
+    const std::string enabled_link = kTargetRoot + "/etc/ginit/services/system/" + kZramServiceName + ".gservice";
+    if (config.swap_mode != SwapMode::Zram) {
+        ensure_file_removed(enabled_link);
+        return true;
+    }
+
+    std::ostringstream settings;
+    settings << "# GeminiOS zram swap settings (written by the installer)\n";
+    settings << "ZRAM_ALGORITHM=" << config.swap_compressor << "\n";
+    settings << "ZRAM_PERCENT=" << config.zram_percent << "\n";
+    settings << "ZRAM_PER_CPU=" << (config.zram_per_cpu ? 1 : 0) << "\n";
+    if (!write_text_file(kTargetRoot + "/etc/default/geminios-zram", settings.str())) {
+        error = "Failed to write zram settings.";
+        return false;
+    }
+
+    const std::string script =
+        "#!/bin/sh\n"
+        "# Attach zram swap devices using /etc/default/geminios-zram.\n"
+        "[ -r /etc/default/geminios-zram ] && . /etc/default/geminios-zram\n"
+        "ZRAM_ALGORITHM=\"${ZRAM_ALGORITHM:-zstd}\"\n"
+        "ZRAM_PERCENT=\"${ZRAM_PERCENT:-50}\"\n"
+        "ZRAM_PER_CPU=\"${ZRAM_PER_CPU:-0}\"\n"
+        "\n"
+        "mem_kib=0\n"
+        "while read -r key value _; do\n"
+        "    if [ \"$key\" = \"MemTotal:\" ]; then mem_kib=$value; break; fi\n"
+        "done < /proc/meminfo\n"
+        "\n"
+        "devices=1\n"
+        "if [ \"$ZRAM_PER_CPU\" = \"1\" ]; then\n"
+        "    devices=$(grep -c '^processor' /proc/cpuinfo)\n"
+        "    [ \"$devices\" -ge 1 ] 2>/dev/null || devices=1\n"
+        "fi\n"
+        "\n"
+        "[ -d /sys/class/zram-control ] || modprobe zram num_devices=\"$devices\" || exit 1\n"
+        "size_kib=$((mem_kib * ZRAM_PERCENT / 100 / devices))\n"
+        "\n"
+        "i=0\n"
+        "while [ \"$i\" -lt \"$devices\" ]; do\n"
+        "    dev=zram$i\n"
+        "    [ -e /sys/block/$dev ] || cat /sys/class/zram-control/hot_add > /dev/null\n"
+        "    echo \"$ZRAM_ALGORITHM\" > /sys/block/$dev/comp_algorithm 2>/dev/null ||\n"
+        "        echo \"zram: $ZRAM_ALGORITHM unavailable for $dev, keeping the kernel default\" >&2\n"
+        "    echo \"${size_kib}K\" > /sys/block/$dev/disksize || exit 1\n"
+        "    mkswap -L GeminiZram /dev/$dev > /dev/null || exit 1\n"
+        "    swapon -p 100 /dev/$dev || exit 1\n"
+        "    i=$((i + 1))\n"
+        "done\n";
+    if (!write_text_file(kTargetRoot + "/usr/libexec/geminios/zram-setup", script, 0755)) {
+        error = "Failed to write the zram setup script.";
+        return false;
+    }
+
+    const std::string service =
+        std::string("service \"") + kZramServiceName + "\" {\n"
+        "    meta {\n"
+        "        description = \"Compressed swap in RAM (zram)\"\n"
+        "    }\n"
+        "\n"
+        "    process {\n"
+        "        type = \"oneshot\"\n"
+        "        commands {\n"
+        "            start = \"/usr/libexec/geminios/zram-setup\"\n"
+        "        }\n"
+        "    }\n"
+        "}\n";
+    if (!write_text_file(kTargetRoot + service_file, service)) {
+        error = "Failed to write the zram ginit service.";
+        return false;
+    }
+    if (!mkdir_p(kTargetRoot + "/etc/ginit/services/system") || !ensure_symlink(service_file, enabled_link)) {
+        error = "Failed to enable the zram ginit service.";
+        return false;
+    }
+    return true;
+}
+
+std::string zswap_kernel_arguments(const InstallerConfig& config) {
+    if (!config.zswap || (config.swap_mode != SwapMode::Swapfile && config.swap_mode != SwapMode::Partition)) {
+        return "";
+    }
+    return " zswap.enabled=1 zswap.compressor=" + config.swap_compressor + " zswap.zpool=zsmalloc zswap.max_pool_percent=20";
+}
+
+bool write_fstab(const InstallerConfig& config, const StorageProfile& storage, const InstallArtifacts& artifacts, std::string& error) {
     std::ostringstream fstab;
     const std::string root_source = !artifacts.root_uuid.empty() ? "UUID=" + artifacts.root_uuid : artifacts.root_partition;
-    fstab << root_source << " / " << filesystem_label(config.filesystem) << " defaults 0 1\n";
+    // btrfs has no boot-time fsck (fsck.btrfs is a no-op), so it gets pass 0.
+    const int root_pass = config.filesystem == FilesystemType::Btrfs ? 0 : 1;
+    if (uses_btrfs_subvolumes(config)) {
+        const std::string options = storage_fstab_options(storage);
+        for (const auto& subvolume : btrfs_subvolume_layout()) {
+            fstab << root_source << " " << subvolume.mountpoint << " btrfs "
+                  << btrfs_subvolume_options(options == "defaults" ? "" : options, subvolume.name) << " 0 0\n";
+        }
+    } else {
+        fstab << root_source << " / " << filesystem_label(config.filesystem) << " " << storage_fstab_options(storage) << " 0 "
+              << root_pass << "\n";
+    }
 
     if (!artifacts.efi_partition.empty()) {
         const std::string efi_source = !artifacts.efi_uuid.empty() ? "UUID=" + artifacts.efi_uuid : artifacts.efi_partition;
@@ -1069,7 +1463,7 @@ bool write_fstab(const InstallerConfig& config, const InstallArtifacts& artifact
         const std::string swap_source = !artifacts.swap_uuid.empty() ? "UUID=" + artifacts.swap_uuid : artifacts.swap_partition;
         fstab << swap_source << " none swap sw 0 0\n";
     } else if (config.swap_mode == SwapMode::Swapfile) {
-        fstab << "/swapfile none swap defaults 0 0\n";
+        fstab << swapfile_path(config) << " none swap defaults 0 0\n";
     }
 
     fstab << "proc /proc proc nosuid,noexec,nodev 0 0\n";
@@ -1093,9 +1487,15 @@ bool write_grub_config(const InstallerConfig& config, const InstallArtifacts& ar
         error = "Unable to determine kernel root device argument.";
         return false;
     }
+    // GRUB resolves paths from the top-level volume, so kernels inside the
+    // @ subvolume need the subvolume prefix and the kernel needs rootflags.
+    const bool subvolumes = uses_btrfs_subvolumes(config);
+    const std::string boot_prefix = subvolumes ? "/@" : "";
     std::ostringstream grub;
-    const std::string base_kernel_args =
+    std::string base_kernel_args =
         "root=" + kernel_root + " rootfstype=" + filesystem_label(config.filesystem) + " rootwait rw audit=0 selinux=0";
+    if (subvolumes) base_kernel_args += " rootflags=subvol=@";
+    base_kernel_args += zswap_kernel_arguments(config);
     grub << "set timeout=5\n";
     grub << "set default=0\n";
     grub << "insmod part_msdos\n";
@@ -1110,10 +1510,10 @@ bool write_grub_config(const InstallerConfig& config, const InstallArtifacts& ar
         grub << "set root=" << (boot_mode == BootMode::Uefi ? "(hd0,gpt2)" : "(hd0,msdos1)") << "\n";
     }
     grub << "menuentry \"GeminiOS\" {\n";
-    grub << "  linux /boot/kernel " << base_kernel_args << " quiet geminios.verbose_boot=0\n";
+    grub << "  linux " << boot_prefix << "/boot/kernel " << base_kernel_args << " quiet geminios.verbose_boot=0\n";
     grub << "}\n";
     grub << "menuentry \"GeminiOS (Verbose Boot)\" {\n";
-    grub << "  linux /boot/kernel " << base_kernel_args << " loglevel=7 ignore_loglevel geminios.verbose_boot=1\n";
+    grub << "  linux " << boot_prefix << "/boot/kernel " << base_kernel_args << " loglevel=7 ignore_loglevel geminios.verbose_boot=1\n";
     grub << "}\n";
 
     if (!write_text_file(kTargetRoot + "/boot/grub/grub.cfg", grub.str())) {
@@ -1163,91 +1563,173 @@ bool install_bootloader(const ToolRegistry& tools, const InstallerConfig& config
 
 }  // namespace
 
-bool perform_install(const ToolRegistry& tools, const InstallerConfig& config, std::string& error) {
-    InstallArtifacts artifacts;
+uint64_t auto_partition_root_bytes(const InstallerConfig& config) {
+    const std::string size = read_file_trimmed("/sys/block/" + sysfs_disk_name(config.disk) + "/size");
+    const uint64_t disk_bytes = size.empty() ? 0 : std::strtoull(size.c_str(), nullptr, 10) * 512;
+    uint64_t reserved = kAutoPartitionStartBytes;
+    // GPT keeps a backup table at the end of the disk; sfdisk also aligns the
+    // last partition's end, so leave a whole MiB for it.
+    if (effective_boot_mode(config) == BootMode::Uefi) reserved += kAutoEfiPartitionBytes + kMiB;
+    return disk_bytes > reserved ? disk_bytes - reserved : 0;
+}
+
+bool perform_install(const ToolRegistry& tools, InstallJournal& journal, std::string& error) {
+    const InstallerConfig& config = journal.config;
+    InstallArtifacts& artifacts = journal.artifacts;
     InstallState state;
 
-    if (!resolve_install_artifacts(config, artifacts, error)) {
-        return false;
+    if (!journal.resumed) {
+        if (!resolve_install_artifacts(config, artifacts, error)) return false;
+        journal.completed_phases.clear();
+        journal.copied_paths.clear();
     }
+    save_install_journal(journal);
 
-    if (config.partition_mode == PartitionMode::AutoWipe) {
-        print_notice("->", C_CYAN, "Partitioning target disk");
-        if (!auto_partition_disk(tools, config, artifacts, error)) {
+    // Each phase is recorded in the journal once it finishes, so --resume
+    // skips straight past it. Mounting is never recorded; it is redone on
+    // every run.
+    auto run_phase = [&](const char* phase, const char* notice, const std::function<bool()>& step) {
+        if (journal_phase_done(journal, phase)) {
+            log_message("INFO", std::string("Skipping completed phase ") + phase);
+            return true;
+        }
+        set_log_phase(phase);
+        print_notice("->", C_CYAN, notice);
+        if (!step()) {
+            end_progress();
             cleanup_install_state(state);
             return false;
         }
+        if (!complete_journal_phase(journal, phase)) {
+            log_message("WARN", std::string("Failed to record phase ") + phase + " in the install journal.");
+        }
+        return true;
+    };
+
+    if (config.partition_mode == PartitionMode::AutoWipe) {
+        // Checked again here because a resumed install skips validation, and
+        // a too-large image must be refused before the disk is wiped.
+        if (!config.image_path.empty() && !journal_phase_done(journal, "partition")) {
+            FilesystemType type = config.filesystem;
+            uint64_t image_bytes = 0;
+            if (!inspect_filesystem_image(config.image_path, type, image_bytes, error)) return false;
+            const uint64_t root_bytes = auto_partition_root_bytes(config);
+            if (root_bytes != 0 && image_bytes > root_bytes) {
+                error = "Image " + config.image_path + " (" + format_bytes(image_bytes) + ") does not fit the " +
+                    format_bytes(root_bytes) + " root partition planned on " + config.disk + ".";
+                return false;
+            }
+        }
+        if (!run_phase("partition", "Partitioning target disk", [&]() {
+                return auto_partition_disk(tools, config, artifacts, error);
+            })) {
+            return false;
+        }
     }
 
-    print_notice("->", C_CYAN, "Formatting selected partitions");
-    if (!format_partitions(tools, config, artifacts, error)) {
-        cleanup_install_state(state);
+    const bool formatting = config.partition_mode == PartitionMode::AutoWipe || config.format_root;
+    const StorageProfile storage = detect_storage_profile(artifacts.root_partition, config.filesystem, formatting);
+    log_storage_profile(storage);
+    apply_io_scheduler(storage);
+
+    const bool image_install = !config.image_path.empty();
+    if (image_install) {
+        if (!run_phase("image", "Writing root filesystem image", [&]() {
+                return write_root_image(tools, config, artifacts, error);
+            })) {
+            return false;
+        }
+    }
+
+    if (!run_phase("format", "Formatting selected partitions", [&]() {
+            return format_partitions(tools, config, storage, artifacts, error);
+        })) {
         return false;
     }
 
+    set_log_phase("mount");
     print_notice("->", C_CYAN, "Mounting target filesystems");
-    if (!prepare_target_mounts(config, artifacts, state, error)) {
+    if (!prepare_target_mounts(tools, config, storage, artifacts, state, error)) {
         cleanup_install_state(state);
         return false;
     }
+    journal.target_mounted = true;
+    save_install_journal(journal);
 
-    print_notice("->", C_CYAN, "Copying GeminiOS base system");
-    if (!bootstrap_target_filesystem(tools, error)) {
-        cleanup_install_state(state);
-        return false;
+    if (image_install) {
+        if (!run_phase("grow", "Growing root filesystem", [&]() {
+                return grow_mounted_root_image(tools, config, error);
+            })) {
+            return false;
+        }
+    } else {
+        // A resumed copy lands on files that are already there, which the
+        // boot readahead pack's layout cannot account for.
+        const bool fresh_target = formatting && !journal.resumed;
+        if (!run_phase("copy", "Copying GeminiOS base system", [&]() {
+                return bootstrap_target_filesystem(tools, storage, fresh_target, journal, error);
+            })) {
+            return false;
+        }
     }
 
-    print_notice("->", C_CYAN, "Creating swap configuration");
-    if (!create_swapfile(tools, config)) {
-        error = "Failed to create the requested swapfile.";
-        cleanup_install_state(state);
+    if (!run_phase("swap", "Creating swap configuration", [&]() {
+            if (!create_swapfile(tools, config)) {
+                error = "Failed to create the requested swapfile.";
+                return false;
+            }
+            return configure_zram_swap(config, error);
+        })) {
         return false;
     }
 
-    print_notice("->", C_CYAN, "Configuring system identity");
-    if (!configure_identity(config, artifacts, error)) {
-        cleanup_install_state(state);
+    if (!run_phase("identity", "Configuring system identity", [&]() {
+            return configure_identity(config, artifacts, error);
+        })) {
         return false;
     }
 
-    print_notice("->", C_CYAN, "Hardening display configuration");
-    if (!configure_display_stack(config, error)) {
-        cleanup_install_state(state);
+    if (!run_phase("display", "Hardening display configuration", [&]() {
+            return configure_display_stack(config, error);
+        })) {
         return false;
     }
 
-    print_notice("->", C_CYAN, "Configuring user accounts");
-    if (!configure_accounts(config, error)) {
-        cleanup_install_state(state);
+    if (!run_phase("accounts", "Configuring user accounts", [&]() {
+            return configure_accounts(config, error);
+        })) {
         return false;
     }
 
-    print_notice("->", C_CYAN, "Writing fstab");
-    if (!write_fstab(config, artifacts, error)) {
-        cleanup_install_state(state);
+    if (!run_phase("fstab", "Writing fstab", [&]() {
+            return write_fstab(config, storage, artifacts, error) && write_io_scheduler_rule(storage, error) &&
+                   write_trim_service(storage, error);
+        })) {
         return false;
     }
 
-    print_notice("->", C_CYAN, "Writing GRUB configuration");
-    if (!write_grub_config(config, artifacts, error)) {
-        cleanup_install_state(state);
+    if (!run_phase("grub", "Writing GRUB configuration", [&]() {
+            return write_grub_config(config, artifacts, error);
+        })) {
         return false;
     }
 
-    print_notice("->", C_CYAN, "Applying SELinux labels");
-    if (!relabel_selinux_target(tools, error)) {
-        cleanup_install_state(state);
+    if (!run_phase("selinux", "Applying SELinux labels", [&]() {
+            return relabel_selinux_target(tools, error);
+        })) {
         return false;
     }
 
     if (config.bootloader == BootloaderChoice::Grub) {
-        print_notice("->", C_CYAN, "Installing bootloader");
-        if (!install_bootloader(tools, config, artifacts, error)) {
-            cleanup_install_state(state);
+        if (!run_phase("bootloader", "Installing bootloader", [&]() {
+                return install_bootloader(tools, config, artifacts, error);
+            })) {
             return false;
         }
     }
 
+    set_log_phase("finalize");
+    clear_install_journal(journal);
     ::sync();
     cleanup_install_state(state);
     ::sync();
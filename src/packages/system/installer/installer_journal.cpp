@@ -0,0 +1,521 @@
+#include "installer_common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+const int kJournalVersion = 1;
+const char* const kRunJournalDir = "/run/geminios-installer";
+const char* const kTargetJournalDir = "/var/lib/geminios";
+const char* const kJournalName = "install-journal";
+const char* const kManifestName = "install-manifest";
+const size_t kProgressStatBudget = 8192;
+
+std::string run_journal_path(const char* name) {
+    return std::string(kRunJournalDir) + "/" + name;
+}
+
+std::string target_journal_path(const char* name) {
+    return kTargetRoot + kTargetJournalDir + "/" + name;
+}
+
+// The journal is rewritten after every phase; a crash mid-write must leave
+// the previous copy intact rather than a truncated one.
+bool write_file_atomically(const std::string& path, const std::string& contents) {
+    const std::string::size_type slash = path.find_last_of('/');
+    if (slash != std::string::npos && !mkdir_p(path.substr(0, slash))) return false;
+
+    const std::string temp_path = path + ".tmp";
+    const int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_message("WARN", "Failed to write " + temp_path + ": " + std::strerror(errno));
+        return false;
+    }
+    size_t offset = 0;
+    while (offset < contents.size()) {
+        const ssize_t written = write(fd, contents.data() + offset, contents.size() - offset);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            log_message("WARN", "Failed to write " + temp_path + ": " + std::strerror(errno));
+            close(fd);
+            unlink(temp_path.c_str());
+            return false;
+        }
+        offset += static_cast<size_t>(written);
+    }
+    fsync(fd);
+    close(fd);
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        log_message("WARN", "Failed to replace " + path + ": " + std::strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Passwords are deliberately left out; --resume asks for them again when the
+// accounts phase has not run yet.
+std::string serialize_journal(const InstallJournal& journal) {
+    const InstallerConfig& config = journal.config;
+    const InstallArtifacts& artifacts = journal.artifacts;
+    std::ostringstream out;
+    auto put = [&out](const char* key, const std::string& value) { out << key << "=" << value << "\n"; };
+    auto put_int = [&put](const char* key, int value) { put(key, std::to_string(value)); };
+
+    out << "# GeminiOS installer journal. Resume with: installer --resume\n";
+    put_int("VERSION", kJournalVersion);
+    put_int("PARTITION_MODE", static_cast<int>(config.partition_mode));
+    put_int("BOOT_MODE", static_cast<int>(config.boot_mode));
+    put_int("FILESYSTEM", static_cast<int>(config.filesystem));
+    put_int("BTRFS_SUBVOLUMES", config.btrfs_subvolumes);
+    put("IMAGE", config.image_path);
+    put_int("SWAP_MODE", static_cast<int>(config.swap_mode));
+    put_int("BOOTLOADER", static_cast<int>(config.bootloader));
+    put_int("PROFILE", static_cast<int>(config.profile));
+    put("DISK", config.disk);
+    put("ROOT_PARTITION", config.root_partition);
+    put_int("FORMAT_ROOT", config.format_root);
+    put("EFI_PARTITION", config.efi_partition);
+    put_int("FORMAT_EFI", config.format_efi);
+    put("SWAP_PARTITION", config.swap_partition);
+    put_int("SWAP_SIZE_MB", config.swap_size_mb);
+    put_int("ZSWAP", config.zswap);
+    put("SWAP_COMPRESSOR", config.swap_compressor);
+    put_int("ZRAM_PERCENT", config.zram_percent);
+    put_int("ZRAM_PER_CPU", config.zram_per_cpu);
+    put("HOSTNAME", config.hostname);
+    put("TIMEZONE", config.timezone);
+    put("LOCALE", config.locale);
+    put("KEYBOARD", config.keyboard_layout);
+    put_int("USER_CREATE", config.user.create);
+    put("USER_NAME", config.user.username);
+    put_int("USER_SUDO", config.user.sudo);
+    put_int("USER_AUTOLOGIN", config.user.autologin);
+
+    put("ARTIFACT_ROOT_PARTITION", artifacts.root_partition);
+    put("ARTIFACT_EFI_PARTITION", artifacts.efi_partition);
+    put("ARTIFACT_SWAP_PARTITION", artifacts.swap_partition);
+    put("ARTIFACT_ROOT_UUID", artifacts.root_uuid);
+    put("ARTIFACT_ROOT_PARTUUID", artifacts.root_partuuid);
+    put("ARTIFACT_EFI_UUID", artifacts.efi_uuid);
+    put("ARTIFACT_EFI_PARTUUID", artifacts.efi_partuuid);
+    put("ARTIFACT_SWAP_UUID", artifacts.swap_uuid);
+    put("ARTIFACT_SWAP_PARTUUID", artifacts.swap_partuuid);
+    put("ARTIFACT_DISK_ID", artifacts.disk_id);
+
+    for (const auto& phase : journal.completed_phases) put("PHASE", phase);
+    for (const auto& path : journal.copied_paths) put("COPIED", path);
+    return out.str();
+}
+
+bool parse_journal(const std::vector<std::string>& lines, InstallJournal& journal, std::string& error) {
+    std::map<std::string, std::string> values;
+    journal.completed_phases.clear();
+    journal.copied_paths.clear();
+    for (const auto& line : lines) {
+        if (line.empty() || line[0] == '#') continue;
+        const std::string::size_type equals = line.find('=');
+        if (equals == std::string::npos) continue;
+        const std::string key = line.substr(0, equals);
+        const std::string value = line.substr(equals + 1);
+        if (key == "PHASE") {
+            journal.completed_phases.push_back(value);
+        } else if (key == "COPIED") {
+            journal.copied_paths.push_back(value);
+        } else {
+            values[key] = value;
+        }
+    }
+
+    if (std::atoi(values["VERSION"].c_str()) != kJournalVersion) {
+        error = "The install journal was written by an incompatible installer version.";
+        return false;
+    }
+
+    auto get_int = [&values](const char* key) { return std::atoi(values[key].c_str()); };
+    // Enumerations are range-checked so a damaged journal is refused rather
+    // than turned into a value no switch handles.
+    auto get_choice = [&values, &error](const char* key, int last, int& choice) {
+        const std::string& text = values[key];
+        char* end = nullptr;
+        errno = 0;
+        const long value = std::strtol(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || errno != 0 || value < 0 || value > last) {
+            error = std::string("The install journal has an invalid ") + key + " value \"" + text + "\".";
+            return false;
+        }
+        choice = static_cast<int>(value);
+        return true;
+    };
+    int partition_mode = 0;
+    int boot_mode = 0;
+    int filesystem = 0;
+    int swap_mode = 0;
+    int bootloader = 0;
+    int profile = 0;
+    if (!get_choice("PARTITION_MODE", static_cast<int>(PartitionMode::Existing), partition_mode) ||
+        !get_choice("BOOT_MODE", static_cast<int>(BootMode::Uefi), boot_mode) ||
+        !get_choice("FILESYSTEM", static_cast<int>(FilesystemType::F2fs), filesystem) ||
+        !get_choice("SWAP_MODE", static_cast<int>(SwapMode::Zram), swap_mode) ||
+        !get_choice("BOOTLOADER", static_cast<int>(BootloaderChoice::None), bootloader) ||
+        !get_choice("PROFILE", static_cast<int>(InstallProfile::Developer), profile)) {
+        return false;
+    }
+
+    InstallerConfig& config = journal.config;
+    config.partition_mode = static_cast<PartitionMode>(partition_mode);
+    config.boot_mode = static_cast<BootMode>(boot_mode);
+    config.filesystem = static_cast<FilesystemType>(filesystem);
+    config.btrfs_subvolumes = get_int("BTRFS_SUBVOLUMES") != 0;
+    config.image_path = values["IMAGE"];
+    config.swap_mode = static_cast<SwapMode>(swap_mode);
+    config.bootloader = static_cast<BootloaderChoice>(bootloader);
+    config.profile = static_cast<InstallProfile>(profile);
+    config.disk = values["DISK"];
+    config.root_partition = values["ROOT_PARTITION"];
+    config.format_root = get_int("FORMAT_ROOT") != 0;
+    config.efi_partition = values["EFI_PARTITION"];
+    config.format_efi = get_int("FORMAT_EFI") != 0;
+    config.swap_partition = values["SWAP_PARTITION"];
+    config.swap_size_mb = get_int("SWAP_SIZE_MB");
+    config.zswap = get_int("ZSWAP") != 0;
+    config.swap_compressor = values["SWAP_COMPRESSOR"];
+    config.zram_percent = get_int("ZRAM_PERCENT");
+    config.zram_per_cpu = get_int("ZRAM_PER_CPU") != 0;
+    config.hostname = values["HOSTNAME"];
+    config.timezone = values["TIMEZONE"];
+    config.locale = values["LOCALE"];
+    config.keyboard_layout = values["KEYBOARD"];
+    config.user.create = get_int("USER_CREATE") != 0;
+    config.user.username = values["USER_NAME"];
+    config.user.sudo = get_int("USER_SUDO") != 0;
+    config.user.autologin = get_int("USER_AUTOLOGIN") != 0;
+
+    InstallArtifacts& artifacts = journal.artifacts;
+    artifacts.root_partition = values["ARTIFACT_ROOT_PARTITION"];
+    artifacts.efi_partition = values["ARTIFACT_EFI_PARTITION"];
+    artifacts.swap_partition = values["ARTIFACT_SWAP_PARTITION"];
+    artifacts.root_uuid = values["ARTIFACT_ROOT_UUID"];
+    artifacts.root_partuuid = values["ARTIFACT_ROOT_PARTUUID"];
+    artifacts.efi_uuid = values["ARTIFACT_EFI_UUID"];
+    artifacts.efi_partuuid = values["ARTIFACT_EFI_PARTUUID"];
+    artifacts.swap_uuid = values["ARTIFACT_SWAP_UUID"];
+    artifacts.swap_partuuid = values["ARTIFACT_SWAP_PARTUUID"];
+    artifacts.disk_id = values["ARTIFACT_DISK_ID"];
+    return true;
+}
+
+// Finds a journalled partition again by its PARTUUID, or its filesystem
+// UUID when no PARTUUID was recorded, and checks the UUID still matches.
+// Kernel names can change between the interrupted run and this one.
+bool resolve_partition(
+    const std::vector<BlockProbe>& probes,
+    const char* what,
+    const std::string& partuuid,
+    const std::string& uuid,
+    std::string& device,
+    std::string& error
+) {
+    if (device.empty()) return true;
+    if (partuuid.empty() && uuid.empty()) {
+        error = std::string("The ") + what + " partition " + device +
+            " has no recorded identity in the install journal. Start a new installation instead.";
+        return false;
+    }
+
+    const BlockProbe* match = nullptr;
+    for (const auto& probe : probes) {
+        if (partuuid.empty() ? probe.uuid == uuid : probe.partuuid == partuuid) {
+            match = &probe;
+            break;
+        }
+    }
+    const std::string identity = partuuid.empty() ? "UUID " + uuid : "PARTUUID " + partuuid;
+    if (!match) {
+        error = std::string("The ") + what + " partition recorded in the install journal (" + identity +
+            ", was " + device + ") is no longer present.";
+        return false;
+    }
+    if (!uuid.empty() && match->uuid != uuid) {
+        error = std::string("The ") + what + " partition " + match->device + " (" + identity +
+            ") no longer carries filesystem UUID " + uuid + "; refusing to resume on it.";
+        return false;
+    }
+    if (match->device != device) {
+        log_message("INFO", std::string("The ") + what + " partition moved from " + device + " to " + match->device);
+        device = match->device;
+    }
+    return true;
+}
+
+// Finds the journalled target disk again by its WWN or serial.
+bool resolve_disk(const std::string& disk_id, std::string& disk, std::string& error) {
+    for (const auto& candidate : list_disks()) {
+        if (disk_stable_id(candidate.name) != disk_id) continue;
+        if (candidate.path != disk) {
+            log_message("INFO", "The target disk moved from " + disk + " to " + candidate.path);
+            disk = candidate.path;
+        }
+        return true;
+    }
+    error = "The target disk recorded in the install journal (" + disk_id + ", was " + disk + ") is no longer present.";
+    return false;
+}
+
+bool resolve_journal_devices(InstallJournal& journal, std::string& error) {
+    InstallerConfig& config = journal.config;
+    InstallArtifacts& artifacts = journal.artifacts;
+    const std::vector<BlockProbe> probes = probe_disk_partitions(list_disks());
+
+    const std::string recorded_root = artifacts.root_partition;
+    if (!resolve_partition(probes, "root", artifacts.root_partuuid, artifacts.root_uuid, artifacts.root_partition, error) ||
+        !resolve_partition(probes, "EFI", artifacts.efi_partuuid, artifacts.efi_uuid, artifacts.efi_partition, error) ||
+        !resolve_partition(probes, "swap", artifacts.swap_partuuid, artifacts.swap_uuid, artifacts.swap_partition, error)) {
+        return false;
+    }
+    if (config.partition_mode == PartitionMode::Existing) {
+        if (!artifacts.root_partition.empty()) config.root_partition = artifacts.root_partition;
+        if (!artifacts.efi_partition.empty()) config.efi_partition = artifacts.efi_partition;
+        if (!artifacts.swap_partition.empty()) config.swap_partition = artifacts.swap_partition;
+    }
+    if (config.disk.empty()) return true;
+
+    // An automatic layout puts the root on the target disk, so once it has
+    // been partitioned the root partition identifies the disk as well.
+    if (config.partition_mode == PartitionMode::AutoWipe && !artifacts.root_partition.empty()) {
+        config.disk = "/dev/" + sysfs_disk_name(artifacts.root_partition);
+        const std::string current_id = disk_stable_id(sysfs_disk_name(config.disk));
+        if (!artifacts.disk_id.empty() && !current_id.empty() && current_id != artifacts.disk_id) {
+            error = "The root partition recorded in the install journal is now on " + config.disk + " (" +
+                current_id + "), not on the journalled disk (" + artifacts.disk_id + ").";
+            return false;
+        }
+        return true;
+    }
+    if (!artifacts.disk_id.empty()) return resolve_disk(artifacts.disk_id, config.disk, error);
+    // Without a WWN or serial the name is only trusted when the partitions
+    // beside it have not moved either.
+    if (!artifacts.root_partition.empty() && artifacts.root_partition == recorded_root) return true;
+    error = "The target disk " + config.disk +
+        " cannot be identified again from the install journal. Start a new installation instead.";
+    return false;
+}
+
+// /run does not survive a reboot. The copy on the target does, so look for
+// it on any partition carrying the label the installer gives its root.
+bool read_journal_from_target_partitions(std::vector<std::string>& lines) {
+    for (const auto& probe : probe_disk_partitions(list_disks())) {
+        if (probe.label != "GeminiRoot" || probe.fs_type.empty()) continue;
+
+        char mountpoint[] = "/run/geminios-journal.XXXXXX";
+        if (!mkdtemp(mountpoint)) return false;
+        bool found = false;
+        if (mount_device(probe.device, mountpoint, probe.fs_type, MS_RDONLY)) {
+            // A btrfs subvolume layout keeps the root filesystem under @.
+            for (const std::string prefix : {"", "/@"}) {
+                const std::string path = std::string(mountpoint) + prefix + kTargetJournalDir + "/" + kJournalName;
+                if (read_lines(path, lines)) {
+                    log_message("INFO", "Found install journal on " + probe.device);
+                    found = true;
+                    break;
+                }
+            }
+            unmount_path(mountpoint);
+        }
+        rmdir(mountpoint);
+        if (found) return true;
+    }
+    return false;
+}
+
+bool path_under(const std::string& path, const std::string& prefix) {
+    return path == prefix || (path.size() > prefix.size() && path.compare(0, prefix.size(), prefix) == 0 &&
+                              path[prefix.size()] == '/');
+}
+
+}  // namespace
+
+bool load_install_journal(InstallJournal& journal, std::string& error) {
+    std::vector<std::string> lines;
+    if (!read_lines(run_journal_path(kJournalName), lines) && !read_journal_from_target_partitions(lines)) {
+        error = "No interrupted installation was found to resume.";
+        return false;
+    }
+    if (!parse_journal(lines, journal, error) || !resolve_journal_devices(journal, error)) return false;
+    journal.resumed = true;
+    return true;
+}
+
+bool save_install_journal(const InstallJournal& journal) {
+    const std::string contents = serialize_journal(journal);
+    bool ok = write_file_atomically(run_journal_path(kJournalName), contents);
+    if (journal.target_mounted) ok = write_file_atomically(target_journal_path(kJournalName), contents) && ok;
+    return ok;
+}
+
+bool journal_phase_done(const InstallJournal& journal, const std::string& phase) {
+    return std::find(journal.completed_phases.begin(), journal.completed_phases.end(), phase) !=
+           journal.completed_phases.end();
+}
+
+bool complete_journal_phase(InstallJournal& journal, const std::string& phase) {
+    if (!journal_phase_done(journal, phase)) journal.completed_phases.push_back(phase);
+    return save_install_journal(journal);
+}
+
+void clear_install_journal(const InstallJournal& journal) {
+    for (const char* name : {kJournalName, kManifestName}) {
+        ensure_file_removed(run_journal_path(name));
+        if (journal.target_mounted) ensure_file_removed(target_journal_path(name));
+    }
+}
+
+bool save_journal_manifest(const InstallJournal& journal, const CopyManifest& manifest) {
+    std::ostringstream out;
+    for (const auto& entry : manifest.entries) {
+        out << entry.mode << " " << entry.size << " " << entry.mtime << " " << entry.path << "\n";
+    }
+    const std::string contents = out.str();
+    bool ok = write_file_atomically(run_journal_path(kManifestName), contents);
+    if (journal.target_mounted) ok = write_file_atomically(target_journal_path(kManifestName), contents) && ok;
+    return ok;
+}
+
+bool load_journal_manifest(CopyManifest& manifest) {
+    std::ifstream input(run_journal_path(kManifestName));
+    if (!input) input.open(target_journal_path(kManifestName));
+    if (!input) return false;
+
+    manifest.entries.clear();
+    manifest.file_count = 0;
+    manifest.total_bytes = 0;
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream fields(line);
+        ManifestEntry entry;
+        unsigned long mode = 0;
+        if (!(fields >> mode >> entry.size >> entry.mtime)) continue;
+        fields.get();
+        std::getline(fields, entry.path);
+        if (entry.path.empty()) continue;
+        entry.mode = static_cast<mode_t>(mode);
+        if (S_ISREG(entry.mode)) {
+            ++manifest.file_count;
+            manifest.total_bytes += entry.size;
+        }
+        manifest.entries.push_back(entry);
+    }
+    return !manifest.entries.empty();
+}
+
+std::vector<std::string> unfinished_manifest_entries(
+    const CopyManifest& manifest,
+    const std::string& prefix,
+    const std::string& target_root
+) {
+    // cp -a sets a file's mtime only once its data is written, so a file that
+    // matches the manifest in type, size and mtime was copied completely.
+    // A missing directory is copied whole, so nothing below it is listed.
+    std::vector<std::string> unfinished;
+    std::set<std::string> missing_dirs;
+    auto inside_missing_dir = [&missing_dirs](const std::string& path) {
+        for (std::string::size_type slash = path.find_last_of('/'); slash != 0 && slash != std::string::npos;
+             slash = path.find_last_of('/', slash - 1)) {
+            if (missing_dirs.count(path.substr(0, slash))) return true;
+        }
+        return false;
+    };
+    for (const auto& entry : manifest.entries) {
+        if (!path_under(entry.path, prefix)) continue;
+        if (!missing_dirs.empty() && inside_missing_dir(entry.path)) continue;
+
+        struct stat st;
+        const std::string target = target_root + entry.path;
+        const bool exists = lstat(target.c_str(), &st) == 0;
+        const bool same_type = exists && (st.st_mode & S_IFMT) == (entry.mode & S_IFMT);
+        if (S_ISDIR(entry.mode)) {
+            if (!same_type) {
+                unfinished.push_back(entry.path);
+                missing_dirs.insert(entry.path);
+            }
+            continue;
+        }
+        const bool complete = same_type && (!S_ISREG(entry.mode) ||
+            (static_cast<uint64_t>(st.st_size) == entry.size && static_cast<int64_t>(st.st_mtime) == entry.mtime));
+        if (!complete) unfinished.push_back(entry.path);
+    }
+    return unfinished;
+}
+
+std::function<void(uint64_t&, uint64_t&)> copy_progress_sampler(
+    const CopyManifest& manifest,
+    const std::string& target_root,
+    uint64_t& copied_bytes,
+    uint64_t& copied_files
+) {
+    // The same completeness test as above. Entries are counted as cp
+    // finishes them, so the figures hold on filesystems whose free block and
+    // inode counts say nothing about it (btrfs, compression).
+    struct SweepState {
+        const CopyManifest* manifest = nullptr;
+        std::string target_root;
+        std::vector<size_t> pending;
+        size_t cursor = 0;
+        uint64_t bytes = 0;
+        uint64_t files = 0;
+    };
+    auto state = std::make_shared<SweepState>();
+    state->manifest = &manifest;
+    state->target_root = target_root;
+
+    auto sweep = [](SweepState& sweep_state, size_t budget) {
+        const size_t checks = std::min(budget, sweep_state.pending.size());
+        for (size_t checked = 0; checked < checks; ++checked) {
+            if (sweep_state.cursor >= sweep_state.pending.size()) sweep_state.cursor = 0;
+            const ManifestEntry& entry = sweep_state.manifest->entries[sweep_state.pending[sweep_state.cursor]];
+            struct stat st;
+            const bool copied = lstat((sweep_state.target_root + entry.path).c_str(), &st) == 0 &&
+                (st.st_mode & S_IFMT) == (entry.mode & S_IFMT) &&
+                (!S_ISREG(entry.mode) || (static_cast<uint64_t>(st.st_size) == entry.size &&
+                                          static_cast<int64_t>(st.st_mtime) == entry.mtime));
+            if (!copied) {
+                ++sweep_state.cursor;
+                continue;
+            }
+            sweep_state.bytes += entry.size;
+            ++sweep_state.files;
+            sweep_state.pending[sweep_state.cursor] = sweep_state.pending.back();
+            sweep_state.pending.pop_back();
+        }
+    };
+
+    state->pending.resize(manifest.entries.size());
+    for (size_t i = 0; i < state->pending.size(); ++i) state->pending[i] = i;
+    sweep(*state, state->pending.size());
+    copied_bytes = state->bytes;
+    copied_files = state->files;
+
+    // Each sample stats a bounded slice of what is still missing, round
+    // robin, so a large tree costs a few milliseconds per refresh.
+    return [state, sweep](uint64_t& bytes, uint64_t& files) {
+        sweep(*state, kProgressStatBudget);
+        bytes = state->bytes;
+        files = state->files;
+    };
+}
+
+}  // namespace installer
@@ -0,0 +1,320 @@
+#include "installer_common.h"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+enum class LogRecordKind {
+    Raw,
+    Message,
+    Command,
+    Output
+};
+
+// Producers only capture what they were given plus two clock reads; all
+// formatting, quoting and I/O happen on the writer thread.
+struct LogRecord {
+    LogRecordKind kind = LogRecordKind::Raw;
+    uint64_t mono_ms = 0;
+    time_t wall = 0;
+    const char* phase = nullptr;
+    std::string level;
+    std::string text;
+    std::vector<std::string> args;
+};
+
+struct LogSlot {
+    std::atomic<size_t> sequence{0};
+    LogRecord record;
+};
+
+const size_t kLogRingSize = 4096;
+const size_t kLogBatchBytes = 64 * 1024;
+
+// Bounded multi-producer ring (Vyukov). Each slot's sequence number says
+// whether it is free for the producer at that position or holds a record
+// for the single writer thread.
+struct LogRing {
+    LogSlot slots[kLogRingSize];
+    std::atomic<size_t> enqueue_pos{0};
+    size_t dequeue_pos = 0;
+
+    LogRing() {
+        for (size_t i = 0; i < kLogRingSize; ++i) slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(LogRecord& record) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        LogSlot* slot = nullptr;
+        while (true) {
+            slot = &slots[pos % kLogRingSize];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->record = std::move(record);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(LogRecord& record) {
+        LogSlot& slot = slots[dequeue_pos % kLogRingSize];
+        const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(dequeue_pos + 1) < 0) return false;
+        record = std::move(slot.record);
+        slot.record = LogRecord{};
+        slot.sequence.store(dequeue_pos + kLogRingSize, std::memory_order_release);
+        ++dequeue_pos;
+        return true;
+    }
+};
+
+struct Logger {
+    LogRing ring;
+    int fd = -1;
+    uint64_t started_ms = 0;
+    std::atomic<bool> running{false};
+    std::atomic<const char*> phase{"setup"};
+    std::atomic<size_t> written{0};
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable flushed;
+    bool stopping = false;
+    bool flush_requested = false;
+    std::thread writer;
+};
+
+Logger& logger() {
+    static Logger* instance = new Logger();
+    return *instance;
+}
+
+void write_all(int fd, const std::string& data) {
+    const char* cursor = data.data();
+    size_t remaining = data.size();
+    while (remaining > 0) {
+        const ssize_t written = write(fd, cursor, remaining);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        cursor += written;
+        remaining -= static_cast<size_t>(written);
+    }
+}
+
+void format_record(const Logger& state, const LogRecord& record, std::string& out) {
+    if (record.kind == LogRecordKind::Raw) {
+        out += record.text;
+        out += '\n';
+        return;
+    }
+
+    std::tm tm_now;
+    localtime_r(&record.wall, &tm_now);
+    char wall[32];
+    std::strftime(wall, sizeof(wall), "%Y-%m-%d %H:%M:%S", &tm_now);
+
+    const uint64_t elapsed = record.mono_ms - state.started_ms;
+    char offset[32];
+    std::snprintf(
+        offset,
+        sizeof(offset),
+        "+%llu.%03llus",
+        static_cast<unsigned long long>(elapsed / 1000),
+        static_cast<unsigned long long>(elapsed % 1000)
+    );
+
+    out += "[";
+    out += wall;
+    out += " ";
+    out += offset;
+    out += "] [";
+    out += record.level;
+    out += "] [";
+    out += record.phase ? record.phase : "-";
+    out += "] ";
+    if (record.kind == LogRecordKind::Command) {
+        out += "EXEC ";
+        out += format_command(record.text, record.args);
+    } else if (record.kind == LogRecordKind::Output) {
+        out += record.args.empty() ? "" : record.args.front() + ": ";
+        out += record.text;
+    } else {
+        out += record.text;
+    }
+    out += '\n';
+}
+
+void writer_loop(Logger& state) {
+    std::string batch;
+    LogRecord record;
+    while (true) {
+        size_t drained = 0;
+        while (state.ring.pop(record)) {
+            format_record(state, record, batch);
+            ++drained;
+            if (batch.size() >= kLogBatchBytes) {
+                write_all(state.fd, batch);
+                if (g_verbose) write_all(STDERR_FILENO, batch);
+                batch.clear();
+            }
+        }
+        if (!batch.empty()) {
+            write_all(state.fd, batch);
+            if (g_verbose) write_all(STDERR_FILENO, batch);
+            batch.clear();
+        }
+
+        std::unique_lock<std::mutex> guard(state.lock);
+        state.written.store(state.ring.dequeue_pos, std::memory_order_release);
+        if (state.flush_requested) {
+            state.flush_requested = false;
+            state.flushed.notify_all();
+        }
+        if (state.stopping && drained == 0) break;
+        if (drained == 0) {
+            state.wake.wait_for(guard, std::chrono::milliseconds(25), [&state]() {
+                return state.stopping || state.flush_requested;
+            });
+        }
+    }
+    state.flushed.notify_all();
+}
+
+void enqueue(LogRecord& record) {
+    Logger& state = logger();
+    if (!state.running.load(std::memory_order_acquire)) start_logging(false);
+
+    record.mono_ms = monotonic_ms();
+    record.wall = std::time(nullptr);
+    record.phase = state.phase.load(std::memory_order_relaxed);
+
+    if (!state.running.load(std::memory_order_acquire)) {
+        std::string line;
+        format_record(state, record, line);
+        std::ofstream log(kLogPath, std::ios::app);
+        log << line;
+        return;
+    }
+
+    // A full ring means the writer is behind on a slow disk; waiting here is
+    // the only way to keep ordering without dropping lines.
+    while (!state.ring.push(record)) {
+        state.wake.notify_one();
+        std::this_thread::yield();
+    }
+}
+
+void stop_logging_at_exit() {
+    stop_logging();
+}
+
+}  // namespace
+
+void start_logging(bool truncate) {
+    Logger& state = logger();
+    std::lock_guard<std::mutex> guard(state.lock);
+    if (state.running.load(std::memory_order_acquire)) return;
+
+    const int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0);
+    state.fd = open(kLogPath.c_str(), flags, 0644);
+    if (state.fd < 0) return;
+
+    state.started_ms = monotonic_ms();
+    state.stopping = false;
+    state.writer = std::thread(writer_loop, std::ref(state));
+    state.running.store(true, std::memory_order_release);
+
+    static bool exit_hook_registered = false;
+    if (!exit_hook_registered) {
+        exit_hook_registered = true;
+        std::atexit(stop_logging_at_exit);
+    }
+}
+
+void flush_log() {
+    Logger& state = logger();
+    if (!state.running.load(std::memory_order_acquire)) return;
+
+    const size_t target = state.ring.enqueue_pos.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> guard(state.lock);
+    while (state.written.load(std::memory_order_acquire) < target && !state.stopping) {
+        state.flush_requested = true;
+        state.wake.notify_one();
+        state.flushed.wait_for(guard, std::chrono::milliseconds(100));
+    }
+}
+
+void stop_logging() {
+    Logger& state = logger();
+    if (!state.running.load(std::memory_order_acquire)) return;
+
+    flush_log();
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        state.stopping = true;
+    }
+    state.wake.notify_one();
+    state.writer.join();
+    state.running.store(false, std::memory_order_release);
+    close(state.fd);
+    state.fd = -1;
+}
+
+void set_log_phase(const char* phase) {
+    logger().phase.store(phase, std::memory_order_relaxed);
+}
+
+void append_log_line(const std::string& line) {
+    LogRecord record;
+    record.kind = LogRecordKind::Raw;
+    record.text = line;
+    enqueue(record);
+}
+
+void log_message(const std::string& level, const std::string& message) {
+    LogRecord record;
+    record.kind = LogRecordKind::Message;
+    record.level = level;
+    record.text = message;
+    enqueue(record);
+}
+
+void log_command(const std::string& path, const std::vector<std::string>& args) {
+    LogRecord record;
+    record.kind = LogRecordKind::Command;
+    record.level = "INFO";
+    record.text = path;
+    record.args = args;
+    enqueue(record);
+}
+
+void log_command_output(const std::string& tag, const std::string& line) {
+    LogRecord record;
+    record.kind = LogRecordKind::Output;
+    record.level = "OUT";
+    record.text = line;
+    record.args.push_back(tag);
+    enqueue(record);
+}
+
+}  // namespace installer
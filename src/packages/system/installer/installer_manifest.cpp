@@ -0,0 +1,190 @@
+#include "installer_common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+// Directories are handed out through a shared queue so one huge tree such as
+// /usr does not serialize the scan behind a single worker.
+struct ManifestScan {
+    std::string source_root;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::string> pending_dirs;
+    size_t busy_workers = 0;
+    bool failed = false;
+    std::string error;
+    std::vector<ManifestEntry> entries;
+    // Directories removed between their parent's listing and their own scan.
+    std::set<std::string> vanished_dirs;
+};
+
+ManifestEntry make_entry(const std::string& path, const struct stat& st) {
+    ManifestEntry entry;
+    entry.path = path;
+    entry.mode = st.st_mode;
+    entry.size = S_ISREG(st.st_mode) ? static_cast<uint64_t>(st.st_size) : 0;
+    entry.mtime = static_cast<int64_t>(st.st_mtime);
+    return entry;
+}
+
+bool scan_directory(ManifestScan& scan, const std::string& dir_path, std::vector<ManifestEntry>& found, std::vector<std::string>& subdirs) {
+    const std::string full_path = manifest_source_path(scan.source_root, dir_path);
+    int dir_fd = open(full_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+    if (dir_fd < 0) {
+        std::lock_guard<std::mutex> guard(scan.lock);
+        // A directory that went away, or was replaced by something else, is
+        // treated like any other entry that vanished during the scan.
+        if (errno == ENOENT || errno == ENOTDIR || errno == ELOOP) {
+            scan.vanished_dirs.insert(dir_path);
+            return true;
+        }
+        scan.failed = true;
+        scan.error = "Failed to open " + full_path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    DIR* dir = fdopendir(dir_fd);
+    if (!dir) {
+        const int saved_errno = errno;
+        close(dir_fd);
+        std::lock_guard<std::mutex> guard(scan.lock);
+        scan.failed = true;
+        scan.error = "Failed to read " + full_path + ": " + std::strerror(saved_errno);
+        return false;
+    }
+
+    while (dirent* item = readdir(dir)) {
+        const char* name = item->d_name;
+        if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) continue;
+
+        struct stat st;
+        if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+        const std::string child = dir_path + "/" + name;
+        found.push_back(make_entry(child, st));
+        if (S_ISDIR(st.st_mode)) subdirs.push_back(child);
+    }
+    closedir(dir);
+    return true;
+}
+
+void manifest_worker(ManifestScan& scan) {
+    std::vector<ManifestEntry> found;
+    std::vector<std::string> subdirs;
+
+    std::unique_lock<std::mutex> guard(scan.lock);
+    while (true) {
+        scan.wake.wait(guard, [&scan]() {
+            return scan.failed || !scan.pending_dirs.empty() || scan.busy_workers == 0;
+        });
+        if (scan.failed || scan.pending_dirs.empty()) break;
+
+        const std::string dir_path = scan.pending_dirs.front();
+        scan.pending_dirs.pop_front();
+        ++scan.busy_workers;
+        guard.unlock();
+
+        subdirs.clear();
+        scan_directory(scan, dir_path, found, subdirs);
+
+        guard.lock();
+        --scan.busy_workers;
+        scan.pending_dirs.insert(scan.pending_dirs.end(), subdirs.begin(), subdirs.end());
+        scan.wake.notify_all();
+    }
+    scan.wake.notify_all();
+
+    scan.entries.insert(
+        scan.entries.end(),
+        std::make_move_iterator(found.begin()),
+        std::make_move_iterator(found.end())
+    );
+}
+
+}  // namespace
+
+std::string manifest_source_path(const std::string& root, const std::string& path) {
+    return root == "/" ? path : root + path;
+}
+
+unsigned int installer_worker_count() {
+    const unsigned int hardware = std::thread::hardware_concurrency();
+    return std::max(2u, std::min(hardware == 0 ? 4u : hardware, 16u));
+}
+
+bool scan_copy_manifest(
+    const std::string& source_root,
+    const std::vector<std::string>& paths,
+    CopyManifest& manifest,
+    std::string& error
+) {
+    manifest = {};
+    manifest.source_root = source_root;
+
+    ManifestScan scan;
+    scan.source_root = source_root;
+    for (const auto& path : paths) {
+        struct stat st;
+        if (lstat(manifest_source_path(source_root, path).c_str(), &st) != 0) continue;
+        scan.entries.push_back(make_entry(path, st));
+        if (S_ISDIR(st.st_mode)) scan.pending_dirs.push_back(path);
+    }
+
+    std::vector<std::thread> workers;
+    const unsigned int worker_count = installer_worker_count();
+    for (unsigned int i = 0; i < worker_count; ++i) {
+        workers.emplace_back(manifest_worker, std::ref(scan));
+    }
+    for (auto& worker : workers) worker.join();
+
+    if (scan.failed) {
+        error = scan.error;
+        return false;
+    }
+    if (!scan.vanished_dirs.empty()) {
+        scan.entries.erase(
+            std::remove_if(scan.entries.begin(), scan.entries.end(), [&scan](const ManifestEntry& entry) {
+                return scan.vanished_dirs.count(entry.path) != 0;
+            }),
+            scan.entries.end()
+        );
+        log_message(
+            "WARN",
+            std::to_string(scan.vanished_dirs.size()) + " director" +
+                (scan.vanished_dirs.size() == 1 ? "y" : "ies") + " vanished while the copy manifest was built"
+        );
+    }
+
+    std::sort(scan.entries.begin(), scan.entries.end(), [](const ManifestEntry& left, const ManifestEntry& right) {
+        return left.path < right.path;
+    });
+    manifest.entries = std::move(scan.entries);
+    for (const auto& entry : manifest.entries) {
+        if (!S_ISREG(entry.mode)) continue;
+        ++manifest.file_count;
+        manifest.total_bytes += entry.size;
+    }
+
+    log_message(
+        "INFO",
+        "Copy manifest: " + std::to_string(manifest.entries.size()) + " entries, " +
+            std::to_string(manifest.file_count) + " regular files, " + format_bytes(manifest.total_bytes)
+    );
+    return true;
+}
+
+}  // namespace installer
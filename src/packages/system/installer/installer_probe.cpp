@@ -0,0 +1,401 @@
+#include "installer_common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+// One read covers every superblock we recognise: btrfs sits at 64 KiB and
+// the swap signature ends at the last byte of a 64 KiB page.
+const size_t kProbeWindow = 64 * 1024 + 4096;
+const size_t kGptMaxEntries = 256;
+
+struct PartitionSlot {
+    std::string type;
+    std::string partuuid;
+};
+
+struct PartitionTable {
+    bool gpt = false;
+    std::map<int, PartitionSlot> slots;
+};
+
+uint16_t le16(const unsigned char* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t le32(const unsigned char* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+        (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint64_t le64(const unsigned char* p) {
+    return static_cast<uint64_t>(le32(p)) | (static_cast<uint64_t>(le32(p + 4)) << 32);
+}
+
+bool all_zero(const unsigned char* p, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (p[i] != 0) return false;
+    }
+    return true;
+}
+
+// Filesystem UUIDs are stored in display order.
+std::string format_uuid(const unsigned char* p) {
+    if (all_zero(p, 16)) return "";
+    char out[37];
+    std::snprintf(
+        out, sizeof(out),
+        "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+        p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7],
+        p[8], p[9], p[10], p[11], p[12], p[13], p[14], p[15]
+    );
+    return out;
+}
+
+// GPT GUIDs keep their first three fields little-endian on disk.
+std::string format_guid(const unsigned char* p) {
+    if (all_zero(p, 16)) return "";
+    char out[37];
+    std::snprintf(
+        out, sizeof(out),
+        "%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+        le32(p), le16(p + 4), le16(p + 6),
+        p[8], p[9], p[10], p[11], p[12], p[13], p[14], p[15]
+    );
+    return out;
+}
+
+std::string fixed_string(const unsigned char* p, size_t size) {
+    size_t length = 0;
+    while (length < size && p[length] != 0) ++length;
+    std::string value(reinterpret_cast<const char*>(p), length);
+    while (!value.empty() && value.back() == ' ') value.pop_back();
+    return value;
+}
+
+// f2fs stores its volume name as UTF-16LE; installer labels are ASCII.
+std::string utf16_label(const unsigned char* p, size_t units) {
+    std::string value;
+    for (size_t i = 0; i < units; ++i) {
+        const uint16_t unit = le16(p + i * 2);
+        if (unit == 0) break;
+        value += unit < 0x80 ? static_cast<char>(unit) : '?';
+    }
+    return value;
+}
+
+size_t read_at(int fd, unsigned char* buffer, size_t size, uint64_t offset) {
+    size_t total = 0;
+    while (total < size) {
+        const ssize_t got = pread(fd, buffer + total, size - total, static_cast<off_t>(offset + total));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        total += static_cast<size_t>(got);
+    }
+    return total;
+}
+
+bool probe_ext(const unsigned char* data, size_t size, BlockProbe& probe) {
+    if (size < 1024 + 256) return false;
+    const unsigned char* sb = data + 1024;
+    if (le16(sb + 56) != 0xEF53) return false;
+
+    const uint32_t compat = le32(sb + 92);
+    const uint32_t incompat = le32(sb + 96);
+    const uint32_t ext4_features = 0x0040 | 0x0080 | 0x0200;  // extents, 64bit, flex_bg
+    if (incompat & ext4_features) {
+        probe.fs_type = "ext4";
+    } else if (compat & 0x0004) {
+        probe.fs_type = "ext3";
+    } else {
+        probe.fs_type = "ext2";
+    }
+    probe.uuid = format_uuid(sb + 104);
+    probe.label = fixed_string(sb + 120, 16);
+    return true;
+}
+
+bool probe_xfs(const unsigned char* data, size_t size, BlockProbe& probe) {
+    if (size < 512 || std::memcmp(data, "XFSB", 4) != 0) return false;
+    probe.fs_type = "xfs";
+    probe.uuid = format_uuid(data + 32);
+    probe.label = fixed_string(data + 108, 12);
+    return true;
+}
+
+bool probe_btrfs(const unsigned char* data, size_t size, BlockProbe& probe) {
+    const size_t offset = 64 * 1024;
+    if (size < offset + 4096) return false;
+    const unsigned char* sb = data + offset;
+    if (std::memcmp(sb + 64, "_BHRfS_M", 8) != 0) return false;
+    probe.fs_type = "btrfs";
+    probe.uuid = format_uuid(sb + 32);
+    probe.label = fixed_string(sb + 299, 256);
+    return true;
+}
+
+bool probe_f2fs(const unsigned char* data, size_t size, BlockProbe& probe) {
+    if (size < 1024 + 1024) return false;
+    const unsigned char* sb = data + 1024;
+    if (le32(sb) != 0xF2F52010) return false;
+    probe.fs_type = "f2fs";
+    probe.uuid = format_uuid(sb + 108);
+    probe.label = utf16_label(sb + 124, 512);
+    return true;
+}
+
+bool probe_vfat(const unsigned char* data, size_t size, BlockProbe& probe) {
+    if (size < 512 || data[510] != 0x55 || data[511] != 0xAA) return false;
+
+    size_t serial_offset = 0;
+    size_t label_offset = 0;
+    if (std::memcmp(data + 82, "FAT32   ", 8) == 0) {
+        serial_offset = 67;
+        label_offset = 71;
+    } else if (std::memcmp(data + 54, "FAT1", 4) == 0) {
+        serial_offset = 39;
+        label_offset = 43;
+    } else {
+        return false;
+    }
+
+    probe.fs_type = "vfat";
+    const uint32_t serial = le32(data + serial_offset);
+    char uuid[10];
+    std::snprintf(uuid, sizeof(uuid), "%04X-%04X", serial >> 16, serial & 0xFFFF);
+    probe.uuid = uuid;
+    probe.label = fixed_string(data + label_offset, 11);
+    if (probe.label == "NO NAME") probe.label.clear();
+    return true;
+}
+
+bool probe_swap(const unsigned char* data, size_t size, BlockProbe& probe) {
+    for (size_t page : {4096u, 8192u, 16384u, 65536u}) {
+        if (size < page) break;
+        if (std::memcmp(data + page - 10, "SWAPSPACE2", 10) != 0) continue;
+        probe.fs_type = "swap";
+        probe.uuid = format_uuid(data + 1036);
+        probe.label = fixed_string(data + 1052, 16);
+        return true;
+    }
+    return false;
+}
+
+void probe_superblocks(const unsigned char* data, size_t size, BlockProbe& probe) {
+    // Stale signatures can survive a reformat, so check the ones a new mkfs
+    // is sure to overwrite first. mkfs.ext4 leaves the boot sector alone and
+    // only mkfs.btrfs clears the start of the device, so vfat comes late and
+    // the 64 KiB btrfs superblock last.
+    if (probe_xfs(data, size, probe)) return;
+    if (probe_f2fs(data, size, probe)) return;
+    if (probe_ext(data, size, probe)) return;
+    if (probe_swap(data, size, probe)) return;
+    if (probe_vfat(data, size, probe)) return;
+    probe_btrfs(data, size, probe);
+}
+
+uint64_t logical_block_size(const std::string& disk) {
+    const std::string value = read_file_trimmed("/sys/block/" + disk + "/queue/logical_block_size");
+    const uint64_t size = value.empty() ? 0 : std::strtoull(value.c_str(), nullptr, 10);
+    return size >= 512 ? size : 512;
+}
+
+bool read_gpt(int fd, uint64_t sector, PartitionTable& table) {
+    std::vector<unsigned char> header(sector);
+    if (read_at(fd, header.data(), header.size(), sector) < 92) return false;
+    if (std::memcmp(header.data(), "EFI PART", 8) != 0) return false;
+
+    const uint64_t entries_lba = le64(header.data() + 72);
+    const uint32_t entry_count = le32(header.data() + 80);
+    const uint32_t entry_size = le32(header.data() + 84);
+    if (entry_size < 128 || entry_size > 4096 || entry_count == 0) return false;
+
+    const size_t count = std::min<size_t>(entry_count, kGptMaxEntries);
+    std::vector<unsigned char> entries(count * entry_size);
+    const size_t got = read_at(fd, entries.data(), entries.size(), entries_lba * sector);
+    for (size_t i = 0; i < count && (i + 1) * entry_size <= got; ++i) {
+        const unsigned char* entry = entries.data() + i * entry_size;
+        if (all_zero(entry, 16)) continue;
+        table.slots[static_cast<int>(i) + 1] = {format_guid(entry), format_guid(entry + 16)};
+    }
+    table.gpt = true;
+    return true;
+}
+
+void read_mbr(const unsigned char* mbr, PartitionTable& table) {
+    if (mbr[510] != 0x55 || mbr[511] != 0xAA) return;
+    const uint32_t signature = le32(mbr + 440);
+
+    // Logical partitions are numbered from 5; their PARTUUID only needs the
+    // disk signature and the number, so no EBR walk is required for it.
+    for (int number = 1; number <= 64; ++number) {
+        char partuuid[16];
+        std::snprintf(partuuid, sizeof(partuuid), "%08x-%02x", signature, number);
+        PartitionSlot slot;
+        if (signature != 0) slot.partuuid = partuuid;
+        if (number <= 4) {
+            const unsigned char type = mbr[446 + (number - 1) * 16 + 4];
+            if (type == 0) continue;
+            char type_hex[8];
+            std::snprintf(type_hex, sizeof(type_hex), "0x%x", type);
+            slot.type = type_hex;
+        }
+        table.slots[number] = slot;
+    }
+}
+
+PartitionTable read_partition_table(const std::string& disk) {
+    PartitionTable table;
+    const std::string path = "/dev/" + disk;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return table;
+
+    unsigned char mbr[512];
+    if (read_at(fd, mbr, sizeof(mbr), 0) == sizeof(mbr)) {
+        const bool protective = mbr[446 + 4] == 0xEE;
+        if (!(protective && read_gpt(fd, logical_block_size(disk), table))) read_mbr(mbr, table);
+    }
+    close(fd);
+    return table;
+}
+
+const uint64_t kIsoDescriptorOffset = 16 * 2048;
+
+bool read_iso9660_volume_id(const std::string& device, std::string& volume_id) {
+    // O_NONBLOCK keeps an empty optical drive from stalling the open.
+    int fd = open(device.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    unsigned char descriptor[2048];
+    const size_t got = read_at(fd, descriptor, sizeof(descriptor), kIsoDescriptorOffset);
+    close(fd);
+    if (got < 72) return false;
+    if (descriptor[0] != 1 || std::memcmp(descriptor + 1, "CD001", 5) != 0 || descriptor[6] != 1) return false;
+
+    volume_id = fixed_string(descriptor + 40, 32);
+    return true;
+}
+
+std::string device_name(const std::string& device_path) {
+    const std::string::size_type slash = device_path.find_last_of('/');
+    return slash == std::string::npos ? device_path : device_path.substr(slash + 1);
+}
+
+}  // namespace
+
+std::vector<BlockProbe> probe_block_devices(const std::vector<std::string>& devices) {
+    std::vector<BlockProbe> probes;
+    std::map<std::string, PartitionTable> tables;
+    std::vector<unsigned char> buffer(kProbeWindow);
+
+    for (const auto& device : devices) {
+        BlockProbe probe;
+        probe.device = device;
+        if (device.empty()) {
+            probes.push_back(probe);
+            continue;
+        }
+
+        const std::string name = device_name(device);
+        const std::string sectors = read_file_trimmed("/sys/class/block/" + name + "/size");
+        probe.bytes = sectors.empty() ? 0 : std::strtoull(sectors.c_str(), nullptr, 10) * 512ULL;
+
+        const std::string number = read_file_trimmed("/sys/class/block/" + name + "/partition");
+        if (!number.empty()) {
+            probe.disk = sysfs_disk_name(device);
+            probe.partition_number = std::atoi(number.c_str());
+            auto table = tables.find(probe.disk);
+            if (table == tables.end()) table = tables.emplace(probe.disk, read_partition_table(probe.disk)).first;
+            auto slot = table->second.slots.find(probe.partition_number);
+            if (slot != table->second.slots.end()) {
+                probe.part_type = slot->second.type;
+                probe.partuuid = slot->second.partuuid;
+            }
+        }
+
+        int fd = open(device.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            const size_t got = read_at(fd, buffer.data(), buffer.size(), 0);
+            close(fd);
+            probe_superblocks(buffer.data(), got, probe);
+        }
+        probes.push_back(probe);
+    }
+
+    for (const auto& probe : probes) {
+        if (probe.device.empty()) continue;
+        log_message(
+            "INFO",
+            "Probe " + probe.device + ": type=" + (probe.fs_type.empty() ? "(none)" : probe.fs_type) +
+                " uuid=" + probe.uuid + " label=" + probe.label + " partuuid=" + probe.partuuid +
+                " parttype=" + probe.part_type
+        );
+    }
+    return probes;
+}
+
+std::vector<IsoVolume> probe_iso9660_devices(const std::vector<std::string>& devices) {
+    std::vector<IsoVolume> found(devices.size());
+    std::vector<char> matched(devices.size(), 0);
+    std::atomic<size_t> next_index(0);
+
+    auto worker = [&]() {
+        while (true) {
+            const size_t index = next_index.fetch_add(1);
+            if (index >= devices.size()) break;
+            found[index].device = devices[index];
+            matched[index] = read_iso9660_volume_id(devices[index], found[index].volume_id) ? 1 : 0;
+        }
+    };
+
+    // Each probe is one small read, but a sleeping drive or a slow USB stick
+    // can take a while to answer; a few threads keep one from blocking the rest.
+    const size_t thread_count = std::min<size_t>(std::min<size_t>(installer_worker_count(), 8), devices.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < thread_count; ++i) workers.emplace_back(worker);
+    for (auto& thread : workers) thread.join();
+
+    std::vector<IsoVolume> volumes;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        if (!matched[i]) continue;
+        log_message("INFO", "ISO9660 volume on " + found[i].device + ": \"" + found[i].volume_id + "\"");
+        volumes.push_back(found[i]);
+    }
+    return volumes;
+}
+
+std::vector<BlockProbe> probe_disk_partitions(const std::vector<DiskInfo>& disks) {
+    std::vector<std::string> devices;
+    for (const auto& disk : disks) {
+        DIR* dir = opendir(("/sys/block/" + disk.name).c_str());
+        if (!dir) continue;
+
+        std::vector<std::pair<int, std::string>> partitions;
+        while (dirent* entry = readdir(dir)) {
+            const std::string name = entry->d_name;
+            if (name.rfind(disk.name, 0) != 0) continue;
+            const std::string number = read_file_trimmed("/sys/block/" + disk.name + "/" + name + "/partition");
+            if (number.empty()) continue;
+            partitions.emplace_back(std::atoi(number.c_str()), "/dev/" + name);
+        }
+        closedir(dir);
+
+        std::sort(partitions.begin(), partitions.end());
+        for (const auto& partition : partitions) devices.push_back(partition.second);
+    }
+    return probe_block_devices(devices);
+}
+
+}  // namespace installer
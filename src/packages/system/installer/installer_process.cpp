@@ -0,0 +1,440 @@
+#include "installer_common.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace installer {
+
+namespace {
+
+const int kTerminateGraceMs = 2000;
+
+enum StreamKind : uint64_t {
+    kStreamOutput = 0,
+    kStreamError = 1,
+    kStreamInput = 2,
+    kStreamExit = 3
+};
+
+// Splits a child's output stream into lines for the logger. A line that
+// never ends (progress bars, missing trailing newline) is flushed on EOF.
+struct OutputStream {
+    int fd = -1;
+    std::string pending;
+    std::string* capture = nullptr;
+};
+
+struct RunningJob {
+    pid_t pid = -1;
+    int pid_fd = -1;
+    int stdin_fd = -1;
+    size_t stdin_offset = 0;
+    OutputStream output;
+    OutputStream errors;
+    std::string tag;
+    uint64_t started_ms = 0;
+    uint64_t deadline_ms = 0;
+    bool terminated = false;
+    bool reaped = false;
+    int status = 0;
+    struct rusage usage {};
+};
+
+void emit_output_lines(const std::string& tag, OutputStream& stream, bool at_eof) {
+    std::string::size_type start = 0;
+    while (true) {
+        const std::string::size_type end = stream.pending.find_first_of("\r\n", start);
+        if (end == std::string::npos) break;
+        if (end > start) log_command_output(tag, stream.pending.substr(start, end - start));
+        start = end + 1;
+    }
+    stream.pending.erase(0, start);
+    if (at_eof && !stream.pending.empty()) {
+        log_command_output(tag, stream.pending);
+        stream.pending.clear();
+    }
+}
+
+std::string command_tag(const std::string& path) {
+    const std::string::size_type slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+uint64_t timeval_ms(const struct timeval& value) {
+    return static_cast<uint64_t>(value.tv_sec) * 1000ULL + static_cast<uint64_t>(value.tv_usec) / 1000ULL;
+}
+
+void close_fd(int& fd) {
+    if (fd >= 0) close(fd);
+    fd = -1;
+}
+
+void close_pipe(int fds[2]) {
+    close_fd(fds[0]);
+    close_fd(fds[1]);
+}
+
+bool make_pipe(int fds[2]) {
+    return pipe2(fds, O_CLOEXEC) == 0;
+}
+
+void set_nonblocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+int open_pid_fd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    const long fd = syscall(SYS_pidfd_open, pid, 0);
+    return fd < 0 ? -1 : static_cast<int>(fd);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+// Children get their own process group so a timeout can take down helpers
+// they fork, stdin from /dev/null unless we feed it, and default SIGPIPE.
+bool spawn_job(const CommandJob& job, RunningJob& running, std::string& error) {
+    int stdin_pipe[2] = {-1, -1};
+    int out_pipe[2] = {-1, -1};
+    int err_pipe[2] = {-1, -1};
+    if ((!job.stdin_data.empty() && !make_pipe(stdin_pipe)) || !make_pipe(out_pipe) ||
+        (job.capture_output && !make_pipe(err_pipe))) {
+        error = std::string("failed to create pipes: ") + std::strerror(errno);
+        close_pipe(stdin_pipe);
+        close_pipe(out_pipe);
+        close_pipe(err_pipe);
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (stdin_pipe[0] >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, stdin_pipe[0], STDIN_FILENO);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_pipe[1] >= 0 ? err_pipe[1] : out_pipe[1], STDERR_FILENO);
+    if (!job.working_directory.empty()) {
+        posix_spawn_file_actions_addchdir_np(&actions, job.working_directory.c_str());
+    }
+
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t default_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &default_signals);
+    posix_spawnattr_setpgroup(&attributes, 0);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(job.path.c_str()));
+    for (const auto& arg : job.args) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    const int spawn_error = posix_spawn(&running.pid, job.path.c_str(), &actions, &attributes, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+
+    close_fd(stdin_pipe[0]);
+    close_fd(out_pipe[1]);
+    close_fd(err_pipe[1]);
+    if (spawn_error != 0) {
+        error = "failed to start " + job.path + ": " + std::strerror(spawn_error);
+        close_fd(stdin_pipe[1]);
+        close_fd(out_pipe[0]);
+        close_fd(err_pipe[0]);
+        return false;
+    }
+
+    running.stdin_fd = stdin_pipe[1];
+    running.output.fd = out_pipe[0];
+    running.errors.fd = err_pipe[0];
+    running.pid_fd = open_pid_fd(running.pid);
+    for (int fd : {running.stdin_fd, running.output.fd, running.errors.fd}) {
+        if (fd >= 0) set_nonblocking(fd);
+    }
+    return true;
+}
+
+class JobRunner {
+public:
+    JobRunner(const std::vector<CommandJob>& jobs, std::vector<CommandJobResult>& results)
+        : jobs_(jobs), results_(results), running_(jobs.size()) {}
+
+    ~JobRunner() {
+        if (epoll_fd_ >= 0) close(epoll_fd_);
+    }
+
+    void run(unsigned int max_parallel) {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0) {
+            for (auto& result : results_) result.result = {false, -1, "epoll_create1 failed"};
+            return;
+        }
+
+        size_t next_job = 0;
+        size_t active = 0;
+        while (next_job < jobs_.size() || active > 0) {
+            while (next_job < jobs_.size() && active < max_parallel) {
+                if (start(next_job)) ++active;
+                ++next_job;
+            }
+            if (active == 0) continue;
+
+            epoll_event events[16];
+            const int ready = epoll_wait(epoll_fd_, events, 16, wait_timeout_ms());
+            if (ready < 0 && errno != EINTR) break;
+            for (int i = 0; i < ready; ++i) {
+                const size_t index = static_cast<size_t>(events[i].data.u64 >> 2);
+                handle_event(index, static_cast<StreamKind>(events[i].data.u64 & 3));
+            }
+            enforce_deadlines();
+
+            for (size_t index = 0; index < running_.size(); ++index) {
+                RunningJob& job = running_[index];
+                if (job.pid < 0 || !finished(job)) continue;
+                complete(index);
+                --active;
+            }
+        }
+    }
+
+private:
+    const std::vector<CommandJob>& jobs_;
+    std::vector<CommandJobResult>& results_;
+    std::vector<RunningJob> running_;
+    int epoll_fd_ = -1;
+
+    void watch(int fd, size_t index, StreamKind kind, uint32_t events) {
+        if (fd < 0) return;
+        epoll_event event {};
+        event.events = events;
+        event.data.u64 = (static_cast<uint64_t>(index) << 2) | kind;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    bool start(size_t index) {
+        const CommandJob& job = jobs_[index];
+        CommandJobResult& result = results_[index];
+        if (job.path.empty()) {
+            result.result = {false, -1, "missing executable path"};
+            return false;
+        }
+
+        log_command(job.path, job.args);
+        RunningJob& running = running_[index];
+        running.tag = command_tag(job.path);
+        std::string error;
+        if (!spawn_job(job, running, error)) {
+            running.pid = -1;
+            log_message("ERROR", error);
+            result.result = {false, -1, error};
+            return false;
+        }
+
+        running.started_ms = monotonic_ms();
+        running.deadline_ms = job.timeout_ms > 0 ? running.started_ms + static_cast<uint64_t>(job.timeout_ms) : 0;
+        if (job.capture_output) running.output.capture = &result.output;
+        watch(running.stdin_fd, index, kStreamInput, EPOLLOUT);
+        watch(running.output.fd, index, kStreamOutput, EPOLLIN);
+        watch(running.errors.fd, index, kStreamError, EPOLLIN);
+        watch(running.pid_fd, index, kStreamExit, EPOLLIN);
+        return true;
+    }
+
+    int wait_timeout_ms() const {
+        uint64_t nearest = 0;
+        for (const auto& job : running_) {
+            if (job.pid < 0 || job.deadline_ms == 0) continue;
+            if (nearest == 0 || job.deadline_ms < nearest) nearest = job.deadline_ms;
+        }
+        if (nearest == 0) return -1;
+        const uint64_t now = monotonic_ms();
+        return nearest <= now ? 0 : static_cast<int>(std::min<uint64_t>(nearest - now, 60000));
+    }
+
+    void handle_event(size_t index, StreamKind kind) {
+        RunningJob& job = running_[index];
+        switch (kind) {
+            case kStreamInput:
+                feed_stdin(index);
+                break;
+            case kStreamOutput:
+                drain(job, job.output);
+                break;
+            case kStreamError:
+                drain(job, job.errors);
+                break;
+            case kStreamExit:
+                reap(job, WNOHANG);
+                if (job.reaped) {
+                    // Whatever the child wrote before exiting is already in
+                    // the pipe; grandchildren keeping it open must not stall us.
+                    drain(job, job.output);
+                    drain(job, job.errors);
+                    close_stream(job, job.output);
+                    close_stream(job, job.errors);
+                    close_fd(job.stdin_fd);
+                }
+                break;
+        }
+    }
+
+    void feed_stdin(size_t index) {
+        RunningJob& job = running_[index];
+        const std::string& data = jobs_[index].stdin_data;
+        while (job.stdin_fd >= 0 && job.stdin_offset < data.size()) {
+            const ssize_t written = write(job.stdin_fd, data.data() + job.stdin_offset, data.size() - job.stdin_offset);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN) return;
+                break;
+            }
+            job.stdin_offset += static_cast<size_t>(written);
+        }
+        close_fd(job.stdin_fd);
+    }
+
+    void drain(RunningJob& job, OutputStream& stream) {
+        char buffer[16384];
+        while (stream.fd >= 0) {
+            const ssize_t count = read(stream.fd, buffer, sizeof(buffer));
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN) return;
+            }
+            if (count <= 0) {
+                close_stream(job, stream);
+                return;
+            }
+            if (stream.capture) {
+                stream.capture->append(buffer, static_cast<size_t>(count));
+            } else {
+                stream.pending.append(buffer, static_cast<size_t>(count));
+                emit_output_lines(job.tag, stream, false);
+            }
+        }
+    }
+
+    void close_stream(RunningJob& job, OutputStream& stream) {
+        if (stream.fd < 0) return;
+        close_fd(stream.fd);
+        if (!stream.capture) emit_output_lines(job.tag, stream, true);
+    }
+
+    void reap(RunningJob& job, int flags) {
+        if (job.reaped) return;
+        pid_t waited;
+        do {
+            waited = wait4(job.pid, &job.status, flags, &job.usage);
+        } while (waited < 0 && errno == EINTR);
+        if (waited == job.pid || (waited < 0 && errno == ECHILD)) job.reaped = true;
+    }
+
+    void enforce_deadlines() {
+        const uint64_t now = monotonic_ms();
+        for (size_t index = 0; index < running_.size(); ++index) {
+            RunningJob& job = running_[index];
+            if (job.pid < 0 || job.reaped || job.deadline_ms == 0 || now < job.deadline_ms) continue;
+            if (!job.terminated) {
+                log_message("WARN", job.tag + " exceeded its " + std::to_string(jobs_[index].timeout_ms) + " ms timeout; terminating");
+                kill(-job.pid, SIGTERM);
+                job.terminated = true;
+                job.deadline_ms = now + kTerminateGraceMs;
+            } else {
+                kill(-job.pid, SIGKILL);
+                job.deadline_ms = 0;
+            }
+            results_[index].timed_out = true;
+        }
+    }
+
+    bool finished(RunningJob& job) {
+        // Without a pidfd, EOF on every output pipe is the exit signal.
+        if (job.output.fd >= 0 || job.errors.fd >= 0) return false;
+        close_fd(job.stdin_fd);
+        reap(job, 0);
+        return job.reaped;
+    }
+
+    void complete(size_t index) {
+        RunningJob& job = running_[index];
+        CommandJobResult& result = results_[index];
+        close_fd(job.pid_fd);
+
+        result.elapsed_ms = monotonic_ms() - job.started_ms;
+        result.user_ms = timeval_ms(job.usage.ru_utime);
+        result.system_ms = timeval_ms(job.usage.ru_stime);
+        result.max_rss_kb = job.usage.ru_maxrss;
+
+        if (WIFEXITED(job.status)) {
+            const int exit_code = WEXITSTATUS(job.status);
+            result.result = {exit_code == 0, exit_code, exit_code == 0 ? "" : "exit code " + std::to_string(exit_code)};
+        } else if (WIFSIGNALED(job.status)) {
+            const int sig = WTERMSIG(job.status);
+            result.result = {false, 128 + sig, "signal " + std::to_string(sig)};
+        } else {
+            result.result = {false, -1, "command did not exit cleanly"};
+        }
+        if (result.timed_out) result.result.message = "timed out after " + std::to_string(jobs_[index].timeout_ms) + " ms";
+
+        log_message(
+            "INFO",
+            "DONE " + job.tag + " (" + (result.result.success ? "ok" : result.result.message) + ") in " +
+                std::to_string(result.elapsed_ms) + " ms, user " + std::to_string(result.user_ms) + " ms, sys " +
+                std::to_string(result.system_ms) + " ms, max RSS " + std::to_string(result.max_rss_kb) + " KiB"
+        );
+        if (!result.result.success && jobs_[index].log_failure) {
+            log_message("ERROR", "Command " + job.tag + " failed: " + result.result.message + ". See " + kLogPath);
+        }
+        job.pid = -1;
+    }
+};
+
+}  // namespace
+
+std::vector<CommandJobResult> run_commands(const std::vector<CommandJob>& jobs, unsigned int max_parallel) {
+    std::vector<CommandJobResult> results(jobs.size());
+    if (jobs.empty()) return results;
+    if (max_parallel == 0) max_parallel = installer_worker_count();
+
+    JobRunner runner(jobs, results);
+    runner.run(max_parallel);
+    return results;
+}
+
+CommandResult run_command(const std::string& path, const std::vector<std::string>& args, const std::string& stdin_data) {
+    CommandJob job;
+    job.path = path;
+    job.args = args;
+    job.stdin_data = stdin_data;
+    return run_commands({job}).front().result;
+}
+
+CommandResult run_command_capture(const std::string& path, const std::vector<std::string>& args, std::string& output) {
+    CommandJob job;
+    job.path = path;
+    job.args = args;
+    job.capture_output = true;
+    job.log_failure = false;
+
+    std::vector<CommandJobResult> results = run_commands({job});
+    output = std::move(results.front().output);
+    return results.front().result;
+}
+
+}  // namespace installer
@@ -0,0 +1,253 @@
+#include "installer_common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+// The work itself only bumps two atomics; sampling, rate smoothing and
+// drawing all happen on the renderer thread at these intervals.
+const int kRenderIntervalMs = 250;
+const int kJsonIntervalMs = 1000;
+const double kRateSmoothing = 0.3;
+
+struct ProgressState {
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread renderer;
+    bool running = false;
+
+    std::string stage;
+    uint64_t total_bytes = 0;
+    uint64_t total_files = 0;
+    std::atomic<uint64_t> done_bytes{0};
+    std::atomic<uint64_t> done_files{0};
+    std::function<void(uint64_t&, uint64_t&)> sampler;
+    uint64_t started_ms = 0;
+
+    FILE* json = nullptr;
+    bool json_to_stdout = false;
+};
+
+struct ProgressSnapshot {
+    uint64_t bytes = 0;
+    uint64_t files = 0;
+    uint64_t elapsed_ms = 0;
+    double bytes_per_second = 0;
+    double files_per_second = 0;
+    int64_t eta_seconds = -1;
+};
+
+ProgressState& progress_state() {
+    static ProgressState state;
+    return state;
+}
+
+std::string format_duration(int64_t seconds) {
+    char buffer[32];
+    if (seconds >= 3600) {
+        std::snprintf(buffer, sizeof(buffer), "%lld:%02lld:%02lld", static_cast<long long>(seconds / 3600),
+                      static_cast<long long>(seconds / 60 % 60), static_cast<long long>(seconds % 60));
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "%lld:%02lld", static_cast<long long>(seconds / 60),
+                      static_cast<long long>(seconds % 60));
+    }
+    return buffer;
+}
+
+void sample_progress(ProgressState& state, ProgressSnapshot& snapshot) {
+    if (state.sampler) {
+        uint64_t bytes = 0;
+        uint64_t files = 0;
+        state.sampler(bytes, files);
+        state.done_bytes.store(bytes, std::memory_order_relaxed);
+        state.done_files.store(files, std::memory_order_relaxed);
+    }
+    snapshot.bytes = state.done_bytes.load(std::memory_order_relaxed);
+    snapshot.files = state.done_files.load(std::memory_order_relaxed);
+    // Never show a sampler running past the totals of its stage.
+    if (state.total_bytes != 0) snapshot.bytes = std::min(snapshot.bytes, state.total_bytes);
+    if (state.total_files != 0) snapshot.files = std::min(snapshot.files, state.total_files);
+    snapshot.elapsed_ms = monotonic_ms() - state.started_ms;
+}
+
+void update_rates(ProgressSnapshot& current, const ProgressSnapshot& previous, const ProgressState& state) {
+    const uint64_t interval_ms = current.elapsed_ms - previous.elapsed_ms;
+    if (interval_ms == 0) return;
+    const double bytes_rate = static_cast<double>(current.bytes - std::min(current.bytes, previous.bytes)) * 1000.0 / interval_ms;
+    const double files_rate = static_cast<double>(current.files - std::min(current.files, previous.files)) * 1000.0 / interval_ms;
+    const bool first = previous.elapsed_ms == 0;
+    current.bytes_per_second = first ? bytes_rate : previous.bytes_per_second + kRateSmoothing * (bytes_rate - previous.bytes_per_second);
+    current.files_per_second = first ? files_rate : previous.files_per_second + kRateSmoothing * (files_rate - previous.files_per_second);
+
+    current.eta_seconds = -1;
+    if (state.total_bytes != 0 && current.bytes_per_second > 1) {
+        current.eta_seconds = static_cast<int64_t>((state.total_bytes - current.bytes) / current.bytes_per_second);
+    } else if (state.total_files != 0 && current.files_per_second > 0.1) {
+        current.eta_seconds = static_cast<int64_t>((state.total_files - current.files) / current.files_per_second);
+    }
+}
+
+std::string render_line(const ProgressState& state, const ProgressSnapshot& snapshot) {
+    std::ostringstream line;
+    line << "   " << state.stage << " ";
+    if (state.total_bytes != 0 || state.total_files != 0) {
+        const double fraction = state.total_bytes != 0
+            ? static_cast<double>(snapshot.bytes) / state.total_bytes
+            : static_cast<double>(snapshot.files) / state.total_files;
+        const int filled = static_cast<int>(fraction * 20);
+        line << "[" << std::string(filled, '#') << std::string(20 - filled, '.') << "] "
+             << static_cast<int>(fraction * 100) << "%";
+    }
+    if (state.total_bytes != 0) {
+        line << "  " << format_bytes(snapshot.bytes) << " / " << format_bytes(state.total_bytes)
+             << "  " << format_bytes(static_cast<uint64_t>(snapshot.bytes_per_second)) << "/s";
+    }
+    if (state.total_files != 0) {
+        line << "  " << static_cast<uint64_t>(snapshot.files_per_second) << " files/s";
+    }
+    if (snapshot.eta_seconds >= 0) {
+        line << "  ETA " << format_duration(snapshot.eta_seconds);
+    } else {
+        line << "  " << format_duration(static_cast<int64_t>(snapshot.elapsed_ms / 1000)) << " elapsed";
+    }
+    return line.str();
+}
+
+void write_json(const ProgressState& state, const ProgressSnapshot& snapshot, bool done) {
+    std::fprintf(
+        state.json,
+        "{\"stage\":\"%s\",\"done\":%s,\"bytes_done\":%llu,\"bytes_total\":%llu,\"files_done\":%llu,"
+        "\"files_total\":%llu,\"bytes_per_second\":%.0f,\"files_per_second\":%.1f,\"eta_seconds\":%lld,"
+        "\"elapsed_ms\":%llu}\n",
+        state.stage.c_str(),
+        done ? "true" : "false",
+        static_cast<unsigned long long>(snapshot.bytes),
+        static_cast<unsigned long long>(state.total_bytes),
+        static_cast<unsigned long long>(snapshot.files),
+        static_cast<unsigned long long>(state.total_files),
+        snapshot.bytes_per_second,
+        snapshot.files_per_second,
+        static_cast<long long>(snapshot.eta_seconds),
+        static_cast<unsigned long long>(snapshot.elapsed_ms)
+    );
+    std::fflush(state.json);
+}
+
+void render_progress(ProgressState& state) {
+    const bool tty = !state.json_to_stdout && isatty(STDOUT_FILENO);
+    // Rates start from the first sample, not from zero, so a resumed copy
+    // does not begin with its earlier bytes counted as one burst.
+    ProgressSnapshot previous;
+    sample_progress(state, previous);
+    previous.elapsed_ms = 0;
+    uint64_t last_json_ms = 0;
+
+    std::unique_lock<std::mutex> guard(state.lock);
+    while (true) {
+        const bool stopping = state.wake.wait_for(
+            guard, std::chrono::milliseconds(kRenderIntervalMs), [&state]() { return !state.running; }
+        );
+
+        ProgressSnapshot snapshot;
+        sample_progress(state, snapshot);
+        update_rates(snapshot, previous, state);
+        previous = snapshot;
+
+        if (tty && !stopping) {
+            std::cout << "\r\033[K" << C_CYAN << render_line(state, snapshot) << C_RESET << std::flush;
+        }
+        if (state.json && (stopping || snapshot.elapsed_ms - last_json_ms >= static_cast<uint64_t>(kJsonIntervalMs))) {
+            write_json(state, snapshot, stopping);
+            last_json_ms = snapshot.elapsed_ms;
+        }
+        if (stopping) {
+            if (tty) std::cout << "\r\033[K" << std::flush;
+            const uint64_t average = snapshot.elapsed_ms == 0 ? 0 : snapshot.bytes * 1000 / snapshot.elapsed_ms;
+            log_message(
+                "INFO",
+                "Progress " + state.stage + ": " + format_bytes(snapshot.bytes) + ", " + std::to_string(snapshot.files) +
+                    " files in " + std::to_string(snapshot.elapsed_ms) + " ms (" + format_bytes(average) + "/s)"
+            );
+            return;
+        }
+    }
+}
+
+}  // namespace
+
+bool set_progress_json_output(const std::string& path) {
+    ProgressState& state = progress_state();
+    if (path == "-") {
+        // stdout then carries nothing but the JSON lines: they keep the
+        // original descriptor, and everything else written to stdout, the
+        // installer's own text and child process output alike, goes to
+        // stderr instead.
+        std::cout.flush();
+        std::fflush(stdout);
+        const int json_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+        if (json_fd < 0) return false;
+        state.json = fdopen(json_fd, "w");
+        if (!state.json || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            if (state.json) std::fclose(state.json);
+            else close(json_fd);
+            state.json = nullptr;
+            return false;
+        }
+        state.json_to_stdout = true;
+        return true;
+    }
+    state.json = std::fopen(path.c_str(), "a");
+    return state.json != nullptr;
+}
+
+void begin_progress(
+    const std::string& stage,
+    uint64_t total_bytes,
+    uint64_t total_files,
+    const std::function<void(uint64_t& bytes, uint64_t& files)>& sampler
+) {
+    end_progress();
+    ProgressState& state = progress_state();
+    std::lock_guard<std::mutex> guard(state.lock);
+    state.stage = stage;
+    state.total_bytes = total_bytes;
+    state.total_files = total_files;
+    state.done_bytes.store(0);
+    state.done_files.store(0);
+    state.sampler = sampler;
+    state.started_ms = monotonic_ms();
+    state.running = true;
+    state.renderer = std::thread(render_progress, std::ref(state));
+}
+
+void add_progress(uint64_t bytes, uint64_t files) {
+    ProgressState& state = progress_state();
+    state.done_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    state.done_files.fetch_add(files, std::memory_order_relaxed);
+}
+
+void end_progress() {
+    ProgressState& state = progress_state();
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        if (!state.running) return;
+        state.running = false;
+        state.wake.notify_all();
+    }
+    state.renderer.join();
+    state.sampler = nullptr;
+}
+
+}  // namespace installer
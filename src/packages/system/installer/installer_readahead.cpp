@@ -0,0 +1,182 @@
+#include "installer_common.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+const char* const kReadaheadListPath = "/var/lib/geminios/readahead.list";
+const char* const kReadaheadServiceName = "readahead";
+// Beyond this the pack stops paying for itself: readahead of a large tail
+// competes with the boot's own reads.
+const uint64_t kMaxPackBytes = 256ULL * 1024 * 1024;
+
+// Read by nearly every early process but never mapped, so /proc/*/maps
+// cannot see them.
+const char* const kBootConfigFiles[] = {
+    "/etc/ld.so.cache",
+    "/etc/nsswitch.conf",
+    "/etc/passwd",
+    "/etc/group",
+};
+
+const ManifestEntry* find_manifest_entry(const CopyManifest& manifest, const std::string& path) {
+    auto it = std::lower_bound(
+        manifest.entries.begin(),
+        manifest.entries.end(),
+        path,
+        [](const ManifestEntry& entry, const std::string& value) { return entry.path < value; }
+    );
+    if (it == manifest.entries.end() || it->path != path) return nullptr;
+    return &*it;
+}
+
+// cp --parents recreates every parent as a real directory, so a file reached
+// through a symlinked directory (/lib -> usr/lib) would later collide with
+// the symlink itself. Only files under real directories are packed.
+bool packable_boot_file(const CopyManifest& manifest, const std::string& path) {
+    const ManifestEntry* entry = find_manifest_entry(manifest, path);
+    if (!entry || !S_ISREG(entry->mode) || entry->size == 0) return false;
+
+    std::string parent = path.substr(0, path.find_last_of('/'));
+    while (!parent.empty()) {
+        const ManifestEntry* dir = find_manifest_entry(manifest, parent);
+        if (dir) {
+            if (!S_ISDIR(dir->mode)) return false;
+        } else {
+            struct stat st;
+            const std::string source = manifest_source_path(manifest.source_root, parent);
+            if (lstat(source.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+        }
+        parent = parent.substr(0, parent.find_last_of('/'));
+    }
+    return true;
+}
+
+std::vector<int> running_pids() {
+    std::vector<int> pids;
+    DIR* dir = opendir("/proc");
+    if (!dir) return pids;
+    while (dirent* entry = readdir(dir)) {
+        char* end = nullptr;
+        const long pid = std::strtol(entry->d_name, &end, 10);
+        if (end && *end == '\0' && pid > 0) pids.push_back(static_cast<int>(pid));
+    }
+    closedir(dir);
+    std::sort(pids.begin(), pids.end());
+    return pids;
+}
+
+void add_candidate(const std::string& path, std::vector<std::string>& ordered, std::set<std::string>& seen) {
+    if (path.empty() || path[0] != '/') return;
+    if (seen.insert(path).second) ordered.push_back(path);
+}
+
+// Processes are visited in PID order, which on a freshly booted live
+// session is close to the order the boot started them in; within a process
+// the executable comes before the libraries it maps.
+std::vector<std::string> live_session_boot_files() {
+    std::vector<std::string> ordered;
+    std::set<std::string> seen;
+    for (int pid : running_pids()) {
+        const std::string proc = "/proc/" + std::to_string(pid);
+
+        char exe[4096];
+        const ssize_t length = readlink((proc + "/exe").c_str(), exe, sizeof(exe) - 1);
+        if (length > 0) add_candidate(std::string(exe, static_cast<size_t>(length)), ordered, seen);
+
+        std::ifstream maps(proc + "/maps");
+        std::string line;
+        while (std::getline(maps, line)) {
+            const std::string::size_type slash = line.find('/');
+            if (slash == std::string::npos) continue;
+            const std::string path = line.substr(slash);
+            if (path.size() > 10 && path.compare(path.size() - 10, 10, " (deleted)") == 0) continue;
+            add_candidate(path, ordered, seen);
+        }
+    }
+    for (const char* path : kBootConfigFiles) add_candidate(path, ordered, seen);
+    return ordered;
+}
+
+}  // namespace
+
+std::vector<std::string> build_boot_file_list(const CopyManifest& manifest) {
+    std::vector<std::string> files;
+    uint64_t bytes = 0;
+    for (const auto& path : live_session_boot_files()) {
+        if (!packable_boot_file(manifest, path)) continue;
+        const uint64_t size = find_manifest_entry(manifest, path)->size;
+        if (bytes + size > kMaxPackBytes) continue;
+        files.push_back(path);
+        bytes += size;
+    }
+    log_message("INFO", "Boot readahead pack: " + std::to_string(files.size()) + " files, " + format_bytes(bytes));
+    return files;
+}
+
+bool precopy_boot_files(
+    const ToolRegistry& tools,
+    const CopyManifest& manifest,
+    const std::vector<std::string>& files,
+    std::string& error
+) {
+    // Written first and in boot order onto a fresh filesystem, the pack ends
+    // up packed together instead of scattered through the bulk copy.
+    if (!copy_listed_paths(tools, manifest.source_root, files, error)) {
+        error = "Failed to copy the boot readahead pack. See " + kLogPath;
+        return false;
+    }
+    return true;
+}
+
+bool write_readahead_pack(const std::vector<std::string>& files, std::string& error) {
+    const std::string service_file = std::string("/usr/lib/ginit/services/") + kReadaheadServiceName + ".gservice";
+    const std::string enabled_link = kTargetRoot + "/etc/ginit/services/system/" + kReadaheadServiceName + ".gservice";
+    if (files.empty()) {
+        ensure_file_removed(enabled_link);
+        ensure_file_removed(kTargetRoot + kReadaheadListPath);
+        return true;
+    }
+
+    std::ostringstream list;
+    list << "# Boot files in on-disk order, written by the GeminiOS installer.\n";
+    for (const auto& path : files) list << path << "\n";
+    if (!write_text_file(kTargetRoot + kReadaheadListPath, list.str())) {
+        error = "Failed to write the boot readahead list.";
+        return false;
+    }
+
+    const std::string service =
+        std::string("service \"") + kReadaheadServiceName + "\" {\n"
+        "    meta {\n"
+        "        description = \"Prefetch boot files into the page cache\"\n"
+        "    }\n"
+        "\n"
+        "    process {\n"
+        "        type = \"oneshot\"\n"
+        "        commands {\n"
+        "            start = \"/bin/apps/system/readahead " + kReadaheadListPath + "\"\n"
+        "        }\n"
+        "    }\n"
+        "}\n";
+    if (!write_text_file(kTargetRoot + service_file, service)) {
+        error = "Failed to write the readahead ginit service.";
+        return false;
+    }
+    if (!mkdir_p(kTargetRoot + "/etc/ginit/services/system") || !ensure_symlink(service_file, enabled_link)) {
+        error = "Failed to enable the readahead ginit service.";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace installer
@@ -0,0 +1,104 @@
+#include "installer_common.h"
+
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+struct RemovalJob {
+    std::string root_path;
+    dev_t root_device = 0;
+    bool failed = false;
+};
+
+void report_failure(RemovalJob& job, const std::string& what, const std::string& name, int error_number) {
+    // Only the first failure is logged; the rest would repeat it per entry.
+    if (!job.failed) {
+        log_message(
+            "WARN",
+            "Failed to " + what + " " + name + " while removing " + job.root_path + ": " + std::strerror(error_number)
+        );
+    }
+    job.failed = true;
+}
+
+// Empties the directory open on fd and closes it. Only one descriptor per
+// level of depth is open at a time.
+void empty_dir(RemovalJob& job, int fd, const std::string& name) {
+    DIR* stream = fdopendir(fd);
+    if (!stream) {
+        report_failure(job, "read", name, errno);
+        close(fd);
+        return;
+    }
+
+    while (dirent* entry = readdir(stream)) {
+        const char* child = entry->d_name;
+        if (std::strcmp(child, ".") == 0 || std::strcmp(child, "..") == 0) continue;
+
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(fd, child, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (!is_dir) {
+            if (unlinkat(fd, child, 0) != 0 && errno != ENOENT) report_failure(job, "remove", child, errno);
+            continue;
+        }
+
+        const int child_fd = openat(fd, child, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        struct stat st;
+        if (child_fd < 0 || fstat(child_fd, &st) != 0) {
+            report_failure(job, "open", child, errno);
+            if (child_fd >= 0) close(child_fd);
+            continue;
+        }
+        // Never follow a mount into another filesystem.
+        if (st.st_dev != job.root_device) {
+            close(child_fd);
+            report_failure(job, "cross into mount point", child, EXDEV);
+            continue;
+        }
+        empty_dir(job, child_fd, child);
+        if (unlinkat(fd, child, AT_REMOVEDIR) != 0) report_failure(job, "remove directory", child, errno);
+    }
+    closedir(stream);
+}
+
+}  // namespace
+
+bool remove_path_recursive(const std::string& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        return errno == ENOENT;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        if (unlink(path.c_str()) != 0) {
+            log_message("WARN", "Failed to remove " + path + ": " + std::strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    const int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        log_message("WARN", "Failed to open " + path + " for cleanup: " + std::strerror(errno));
+        return false;
+    }
+
+    RemovalJob job;
+    job.root_path = path;
+    job.root_device = st.st_dev;
+    empty_dir(job, fd, path);
+    if (rmdir(path.c_str()) != 0) report_failure(job, "remove directory", path, errno);
+    return !job.failed;
+}
+
+}  // namespace installer
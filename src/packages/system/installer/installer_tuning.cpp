@@ -0,0 +1,367 @@
+#include "installer_common.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/mount.h>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+uint64_t read_sysfs_u64(const std::string& path) {
+    const std::string value = read_file_trimmed(path);
+    if (value.empty()) return 0;
+    return std::strtoull(value.c_str(), nullptr, 10);
+}
+
+// Reads a property from udev's database entry for a whole disk, which is
+// where the persistent ID_WWN and ID_SERIAL keys end up.
+std::string udev_disk_property(const std::string& disk, const std::string& key) {
+    const std::string dev = read_file_trimmed("/sys/block/" + disk + "/dev");
+    if (dev.empty()) return "";
+    std::ifstream file("/run/udev/data/b" + dev);
+    const std::string prefix = "E:" + key + "=";
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, prefix.size(), prefix) == 0) return line.substr(prefix.size());
+    }
+    return "";
+}
+
+// Kernel names move between boots, so the rule matches the disk by WWN or
+// serial. Without either it falls back to every disk of the same kind,
+// which the same scheduler choice suits.
+std::string io_scheduler_rule_match(const StorageProfile& profile) {
+    for (const char* key : {"ID_WWN", "ID_SERIAL"}) {
+        const std::string value = udev_disk_property(profile.disk, key);
+        if (!value.empty() && value.find_first_of("\"\\\n") == std::string::npos) {
+            return std::string("ENV{") + key + "}==\"" + value + "\"";
+        }
+    }
+    switch (profile.media) {
+        case StorageMedia::Nvme: return "KERNEL==\"nvme[0-9]*n[0-9]*\"";
+        case StorageMedia::Emmc: return "KERNEL==\"mmcblk[0-9]*\"";
+        case StorageMedia::Rotational: return "KERNEL==\"sd*|vd*|xvd*\", ATTR{queue/rotational}==\"1\"";
+        case StorageMedia::Ssd: return "KERNEL==\"sd*|vd*|xvd*\", ATTR{queue/rotational}==\"0\"";
+    }
+    return "";
+}
+
+bool scheduler_available(const std::string& disk, const std::string& scheduler) {
+    std::istringstream choices(read_file_trimmed("/sys/block/" + disk + "/queue/scheduler"));
+    std::string choice;
+    while (choices >> choice) {
+        if (choice == scheduler || choice == "[" + scheduler + "]") return true;
+    }
+    return false;
+}
+
+std::string pick_io_scheduler(const StorageProfile& profile) {
+    std::vector<std::string> preferred;
+    switch (profile.media) {
+        case StorageMedia::Nvme:
+            preferred = {"none", "mq-deadline"};
+            break;
+        case StorageMedia::Rotational:
+            preferred = {"bfq", "mq-deadline"};
+            break;
+        case StorageMedia::Ssd:
+        case StorageMedia::Emmc:
+            preferred = {"mq-deadline", "bfq", "none"};
+            break;
+    }
+
+    for (const auto& scheduler : preferred) {
+        if (scheduler_available(profile.disk, scheduler)) return scheduler;
+    }
+    return "";
+}
+
+void choose_mkfs_arguments(StorageProfile& profile, FilesystemType filesystem) {
+    const bool flash = profile.media != StorageMedia::Rotational;
+    const uint64_t fs_block = 4096;
+    const bool aligned_io = profile.optimal_io_size >= fs_block && profile.optimal_io_size % fs_block == 0;
+    // RAID-style geometry, as mke2fs and mkfs.xfs read it from the topology:
+    // minimum_io_size is the chunk, optimal_io_size the full stripe.
+    const uint64_t stripe_unit = aligned_io && profile.minimum_io_size > fs_block &&
+            profile.minimum_io_size % fs_block == 0 && profile.optimal_io_size % profile.minimum_io_size == 0
+        ? profile.minimum_io_size
+        : 0;
+
+    switch (filesystem) {
+        case FilesystemType::Ext4: {
+            // Lazy inode table and journal init push the zeroing out of mkfs
+            // and into the kernel's background thread after first mount.
+            std::string extended = "lazy_itable_init=1,lazy_journal_init=1";
+            if (stripe_unit > 0) extended += ",stride=" + std::to_string(stripe_unit / fs_block);
+            if (aligned_io) extended += ",stripe_width=" + std::to_string(profile.optimal_io_size / fs_block);
+            if (profile.media == StorageMedia::Emmc) extended += ",nodiscard";
+            profile.mkfs_args = {"-b", std::to_string(fs_block), "-E", extended};
+            break;
+        }
+        case FilesystemType::Xfs:
+            if (profile.physical_block_size >= 4096) {
+                profile.mkfs_args.push_back("-s");
+                profile.mkfs_args.push_back("size=" + std::to_string(profile.physical_block_size));
+            }
+            if (aligned_io) {
+                const uint64_t unit = stripe_unit > 0 ? stripe_unit : profile.optimal_io_size;
+                profile.mkfs_args.push_back("-d");
+                profile.mkfs_args.push_back(
+                    "su=" + std::to_string(unit) + ",sw=" + std::to_string(profile.optimal_io_size / unit)
+                );
+            }
+            if (profile.media == StorageMedia::Emmc) profile.mkfs_args.push_back("-K");
+            break;
+        case FilesystemType::Btrfs:
+            if (profile.media == StorageMedia::Emmc) profile.mkfs_args.push_back("--nodiscard");
+            break;
+        case FilesystemType::F2fs:
+            if (flash) {
+                profile.mkfs_args = {"-O", "extra_attr,inode_checksum,sb_checksum,compression"};
+            }
+            break;
+    }
+}
+
+void choose_mount_options(StorageProfile& profile, FilesystemType filesystem, bool formatting) {
+    const bool flash = profile.media != StorageMedia::Rotational;
+    profile.noatime = true;
+
+    switch (filesystem) {
+        case FilesystemType::Ext4:
+            // Online discard on ext4 and XFS is issued synchronously with
+            // every delete; a weekly fstrim frees the same blocks off the
+            // hot path.
+            profile.periodic_trim = flash && profile.supports_discard;
+            if (profile.media == StorageMedia::Emmc) profile.mount_options.push_back("commit=30");
+            break;
+        case FilesystemType::Xfs:
+            profile.periodic_trim = flash && profile.supports_discard;
+            break;
+        case FilesystemType::Btrfs:
+            // zstd:1 keeps fast flash from becoming CPU bound; spinning disks
+            // gain more from the extra ratio of level 3 than they lose in CPU.
+            profile.btrfs_compress_level = flash ? 1 : 3;
+            profile.mount_options.push_back("compress=zstd:" + std::to_string(profile.btrfs_compress_level));
+            profile.mount_options.push_back("space_cache=v2");
+            if (flash) profile.mount_options.push_back("ssd");
+            if (flash && profile.supports_discard) profile.mount_options.push_back("discard=async");
+            if (profile.media == StorageMedia::Emmc) profile.mount_options.push_back("commit=60");
+            break;
+        case FilesystemType::F2fs:
+            // Compression options only mount on volumes created with the
+            // compression feature, which only our own mkfs guarantees.
+            if (flash && formatting) {
+                profile.mount_options.push_back("compress_algorithm=lz4");
+                profile.mount_options.push_back("compress_chksum");
+                profile.mount_options.push_back("atgc");
+                profile.mount_options.push_back("gc_merge");
+            }
+            // F2FS already discards from a background thread by default.
+            break;
+    }
+}
+
+}  // namespace
+
+// Partitions do not carry their own queue/ directory, so resolve
+// /sys/class/block/<part> to its parent disk before reading queue limits.
+std::string sysfs_disk_name(const std::string& device_path) {
+    const std::string::size_type slash = device_path.find_last_of('/');
+    const std::string name = slash == std::string::npos ? device_path : device_path.substr(slash + 1);
+    if (name.empty()) return "";
+
+    const std::string class_path = "/sys/class/block/" + name;
+    if (!file_exists(class_path + "/partition")) return name;
+
+    char resolved[PATH_MAX];
+    if (!realpath(class_path.c_str(), resolved)) return name;
+
+    std::string parent = resolved;
+    parent = parent.substr(0, parent.find_last_of('/'));
+    return parent.substr(parent.find_last_of('/') + 1);
+}
+
+// The WWN or serial udev recorded for a disk, tagged with the key it came
+// from. Empty when udev knows neither.
+std::string disk_stable_id(const std::string& disk) {
+    for (const char* key : {"ID_WWN", "ID_SERIAL"}) {
+        const std::string value = udev_disk_property(disk, key);
+        if (!value.empty()) return std::string(key) + "=" + value;
+    }
+    return "";
+}
+
+std::string storage_media_label(StorageMedia media) {
+    switch (media) {
+        case StorageMedia::Rotational: return "rotational";
+        case StorageMedia::Ssd: return "ssd";
+        case StorageMedia::Nvme: return "nvme";
+        case StorageMedia::Emmc: return "emmc";
+    }
+    return "unknown";
+}
+
+StorageProfile detect_storage_profile(const std::string& device_path, FilesystemType filesystem, bool formatting) {
+    StorageProfile profile;
+    profile.disk = sysfs_disk_name(device_path);
+
+    const std::string queue = "/sys/block/" + profile.disk + "/queue/";
+    profile.rotational = read_file_trimmed(queue + "rotational") != "0";
+    profile.discard_granularity = read_sysfs_u64(queue + "discard_granularity");
+    profile.minimum_io_size = read_sysfs_u64(queue + "minimum_io_size");
+    profile.optimal_io_size = read_sysfs_u64(queue + "optimal_io_size");
+    profile.physical_block_size = read_sysfs_u64(queue + "physical_block_size");
+    profile.supports_discard = profile.discard_granularity > 0;
+
+    if (profile.disk.rfind("nvme", 0) == 0) {
+        profile.media = StorageMedia::Nvme;
+    } else if (profile.disk.rfind("mmcblk", 0) == 0) {
+        profile.media = StorageMedia::Emmc;
+    } else {
+        profile.media = profile.rotational ? StorageMedia::Rotational : StorageMedia::Ssd;
+    }
+
+    if (formatting) choose_mkfs_arguments(profile, filesystem);
+    choose_mount_options(profile, filesystem, formatting);
+    profile.io_scheduler = pick_io_scheduler(profile);
+    return profile;
+}
+
+unsigned long storage_mount_flags(const StorageProfile& profile) {
+    return profile.noatime ? MS_NOATIME : 0;
+}
+
+std::string storage_mount_data(const StorageProfile& profile) {
+    return join_strings(profile.mount_options, ",");
+}
+
+std::string storage_fstab_options(const StorageProfile& profile) {
+    std::vector<std::string> options;
+    if (profile.noatime) options.push_back("noatime");
+    options.insert(options.end(), profile.mount_options.begin(), profile.mount_options.end());
+    return options.empty() ? "defaults" : join_strings(options, ",");
+}
+
+void log_storage_profile(const StorageProfile& profile) {
+    log_message(
+        "INFO",
+        "Storage profile for " + profile.disk + ": media=" + storage_media_label(profile.media) +
+            " rotational=" + (profile.rotational ? "1" : "0") +
+            " discard_granularity=" + std::to_string(profile.discard_granularity) +
+            " minimum_io_size=" + std::to_string(profile.minimum_io_size) +
+            " optimal_io_size=" + std::to_string(profile.optimal_io_size) +
+            " physical_block_size=" + std::to_string(profile.physical_block_size)
+    );
+    log_message(
+        "INFO",
+        "Storage tuning: mkfs=[" + join_strings(profile.mkfs_args, " ") + "] fstab=" + storage_fstab_options(profile) +
+            " scheduler=" + (profile.io_scheduler.empty() ? "(kernel default)" : profile.io_scheduler) +
+            " weekly_trim=" + (profile.periodic_trim ? "1" : "0")
+    );
+}
+
+bool apply_io_scheduler(const StorageProfile& profile) {
+    if (profile.disk.empty() || profile.io_scheduler.empty()) return true;
+    const std::string path = "/sys/block/" + profile.disk + "/queue/scheduler";
+    // sysfs validates the name in write(), so a buffered stream would only
+    // see the EINVAL at close; write it directly and check the result.
+    const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    const std::string value = profile.io_scheduler + "\n";
+    bool ok = fd >= 0 && write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+    int write_errno = errno;
+    if (fd >= 0 && close(fd) != 0 && ok) {
+        ok = false;
+        write_errno = errno;
+    }
+    if (!ok) {
+        log_message(
+            "WARN",
+            "Failed to select the " + profile.io_scheduler + " I/O scheduler for " + profile.disk + ": " +
+                std::strerror(write_errno)
+        );
+        return false;
+    }
+    log_message("INFO", "Selected the " + profile.io_scheduler + " I/O scheduler for " + profile.disk);
+    return true;
+}
+
+bool write_io_scheduler_rule(const StorageProfile& profile, std::string& error) {
+    // Ordered after 60-persistent-storage.rules, which sets ID_WWN and ID_SERIAL.
+    const std::string rule_path = kTargetRoot + "/etc/udev/rules.d/61-geminios-iosched.rules";
+    ensure_file_removed(kTargetRoot + "/etc/udev/rules.d/60-geminios-iosched.rules");
+    if (profile.disk.empty() || profile.io_scheduler.empty()) {
+        ensure_file_removed(rule_path);
+        return true;
+    }
+
+    std::ostringstream rule;
+    rule << "# Written by the GeminiOS installer from the detected "
+         << storage_media_label(profile.media) << " storage profile.\n";
+    rule << "ACTION==\"add|change\", SUBSYSTEM==\"block\", ENV{DEVTYPE}==\"disk\", " << io_scheduler_rule_match(profile)
+         << ", ATTR{queue/scheduler}=\"" << profile.io_scheduler << "\"\n";
+    if (!write_text_file(rule_path, rule.str())) {
+        error = "Failed to write the I/O scheduler udev rule.";
+        return false;
+    }
+    return true;
+}
+
+const char* const kTrimServiceName = "fstrim";
+
+// ginit has no timers, so the weekly trim is a simple service that sleeps
+// between runs; the first one waits a while so it never competes with boot.
+bool write_trim_service(const StorageProfile& profile, std::string& error) {
+    const std::string service_file = std::string("/usr/lib/ginit/services/") + kTrimServiceName + ".gservice";
+    const std::string enabled_link = kTargetRoot + "/etc/ginit/services/system/" + kTrimServiceName + ".gservice";
+    if (!profile.periodic_trim) {
+        ensure_file_removed(enabled_link);
+        return true;
+    }
+
+    const std::string script =
+        "#!/bin/sh\n"
+        "# Discard unused blocks on mounted filesystems once a week.\n"
+        "command -v fstrim > /dev/null || exit 0\n"
+        "sleep 900\n"
+        "while :; do\n"
+        "    fstrim -a\n"
+        "    sleep 604800\n"
+        "done\n";
+    if (!write_text_file(kTargetRoot + "/usr/libexec/geminios/fstrim-weekly", script, 0755)) {
+        error = "Failed to write the periodic trim script.";
+        return false;
+    }
+
+    const std::string service =
+        std::string("service \"") + kTrimServiceName + "\" {\n"
+        "    meta {\n"
+        "        description = \"Weekly discard of unused blocks (fstrim)\"\n"
+        "    }\n"
+        "\n"
+        "    process {\n"
+        "        type = \"simple\"\n"
+        "        commands {\n"
+        "            start = \"/usr/libexec/geminios/fstrim-weekly\"\n"
+        "        }\n"
+        "    }\n"
+        "}\n";
+    if (!write_text_file(kTargetRoot + service_file, service)) {
+        error = "Failed to write the periodic trim ginit service.";
+        return false;
+    }
+    if (!mkdir_p(kTargetRoot + "/etc/ginit/services/system") || !ensure_symlink(service_file, enabled_link)) {
+        error = "Failed to enable the periodic trim ginit service.";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace installer
@@ -0,0 +1,277 @@
+#include "installer_common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace installer {
+
+namespace {
+
+// XXH64 (https://github.com/Cyan4973/xxHash). Neither xxh3 nor BLAKE3 is
+// available in the target sysroot; XXH64's four independent lanes still keep
+// a core well ahead of disk bandwidth, which is all verification needs.
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl64(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t read32(const unsigned char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    acc = rotl64(acc, 31);
+    return acc * kPrime1;
+}
+
+inline uint64_t xxh64_merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh64_round(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+
+struct Xxh64State {
+    uint64_t lanes[4] = {kPrime1 + kPrime2, kPrime2, 0, 0ULL - kPrime1};
+    uint64_t total = 0;
+    unsigned char tail[32];
+    size_t tail_size = 0;
+
+    void update(const unsigned char* data, size_t size) {
+        total += size;
+        if (tail_size + size < 32) {
+            std::memcpy(tail + tail_size, data, size);
+            tail_size += size;
+            return;
+        }
+        if (tail_size > 0) {
+            const size_t fill = 32 - tail_size;
+            std::memcpy(tail + tail_size, data, fill);
+            consume(tail);
+            data += fill;
+            size -= fill;
+            tail_size = 0;
+        }
+        while (size >= 32) {
+            consume(data);
+            data += 32;
+            size -= 32;
+        }
+        std::memcpy(tail, data, size);
+        tail_size = size;
+    }
+
+    void consume(const unsigned char* stripe) {
+        lanes[0] = xxh64_round(lanes[0], read64(stripe));
+        lanes[1] = xxh64_round(lanes[1], read64(stripe + 8));
+        lanes[2] = xxh64_round(lanes[2], read64(stripe + 16));
+        lanes[3] = xxh64_round(lanes[3], read64(stripe + 24));
+    }
+
+    uint64_t digest() const {
+        uint64_t hash;
+        if (total >= 32) {
+            hash = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+            for (uint64_t lane : lanes) hash = xxh64_merge(hash, lane);
+        } else {
+            hash = lanes[2] + kPrime5;
+        }
+        hash += total;
+
+        const unsigned char* p = tail;
+        size_t remaining = tail_size;
+        while (remaining >= 8) {
+            hash ^= xxh64_round(0, read64(p));
+            hash = rotl64(hash, 27) * kPrime1 + kPrime4;
+            p += 8;
+            remaining -= 8;
+        }
+        if (remaining >= 4) {
+            hash ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+            hash = rotl64(hash, 23) * kPrime2 + kPrime3;
+            p += 4;
+            remaining -= 4;
+        }
+        while (remaining > 0) {
+            hash ^= (*p) * kPrime5;
+            hash = rotl64(hash, 11) * kPrime1;
+            ++p;
+            --remaining;
+        }
+
+        hash ^= hash >> 33;
+        hash *= kPrime2;
+        hash ^= hash >> 29;
+        hash *= kPrime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+};
+
+const size_t kHashBufferSize = 1024 * 1024;
+
+bool hash_file(const std::string& path, std::vector<unsigned char>& buffer, uint64_t& digest, uint64_t& bytes, std::string& error) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    Xxh64State state;
+    bytes = 0;
+    while (true) {
+        const ssize_t got = read(fd, buffer.data(), buffer.size());
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            error = std::strerror(errno);
+            close(fd);
+            return false;
+        }
+        if (got == 0) break;
+        state.update(buffer.data(), static_cast<size_t>(got));
+        bytes += static_cast<uint64_t>(got);
+    }
+    // Verification is the last reader of these pages; drop them so the copy
+    // does not end up pinning the whole image in the page cache.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    digest = state.digest();
+    return true;
+}
+
+std::string file_type_label(mode_t mode) {
+    if (S_ISREG(mode)) return "file";
+    if (S_ISDIR(mode)) return "directory";
+    if (S_ISLNK(mode)) return "symlink";
+    if (S_ISCHR(mode)) return "character device";
+    if (S_ISBLK(mode)) return "block device";
+    if (S_ISFIFO(mode)) return "fifo";
+    if (S_ISSOCK(mode)) return "socket";
+    return "unknown";
+}
+
+std::string read_link_target(const std::string& path) {
+    std::vector<char> buffer(256);
+    while (true) {
+        const ssize_t length = readlink(path.c_str(), buffer.data(), buffer.size());
+        if (length < 0) return "";
+        if (static_cast<size_t>(length) < buffer.size()) return std::string(buffer.data(), static_cast<size_t>(length));
+        buffer.resize(buffer.size() * 2);
+    }
+}
+
+// Returns an empty string when the target entry matches the source.
+std::string verify_entry(
+    const ManifestEntry& entry,
+    const std::string& source_root,
+    const std::string& target_root,
+    std::vector<unsigned char>& buffer
+) {
+    const std::string source = manifest_source_path(source_root, entry.path);
+    const std::string target = target_root + entry.path;
+
+    struct stat st;
+    if (lstat(target.c_str(), &st) != 0) return "missing from target";
+    if ((st.st_mode & S_IFMT) != (entry.mode & S_IFMT)) {
+        return "type differs (source " + file_type_label(entry.mode) + ", target " + file_type_label(st.st_mode) + ")";
+    }
+
+    if (S_ISLNK(entry.mode)) {
+        const std::string source_link = read_link_target(source);
+        const std::string target_link = read_link_target(target);
+        if (source_link != target_link) return "symlink target differs (" + source_link + " vs " + target_link + ")";
+        return "";
+    }
+    if (!S_ISREG(entry.mode)) return "";
+
+    if (static_cast<uint64_t>(st.st_size) != entry.size) {
+        return "size differs (source " + std::to_string(entry.size) + ", target " + std::to_string(st.st_size) + ")";
+    }
+
+    uint64_t source_digest = 0;
+    uint64_t target_digest = 0;
+    uint64_t source_bytes = 0;
+    uint64_t target_bytes = 0;
+    std::string read_error;
+    if (!hash_file(source, buffer, source_digest, source_bytes, read_error)) return "source unreadable: " + read_error;
+    if (!hash_file(target, buffer, target_digest, target_bytes, read_error)) return "target unreadable: " + read_error;
+    if (source_bytes != target_bytes) {
+        return "short copy (source " + std::to_string(source_bytes) + " bytes, target " + std::to_string(target_bytes) + ")";
+    }
+    if (source_digest != target_digest) return "content differs";
+    return "";
+}
+
+}  // namespace
+
+bool verify_copied_tree(const CopyManifest& manifest, const std::string& target_root, VerifyReport& report) {
+    report = {};
+
+    std::atomic<size_t> next_index(0);
+    std::atomic<uint64_t> hashed_bytes(0);
+    std::mutex mismatch_lock;
+
+    auto worker = [&]() {
+        std::vector<unsigned char> buffer(kHashBufferSize);
+        while (true) {
+            const size_t index = next_index.fetch_add(1);
+            if (index >= manifest.entries.size()) break;
+
+            const ManifestEntry& entry = manifest.entries[index];
+            const std::string problem = verify_entry(entry, manifest.source_root, target_root, buffer);
+            if (S_ISREG(entry.mode)) hashed_bytes += entry.size;
+            add_progress(S_ISREG(entry.mode) ? entry.size : 0, 1);
+            if (!problem.empty()) {
+                std::lock_guard<std::mutex> guard(mismatch_lock);
+                report.mismatches.push_back(entry.path + ": " + problem);
+            }
+        }
+    };
+
+    const uint64_t started = monotonic_ms();
+    begin_progress("verify", manifest.total_bytes, manifest.entries.size());
+    std::vector<std::thread> workers;
+    const unsigned int worker_count = installer_worker_count();
+    for (unsigned int i = 0; i < worker_count; ++i) workers.emplace_back(worker);
+    for (auto& thread : workers) thread.join();
+    end_progress();
+
+    report.checked_entries = manifest.entries.size();
+    report.verified_bytes = hashed_bytes.load();
+    report.elapsed_ms = monotonic_ms() - started;
+    std::sort(report.mismatches.begin(), report.mismatches.end());
+
+    const uint64_t rate = report.elapsed_ms == 0 ? 0 : report.verified_bytes * 1000ULL / report.elapsed_ms;
+    log_message(
+        "INFO",
+        "Verified " + std::to_string(report.checked_entries) + " entries (" + format_bytes(report.verified_bytes) +
+            ") in " + std::to_string(report.elapsed_ms) + " ms, " + format_bytes(rate) + "/s per side, " +
+            std::to_string(report.mismatches.size()) + " mismatches"
+    );
+    for (const auto& mismatch : report.mismatches) {
+        log_message("ERROR", "VERIFY " + mismatch);
+    }
+    return report.mismatches.empty();
+}
+
+}  // namespace installer
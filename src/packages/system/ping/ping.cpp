@@ -11,7 +11,7 @@
 #include <sys/time.h>
 #include <csignal>
 #include <cmath>
-#include "network.h"
+#include "resolver.h"
 #include "signals.h"
 
 volatile bool g_running = true;
@@ -41,17 +41,18 @@ int main(int argc, char* argv[]) {
     }
 
     std::string dest = argv[1];
-    std::string ip_str = ResolveDNS(dest);
-    
-    // If resolve failed, try treating it as IP
-    if (ip_str.empty()) ip_str = dest;
-    
-    // Check if valid IP
-    struct sockaddr_in addr;
-    if (inet_pton(AF_INET, ip_str.c_str(), &addr.sin_addr) <= 0) {
+    // ICMP echo over a raw IPv4 socket, so only A records are of use.
+    dns::ResolverOptions resolver;
+    resolver.family = AF_INET;
+    std::vector<dns::Address> addresses;
+    std::string error;
+    if (!dns::resolve(dest, 0, resolver, addresses, error)) {
         std::cerr << "ping: unknown host " << dest << "\n";
         return 1;
     }
+    struct sockaddr_in addr;
+    std::memcpy(&addr, &addresses.front().storage, sizeof(addr));
+    std::string ip_str = dns::address_to_string(addresses.front());
     
     int sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
     if (sock < 0) {
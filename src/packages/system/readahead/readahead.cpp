@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "sys_info.h"
+
+// Replays the boot file list the installer writes into the target. The list
+// is in on-disk layout order, so a few threads walking it in order keep the
+// device streaming instead of seeking between scattered small reads.
+
+static const char* kDefaultList = "/var/lib/geminios/readahead.list";
+
+static bool prefetch_file(const std::string& path, uint64_t& bytes) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME);
+    if (fd < 0) fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    if (readahead(fd, 0, static_cast<size_t>(st.st_size)) != 0) {
+        posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+    bytes = static_cast<uint64_t>(st.st_size);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    std::string list_path = kDefaultList;
+    unsigned int jobs = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help") {
+            std::cout << "Usage: readahead [-j JOBS] [LIST]\n"
+                      << "Prefetch the files named in LIST (default " << kDefaultList << ") into the page cache.\n";
+            return 0;
+        }
+        if (arg == "--version") { std::cout << "readahead (" << OS_NAME << ") " << OS_VERSION << std::endl; return 0; }
+        if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+            jobs = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+            continue;
+        }
+        list_path = arg;
+    }
+
+    std::ifstream list(list_path);
+    if (!list) {
+        std::cerr << "readahead: cannot open " << list_path << std::endl;
+        return 1;
+    }
+    std::vector<std::string> files;
+    std::string line;
+    while (std::getline(list, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        files.push_back(line);
+    }
+
+    if (jobs == 0) jobs = std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
+    jobs = std::max(1u, std::min<unsigned int>(jobs, static_cast<unsigned int>(std::max<size_t>(files.size(), 1))));
+
+    const auto started = std::chrono::steady_clock::now();
+    std::atomic<size_t> next_index(0);
+    std::atomic<size_t> loaded(0);
+    std::atomic<uint64_t> loaded_bytes(0);
+    auto worker = [&]() {
+        while (true) {
+            const size_t index = next_index.fetch_add(1);
+            if (index >= files.size()) break;
+            uint64_t bytes = 0;
+            if (!prefetch_file(files[index], bytes)) continue;
+            ++loaded;
+            loaded_bytes += bytes;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < jobs; ++i) workers.emplace_back(worker);
+    for (auto& thread : workers) thread.join();
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    std::cout << "readahead: " << loaded.load() << "/" << files.size() << " files, "
+              << (loaded_bytes.load() / (1024 * 1024)) << " MiB in " << elapsed.count() << " ms" << std::endl;
+    return 0;
+}
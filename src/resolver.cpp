@@ -0,0 +1,993 @@
+#include "resolver.h"
+#include "signals.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <ifaddrs.h>
+#include <map>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <set>
+#include <sstream>
+#include <sys/random.h>
+#include <unistd.h>
+
+namespace dns {
+
+namespace {
+
+const uint16_t kTypeA = 1;
+const uint16_t kTypeCname = 5;
+const uint16_t kTypeSoa = 6;
+const uint16_t kTypeAaaa = 28;
+const uint16_t kTypeOpt = 41;
+const uint16_t kClassIn = 1;
+const int kRcodeNxdomain = 3;
+// EDNS0 payload size that avoids IP fragmentation (DNS flag day 2020).
+const uint16_t kUdpPayloadBytes = 1232;
+const int kMaxCnameHops = 8;
+const uint32_t kMaxTtl = 24 * 60 * 60;
+// Negative answers are kept briefly so a new record shows up soon.
+const uint32_t kMaxNegativeTtl = 5 * 60;
+// RFC 8305 section 3 and 5.
+const uint64_t kResolutionDelayNs = 50 * 1000000ull;
+const uint64_t kConnectionAttemptDelayNs = 250 * 1000000ull;
+
+uint64_t monotonic_ns() {
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + static_cast<uint64_t>(now.tv_nsec);
+}
+
+int poll_timeout(uint64_t now, uint64_t until) {
+    if (until <= now) return 0;
+    return static_cast<int>(std::min<uint64_t>((until - now + 999999) / 1000000, 60000));
+}
+
+std::string to_lower(std::string text) {
+    for (char& c : text) {
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+    }
+    return text;
+}
+
+// Raw addresses are kept as their 4 or 16 network-order bytes.
+Address make_address(const std::string& raw, int port) {
+    Address address;
+    if (raw.size() == 4) {
+        auto* in = reinterpret_cast<struct sockaddr_in*>(&address.storage);
+        in->sin_family = AF_INET;
+        in->sin_port = htons(static_cast<uint16_t>(port));
+        std::memcpy(&in->sin_addr, raw.data(), 4);
+        address.length = sizeof(*in);
+        address.family = AF_INET;
+    } else {
+        auto* in6 = reinterpret_cast<struct sockaddr_in6*>(&address.storage);
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(static_cast<uint16_t>(port));
+        std::memcpy(&in6->sin6_addr, raw.data(), 16);
+        address.length = sizeof(*in6);
+        address.family = AF_INET6;
+    }
+    return address;
+}
+
+std::string raw_to_text(const std::string& raw) {
+    char text[INET6_ADDRSTRLEN] = {};
+    inet_ntop(raw.size() == 4 ? AF_INET : AF_INET6, raw.data(), text, sizeof(text));
+    return text;
+}
+
+bool text_to_raw(const std::string& text, std::string& raw) {
+    unsigned char bytes[16];
+    if (inet_pton(AF_INET, text.c_str(), bytes) == 1) {
+        raw.assign(reinterpret_cast<char*>(bytes), 4);
+        return true;
+    }
+    if (inet_pton(AF_INET6, text.c_str(), bytes) == 1) {
+        raw.assign(reinterpret_cast<char*>(bytes), 16);
+        return true;
+    }
+    return false;
+}
+
+// Numeric hosts, scoped IPv6 literals included, never reach the lookups.
+bool numeric_address(const std::string& host, int port, int family, Address& address) {
+    struct addrinfo hints = {};
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    struct addrinfo* results = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) != 0) return false;
+    std::memcpy(&address.storage, results->ai_addr, results->ai_addrlen);
+    address.length = results->ai_addrlen;
+    address.family = results->ai_family;
+    freeaddrinfo(results);
+    return true;
+}
+
+// The AI_ADDRCONFIG rule: only ask for a family the host has a
+// non-loopback, non-link-local address in.
+bool family_configured(int family) {
+    struct ifaddrs* interfaces = nullptr;
+    if (getifaddrs(&interfaces) != 0) return true;
+    bool found = false;
+    for (struct ifaddrs* entry = interfaces; entry && !found; entry = entry->ifa_next) {
+        if (!entry->ifa_addr || entry->ifa_addr->sa_family != family) continue;
+        if (family == AF_INET) {
+            const auto* in = reinterpret_cast<const struct sockaddr_in*>(entry->ifa_addr);
+            found = (ntohl(in->sin_addr.s_addr) >> 24) != 127;
+        } else {
+            const auto* in6 = reinterpret_cast<const struct sockaddr_in6*>(entry->ifa_addr);
+            found = !IN6_IS_ADDR_LOOPBACK(&in6->sin6_addr) && !IN6_IS_ADDR_LINKLOCAL(&in6->sin6_addr);
+        }
+    }
+    freeifaddrs(interfaces);
+    return found;
+}
+
+struct ResolvConf {
+    std::vector<Address> servers;
+    std::vector<std::string> search;
+    int ndots = 1;
+    int timeout_ms = 5000;
+    int attempts = 2;
+};
+
+ResolvConf read_resolv_conf() {
+    ResolvConf conf;
+    std::ifstream file("/etc/resolv.conf");
+    std::string line;
+    while (std::getline(file, line)) {
+        const size_t comment = line.find_first_of("#;");
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+        if (keyword == "nameserver") {
+            std::string server;
+            Address address;
+            if (words >> server && conf.servers.size() < 3 && numeric_address(server, 53, AF_UNSPEC, address)) {
+                conf.servers.push_back(address);
+            }
+        } else if (keyword == "search" || keyword == "domain") {
+            conf.search.clear();
+            std::string domain;
+            while (words >> domain) {
+                if (domain.back() == '.') domain.pop_back();
+                if (!domain.empty()) conf.search.push_back(to_lower(domain));
+            }
+        } else if (keyword == "options") {
+            std::string option;
+            while (words >> option) {
+                if (option.compare(0, 6, "ndots:") == 0) {
+                    conf.ndots = std::min(std::max(std::atoi(option.c_str() + 6), 0), 15);
+                } else if (option.compare(0, 8, "timeout:") == 0) {
+                    conf.timeout_ms = std::min(std::max(std::atoi(option.c_str() + 8), 1), 30) * 1000;
+                } else if (option.compare(0, 9, "attempts:") == 0) {
+                    conf.attempts = std::min(std::max(std::atoi(option.c_str() + 9), 1), 5);
+                }
+            }
+        }
+    }
+    if (conf.servers.empty()) {
+        Address local;
+        numeric_address("127.0.0.1", 53, AF_INET, local);
+        conf.servers.push_back(local);
+    }
+    return conf;
+}
+
+// /etc/hosts is read on every lookup, as the libc resolver does.
+void hosts_lookup(const std::string& name, std::vector<std::string>& v6, std::vector<std::string>& v4) {
+    std::ifstream file("/etc/hosts");
+    std::string line;
+    while (std::getline(file, line)) {
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream words(line);
+        std::string text;
+        std::string raw;
+        if (!(words >> text) || !text_to_raw(text, raw)) continue;
+        std::string alias;
+        while (words >> alias) {
+            if (to_lower(alias) != name) continue;
+            auto& list = raw.size() == 4 ? v4 : v6;
+            if (std::find(list.begin(), list.end(), raw) == list.end()) list.push_back(raw);
+            break;
+        }
+    }
+}
+
+struct CacheEntry {
+    std::vector<std::string> addresses;
+    // CLOCK_REALTIME seconds, so the file stays meaningful across boots.
+    int64_t expires = 0;
+};
+
+struct Cache {
+    std::mutex mutex;
+    std::map<std::string, CacheEntry> entries;
+    std::set<std::string> loaded_files;
+};
+
+Cache& shared_cache() {
+    static Cache cache;
+    return cache;
+}
+
+const char* type_name(uint16_t type) {
+    return type == kTypeA ? "A" : "AAAA";
+}
+
+std::string cache_key(const std::string& name, uint16_t type) {
+    return name + " " + type_name(type);
+}
+
+std::string cache_path(const ResolverOptions& options) {
+    if (!options.cache_file.empty()) return options.cache_file;
+    const char* path = std::getenv("GEMINIOS_DNS_CACHE");
+    return path ? path : "";
+}
+
+// Lines read "name TYPE expires address...". Whichever copy of an entry
+// lives longer wins. The caller holds the cache mutex.
+void merge_cache_file(Cache& cache, const std::string& path) {
+    std::ifstream file(path);
+    const int64_t now = static_cast<int64_t>(time(nullptr));
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream words(line);
+        std::string name;
+        std::string type;
+        int64_t expires = 0;
+        if (!(words >> name >> type >> expires) || (type != "A" && type != "AAAA") || expires <= now) continue;
+        CacheEntry entry;
+        entry.expires = expires;
+        std::string text;
+        std::string raw;
+        while (words >> text) {
+            if (text_to_raw(text, raw) && raw.size() == (type == "A" ? 4u : 16u)) entry.addresses.push_back(raw);
+        }
+        CacheEntry& current = cache.entries[name + " " + type];
+        if (current.expires < expires) current = entry;
+    }
+}
+
+void load_cache_file(const std::string& path) {
+    if (path.empty()) return;
+    Cache& cache = shared_cache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (cache.loaded_files.insert(path).second) merge_cache_file(cache, path);
+}
+
+// Rewrites the file with what this process learnt merged into what other
+// runs wrote meanwhile. The cache is an optimisation, so a file that
+// cannot be written is silently left alone.
+void save_cache_file(const std::string& path) {
+    if (path.empty()) return;
+    Cache& cache = shared_cache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    merge_cache_file(cache, path);
+    // mkostemp creates the file exclusively under a name nobody can guess,
+    // so a planted symlink or file at a predictable path is never written.
+    std::string temporary = path + ".XXXXXX";
+    const int fd = mkostemp(&temporary[0], O_CLOEXEC);
+    if (fd < 0) return;
+    FILE* file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        unlink(temporary.c_str());
+        return;
+    }
+    const int64_t now = static_cast<int64_t>(time(nullptr));
+    for (const auto& item : cache.entries) {
+        if (item.second.expires <= now) continue;
+        std::string line = item.first + " " + std::to_string(item.second.expires);
+        for (const auto& raw : item.second.addresses) line += " " + raw_to_text(raw);
+        std::fprintf(file, "%s\n", line.c_str());
+    }
+    if (std::fclose(file) != 0 || std::rename(temporary.c_str(), path.c_str()) != 0) unlink(temporary.c_str());
+}
+
+bool cache_get(const std::string& name, uint16_t type, std::vector<std::string>& addresses) {
+    Cache& cache = shared_cache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    const auto found = cache.entries.find(cache_key(name, type));
+    if (found == cache.entries.end() || found->second.expires <= static_cast<int64_t>(time(nullptr))) return false;
+    addresses = found->second.addresses;
+    return true;
+}
+
+void cache_put(const std::string& name, uint16_t type, const std::vector<std::string>& addresses, uint32_t ttl) {
+    Cache& cache = shared_cache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    CacheEntry& entry = cache.entries[cache_key(name, type)];
+    entry.addresses = addresses;
+    entry.expires = static_cast<int64_t>(time(nullptr)) + ttl;
+}
+
+void put16(std::string& out, uint16_t value) {
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value & 0xff);
+}
+
+uint16_t get16(const unsigned char* data) {
+    return static_cast<uint16_t>(data[0] << 8 | data[1]);
+}
+
+uint32_t get32(const unsigned char* data) {
+    return static_cast<uint32_t>(data[0]) << 24 | static_cast<uint32_t>(data[1]) << 16 |
+           static_cast<uint32_t>(data[2]) << 8 | data[3];
+}
+
+bool valid_name(const std::string& name) {
+    if (name.empty() || name.size() > 253) return false;
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) dot = name.size();
+        if (dot == start || dot - start > 63) return false;
+        start = dot + 1;
+    }
+    return true;
+}
+
+std::string build_query(uint16_t id, const std::string& name, uint16_t type) {
+    std::string packet;
+    put16(packet, id);
+    put16(packet, 0x0100);  // RD
+    put16(packet, 1);
+    put16(packet, 0);
+    put16(packet, 0);
+    put16(packet, 1);
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) dot = name.size();
+        packet += static_cast<char>(dot - start);
+        packet.append(name, start, dot - start);
+        start = dot + 1;
+    }
+    packet += '\0';
+    put16(packet, type);
+    put16(packet, kClassIn);
+    // EDNS0 OPT record, so larger answers still fit in one datagram.
+    packet += '\0';
+    put16(packet, kTypeOpt);
+    put16(packet, kUdpPayloadBytes);
+    put16(packet, 0);
+    put16(packet, 0);
+    put16(packet, 0);
+    return packet;
+}
+
+// Reads a possibly compressed name; offset ends up past its first copy.
+bool read_name(const unsigned char* message, size_t size, size_t& offset, std::string& name) {
+    name.clear();
+    size_t position = offset;
+    bool jumped = false;
+    for (int hops = 0; hops < 64; ++hops) {
+        if (position >= size) return false;
+        const unsigned char length = message[position];
+        if ((length & 0xc0) == 0xc0) {
+            if (position + 1 >= size) return false;
+            if (!jumped) offset = position + 2;
+            jumped = true;
+            position = static_cast<size_t>(length & 0x3f) << 8 | message[position + 1];
+            continue;
+        }
+        if (length & 0xc0) return false;
+        if (length == 0) {
+            if (!jumped) offset = position + 1;
+            name = to_lower(name);
+            return true;
+        }
+        if (position + 1 + length > size) return false;
+        if (!name.empty()) name += '.';
+        name.append(reinterpret_cast<const char*>(message) + position + 1, length);
+        position += 1 + length;
+    }
+    return false;
+}
+
+struct Answer {
+    int rcode = 0;
+    bool truncated = false;
+    std::vector<std::string> addresses;
+    uint32_t ttl = kMaxTtl;
+    uint32_t negative_ttl = 0;
+};
+
+// Checks a reply against the question that was asked and collects the
+// addresses at the end of the CNAME chain starting at `name`. The TTL is
+// the smallest along that chain.
+bool parse_answer(const std::string& packet, uint16_t id, const std::string& name, uint16_t type, Answer& answer) {
+    const auto* message = reinterpret_cast<const unsigned char*>(packet.data());
+    const size_t size = packet.size();
+    if (size < 12 || get16(message) != id || !(message[2] & 0x80) || get16(message + 4) != 1) return false;
+    answer.truncated = (message[2] & 0x02) != 0;
+    answer.rcode = message[3] & 0x0f;
+    const unsigned answers = get16(message + 6);
+    const unsigned authorities = get16(message + 8);
+
+    size_t offset = 12;
+    std::string owner;
+    if (!read_name(message, size, offset, owner) || owner != name || offset + 4 > size || get16(message + offset) != type) {
+        return false;
+    }
+    offset += 4;
+    if (answer.truncated) return true;
+
+    struct Record {
+        std::string owner;
+        uint16_t type;
+        uint32_t ttl;
+        size_t data;
+        uint16_t length;
+    };
+    std::vector<Record> records;
+    for (unsigned index = 0; index < answers + authorities; ++index) {
+        Record record;
+        if (!read_name(message, size, offset, record.owner) || offset + 10 > size) return false;
+        record.type = get16(message + offset);
+        record.ttl = std::min(get32(message + offset + 4), kMaxTtl);
+        record.length = get16(message + offset + 8);
+        offset += 10;
+        record.data = offset;
+        if (offset + record.length > size) return false;
+        offset += record.length;
+        if (index < answers) {
+            records.push_back(record);
+        } else if (record.type == kTypeSoa) {
+            // RFC 2308: a negative answer lives for the smaller of the SOA
+            // TTL and its MINIMUM field.
+            size_t position = record.data;
+            std::string ignored;
+            if (read_name(message, size, position, ignored) && read_name(message, size, position, ignored) &&
+                position + 20 <= record.data + record.length) {
+                answer.negative_ttl = std::min(record.ttl, get32(message + position + 16));
+            }
+        }
+    }
+
+    std::set<std::string> aliases = {name};
+    uint32_t ttl = kMaxTtl;
+    for (int hop = 0; hop < kMaxCnameHops; ++hop) {
+        bool grew = false;
+        for (const auto& record : records) {
+            if (record.type != kTypeCname || !aliases.count(record.owner)) continue;
+            size_t position = record.data;
+            std::string target;
+            if (!read_name(message, size, position, target) || aliases.count(target)) continue;
+            aliases.insert(target);
+            ttl = std::min(ttl, record.ttl);
+            grew = true;
+        }
+        if (!grew) break;
+    }
+    const uint16_t length = type == kTypeA ? 4 : 16;
+    for (const auto& record : records) {
+        if (record.type != type || record.length != length || !aliases.count(record.owner)) continue;
+        const std::string raw(reinterpret_cast<const char*>(message) + record.data, length);
+        if (std::find(answer.addresses.begin(), answer.addresses.end(), raw) != answer.addresses.end()) continue;
+        answer.addresses.push_back(raw);
+        ttl = std::min(ttl, record.ttl);
+    }
+    answer.ttl = ttl;
+    return true;
+}
+
+bool wait_fd(int fd, short events, uint64_t deadline) {
+    for (;;) {
+        struct pollfd pfd = {fd, events, 0};
+        const int ready = poll(&pfd, 1, poll_timeout(monotonic_ns(), deadline));
+        if (ready > 0) return true;
+        if (ready == 0 || errno != EINTR || g_stop_sig) return false;
+    }
+}
+
+// Repeats a query whose UDP answer came back truncated over TCP.
+bool tcp_exchange(const Address& server, const std::string& query, int timeout_ms, std::string& reply) {
+    const uint64_t deadline = monotonic_ns() + static_cast<uint64_t>(timeout_ms) * 1000000ull;
+    const int fd = socket(server.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    bool ok = connect(fd, reinterpret_cast<const struct sockaddr*>(&server.storage), server.length) == 0 ||
+              (errno == EINPROGRESS && wait_fd(fd, POLLOUT, deadline));
+    int socket_error = 0;
+    socklen_t length = sizeof(socket_error);
+    ok = ok && getsockopt(fd, SOL_SOCKET, SO_ERROR, &socket_error, &length) == 0 && socket_error == 0;
+
+    std::string out;
+    put16(out, static_cast<uint16_t>(query.size()));
+    out += query;
+    size_t sent = 0;
+    while (ok && sent < out.size()) {
+        const ssize_t wrote = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (wrote > 0) sent += static_cast<size_t>(wrote);
+        else ok = wrote < 0 && errno == EAGAIN && wait_fd(fd, POLLOUT, deadline);
+    }
+    std::string in;
+    while (ok && (in.size() < 2 || in.size() < 2u + get16(reinterpret_cast<const unsigned char*>(in.data())))) {
+        char buffer[4096];
+        const ssize_t got = recv(fd, buffer, sizeof(buffer), 0);
+        if (got > 0) in.append(buffer, static_cast<size_t>(got));
+        else ok = got < 0 && errno == EAGAIN && wait_fd(fd, POLLIN, deadline);
+    }
+    close(fd);
+    if (ok) reply = in.substr(2, get16(reinterpret_cast<const unsigned char*>(in.data())));
+    return ok;
+}
+
+uint16_t random_id() {
+    uint16_t id = 0;
+    if (getrandom(&id, sizeof(id), GRND_NONBLOCK) != sizeof(id)) id = static_cast<uint16_t>(monotonic_ns() >> 10);
+    return id;
+}
+
+// One of the two queries of a lookup; the AAAA one goes out first, as
+// RFC 8305 section 3 asks.
+struct Query {
+    uint16_t type = 0;
+    // Sent to the servers, rather than answered from the cache or not
+    // wanted at all.
+    bool active = false;
+    bool done = false;
+    uint16_t id = 0;
+    std::string packet;
+    std::vector<std::string> addresses;
+    uint32_t ttl = 0;
+    uint64_t done_ns = 0;
+};
+
+struct Lookup {
+    std::string name;
+    std::string cache_file;
+    ResolvConf conf;
+    std::vector<std::string> candidates;
+    size_t candidate = 0;
+    Query queries[2];
+    int fd = -1;
+    size_t server = 0;
+    int attempt = 0;
+    uint64_t retry_ns = 0;
+    bool finished = false;
+    bool learnt = false;
+    std::string error;
+
+    Query& aaaa() { return queries[0]; }
+    Query& a() { return queries[1]; }
+};
+
+void lookup_fail(Lookup& lookup, const std::string& error) {
+    lookup.finished = true;
+    lookup.error = error;
+}
+
+void lookup_send(Lookup& lookup) {
+    for (auto& query : lookup.queries) {
+        if (query.active && !query.done) send(lookup.fd, query.packet.data(), query.packet.size(), 0);
+    }
+    lookup.retry_ns = monotonic_ns() + static_cast<uint64_t>(lookup.conf.timeout_ms) * 1000000ull;
+}
+
+bool lookup_open_server(Lookup& lookup) {
+    if (lookup.fd >= 0) close(lookup.fd);
+    const Address& server = lookup.conf.servers[lookup.server];
+    lookup.fd = socket(server.family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lookup.fd < 0) return false;
+    // Connected, so the kernel drops datagrams from anyone but the server.
+    return connect(lookup.fd, reinterpret_cast<const struct sockaddr*>(&server.storage), server.length) == 0;
+}
+
+// Moves on to the next server, and round again for the configured number
+// of attempts, after a timeout or a server failure.
+void lookup_next_server(Lookup& lookup) {
+    for (;;) {
+        if (++lookup.server >= lookup.conf.servers.size()) {
+            lookup.server = 0;
+            if (++lookup.attempt >= lookup.conf.attempts) {
+                lookup_fail(lookup, "no answer from the name servers");
+                return;
+            }
+        }
+        if (lookup_open_server(lookup)) break;
+    }
+    lookup_send(lookup);
+}
+
+void lookup_begin_candidate(Lookup& lookup) {
+    for (auto& query : lookup.queries) {
+        if (!query.active) continue;
+        query.done = false;
+        query.addresses.clear();
+        query.id = random_id();
+        query.packet = build_query(query.id, lookup.candidates[lookup.candidate], query.type);
+    }
+    lookup_send(lookup);
+}
+
+// Both queries answered: done if either found addresses, otherwise on to
+// the next search domain. Negative answers are cached once the whole
+// search has come up empty.
+void lookup_check(Lookup& lookup) {
+    for (auto& query : lookup.queries) {
+        if (!query.done) return;
+    }
+    const bool found = !lookup.aaaa().addresses.empty() || !lookup.a().addresses.empty();
+    if (!found && lookup.candidate + 1 < lookup.candidates.size()) {
+        ++lookup.candidate;
+        lookup_begin_candidate(lookup);
+        return;
+    }
+    for (auto& query : lookup.queries) {
+        if (!query.active || !query.addresses.empty()) continue;
+        cache_put(lookup.name, query.type, query.addresses, query.ttl);
+        lookup.learnt = true;
+    }
+    lookup.finished = true;
+}
+
+void lookup_readable(Lookup& lookup) {
+    bool server_failed = false;
+    std::string packet(65536, '\0');
+    for (;;) {
+        const ssize_t got = recv(lookup.fd, &packet[0], packet.size(), 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            // A refused datagram shows up here as ECONNREFUSED.
+            if (errno != EAGAIN) server_failed = true;
+            break;
+        }
+        const std::string reply = packet.substr(0, static_cast<size_t>(got));
+        for (auto& query : lookup.queries) {
+            if (!query.active || query.done) continue;
+            const std::string& name = lookup.candidates[lookup.candidate];
+            Answer answer;
+            if (!parse_answer(reply, query.id, name, query.type, answer)) continue;
+            if (answer.truncated) {
+                std::string full;
+                answer = Answer();
+                if (!tcp_exchange(lookup.conf.servers[lookup.server], query.packet, lookup.conf.timeout_ms, full) ||
+                    !parse_answer(full, query.id, name, query.type, answer) || answer.truncated) {
+                    server_failed = true;
+                    break;
+                }
+            }
+            if (answer.rcode != 0 && answer.rcode != kRcodeNxdomain) {
+                server_failed = true;
+                break;
+            }
+            query.done = true;
+            query.done_ns = monotonic_ns();
+            query.addresses = answer.addresses;
+            if (answer.addresses.empty()) {
+                query.ttl = std::min(answer.negative_ttl, kMaxNegativeTtl);
+            } else {
+                query.ttl = answer.ttl;
+                cache_put(lookup.name, query.type, query.addresses, query.ttl);
+                lookup.learnt = true;
+            }
+            break;
+        }
+    }
+    if (server_failed) lookup_next_server(lookup);
+    if (!lookup.finished) lookup_check(lookup);
+}
+
+void lookup_tick(Lookup& lookup) {
+    if (!lookup.finished && monotonic_ns() >= lookup.retry_ns) lookup_next_server(lookup);
+}
+
+// Fills in the queries from the cache and sends the rest. Returns false
+// with lookup.error set when the name cannot be looked up at all.
+bool lookup_start(Lookup& lookup, const std::string& host, const ResolverOptions& options) {
+    std::string name = to_lower(host);
+    const bool absolute = !name.empty() && name.back() == '.';
+    if (absolute) name.pop_back();
+    if (!valid_name(name)) {
+        lookup.error = "invalid host name";
+        return false;
+    }
+    lookup.name = name;
+    lookup.cache_file = cache_path(options);
+    load_cache_file(lookup.cache_file);
+
+    bool want6 = options.family != AF_INET;
+    bool want4 = options.family != AF_INET6;
+    if (options.family == AF_UNSPEC) {
+        static const bool have6 = family_configured(AF_INET6);
+        static const bool have4 = family_configured(AF_INET);
+        if (have6 || have4) {
+            want6 = have6;
+            want4 = have4;
+        }
+    }
+    const uint64_t now = monotonic_ns();
+    lookup.aaaa().type = kTypeAaaa;
+    lookup.a().type = kTypeA;
+    for (auto& query : lookup.queries) {
+        const bool wanted = query.type == kTypeAaaa ? want6 : want4;
+        query.done_ns = now;
+        query.done = !wanted || cache_get(name, query.type, query.addresses);
+        query.active = !query.done;
+    }
+    if (!lookup.aaaa().active && !lookup.a().active) {
+        lookup.finished = true;
+        return true;
+    }
+
+    lookup.conf = read_resolv_conf();
+    const size_t dots = static_cast<size_t>(std::count(name.begin(), name.end(), '.'));
+    if (absolute || lookup.conf.search.empty()) {
+        lookup.candidates.push_back(name);
+    } else {
+        if (dots >= static_cast<size_t>(lookup.conf.ndots)) lookup.candidates.push_back(name);
+        for (const auto& domain : lookup.conf.search) {
+            if (valid_name(name + "." + domain)) lookup.candidates.push_back(name + "." + domain);
+        }
+        if (dots < static_cast<size_t>(lookup.conf.ndots)) lookup.candidates.push_back(name);
+    }
+    while (!lookup_open_server(lookup)) {
+        if (++lookup.server >= lookup.conf.servers.size()) {
+            lookup.error = std::strerror(errno);
+            if (lookup.fd >= 0) close(lookup.fd);
+            lookup.fd = -1;
+            return false;
+        }
+    }
+    lookup_begin_candidate(lookup);
+    return true;
+}
+
+void lookup_end(Lookup& lookup) {
+    if (lookup.fd >= 0) close(lookup.fd);
+    lookup.fd = -1;
+    if (lookup.learnt) save_cache_file(lookup.cache_file);
+}
+
+// RFC 8305 section 4: alternate families, starting with `first`.
+std::vector<std::string> interleave(const std::vector<std::string>& v6, const std::vector<std::string>& v4, int first) {
+    std::vector<std::string> ordered;
+    const auto& lead = first == AF_INET ? v4 : v6;
+    const auto& follow = first == AF_INET ? v6 : v4;
+    for (size_t index = 0; index < std::max(lead.size(), follow.size()); ++index) {
+        if (index < lead.size()) ordered.push_back(lead[index]);
+        if (index < follow.size()) ordered.push_back(follow[index]);
+    }
+    return ordered;
+}
+
+// Answers the host from a literal or /etc/hosts. Returns false when the
+// name has to go to the servers.
+bool local_answer(const std::string& host, int port, int family, std::vector<Address>& addresses) {
+    Address literal;
+    if (numeric_address(host, port, family, literal)) {
+        addresses.push_back(literal);
+        return true;
+    }
+    std::vector<std::string> v6;
+    std::vector<std::string> v4;
+    std::string name = to_lower(host);
+    if (!name.empty() && name.back() == '.') name.pop_back();
+    hosts_lookup(name, v6, v4);
+    if (family == AF_INET) v6.clear();
+    if (family == AF_INET6) v4.clear();
+    for (const auto& raw : interleave(v6, v4, AF_INET6)) addresses.push_back(make_address(raw, port));
+    return !addresses.empty();
+}
+
+struct Attempt {
+    int fd;
+    Address address;
+};
+
+bool start_attempt(const Address& address, std::vector<Attempt>& attempts, std::string& error) {
+    const int fd = socket(address.family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = std::strerror(errno);
+        return false;
+    }
+    if (connect(fd, reinterpret_cast<const struct sockaddr*>(&address.storage), address.length) != 0 &&
+        errno != EINPROGRESS) {
+        error = std::strerror(errno);
+        close(fd);
+        return false;
+    }
+    attempts.push_back({fd, address});
+    return true;
+}
+
+}  // namespace
+
+bool resolve(
+    const std::string& host,
+    int port,
+    const ResolverOptions& options,
+    std::vector<Address>& addresses,
+    std::string& error
+) {
+    addresses.clear();
+    if (local_answer(host, port, options.family, addresses)) return true;
+    Lookup lookup;
+    if (!lookup_start(lookup, host, options)) {
+        error = "cannot resolve " + host + ": " + lookup.error;
+        return false;
+    }
+    while (!lookup.finished) {
+        struct pollfd pfd = {lookup.fd, POLLIN, 0};
+        const int ready = poll(&pfd, 1, poll_timeout(monotonic_ns(), lookup.retry_ns));
+        if (ready < 0 && errno == EINTR && g_stop_sig) {
+            lookup_fail(lookup, "interrupted");
+            break;
+        }
+        if (ready > 0) lookup_readable(lookup);
+        lookup_tick(lookup);
+    }
+    lookup_end(lookup);
+    for (const auto& raw : interleave(lookup.aaaa().addresses, lookup.a().addresses, AF_INET6)) {
+        addresses.push_back(make_address(raw, port));
+    }
+    if (addresses.empty()) {
+        error = "cannot resolve " + host + ": " + (lookup.error.empty() ? "unknown host" : lookup.error);
+        return false;
+    }
+    return true;
+}
+
+bool connect_host(
+    const std::string& host,
+    int port,
+    const ResolverOptions& options,
+    int timeout_ms,
+    ConnectResult& result,
+    std::string& error
+) {
+    const uint64_t started = monotonic_ns();
+    const uint64_t deadline = started + static_cast<uint64_t>(std::max(timeout_ms, 1)) * 1000000ull;
+    const std::string target = host + ":" + std::to_string(port);
+
+    // Addresses not tried yet, in the order they will be.
+    std::vector<Address> pending;
+    std::vector<Address> tried;
+    std::vector<Attempt> attempts;
+    bool have6 = false;
+    bool have4 = false;
+    uint64_t resolved_ns = 0;
+    Lookup lookup;
+    if (local_answer(host, port, options.family, pending)) {
+        lookup.finished = true;
+        resolved_ns = started;
+    } else if (!lookup_start(lookup, host, options)) {
+        error = "cannot resolve " + host + ": " + lookup.error;
+        return false;
+    }
+
+    // Adds the addresses of one answer to the untried ones and restores the
+    // alternation, starting with the family the last attempt did not use.
+    auto take = [&](const std::vector<std::string>& raws) {
+        std::vector<std::string> v6;
+        std::vector<std::string> v4;
+        for (const auto& address : pending) {
+            const char* bytes = address.family == AF_INET
+                ? reinterpret_cast<const char*>(&reinterpret_cast<const struct sockaddr_in*>(&address.storage)->sin_addr)
+                : reinterpret_cast<const char*>(&reinterpret_cast<const struct sockaddr_in6*>(&address.storage)->sin6_addr);
+            (address.family == AF_INET ? v4 : v6).emplace_back(bytes, address.family == AF_INET ? 4 : 16);
+        }
+        for (const auto& raw : raws) (raw.size() == 4 ? v4 : v6).push_back(raw);
+        const int last = tried.empty() ? AF_INET : tried.back().family;
+        pending.clear();
+        for (const auto& raw : interleave(v6, v4, last == AF_INET ? AF_INET6 : AF_INET)) {
+            pending.push_back(make_address(raw, port));
+        }
+        if (resolved_ns == 0 && !raws.empty()) resolved_ns = monotonic_ns();
+    };
+
+    std::string last_error;
+    uint64_t next_attempt_ns = 0;
+    bool connected = false;
+    for (;;) {
+        uint64_t now = monotonic_ns();
+        // AAAA answers are used at once; an A answer waits up to the
+        // Resolution Delay for the AAAA one.
+        Query& aaaa = lookup.aaaa();
+        Query& a = lookup.a();
+        // Until something is found, a negative answer may be for a search
+        // domain the lookup is about to move past.
+        const bool settled = lookup.finished || (aaaa.done && !aaaa.addresses.empty()) || (a.done && !a.addresses.empty());
+        if (!have6 && aaaa.done && settled) {
+            have6 = true;
+            take(aaaa.addresses);
+        }
+        const uint64_t a_usable_ns = a.done_ns + kResolutionDelayNs;
+        if (!have4 && a.done && settled && (have6 || lookup.finished || now >= a_usable_ns)) {
+            have4 = true;
+            take(a.addresses);
+        }
+
+        if (!pending.empty() && (attempts.empty() || now >= next_attempt_ns)) {
+            const Address address = pending.front();
+            pending.erase(pending.begin());
+            tried.push_back(address);
+            next_attempt_ns = start_attempt(address, attempts, last_error) ? now + kConnectionAttemptDelayNs : 0;
+            continue;
+        }
+        if (attempts.empty() && pending.empty() && lookup.finished && (have6 || !aaaa.done) && (have4 || !a.done)) {
+            if (tried.empty()) {
+                error = "cannot resolve " + host + ": " + (lookup.error.empty() ? "unknown host" : lookup.error);
+            } else {
+                error = "cannot connect to " + target + ": " + last_error;
+            }
+            break;
+        }
+        if (now >= deadline) {
+            error = "cannot connect to " + target + ": connection timed out";
+            break;
+        }
+
+        uint64_t wake = deadline;
+        if (!lookup.finished) wake = std::min(wake, lookup.retry_ns);
+        if (!pending.empty()) wake = std::min(wake, next_attempt_ns);
+        if (a.done && !have4) wake = std::min(wake, a_usable_ns);
+        std::vector<struct pollfd> fds;
+        for (const auto& attempt : attempts) fds.push_back({attempt.fd, POLLOUT, 0});
+        if (!lookup.finished) fds.push_back({lookup.fd, POLLIN, 0});
+        const int ready = poll(fds.data(), fds.size(), poll_timeout(now, wake));
+        if (ready < 0 && errno == EINTR && g_stop_sig) {
+            error = "interrupted";
+            break;
+        }
+        if (ready <= 0) {
+            lookup_tick(lookup);
+            continue;
+        }
+        if (!lookup.finished && fds.back().revents) lookup_readable(lookup);
+        lookup_tick(lookup);
+        for (size_t index = attempts.size(); index-- > 0;) {
+            if (!fds[index].revents) continue;
+            int socket_error = 0;
+            socklen_t length = sizeof(socket_error);
+            if (getsockopt(attempts[index].fd, SOL_SOCKET, SO_ERROR, &socket_error, &length) == 0 && socket_error == 0) {
+                result.fd = attempts[index].fd;
+                result.address = attempts[index].address;
+                attempts.erase(attempts.begin() + static_cast<std::ptrdiff_t>(index));
+                connected = true;
+                break;
+            }
+            // A failed attempt lets the next one start straight away.
+            last_error = std::strerror(socket_error != 0 ? socket_error : errno);
+            close(attempts[index].fd);
+            attempts.erase(attempts.begin() + static_cast<std::ptrdiff_t>(index));
+            next_attempt_ns = 0;
+        }
+        if (connected) break;
+    }
+
+    for (const auto& attempt : attempts) close(attempt.fd);
+    lookup_end(lookup);
+    if (!connected) return false;
+    fcntl(result.fd, F_SETFL, fcntl(result.fd, F_GETFL) & ~O_NONBLOCK);
+    result.resolved_ns = resolved_ns;
+    return true;
+}
+
+std::string address_to_string(const Address& address) {
+    char text[INET6_ADDRSTRLEN] = {};
+    if (address.family == AF_INET) {
+        inet_ntop(AF_INET, &reinterpret_cast<const struct sockaddr_in*>(&address.storage)->sin_addr, text, sizeof(text));
+    } else if (address.family == AF_INET6) {
+        inet_ntop(AF_INET6, &reinterpret_cast<const struct sockaddr_in6*>(&address.storage)->sin6_addr, text, sizeof(text));
+    }
+    return text;
+}
+
+}  // namespace dns
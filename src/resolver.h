@@ -0,0 +1,67 @@
+#ifndef GEMINIOS_RESOLVER_H
+#define GEMINIOS_RESOLVER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+// Stub resolver shared by the network tools. Names are looked up in
+// /etc/hosts, then with A and AAAA queries sent together to the
+// /etc/resolv.conf name servers. Answers, negative ones included, are
+// cached for their TTL in the process and, optionally, in a file that
+// later runs read back.
+namespace dns {
+
+struct Address {
+    struct sockaddr_storage storage = {};
+    socklen_t length = 0;
+    int family = AF_UNSPEC;
+};
+
+struct ResolverOptions {
+    // AF_INET or AF_INET6 to look up one family only.
+    int family = AF_UNSPEC;
+    // Cache file shared between runs. Empty means $GEMINIOS_DNS_CACHE, and
+    // no file at all when that is unset too.
+    std::string cache_file;
+};
+
+struct ConnectResult {
+    int fd = -1;
+    Address address;
+    // CLOCK_MONOTONIC nanoseconds at which the first usable address was known.
+    uint64_t resolved_ns = 0;
+};
+
+// Addresses of host (a name or a numeric address) with `port` filled in,
+// IPv6 and IPv4 interleaved as RFC 8305 section 4 orders them.
+bool resolve(
+    const std::string& host,
+    int port,
+    const ResolverOptions& options,
+    std::vector<Address>& addresses,
+    std::string& error
+);
+
+// Opens a TCP connection to host the Happy Eyeballs v2 way (RFC 8305): the
+// lookups run alongside the connection attempts, the first attempt starts
+// as soon as an AAAA answer arrives or 50 ms after an A answer, and a new
+// attempt starts every 250 ms, or as soon as one fails, without giving up
+// on the ones still pending. The first to connect wins; its socket comes
+// back in blocking mode.
+bool connect_host(
+    const std::string& host,
+    int port,
+    const ResolverOptions& options,
+    int timeout_ms,
+    ConnectResult& result,
+    std::string& error
+);
+
+std::string address_to_string(const Address& address);
+
+}  // namespace dns
+
+#endif
@@ -0,0 +1,476 @@
+#!/usr/bin/env bash
+set -Eeuo pipefail
+
+usage() {
+    cat <<'EOF'
+Usage: greq_cache_test.sh [options]
+
+Exercises the greq --cache-dir cache (storage, If-None-Match and
+If-Modified-Since revalidation, 304 hits and LRU eviction) against a
+local HTTP server started by this script.
+
+Options:
+  -h, --help              Show this help text
+  --greq PATH             greq binary to use
+  --http-port PORT        port for the local HTTP server, default 18045
+
+Environment overrides:
+  GREQ_BIN
+  GREQ_TEST_HTTP_PORT
+  GREQ_TEST_REPORT_DIR=/tmp/...
+
+Examples:
+  ./tools/greq_cache_test.sh
+  ./tools/greq_cache_test.sh --greq ./build/greq
+EOF
+}
+
+GREQ_BIN="${GREQ_BIN:-}"
+HTTP_PORT="${GREQ_TEST_HTTP_PORT:-18045}"
+
+while [[ $# -gt 0 ]]; do
+    case "$1" in
+        -h|--help)
+            usage
+            exit 0
+            ;;
+        --greq)
+            [[ $# -ge 2 ]] || { echo "Missing value for --greq" >&2; exit 1; }
+            GREQ_BIN="$2"
+            shift
+            ;;
+        --http-port)
+            [[ $# -ge 2 ]] || { echo "Missing value for --http-port" >&2; exit 1; }
+            HTTP_PORT="$2"
+            shift
+            ;;
+        *)
+            echo "Unknown option: $1" >&2
+            usage >&2
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+STAMP="$(date +%Y%m%d-%H%M%S)"
+REPORT_DIR="${GREQ_TEST_REPORT_DIR:-/tmp/greq-cache-$STAMP}"
+TMP_ROOT="/tmp/greq-cache-work-$STAMP"
+LOG="$REPORT_DIR/report.txt"
+mkdir -p "$REPORT_DIR"
+exec > >(tee "$LOG") 2>&1
+
+FAILS=0
+WARNS=0
+SKIPS=0
+CHECKS=0
+STEP=0
+LAST_LOG=""
+LAST_RC=0
+SUMMARY_PRINTED=0
+CLEANUP_DONE=0
+
+BASE="http://127.0.0.1:$HTTP_PORT"
+REQUEST_LOG="$TMP_ROOT/requests.log"
+OUT_DIR="$TMP_ROOT/out"
+CACHE_DIR="$TMP_ROOT/cache"
+SERVER_PID=""
+
+say()  { printf '%s\n' "$*"; }
+ok()   { CHECKS=$((CHECKS + 1)); printf '[OK] %s\n' "$*"; }
+warn() { WARNS=$((WARNS + 1)); printf '[WARN] %s\n' "$*"; }
+fail() { FAILS=$((FAILS + 1)); printf '[FAIL] %s\n' "$*"; }
+skip() { SKIPS=$((SKIPS + 1)); printf '[SKIP] %s\n' "$*"; }
+
+need_cmd() {
+    command -v "$1" >/dev/null 2>&1 || {
+        echo "Missing required command: $1" >&2
+        exit 1
+    }
+}
+
+resolve_binary() {
+    local current="$1"
+    shift
+    if [[ -n "$current" ]]; then
+        [[ -x "$current" ]] && { printf '%s\n' "$current"; return 0; }
+        if command -v "$current" >/dev/null 2>&1; then
+            command -v "$current"
+            return 0
+        fi
+        return 1
+    fi
+
+    local candidate
+    for candidate in "$@"; do
+        [[ -x "$candidate" ]] && { printf '%s\n' "$candidate"; return 0; }
+        if command -v "$candidate" >/dev/null 2>&1; then
+            command -v "$candidate"
+            return 0
+        fi
+    done
+    return 1
+}
+
+sanitize_name() {
+    sed 's#[^A-Za-z0-9._-]#_#g' <<<"$1"
+}
+
+run_logged() {
+    local label="$1"
+    shift
+    STEP=$((STEP + 1))
+    local safe
+    safe="$(sanitize_name "$label")"
+    LAST_LOG="$REPORT_DIR/$(printf '%03d' "$STEP")-$safe.log"
+    {
+        printf '$'
+        local arg
+        for arg in "$@"; do
+            printf ' %q' "$arg"
+        done
+        printf '\n'
+    } >"$LAST_LOG"
+
+    set +e
+    "$@" >>"$LAST_LOG" 2>&1
+    LAST_RC=$?
+    set -e
+    return 0
+}
+
+expect_success() {
+    local label="$1"
+    shift
+    run_logged "$label" "$@"
+    if [[ "$LAST_RC" -eq 0 ]]; then
+        ok "$label"
+        return 0
+    fi
+    fail "$label failed (rc=$LAST_RC). See $LAST_LOG"
+    return 1
+}
+
+assert_last_log_contains() {
+    local pattern="$1"
+    local message="$2"
+    if grep -Eq -- "$pattern" "$LAST_LOG"; then
+        ok "$message"
+        return 0
+    fi
+    fail "$message (pattern not found in $LAST_LOG)"
+    return 1
+}
+
+assert_same_file() {
+    local expected="$1"
+    local actual="$2"
+    local label="$3"
+    if cmp -s -- "$expected" "$actual"; then
+        ok "$label"
+        return 0
+    fi
+    fail "$label ($actual differs from $expected)"
+    return 1
+}
+
+# Requests the server logged since the last reset_requests, one line each:
+# "METHOD path inm=yes|no ims=yes|no status".
+reset_requests() {
+    : >"$REQUEST_LOG"
+}
+
+request_count() {
+    grep -Ec -- "$1" "$REQUEST_LOG" || true
+}
+
+assert_request_count_at_least() {
+    local pattern="$1"
+    local minimum="$2"
+    local message="$3"
+    local count
+    count="$(request_count "$pattern")"
+    if [[ "$count" -ge "$minimum" ]]; then
+        ok "$message"
+        return 0
+    fi
+    fail "$message ($count requests matched '$pattern', expected at least $minimum; see $REQUEST_LOG)"
+    return 1
+}
+
+assert_no_request() {
+    local pattern="$1"
+    local message="$2"
+    if grep -Eq -- "$pattern" "$REQUEST_LOG"; then
+        fail "$message (unexpected request matching '$pattern' in $REQUEST_LOG)"
+        return 1
+    fi
+    ok "$message"
+    return 0
+}
+
+write_helper_scripts() {
+    mkdir -p "$TMP_ROOT/www" "$OUT_DIR"
+    head -c $((200 * 1024)) /dev/urandom >"$TMP_ROOT/www/index.bin"
+    cp -- "$TMP_ROOT/www/index.bin" "$TMP_ROOT/www/mirror.bin"
+    head -c $((200 * 1024)) /dev/urandom >"$TMP_ROOT/www/other.bin"
+
+    # /etag/ validates with an ETag taken from the content, /dated/ only
+    # with Last-Modified from the file time, and /nostore/ sends an ETag
+    # together with Cache-Control: no-store.
+    cat >"$TMP_ROOT/http_fixture.py" <<'EOF'
+import email.utils
+import hashlib
+import http.server
+import os
+import sys
+import threading
+
+ROOT = sys.argv[1]
+LOG = open(sys.argv[2], "a", buffering=1)
+PORT = int(sys.argv[3])
+LOCK = threading.Lock()
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def record(self, status):
+        with LOCK:
+            LOG.write("%s %s inm=%s ims=%s %d\n" % (
+                self.command, self.path,
+                "yes" if self.headers.get("If-None-Match") else "no",
+                "yes" if self.headers.get("If-Modified-Since") else "no", status))
+
+    def do_GET(self):
+        route, _, name = self.path.lstrip("/").partition("/")
+        path = os.path.join(ROOT, os.path.basename(name))
+        if route not in ("etag", "dated", "nostore") or not os.path.isfile(path):
+            self.record(404)
+            self.send_error(404)
+            return
+        with open(path, "rb") as f:
+            data = f.read()
+        etag = '"%s"' % hashlib.sha256(data).hexdigest()[:16]
+        mtime = int(os.stat(path).st_mtime)
+        headers = []
+        fresh = False
+        if route in ("etag", "nostore"):
+            headers.append(("ETag", etag))
+            fresh = self.headers.get("If-None-Match") == etag
+        else:
+            headers.append(("Last-Modified", email.utils.formatdate(mtime, usegmt=True)))
+            since = self.headers.get("If-Modified-Since")
+            fresh = since is not None and email.utils.parsedate_to_datetime(since).timestamp() >= mtime
+        if route == "nostore":
+            headers.append(("Cache-Control", "no-store"))
+        status = 304 if fresh else 200
+        self.record(status)
+        self.send_response(status)
+        for key, value in headers:
+            self.send_header(key, value)
+        self.send_header("Content-Length", "0" if fresh else str(len(data)))
+        self.end_headers()
+        if not fresh:
+            self.wfile.write(data)
+
+
+http.server.ThreadingHTTPServer(("127.0.0.1", PORT), Handler).serve_forever()
+EOF
+}
+
+greq_cached() {
+    "$GREQ_BIN" -v --cache-dir "$CACHE_DIR" "$@"
+}
+
+# Writes the body to stdout, redirected to $1, instead of using -o.
+greq_cached_to() {
+    local output="$1"
+    shift
+    "$GREQ_BIN" --cache-dir "$CACHE_DIR" "$@" >"$output"
+}
+
+cache_objects() {
+    find "$CACHE_DIR/objects" -type f 2>/dev/null | wc -l | tr -d ' '
+}
+
+wait_for_port() {
+    local port="$1"
+    local timeout_s="$2"
+    local start=$SECONDS
+    while (( SECONDS - start < timeout_s )); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.2
+    done
+    return 1
+}
+
+start_server() {
+    reset_requests
+    python3 "$TMP_ROOT/http_fixture.py" "$TMP_ROOT/www" "$REQUEST_LOG" "$HTTP_PORT" >"$REPORT_DIR/http-server.log" 2>&1 &
+    SERVER_PID=$!
+    if ! wait_for_port "$HTTP_PORT" 5; then
+        fail "local HTTP server did not start on port $HTTP_PORT (see $REPORT_DIR/http-server.log)"
+        return 1
+    fi
+    ok "Started the HTTP server on port $HTTP_PORT"
+}
+
+stop_server() {
+    [[ -n "$SERVER_PID" ]] || return 0
+    kill "$SERVER_PID" 2>/dev/null || true
+    wait "$SERVER_PID" 2>/dev/null || true
+    SERVER_PID=""
+}
+
+cleanup() {
+    [[ "$CLEANUP_DONE" -eq 0 ]] || return 0
+    CLEANUP_DONE=1
+
+    say
+    say "== Cleanup =="
+
+    stop_server
+    if rm -rf -- "$TMP_ROOT"; then
+        ok "Removed temporary workspace $TMP_ROOT"
+    else
+        warn "Failed to remove temporary workspace $TMP_ROOT"
+    fi
+}
+
+print_summary() {
+    [[ "$SUMMARY_PRINTED" -eq 0 ]] || return 0
+    SUMMARY_PRINTED=1
+    say
+    say "== Summary =="
+    say "Checks: $CHECKS"
+    say "Warnings: $WARNS"
+    say "Skips: $SKIPS"
+    say "Failures: $FAILS"
+    say "Report: $REPORT_DIR"
+}
+
+on_exit() {
+    local rc=$?
+    if [[ "$SUMMARY_PRINTED" -eq 0 ]]; then
+        cleanup
+        print_summary
+    fi
+    exit "$rc"
+}
+
+trap on_exit EXIT
+
+preflight() {
+    say "GeminiOS greq Cache Test"
+    say "greq: ${GREQ_BIN:-<auto>}"
+    say "server: 127.0.0.1:$HTTP_PORT"
+    say "Report: $REPORT_DIR"
+    say
+
+    need_cmd bash
+    need_cmd grep
+    need_cmd sed
+    need_cmd cmp
+    need_cmd find
+    need_cmd python3
+
+    if ! GREQ_BIN="$(resolve_binary "$GREQ_BIN" greq /bin/apps/system/greq)"; then
+        fail "Could not locate a greq binary"
+        return 1
+    fi
+    ok "Using greq binary: $GREQ_BIN"
+
+    mkdir -p "$TMP_ROOT"
+    write_helper_scripts
+    start_server || return 1
+    say
+}
+
+run_revalidation_tests() {
+    say "== Revalidation =="
+
+    reset_requests
+    expect_success "etag-miss" greq_cached -o "$OUT_DIR/first.bin" "$BASE/etag/index.bin" || return 1
+    assert_last_log_contains 'Cache miss: .*, stored ' "the first fetch is a miss and is stored" || return 1
+    assert_same_file "$TMP_ROOT/www/index.bin" "$OUT_DIR/first.bin" "the first fetch wrote the body" || return 1
+    assert_request_count_at_least '^GET /etag/index.bin inm=no ims=no 200$' 1 "the first request was unconditional" || return 1
+
+    reset_requests
+    expect_success "etag-hit" greq_cached -o "$OUT_DIR/second.bin" "$BASE/etag/index.bin" || return 1
+    assert_request_count_at_least '^GET /etag/index.bin inm=yes ims=no 304$' 1 "the second request sent If-None-Match and got 304" || return 1
+    assert_last_log_contains 'Cache hit: .* not modified, served 200\.0 KiB via ' "the 304 was served from the cache" || return 1
+    assert_same_file "$TMP_ROOT/www/index.bin" "$OUT_DIR/second.bin" "the cached body matches the original" || return 1
+    assert_last_log_contains 'Cache: 1 hits, 1 misses, ' "the hit and miss statistics were updated" || return 1
+
+    expect_success "etag-hit-stdout" greq_cached_to "$OUT_DIR/stdout.bin" "$BASE/etag/index.bin" || return 1
+    assert_same_file "$TMP_ROOT/www/index.bin" "$OUT_DIR/stdout.bin" "a cache hit written to stdout matches the original" || return 1
+
+    head -c $((200 * 1024)) /dev/urandom >"$TMP_ROOT/www/index.bin"
+    reset_requests
+    expect_success "etag-changed" greq_cached -o "$OUT_DIR/changed.bin" "$BASE/etag/index.bin" || return 1
+    assert_request_count_at_least '^GET /etag/index.bin inm=yes ims=no 200$' 1 "a changed body answered the conditional request with 200" || return 1
+    assert_last_log_contains 'Cache miss: .*, stored ' "the changed body replaced the cached one" || return 1
+    assert_same_file "$TMP_ROOT/www/index.bin" "$OUT_DIR/changed.bin" "the output holds the new body" || return 1
+
+    touch -d '2020-01-01 00:00:00 UTC' "$TMP_ROOT/www/other.bin"
+    expect_success "dated-miss" greq_cached -o "$OUT_DIR/dated.bin" "$BASE/dated/other.bin" || return 1
+    reset_requests
+    expect_success "dated-hit" greq_cached -o "$OUT_DIR/dated.bin" "$BASE/dated/other.bin" || return 1
+    assert_request_count_at_least '^GET /dated/other.bin inm=no ims=yes 304$' 1 "Last-Modified alone revalidates with If-Modified-Since" || return 1
+    assert_last_log_contains 'Cache hit: ' "the If-Modified-Since 304 was served from the cache" || return 1
+    assert_same_file "$TMP_ROOT/www/other.bin" "$OUT_DIR/dated.bin" "the date-validated body matches the original" || return 1
+
+    expect_success "nostore-first" greq_cached -o "$OUT_DIR/nostore.bin" "$BASE/nostore/other.bin" || return 1
+    assert_last_log_contains 'not stored \(no-store\)' "a no-store response is not cached" || return 1
+    reset_requests
+    expect_success "nostore-second" greq_cached -o "$OUT_DIR/nostore.bin" "$BASE/nostore/other.bin" || return 1
+    assert_request_count_at_least '^GET /nostore/other.bin inm=no ims=no 200$' 1 "a no-store URL is fetched unconditionally again" || return 1
+    say
+}
+
+run_storage_tests() {
+    say "== Content-addressed storage and eviction =="
+
+    rm -rf -- "$CACHE_DIR"
+    expect_success "same-body-first" greq_cached -o "$OUT_DIR/a.bin" "$BASE/etag/index.bin" || return 1
+    cp -- "$TMP_ROOT/www/index.bin" "$TMP_ROOT/www/mirror.bin"
+    expect_success "same-body-second" greq_cached -o "$OUT_DIR/b.bin" "$BASE/etag/mirror.bin" || return 1
+    if [[ "$(cache_objects)" -eq 1 ]]; then
+        ok "two URLs with the same body share one cached object"
+    else
+        fail "two URLs with the same body left $(cache_objects) objects in $CACHE_DIR/objects"
+        return 1
+    fi
+
+    rm -rf -- "$CACHE_DIR"
+    expect_success "evict-first" greq_cached --cache-max 300K -o "$OUT_DIR/a.bin" "$BASE/etag/index.bin" || return 1
+    sleep 1
+    expect_success "evict-second" greq_cached --cache-max 300K -o "$OUT_DIR/b.bin" "$BASE/etag/other.bin" || return 1
+    assert_last_log_contains 'Cache: evicted 1 least recently used entries' "going over --cache-max evicted the older entry" || return 1
+    reset_requests
+    expect_success "evict-refetch" greq_cached --cache-max 300K -o "$OUT_DIR/a.bin" "$BASE/etag/index.bin" || return 1
+    assert_request_count_at_least '^GET /etag/index.bin inm=no ims=no 200$' 1 "the evicted URL is fetched without validators" || return 1
+    assert_same_file "$TMP_ROOT/www/index.bin" "$OUT_DIR/a.bin" "the refetched body matches the original" || return 1
+    say
+}
+
+main_rc=0
+
+preflight || main_rc=1
+if [[ "$main_rc" -eq 0 ]]; then run_revalidation_tests || main_rc=1; fi
+if [[ "$main_rc" -eq 0 ]]; then run_storage_tests || main_rc=1; fi
+
+cleanup
+print_summary
+trap - EXIT
+
+if [[ "$main_rc" -ne 0 || "$FAILS" -ne 0 ]]; then
+    exit 1
+fi
+exit 0
@@ -0,0 +1,487 @@
+#!/usr/bin/env bash
+set -Eeuo pipefail
+
+usage() {
+    cat <<'EOF'
+Usage: greq_range_test.sh [options]
+
+Exercises greq --parallel range downloads and redirect handling against
+two local HTTP servers (two origins) started by this script.
+
+Options:
+  -h, --help              Show this help text
+  --greq PATH             greq binary to use
+  --http-port PORT        first of two consecutive ports for the servers, default 18040
+
+Environment overrides:
+  GREQ_BIN
+  GREQ_TEST_HTTP_PORT
+  GREQ_TEST_REPORT_DIR=/tmp/...
+
+Examples:
+  ./tools/greq_range_test.sh
+  ./tools/greq_range_test.sh --greq ./build/greq
+EOF
+}
+
+GREQ_BIN="${GREQ_BIN:-}"
+HTTP_PORT="${GREQ_TEST_HTTP_PORT:-18040}"
+
+while [[ $# -gt 0 ]]; do
+    case "$1" in
+        -h|--help)
+            usage
+            exit 0
+            ;;
+        --greq)
+            [[ $# -ge 2 ]] || { echo "Missing value for --greq" >&2; exit 1; }
+            GREQ_BIN="$2"
+            shift
+            ;;
+        --http-port)
+            [[ $# -ge 2 ]] || { echo "Missing value for --http-port" >&2; exit 1; }
+            HTTP_PORT="$2"
+            shift
+            ;;
+        *)
+            echo "Unknown option: $1" >&2
+            usage >&2
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+STAMP="$(date +%Y%m%d-%H%M%S)"
+REPORT_DIR="${GREQ_TEST_REPORT_DIR:-/tmp/greq-range-$STAMP}"
+TMP_ROOT="/tmp/greq-range-work-$STAMP"
+LOG="$REPORT_DIR/report.txt"
+mkdir -p "$REPORT_DIR"
+exec > >(tee "$LOG") 2>&1
+
+FAILS=0
+WARNS=0
+SKIPS=0
+CHECKS=0
+STEP=0
+LAST_LOG=""
+LAST_RC=0
+SUMMARY_PRINTED=0
+CLEANUP_DONE=0
+
+OTHER_PORT=$((HTTP_PORT + 1))
+BASE="http://127.0.0.1:$HTTP_PORT"
+REQUEST_LOG="$TMP_ROOT/requests.log"
+OUT_DIR="$TMP_ROOT/out"
+
+declare -a SERVER_PIDS=()
+
+say()  { printf '%s\n' "$*"; }
+ok()   { CHECKS=$((CHECKS + 1)); printf '[OK] %s\n' "$*"; }
+warn() { WARNS=$((WARNS + 1)); printf '[WARN] %s\n' "$*"; }
+fail() { FAILS=$((FAILS + 1)); printf '[FAIL] %s\n' "$*"; }
+skip() { SKIPS=$((SKIPS + 1)); printf '[SKIP] %s\n' "$*"; }
+
+need_cmd() {
+    command -v "$1" >/dev/null 2>&1 || {
+        echo "Missing required command: $1" >&2
+        exit 1
+    }
+}
+
+resolve_binary() {
+    local current="$1"
+    shift
+    if [[ -n "$current" ]]; then
+        [[ -x "$current" ]] && { printf '%s\n' "$current"; return 0; }
+        if command -v "$current" >/dev/null 2>&1; then
+            command -v "$current"
+            return 0
+        fi
+        return 1
+    fi
+
+    local candidate
+    for candidate in "$@"; do
+        [[ -x "$candidate" ]] && { printf '%s\n' "$candidate"; return 0; }
+        if command -v "$candidate" >/dev/null 2>&1; then
+            command -v "$candidate"
+            return 0
+        fi
+    done
+    return 1
+}
+
+sanitize_name() {
+    sed 's#[^A-Za-z0-9._-]#_#g' <<<"$1"
+}
+
+run_logged() {
+    local label="$1"
+    shift
+    STEP=$((STEP + 1))
+    local safe
+    safe="$(sanitize_name "$label")"
+    LAST_LOG="$REPORT_DIR/$(printf '%03d' "$STEP")-$safe.log"
+    {
+        printf '$'
+        local arg
+        for arg in "$@"; do
+            printf ' %q' "$arg"
+        done
+        printf '\n'
+    } >"$LAST_LOG"
+
+    set +e
+    "$@" >>"$LAST_LOG" 2>&1
+    LAST_RC=$?
+    set -e
+    return 0
+}
+
+expect_success() {
+    local label="$1"
+    shift
+    run_logged "$label" "$@"
+    if [[ "$LAST_RC" -eq 0 ]]; then
+        ok "$label"
+        return 0
+    fi
+    fail "$label failed (rc=$LAST_RC). See $LAST_LOG"
+    return 1
+}
+
+assert_last_log_contains() {
+    local pattern="$1"
+    local message="$2"
+    if grep -Eq -- "$pattern" "$LAST_LOG"; then
+        ok "$message"
+        return 0
+    fi
+    fail "$message (pattern not found in $LAST_LOG)"
+    return 1
+}
+
+assert_same_file() {
+    local expected="$1"
+    local actual="$2"
+    local label="$3"
+    if cmp -s -- "$expected" "$actual"; then
+        ok "$label"
+        return 0
+    fi
+    fail "$label ($actual differs from $expected)"
+    return 1
+}
+
+# Requests the servers logged since the last reset_requests, one line each:
+# "port METHOD path range=... auth=yes|no cookie=yes|no".
+reset_requests() {
+    : >"$REQUEST_LOG"
+}
+
+request_count() {
+    grep -Ec -- "$1" "$REQUEST_LOG" || true
+}
+
+assert_request_count_at_least() {
+    local pattern="$1"
+    local minimum="$2"
+    local message="$3"
+    local count
+    count="$(request_count "$pattern")"
+    if [[ "$count" -ge "$minimum" ]]; then
+        ok "$message"
+        return 0
+    fi
+    fail "$message ($count requests matched '$pattern', expected at least $minimum; see $REQUEST_LOG)"
+    return 1
+}
+
+assert_no_request() {
+    local pattern="$1"
+    local message="$2"
+    if grep -Eq -- "$pattern" "$REQUEST_LOG"; then
+        fail "$message (unexpected request matching '$pattern' in $REQUEST_LOG)"
+        return 1
+    fi
+    ok "$message"
+    return 0
+}
+
+write_helper_scripts() {
+    mkdir -p "$TMP_ROOT/www" "$OUT_DIR"
+    head -c $((9 * 1024 * 1024 + 12345)) /dev/urandom >"$TMP_ROOT/www/big.bin"
+    head -c $((64 * 1024)) /dev/urandom >"$TMP_ROOT/www/small.bin"
+
+    # /files/ serves byte ranges, /plain/ ignores Range and does not
+    # advertise it, /redirect/ sends a 302 to /files/ on the same origin and
+    # /elsewhere/ a 302 to /files/ on the other server.
+    cat >"$TMP_ROOT/http_fixture.py" <<'EOF'
+import http.server
+import os
+import re
+import sys
+import threading
+
+ROOT = sys.argv[1]
+LOG = open(sys.argv[2], "a", buffering=1)
+PORT = int(sys.argv[3])
+OTHER_PORT = int(sys.argv[4])
+LOCK = threading.Lock()
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def record(self):
+        with LOCK:
+            LOG.write("%d %s %s range=%s auth=%s cookie=%s\n" % (
+                PORT, self.command, self.path, self.headers.get("Range", "-"),
+                "yes" if self.headers.get("Authorization") else "no",
+                "yes" if self.headers.get("Cookie") else "no"))
+
+    def redirect(self, location):
+        self.send_response(302)
+        self.send_header("Location", location)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
+
+    def serve(self, send_body):
+        self.record()
+        route, _, name = self.path.lstrip("/").partition("/")
+        if route == "redirect":
+            return self.redirect("/files/" + name)
+        if route == "elsewhere":
+            return self.redirect("http://127.0.0.1:%d/files/%s" % (OTHER_PORT, name))
+        path = os.path.join(ROOT, os.path.basename(name))
+        if route not in ("files", "plain") or not os.path.isfile(path):
+            self.send_error(404)
+            return
+        with open(path, "rb") as f:
+            data = f.read()
+        info = os.stat(path)
+        start, end, status = 0, len(data) - 1, 200
+        match = re.fullmatch(r"bytes=(\d+)-(\d*)", self.headers.get("Range", ""))
+        if route == "files" and match:
+            start = int(match.group(1))
+            end = min(int(match.group(2)), end) if match.group(2) else end
+            if start > end:
+                self.send_response(416)
+                self.send_header("Content-Range", "bytes */%d" % len(data))
+                self.send_header("Content-Length", "0")
+                self.end_headers()
+                return
+            status = 206
+        self.send_response(status)
+        if route == "files":
+            self.send_header("Accept-Ranges", "bytes")
+            self.send_header("ETag", '"%x-%x"' % (info.st_size, int(info.st_mtime)))
+        if status == 206:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, len(data)))
+        self.send_header("Content-Length", str(end - start + 1))
+        self.end_headers()
+        if send_body:
+            self.wfile.write(data[start:end + 1])
+
+    def do_GET(self):
+        self.serve(True)
+
+    def do_HEAD(self):
+        self.serve(False)
+
+
+http.server.ThreadingHTTPServer(("127.0.0.1", PORT), Handler).serve_forever()
+EOF
+}
+
+wait_for_port() {
+    local port="$1"
+    local timeout_s="$2"
+    local start=$SECONDS
+    while (( SECONDS - start < timeout_s )); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.2
+    done
+    return 1
+}
+
+start_servers() {
+    reset_requests
+    local port
+    local other
+    for port in "$HTTP_PORT" "$OTHER_PORT"; do
+        other=$((port == HTTP_PORT ? OTHER_PORT : HTTP_PORT))
+        python3 "$TMP_ROOT/http_fixture.py" "$TMP_ROOT/www" "$REQUEST_LOG" "$port" "$other" \
+            >"$REPORT_DIR/http-$port.log" 2>&1 &
+        SERVER_PIDS+=("$!")
+        if ! wait_for_port "$port" 5; then
+            fail "local HTTP server did not start on port $port (see $REPORT_DIR/http-$port.log)"
+            return 1
+        fi
+    done
+    ok "Started HTTP servers on ports $HTTP_PORT and $OTHER_PORT"
+}
+
+stop_servers() {
+    local pid
+    for pid in "${SERVER_PIDS[@]}"; do
+        kill "$pid" 2>/dev/null || true
+        wait "$pid" 2>/dev/null || true
+    done
+    SERVER_PIDS=()
+}
+
+cleanup() {
+    [[ "$CLEANUP_DONE" -eq 0 ]] || return 0
+    CLEANUP_DONE=1
+
+    say
+    say "== Cleanup =="
+
+    stop_servers
+    if rm -rf -- "$TMP_ROOT"; then
+        ok "Removed temporary workspace $TMP_ROOT"
+    else
+        warn "Failed to remove temporary workspace $TMP_ROOT"
+    fi
+}
+
+print_summary() {
+    [[ "$SUMMARY_PRINTED" -eq 0 ]] || return 0
+    SUMMARY_PRINTED=1
+    say
+    say "== Summary =="
+    say "Checks: $CHECKS"
+    say "Warnings: $WARNS"
+    say "Skips: $SKIPS"
+    say "Failures: $FAILS"
+    say "Report: $REPORT_DIR"
+}
+
+on_exit() {
+    local rc=$?
+    if [[ "$SUMMARY_PRINTED" -eq 0 ]]; then
+        cleanup
+        print_summary
+    fi
+    exit "$rc"
+}
+
+trap on_exit EXIT
+
+preflight() {
+    say "GeminiOS greq Range and Redirect Test"
+    say "greq: ${GREQ_BIN:-<auto>}"
+    say "servers: 127.0.0.1:$HTTP_PORT, 127.0.0.1:$OTHER_PORT"
+    say "Report: $REPORT_DIR"
+    say
+
+    need_cmd bash
+    need_cmd grep
+    need_cmd sed
+    need_cmd cmp
+    need_cmd head
+    need_cmd python3
+
+    if ! GREQ_BIN="$(resolve_binary "$GREQ_BIN" greq /bin/apps/system/greq)"; then
+        fail "Could not locate a greq binary"
+        return 1
+    fi
+    ok "Using greq binary: $GREQ_BIN"
+
+    mkdir -p "$TMP_ROOT"
+    write_helper_scripts
+    start_servers || return 1
+    say
+}
+
+run_parallel_tests() {
+    say "== Parallel range downloads =="
+
+    reset_requests
+    expect_success "parallel-ranges" "$GREQ_BIN" -v --parallel 4 -o "$OUT_DIR/big.bin" "$BASE/files/big.bin" || return 1
+    assert_last_log_contains 'over 4 connections \(If-Range ' "the download was split over 4 connections with an If-Range validator" || return 1
+    assert_same_file "$TMP_ROOT/www/big.bin" "$OUT_DIR/big.bin" "the reassembled file matches the original" || return 1
+    assert_request_count_at_least "^$HTTP_PORT HEAD /files/big.bin " 1 "the size was probed with HEAD" || return 1
+    assert_request_count_at_least "^$HTTP_PORT GET /files/big.bin range=bytes=[0-9]+-[0-9]+ " 4 "every connection asked for a byte range" || return 1
+    assert_no_request "^$HTTP_PORT GET /files/big.bin range=- " "no connection fetched the whole body" || return 1
+
+    reset_requests
+    expect_success "parallel-no-ranges" "$GREQ_BIN" -v --parallel 4 -o "$OUT_DIR/plain.bin" "$BASE/plain/big.bin" || return 1
+    assert_last_log_contains 'does not accept byte ranges, using a single connection' "a server without Accept-Ranges gets one plain stream" || return 1
+    assert_same_file "$TMP_ROOT/www/big.bin" "$OUT_DIR/plain.bin" "the single-stream fallback file matches the original" || return 1
+
+    expect_success "parallel-small" "$GREQ_BIN" -v --parallel 4 -o "$OUT_DIR/small.bin" "$BASE/files/small.bin" || return 1
+    assert_last_log_contains 'Using a single connection for ' "a small file is not split" || return 1
+    assert_same_file "$TMP_ROOT/www/small.bin" "$OUT_DIR/small.bin" "the small file matches the original" || return 1
+
+    reset_requests
+    expect_success "parallel-redirect" "$GREQ_BIN" -v -L --parallel 4 -o "$OUT_DIR/redirected.bin" "$BASE/redirect/big.bin" || return 1
+    assert_same_file "$TMP_ROOT/www/big.bin" "$OUT_DIR/redirected.bin" "a redirected parallel download matches the original" || return 1
+    assert_request_count_at_least "^$HTTP_PORT GET /files/big.bin range=bytes=" 4 "the ranges were fetched from the redirect target" || return 1
+    assert_no_request " GET /redirect/" "the ranges did not go back through the redirect" || return 1
+
+    # A parallel run preallocates the file, so a full-size file without a
+    # resume record is not taken as finished.
+    head -c "$(stat -c %s "$TMP_ROOT/www/big.bin")" /dev/zero >"$OUT_DIR/resumed.bin"
+    rm -f "$OUT_DIR/resumed.bin.greq-partial"
+    reset_requests
+    expect_success "parallel-resume-unrecorded" "$GREQ_BIN" -v -C - --parallel 4 -o "$OUT_DIR/resumed.bin" "$BASE/files/big.bin" || return 1
+    assert_last_log_contains 'No resume record for a full-size ' "the unrecorded full-size file was not trusted" || return 1
+    assert_same_file "$TMP_ROOT/www/big.bin" "$OUT_DIR/resumed.bin" "the file was downloaded again in full" || return 1
+    if [[ -e "$OUT_DIR/resumed.bin.greq-partial" ]]; then
+        fail "the resume record was left behind after a complete download"
+        return 1
+    fi
+    ok "the resume record was removed after a complete download"
+    say
+}
+
+run_redirect_credential_tests() {
+    say "== Redirects and credentials =="
+
+    reset_requests
+    expect_success "redirect-same-origin" "$GREQ_BIN" -L -u user:secret -H "Cookie: session=1" \
+        -o "$OUT_DIR/same.bin" "$BASE/redirect/small.bin" || return 1
+    assert_same_file "$TMP_ROOT/www/small.bin" "$OUT_DIR/same.bin" "the same-origin redirect was followed" || return 1
+    assert_request_count_at_least "^$HTTP_PORT GET /files/small.bin .*auth=yes cookie=yes$" 1 \
+        "credentials are kept on a same-origin redirect" || return 1
+
+    reset_requests
+    expect_success "redirect-cross-origin" "$GREQ_BIN" -v -L -u user:secret -H "Cookie: session=1" \
+        -o "$OUT_DIR/cross.bin" "$BASE/elsewhere/small.bin" || return 1
+    assert_same_file "$TMP_ROOT/www/small.bin" "$OUT_DIR/cross.bin" "the cross-origin redirect was followed" || return 1
+    assert_last_log_contains 'Not sending credentials to ' "greq reports dropping credentials for the new origin" || return 1
+    assert_request_count_at_least "^$HTTP_PORT GET /elsewhere/small.bin .*auth=yes cookie=yes$" 1 \
+        "the original origin still received the credentials" || return 1
+    assert_no_request "^$OTHER_PORT .*(auth=yes|cookie=yes)" "the other origin received neither Authorization nor Cookie" || return 1
+
+    reset_requests
+    expect_success "parallel-cross-origin" "$GREQ_BIN" -L --parallel 4 -u user:secret -H "Cookie: session=1" \
+        -o "$OUT_DIR/cross-parallel.bin" "$BASE/elsewhere/big.bin" || return 1
+    assert_same_file "$TMP_ROOT/www/big.bin" "$OUT_DIR/cross-parallel.bin" "the cross-origin parallel download matches the original" || return 1
+    assert_request_count_at_least "^$OTHER_PORT GET /files/big.bin range=bytes=" 4 "the ranges were fetched from the other origin" || return 1
+    assert_no_request "^$OTHER_PORT .*(auth=yes|cookie=yes)" "no range request to the other origin carried credentials" || return 1
+    say
+}
+
+main_rc=0
+
+preflight || main_rc=1
+if [[ "$main_rc" -eq 0 ]]; then run_parallel_tests || main_rc=1; fi
+if [[ "$main_rc" -eq 0 ]]; then run_redirect_credential_tests || main_rc=1; fi
+
+cleanup
+print_summary
+trap - EXIT
+
+if [[ "$main_rc" -ne 0 || "$FAILS" -ne 0 ]]; then
+    exit 1
+fi
+exit 0
@@ -0,0 +1,621 @@
+#!/usr/bin/env bash
+set -Eeuo pipefail
+
+usage() {
+    cat <<'EOF'
+Usage: greq_resolver_test.sh [options]
+
+Exercises the stub resolver shared by greq and ping against a local stub
+DNS server (UDP and TCP) and a local HTTP server.
+
+Warning:
+  This script temporarily replaces /etc/resolv.conf and /etc/hosts and
+  binds port 53 on a loopback address. Both files are restored on exit.
+
+Best used on a disposable GeminiOS VM / ISO / test machine.
+
+Options:
+  -h, --help              Show this help text
+  --greq PATH             greq binary to use
+  --dns-address ADDR      loopback address for the stub DNS server, default 127.0.0.153
+  --http-port PORT        port for the local HTTP server, default 18053
+
+Environment overrides:
+  GREQ_BIN
+  GREQ_TEST_DNS_ADDRESS
+  GREQ_TEST_HTTP_PORT
+  GREQ_TEST_REPORT_DIR=/tmp/...
+
+Examples:
+  sudo ./tools/greq_resolver_test.sh
+  sudo ./tools/greq_resolver_test.sh --greq ./build/greq
+EOF
+}
+
+GREQ_BIN="${GREQ_BIN:-}"
+DNS_ADDRESS="${GREQ_TEST_DNS_ADDRESS:-127.0.0.153}"
+HTTP_PORT="${GREQ_TEST_HTTP_PORT:-18053}"
+
+while [[ $# -gt 0 ]]; do
+    case "$1" in
+        -h|--help)
+            usage
+            exit 0
+            ;;
+        --greq)
+            [[ $# -ge 2 ]] || { echo "Missing value for --greq" >&2; exit 1; }
+            GREQ_BIN="$2"
+            shift
+            ;;
+        --dns-address)
+            [[ $# -ge 2 ]] || { echo "Missing value for --dns-address" >&2; exit 1; }
+            DNS_ADDRESS="$2"
+            shift
+            ;;
+        --http-port)
+            [[ $# -ge 2 ]] || { echo "Missing value for --http-port" >&2; exit 1; }
+            HTTP_PORT="$2"
+            shift
+            ;;
+        *)
+            echo "Unknown option: $1" >&2
+            usage >&2
+            exit 1
+            ;;
+    esac
+    shift
+done
+
+STAMP="$(date +%Y%m%d-%H%M%S)"
+REPORT_DIR="${GREQ_TEST_REPORT_DIR:-/tmp/greq-resolver-$STAMP}"
+TMP_ROOT="/tmp/greq-resolver-work-$STAMP"
+LOG="$REPORT_DIR/report.txt"
+mkdir -p "$REPORT_DIR"
+exec > >(tee "$LOG") 2>&1
+
+FAILS=0
+WARNS=0
+SKIPS=0
+CHECKS=0
+STEP=0
+LAST_LOG=""
+LAST_RC=0
+LAST_MS=0
+SUMMARY_PRINTED=0
+CLEANUP_DONE=0
+HAVE_IPV6=0
+DNS_PID=""
+HTTP_PID=""
+
+RESOLV_CONF="/etc/resolv.conf"
+HOSTS_FILE="/etc/hosts"
+DNS_LOG="$TMP_ROOT/dns.log"
+DNS_CACHE="$TMP_ROOT/dns.cache"
+# How long the stub holds back the AAAA answer for slow6.greqtest.
+SLOW_AAAA_MS=2000
+
+declare -a SAVED_FILES=()
+
+say()  { printf '%s\n' "$*"; }
+ok()   { CHECKS=$((CHECKS + 1)); printf '[OK] %s\n' "$*"; }
+warn() { WARNS=$((WARNS + 1)); printf '[WARN] %s\n' "$*"; }
+fail() { FAILS=$((FAILS + 1)); printf '[FAIL] %s\n' "$*"; }
+skip() { SKIPS=$((SKIPS + 1)); printf '[SKIP] %s\n' "$*"; }
+
+need_cmd() {
+    command -v "$1" >/dev/null 2>&1 || {
+        echo "Missing required command: $1" >&2
+        exit 1
+    }
+}
+
+resolve_binary() {
+    local current="$1"
+    shift
+    if [[ -n "$current" ]]; then
+        [[ -x "$current" ]] && { printf '%s\n' "$current"; return 0; }
+        if command -v "$current" >/dev/null 2>&1; then
+            command -v "$current"
+            return 0
+        fi
+        return 1
+    fi
+
+    local candidate
+    for candidate in "$@"; do
+        [[ -x "$candidate" ]] && { printf '%s\n' "$candidate"; return 0; }
+        if command -v "$candidate" >/dev/null 2>&1; then
+            command -v "$candidate"
+            return 0
+        fi
+    done
+    return 1
+}
+
+sanitize_name() {
+    sed 's#[^A-Za-z0-9._-]#_#g' <<<"$1"
+}
+
+now_ms() {
+    date +%s%3N
+}
+
+run_logged() {
+    local label="$1"
+    shift
+    STEP=$((STEP + 1))
+    local safe
+    safe="$(sanitize_name "$label")"
+    LAST_LOG="$REPORT_DIR/$(printf '%03d' "$STEP")-$safe.log"
+    {
+        printf '$'
+        local arg
+        for arg in "$@"; do
+            printf ' %q' "$arg"
+        done
+        printf '\n'
+    } >"$LAST_LOG"
+
+    local started
+    started="$(now_ms)"
+    set +e
+    "$@" >>"$LAST_LOG" 2>&1
+    LAST_RC=$?
+    set -e
+    LAST_MS=$(( $(now_ms) - started ))
+    return 0
+}
+
+expect_success() {
+    local label="$1"
+    shift
+    run_logged "$label" "$@"
+    if [[ "$LAST_RC" -eq 0 ]]; then
+        ok "$label"
+        return 0
+    fi
+    fail "$label failed (rc=$LAST_RC). See $LAST_LOG"
+    return 1
+}
+
+expect_failure() {
+    local label="$1"
+    shift
+    run_logged "$label" "$@"
+    if [[ "$LAST_RC" -ne 0 ]]; then
+        ok "$label failed as expected"
+        return 0
+    fi
+    fail "$label unexpectedly succeeded. See $LAST_LOG"
+    return 1
+}
+
+assert_last_log_contains() {
+    local pattern="$1"
+    local message="$2"
+    if grep -Eq -- "$pattern" "$LAST_LOG"; then
+        ok "$message"
+        return 0
+    fi
+    fail "$message (pattern not found in $LAST_LOG)"
+    return 1
+}
+
+# Number of queries the stub DNS server saw, e.g. dns_queries udp web.greqtest A.
+dns_queries() {
+    local transport="$1"
+    local name="$2"
+    local type="$3"
+    grep -c -- "^$transport $name $type\$" "$DNS_LOG" || true
+}
+
+assert_dns_queries() {
+    local transport="$1"
+    local name="$2"
+    local type="$3"
+    local expected="$4"
+    local message="$5"
+    local count
+    count="$(dns_queries "$transport" "$name" "$type")"
+    if [[ "$count" -eq "$expected" ]]; then
+        ok "$message"
+        return 0
+    fi
+    fail "$message ($count $transport $name $type queries, expected $expected; see $DNS_LOG)"
+    return 1
+}
+
+# First query line of the DNS log that mentions any of the given names.
+first_dns_query_for() {
+    local pattern
+    pattern="$(printf '%s|' "$@")"
+    grep -E -m1 -- " (${pattern%|}) " "$DNS_LOG" | awk '{print $2}'
+}
+
+greq_get() {
+    "$GREQ_BIN" -v -o /dev/null "$@"
+}
+
+# Points a system file at test content, keeping the original (or the
+# symlink it was) for restore_system_files. Bind-mounted files, as in
+# containers, are rewritten in place.
+replace_system_file() {
+    local path="$1"
+    local content="$2"
+    local backup
+    backup="$TMP_ROOT/saved$(sanitize_name "$path")"
+    if [[ ! -e "$backup" ]]; then
+        cp -a -- "$path" "$backup"
+        SAVED_FILES+=("$path")
+    fi
+    if [[ -L "$path" ]]; then
+        rm -f -- "$path"
+    fi
+    printf '%s\n' "$content" >"$path"
+}
+
+restore_system_files() {
+    local path
+    local backup
+    for path in "${SAVED_FILES[@]}"; do
+        backup="$TMP_ROOT/saved$(sanitize_name "$path")"
+        if [[ -L "$backup" ]]; then
+            rm -f -- "$path"
+            cp -a -- "$backup" "$path"
+        else
+            cat -- "$backup" >"$path"
+        fi
+        if cmp -s -- "$backup" "$path"; then
+            ok "Restored $path"
+        else
+            warn "Failed to restore $path, the original is at $backup"
+            return 1
+        fi
+    done
+    SAVED_FILES=()
+}
+
+write_resolv_conf() {
+    replace_system_file "$RESOLV_CONF" "nameserver $DNS_ADDRESS
+search corp.greqtest
+$*"
+}
+
+write_helper_scripts() {
+    mkdir -p "$TMP_ROOT/www"
+    printf 'resolver test payload\n' >"$TMP_ROOT/www/index.txt"
+
+    # Zone entries map a name to its A and AAAA records; "ttl" overrides the
+    # default of 60, "slow_aaaa" delays the AAAA answer and "truncate" marks
+    # UDP answers TC so the client has to retry over TCP. Unknown names get
+    # NXDOMAIN with an SOA minimum of 30 seconds.
+    cat >"$TMP_ROOT/stub_dns.py" <<'EOF'
+import socket
+import struct
+import sys
+import threading
+import time
+
+ADDRESS = sys.argv[1]
+LOG = open(sys.argv[2], "a", buffering=1)
+SLOW_AAAA = int(sys.argv[3]) / 1000.0
+LOCK = threading.Lock()
+
+ZONE = {
+    "web.greqtest": {"A": ["127.0.0.1"], "AAAA": ["::1"]},
+    "pinned.greqtest": {"A": ["127.0.0.1"]},
+    "host.corp.greqtest": {"A": ["127.0.0.2"]},
+    "dual.greqtest": {"A": ["127.0.0.3"]},
+    "dual.greqtest.corp.greqtest": {"A": ["127.0.0.4"]},
+    "slow6.greqtest": {"A": ["127.0.0.1"], "AAAA": ["::1"], "slow_aaaa": True},
+    "big.greqtest": {"A": ["127.0.0.%d" % i for i in range(1, 101)], "truncate": True},
+    "short.greqtest": {"A": ["127.0.0.1"], "ttl": 1},
+}
+
+
+def wire_name(name):
+    return b"".join(bytes([len(label)]) + label.encode() for label in name.split(".")) + b"\0"
+
+
+def record(name, rtype, ttl, data):
+    return wire_name(name) + struct.pack("!HHIH", rtype, 1, ttl, len(data)) + data
+
+
+def answer(query, transport):
+    offset, labels = 12, []
+    while query[offset]:
+        labels.append(query[offset + 1:offset + 1 + query[offset]].decode())
+        offset += 1 + query[offset]
+    qtype = struct.unpack("!H", query[offset + 1:offset + 3])[0]
+    name = ".".join(labels).lower()
+    tname = {1: "A", 28: "AAAA"}.get(qtype, str(qtype))
+    with LOCK:
+        LOG.write("%s %s %s\n" % (transport, name, tname))
+
+    entry = ZONE.get(name)
+    if entry and entry.get("slow_aaaa") and tname == "AAAA":
+        time.sleep(SLOW_AAAA)
+    flags = 0x8180 if entry is not None else 0x8183
+    answers, authority = [], []
+    family = socket.AF_INET if tname == "A" else socket.AF_INET6
+    for address in (entry or {}).get(tname, []):
+        answers.append(record(name, qtype, entry.get("ttl", 60), socket.inet_pton(family, address)))
+    if not answers:
+        soa = wire_name("ns.greqtest") + wire_name("admin.greqtest") + struct.pack("!IIIII", 1, 60, 60, 60, 30)
+        authority.append(record("greqtest", 6, 120, soa))
+    if entry and entry.get("truncate") and transport == "udp":
+        flags |= 0x0200
+        answers = []
+    header = query[:2] + struct.pack("!HHHHH", flags, 1, len(answers), len(authority), 0)
+    return header + query[12:offset + 5] + b"".join(answers) + b"".join(authority)
+
+
+def serve_udp():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((ADDRESS, 53))
+    while True:
+        query, peer = sock.recvfrom(4096)
+        threading.Thread(target=lambda q=query, p=peer: sock.sendto(answer(q, "udp"), p), daemon=True).start()
+
+
+def serve_tcp_client(conn):
+    with conn:
+        size = b""
+        while len(size) < 2:
+            size += conn.recv(2 - len(size))
+        length = struct.unpack("!H", size)[0]
+        query = b""
+        while len(query) < length:
+            query += conn.recv(length - len(query))
+        reply = answer(query, "tcp")
+        conn.sendall(struct.pack("!H", len(reply)) + reply)
+
+
+def serve_tcp():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind((ADDRESS, 53))
+    sock.listen(16)
+    while True:
+        conn, _ = sock.accept()
+        threading.Thread(target=serve_tcp_client, args=(conn,), daemon=True).start()
+
+
+threading.Thread(target=serve_tcp, daemon=True).start()
+serve_udp()
+EOF
+}
+
+wait_for_port() {
+    local port="$1"
+    local timeout_s="$2"
+    local start=$SECONDS
+    while (( SECONDS - start < timeout_s )); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.2
+    done
+    return 1
+}
+
+start_servers() {
+    : >"$DNS_LOG"
+    python3 "$TMP_ROOT/stub_dns.py" "$DNS_ADDRESS" "$DNS_LOG" "$SLOW_AAAA_MS" >"$REPORT_DIR/stub-dns.log" 2>&1 &
+    DNS_PID=$!
+    # http.server binds :: dual-stack, so it also answers on every 127.0.0.0/8 address.
+    python3 -m http.server --bind :: --directory "$TMP_ROOT/www" "$HTTP_PORT" >"$REPORT_DIR/http-server.log" 2>&1 &
+    HTTP_PID=$!
+
+    if ! wait_for_port "$HTTP_PORT" 5; then
+        fail "local HTTP server did not start on port $HTTP_PORT (see $REPORT_DIR/http-server.log)"
+        return 1
+    fi
+    sleep 0.3
+    if ! kill -0 "$DNS_PID" 2>/dev/null; then
+        fail "stub DNS server did not start on $DNS_ADDRESS:53 (see $REPORT_DIR/stub-dns.log)"
+        return 1
+    fi
+    ok "Started the stub DNS server on $DNS_ADDRESS:53 and the HTTP server on port $HTTP_PORT"
+}
+
+stop_servers() {
+    local pid
+    for pid in "$DNS_PID" "$HTTP_PID"; do
+        [[ -n "$pid" ]] || continue
+        kill "$pid" 2>/dev/null || true
+        wait "$pid" 2>/dev/null || true
+    done
+    DNS_PID=""
+    HTTP_PID=""
+}
+
+cleanup() {
+    [[ "$CLEANUP_DONE" -eq 0 ]] || return 0
+    CLEANUP_DONE=1
+
+    say
+    say "== Cleanup =="
+
+    stop_servers
+    local restored=1
+    restore_system_files || restored=0
+
+    if [[ "$restored" -eq 0 ]]; then
+        warn "Keeping temporary workspace $TMP_ROOT for the saved system files"
+    elif rm -rf -- "$TMP_ROOT"; then
+        ok "Removed temporary workspace $TMP_ROOT"
+    else
+        warn "Failed to remove temporary workspace $TMP_ROOT"
+    fi
+}
+
+print_summary() {
+    [[ "$SUMMARY_PRINTED" -eq 0 ]] || return 0
+    SUMMARY_PRINTED=1
+    say
+    say "== Summary =="
+    say "Checks: $CHECKS"
+    say "Warnings: $WARNS"
+    say "Skips: $SKIPS"
+    say "Failures: $FAILS"
+    say "Report: $REPORT_DIR"
+}
+
+on_exit() {
+    local rc=$?
+    if [[ "$SUMMARY_PRINTED" -eq 0 ]]; then
+        cleanup
+        print_summary
+    fi
+    exit "$rc"
+}
+
+trap on_exit EXIT
+
+preflight() {
+    say "GeminiOS greq Resolver Test"
+    say "greq: ${GREQ_BIN:-<auto>}"
+    say "stub DNS: $DNS_ADDRESS:53"
+    say "Report: $REPORT_DIR"
+    say
+
+    need_cmd bash
+    need_cmd grep
+    need_cmd sed
+    need_cmd awk
+    need_cmd cmp
+    need_cmd python3
+
+    if ! GREQ_BIN="$(resolve_binary "$GREQ_BIN" greq /bin/apps/system/greq)"; then
+        fail "Could not locate a greq binary"
+        return 1
+    fi
+    ok "Using greq binary: $GREQ_BIN"
+
+    if [[ "$(id -u)" -ne 0 ]]; then
+        fail "Must run as root to bind port 53 and replace $RESOLV_CONF and $HOSTS_FILE"
+        return 1
+    fi
+    if [[ "$DNS_ADDRESS" != 127.* ]]; then
+        fail "--dns-address must be an IPv4 loopback address, got $DNS_ADDRESS"
+        return 1
+    fi
+    if python3 -c 'import socket; s = socket.socket(socket.AF_INET6); s.bind(("::1", 0))' 2>/dev/null; then
+        HAVE_IPV6=1
+    else
+        warn "IPv6 loopback is unavailable; the IPv6 preference check will be skipped"
+    fi
+
+    mkdir -p "$TMP_ROOT"
+    write_helper_scripts
+    replace_system_file "$HOSTS_FILE" "127.0.0.1 localhost
+127.0.0.5 pinned.greqtest"
+    write_resolv_conf
+    ok "Pointed $RESOLV_CONF at the stub DNS server"
+    start_servers || return 1
+    say
+}
+
+run_hosts_and_search_tests() {
+    say "== /etc/hosts and search list =="
+
+    expect_success "hosts-file-wins" greq_get "http://pinned.greqtest:$HTTP_PORT/index.txt" || return 1
+    assert_last_log_contains '\(127\.0\.0\.5\)' "/etc/hosts answers before DNS" || return 1
+    assert_dns_queries udp pinned.greqtest A 0 "a name in /etc/hosts is never sent to the name server" || return 1
+
+    expect_success "search-short-name" greq_get "http://host:$HTTP_PORT/index.txt" || return 1
+    assert_last_log_contains '\(127\.0\.0\.2\)' "a dotless name resolves through the search list" || return 1
+    if [[ "$(first_dns_query_for host host.corp.greqtest)" == "host.corp.greqtest" ]]; then
+        ok "a dotless name tries the search domain before the bare name"
+    else
+        fail "a dotless name was not tried with the search domain first (see $DNS_LOG)"
+        return 1
+    fi
+
+    expect_success "search-ndots-1" greq_get "http://dual.greqtest:$HTTP_PORT/index.txt" || return 1
+    assert_last_log_contains '\(127\.0\.0\.3\)' "with ndots:1 a dotted name is tried as given first" || return 1
+
+    write_resolv_conf "options ndots:2"
+    expect_success "search-ndots-2" greq_get "http://dual.greqtest:$HTTP_PORT/index.txt" || return 1
+    assert_last_log_contains '\(127\.0\.0\.4\)' "with ndots:2 the same name is tried with the search domain first" || return 1
+    write_resolv_conf
+    say
+}
+
+run_truncation_tests() {
+    say "== Truncation and TCP fallback =="
+
+    expect_success "truncated-answer" greq_get "http://big.greqtest:$HTTP_PORT/index.txt" || return 1
+    assert_dns_queries udp big.greqtest A 1 "the A query went out over UDP first" || return 1
+    assert_dns_queries tcp big.greqtest A 1 "the truncated UDP answer was retried over TCP" || return 1
+    assert_last_log_contains '\(127\.0\.0\.[0-9]+\)' "the TCP answer was used to connect" || return 1
+    say
+}
+
+run_cache_tests() {
+    say "== Negative caching and TTL expiry =="
+
+    expect_failure "nxdomain-first" greq_get --dns-cache "$DNS_CACHE" "http://missing.greqtest:$HTTP_PORT/" || return 1
+    assert_dns_queries udp missing.greqtest A 1 "the unknown name was asked once" || return 1
+    if grep -Eq '^missing\.greqtest A [0-9]+$' "$DNS_CACHE" 2>/dev/null; then
+        ok "the NXDOMAIN answer was written to the cache file"
+    else
+        fail "the cache file holds no negative entry for missing.greqtest (see $DNS_CACHE)"
+        return 1
+    fi
+    expect_failure "nxdomain-cached" greq_get --dns-cache "$DNS_CACHE" "http://missing.greqtest:$HTTP_PORT/" || return 1
+    assert_dns_queries udp missing.greqtest A 1 "the cached NXDOMAIN answer kept the next run off the network" || return 1
+
+    expect_success "ttl-first" greq_get --dns-cache "$DNS_CACHE" "http://short.greqtest:$HTTP_PORT/index.txt" || return 1
+    assert_dns_queries udp short.greqtest A 1 "the 1 second record was fetched" || return 1
+    expect_success "ttl-cached" greq_get --dns-cache "$DNS_CACHE" "http://short.greqtest:$HTTP_PORT/index.txt" || return 1
+    if [[ "$LAST_MS" -lt 900 ]]; then
+        assert_dns_queries udp short.greqtest A 1 "the record was served from the cache within its TTL" || return 1
+    else
+        warn "second lookup of short.greqtest took ${LAST_MS} ms, too slow to check the in-TTL cache hit"
+    fi
+    sleep 2
+    expect_success "ttl-expired" greq_get --dns-cache "$DNS_CACHE" "http://short.greqtest:$HTTP_PORT/index.txt" || return 1
+    assert_dns_queries udp short.greqtest A 2 "the record was asked again once its TTL ran out" || return 1
+    say
+}
+
+run_happy_eyeballs_tests() {
+    say "== Happy Eyeballs =="
+
+    if [[ "$HAVE_IPV6" -eq 1 ]]; then
+        expect_success "prefer-ipv6" greq_get "http://web.greqtest:$HTTP_PORT/index.txt" || return 1
+        assert_last_log_contains '\(::1\)' "IPv6 is tried first when both answers arrive together" || return 1
+    else
+        skip "IPv6 preference check needs an IPv6 loopback"
+    fi
+
+    expect_success "slow-aaaa" greq_get "http://slow6.greqtest:$HTTP_PORT/index.txt" || return 1
+    assert_last_log_contains '\(127\.0\.0\.1\)' "IPv4 connects while the AAAA answer is still outstanding" || return 1
+    if [[ "$LAST_MS" -lt $((SLOW_AAAA_MS / 2)) ]]; then
+        ok "the connect did not wait for the ${SLOW_AAAA_MS} ms AAAA answer (${LAST_MS} ms)"
+    else
+        fail "the connect took ${LAST_MS} ms, as if it waited for the slow AAAA answer"
+        return 1
+    fi
+    assert_dns_queries udp slow6.greqtest AAAA 1 "the AAAA query was sent alongside the A query" || return 1
+    say
+}
+
+main_rc=0
+
+preflight || main_rc=1
+if [[ "$main_rc" -eq 0 ]]; then run_hosts_and_search_tests || main_rc=1; fi
+if [[ "$main_rc" -eq 0 ]]; then run_truncation_tests || main_rc=1; fi
+if [[ "$main_rc" -eq 0 ]]; then run_cache_tests || main_rc=1; fi
+if [[ "$main_rc" -eq 0 ]]; then run_happy_eyeballs_tests || main_rc=1; fi
+
+cleanup
+print_summary
+trap - EXIT
+
+if [[ "$main_rc" -ne 0 || "$FAILS" -ne 0 ]]; then
+    exit 1
+fi
+exit 0